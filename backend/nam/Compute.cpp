@@ -1,4 +1,5 @@
 #include "Compute.hpp"
+#include "nam/utils/Time.hpp"
 // -------------------------------------------------------------------------------------
 #include <fcntl.h>
 #include <linux/fs.h>
@@ -8,10 +9,13 @@
 #include <unistd.h>
 
 namespace nam {
-Compute::Compute() {
-   cm = std::make_unique<rdma::CM<rdma::InitMessage>>();
+Compute::Compute(bool sharedQpAware) {
+   auto start = utils::getTimePoint();
+   cm = std::make_unique<rdma::CM<rdma::InitMessage>>(false);
    rdmaCounters = std::make_unique<profiling::RDMACounters>();
-   workerPool = std::make_unique<threads::WorkerPool>(*cm, 0);
+   workerPool = std::make_unique<threads::WorkerPool>(*cm, 0, sharedQpAware);
+   timeToReady = utils::getTimePoint() - start;
+   std::cout << "Time to ready " << timeToReady / 1000.0 << " ms" << std::endl;
 }
 
 Compute::~Compute() {
@@ -16,8 +16,8 @@ class Compute
 {
 
   public:
-   //! Default constructor
-   Compute();
+   //! Default constructor, see WorkerPool for sharedQpAware
+   explicit Compute(bool sharedQpAware = false);
    //! Destructor
    ~Compute();
    // -------------------------------------------------------------------------------------
@@ -37,6 +37,9 @@ class Compute
       return *workerPool;
    }
    // -------------------------------------------------------------------------------------
+   // us from construction until all workers are connected
+   uint64_t getTimeToReady() { return timeToReady; }
+   // -------------------------------------------------------------------------------------
    void startProfiler(profiling::WorkloadInfo& wlInfo) {
       pt.running = true;
       profilingThread.emplace_back(&profiling::ProfilingThread::profile, &pt, 0, std::ref(wlInfo));
@@ -59,6 +62,7 @@ class Compute
    profiling::ProfilingThread pt;
    std::vector<std::thread> profilingThread;
    std::unique_ptr<threads::WorkerPool> workerPool;
+   uint64_t timeToReady = 0;
 };
 // -------------------------------------------------------------------------------------
 }  // namespace scalestore
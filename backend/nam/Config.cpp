@@ -1,6 +1,9 @@
 // -------------------------------------------------------------------------------------
+#include "nam/utils/Checksum.hpp"
 #include "gflags/gflags.h"
 // -------------------------------------------------------------------------------------
+#include <iostream>
+// -------------------------------------------------------------------------------------
 DEFINE_double(dramGB, 1, "DRAM buffer pool size");
 DEFINE_uint64(worker,1, "Number worker threads");
 DEFINE_uint64(all_worker,1, "number of all worker threads in the cluster for barrier");
@@ -16,6 +19,9 @@ DEFINE_uint32(partitionBits, 6, "bits per partition");
 DEFINE_uint32(page_pool_partitions, 8, "page pool partitions each is shifted by 512 byte to increase cache associativity");
 // -------------------------------------------------------------------------------------
 DEFINE_bool(backoff, true, "backoff enabled");
+DEFINE_string(backoffPolicy, "", "pauses after failed remote lock attempts: none, exponential, proportional or adaptive (empty = default of the lock)");
+DEFINE_uint64(backoffPauses, 16, "base pauses of the backoff policy");
+DEFINE_uint64(backoffMaxPauses, 4096, "upper bound of the pauses after one failed attempt");
 // -------------------------------------------------------------------------------------
 DEFINE_bool(storage_node, false, "storage node");
 DEFINE_uint64(storage_nodes, 1,"Number nodes participating");
@@ -28,6 +34,27 @@ DEFINE_bool(read, true, "read protocol");
 DEFINE_bool(random, false, "use random pages");
 DEFINE_uint64(messageHandlerThreads, 4, " number message handler ");
 DEFINE_uint64(messageHandlerMaxRetries, 10, "Number retries before message gets restarted at client"); // prevents deadlocks but also mitigates early aborts
+DEFINE_bool(emulated, false, "in-process emulated RDMA transport instead of libibverbs");
+DEFINE_uint64(emulatedNicThreads, 2, "threads executing work requests of the emulated NIC");
+DEFINE_uint64(emulatedLatencyNs, 0, "latency per operation of the emulated NIC");
+DEFINE_double(emulatedBandwidthGBs, 0, "bandwidth per QP of the emulated NIC (0 = unlimited)");
+DEFINE_uint64(qpSharing, 1, "workers sharing one QP per storage node (1 = one QP per worker)");
+DEFINE_string(rdmaNumaPolicy, "default", "placement of the registered buffer: default, nic, interleave or a numa node id");
+DEFINE_uint64(hugePageSizeMB, 0, "page size of the registered memory, 2 or 1024 (0 = default huge page size)");
+DEFINE_uint64(prefaultThreads, 0, "threads touching the registered memory before registration (0 = fault on first access)");
+DEFINE_string(checksum, "crc64", "checksum of the optimistic CRC scheme: crc64, crc64_clmul, crc32c or hash64");
+// rejects unknown names and checksums the cpu cannot run while the command line is parsed
+static bool validateChecksum(const char* flag, const std::string& value)
+{
+   try {
+      nam::utils::checksumFunction(nam::utils::parseChecksum(value));
+      return true;
+   } catch (const std::exception& e) {
+      std::cerr << "-" << flag << ": " << e.what() << std::endl;
+      return false;
+   }
+}
+DEFINE_validator(checksum, &validateChecksum);
 // -------------------------------------------------------------------------------------
 DEFINE_uint32(sockets, 2 , "Number Sockets");
 DEFINE_uint32(socket, 0, " Socket we are running on");
@@ -21,6 +21,9 @@ DECLARE_uint32(page_pool_partitions);
 // CONTENTION
 // -------------------------------------------------------------------------------------
 DECLARE_bool(backoff);
+DECLARE_string(backoffPolicy);
+DECLARE_uint64(backoffPauses);
+DECLARE_uint64(backoffMaxPauses);
 // -------------------------------------------------------------------------------------
 // RDMA Config
 // -------------------------------------------------------------------------------------
@@ -34,6 +37,15 @@ DECLARE_bool(read);
 DECLARE_bool(random);
 DECLARE_uint64(messageHandlerThreads);
 DECLARE_uint64(messageHandlerMaxRetries);
+DECLARE_bool(emulated);
+DECLARE_uint64(emulatedNicThreads);
+DECLARE_uint64(emulatedLatencyNs);
+DECLARE_double(emulatedBandwidthGBs);
+DECLARE_uint64(qpSharing);
+DECLARE_string(rdmaNumaPolicy);
+DECLARE_uint64(hugePageSizeMB);
+DECLARE_uint64(prefaultThreads);
+DECLARE_string(checksum);
 
 // -------------------------------------------------------------------------------------
 // Server Specific Part
@@ -21,7 +21,7 @@ Storage::Storage() {
    ensure(nodeId < FLAGS_storage_nodes);
    // -------------------------------------------------------------------------------------
    // order of construction is important
-   cm = std::make_unique<rdma::CM<rdma::InitMessage>>();
+   cm = std::make_unique<rdma::CM<rdma::InitMessage>>(true);
    rdmaCounters = std::make_unique<profiling::RDMACounters>();
 }
 
@@ -6,7 +6,9 @@
 #include "threads/CoreManager.hpp"
 #include "threads/WorkerPool.hpp"
 #include "nam/utils/RandomGenerator.hpp"
+#include "nam/utils/Time.hpp"
 // -------------------------------------------------------------------------------------
+#include <cstring>
 #include <memory>
 
 namespace nam
@@ -63,34 +65,27 @@ class Storage
    void startAndConnect() {
       std::thread connectionThread([&]() {
          using namespace rdma;
+         auto start = utils::getTimePoint();
          rdma::InitMessage* initServer = (rdma::InitMessage*)cm->getGlobalBuffer().allocate(sizeof(rdma::InitMessage));
          // -------------------------------------------------------------------------------------
-         size_t numConnections = (FLAGS_worker);
+         // the groups of all compute nodes have to be full, otherwise they open more connections than expected
+         ensure(FLAGS_worker % FLAGS_qpSharing == 0);
+         size_t numConnections = FLAGS_worker / FLAGS_qpSharing;  // one per group of workers sharing a QP
          std::cout << "Waiting for connections " << numConnections << "\n";
          while (cm->getNumberIncomingConnections() != (numConnections))
             ;  // block until client is connected
 
          std::vector<RdmaContext*> rdmaCtxs(cm->getIncomingConnections());  // get cm ids of incomming
-
          for (auto* rContext : rdmaCtxs) {
-            // -------------------------------------------------------------------------------------
-            if (rContext->type != Type::WORKER) { throw; }
-            // -------------------------------------------------------------------------------------
-            initServer->nodeId = nodeId; 
-            initServer->threadId = 1000;
-            initServer->num_regions = catalog.size();
-            ensure(initServer->num_regions < MAX_REGIONS);
-            for (auto& it : catalog) {
-               // Do stuff
-               initServer->mem_regions[it.second.region_id].offset = (uintptr_t)it.second.start;
-               initServer->mem_regions[it.second.region_id].size_bytes = (uintptr_t)it.second.size_bytes;
-            }
-
-            // -------------------------------------------------------------------------------------
-            cm->exchangeInitialMesssage(*(rContext), initServer);
-            
+            if (rContext->type != Type::WORKER) { throw std::runtime_error("Unexpected connection type"); }
          }
-         std::cout << "Finished connection " << "\n";
+         // -------------------------------------------------------------------------------------
+         initServer->nodeId = nodeId; 
+         initServer->threadId = 1000;
+         writeCatalog(initServer);
+         cm->exchangeInitialMessages(rdmaCtxs, initServer);
+         timeToReady = utils::getTimePoint() - start;
+         std::cout << "Finished connection, time to ready " << timeToReady / 1000.0 << " ms\n";
 
       });
       connectionThread.join();
@@ -99,46 +94,52 @@ class Storage
    void startAndConnect(std::function<void()> startup) {
       std::thread connectionThread([&]() {
          using namespace rdma;
+         auto start = utils::getTimePoint();
          rdma::InitMessage* initServer = (rdma::InitMessage*)cm->getGlobalBuffer().allocate(sizeof(rdma::InitMessage));
          // -------------------------------------------------------------------------------------
-         size_t numConnections = (FLAGS_worker);
+         // the groups of all compute nodes have to be full, otherwise they open more connections than expected
+         ensure(FLAGS_worker % FLAGS_qpSharing == 0);
+         size_t numConnections = FLAGS_worker / FLAGS_qpSharing;  // one per group of workers sharing a QP
          std::cout << "Waiting for connections " << numConnections << "\n";
          while (cm->getNumberIncomingConnections() != (numConnections))
             ;  // block until client is connected
 
          std::vector<RdmaContext*> rdmaCtxs(cm->getIncomingConnections());  // get cm ids of incomming
-
          for (auto* rContext : rdmaCtxs) {
-            // -------------------------------------------------------------------------------------
-            if (rContext->type != Type::WORKER) { throw; }
-            // -------------------------------------------------------------------------------------
-            initServer->nodeId = nodeId; 
-            initServer->threadId = 1000;
-            initServer->num_regions = catalog.size();
-            ensure(initServer->num_regions < MAX_REGIONS);
-            for (auto& it : catalog) {
-               // Do stuff
-               initServer->mem_regions[it.second.region_id].offset = (uintptr_t)it.second.start;
-               initServer->mem_regions[it.second.region_id].size_bytes = (uintptr_t)it.second.size_bytes;
-            }
-
-            // -------------------------------------------------------------------------------------
-            cm->exchangeInitialMesssage(*(rContext), initServer);
-            
+            if (rContext->type != Type::WORKER) { throw std::runtime_error("Unexpected connection type"); }
          }
+         // -------------------------------------------------------------------------------------
+         initServer->nodeId = nodeId; 
+         initServer->threadId = 1000;
+         writeCatalog(initServer);
+         cm->exchangeInitialMessages(rdmaCtxs, initServer);
+         timeToReady = utils::getTimePoint() - start;
       });
       startup();
       connectionThread.join();
    };
 
 
-   void registerMemoryRegion(std::string name, size_t bytes){
-      if (catalog.count(name)) throw;
-      uintptr_t buffer = (uintptr_t)static_cast<void*>(cm->getGlobalBuffer().allocate(bytes,64));
+   // every region has its own registration and rkey
+   // by default it is carved out of the global buffer, with a numa placement (node id, utils::NUMA_INTERLEAVE,
+   // utils::parseNumaPolicy) or page size it is mapped separately
+   void registerMemoryRegion(std::string name, size_t bytes, int numaNode = utils::NUMA_DEFAULT, size_t pageSize = 0){
+      if (catalog.count(name)) throw std::runtime_error("Memory region " + name + " already registered");
+      ensure(name.size() < rdma::MAX_REGION_NAME);
+      void* buffer = nullptr;
+      if (numaNode == utils::NUMA_DEFAULT && pageSize == 0) {
+         buffer = cm->getGlobalBuffer().allocate(bytes, 64);
+      } else {
+         regionMemory.push_back(std::make_unique<utils::HugePages<uint8_t>>(bytes, pageSize, numaNode, FLAGS_prefaultThreads));
+         buffer = *regionMemory.back();
+      }
+      auto* mr = cm->registerMemory(buffer, bytes);
       MemoryRegionDesc desc;
-      desc.start = buffer;
+      desc.start = (uintptr_t)buffer;
       desc.size_bytes = bytes;
       desc.region_id = regions++;
+      desc.rkey = mr->rkey;
+      desc.lkey = mr->lkey;
       catalog[name] = desc;
    }
 
@@ -146,14 +147,31 @@ class Storage
       return catalog[name];
    }
 
+   // us from startAndConnect until all workers are connected
+   uint64_t getTimeToReady() { return timeToReady; }
+
   private:
    NodeID nodeId = 0;
+   std::vector<std::unique_ptr<utils::HugePages<uint8_t>>> regionMemory;  // dedicated regions, outlive their registration in cm
    std::unique_ptr<rdma::CM<rdma::InitMessage>> cm;
    std::unique_ptr<profiling::RDMACounters> rdmaCounters;
    profiling::ProfilingThread pt;
    std::vector<std::thread> profilingThread;
    std::unordered_map<std::string,MemoryRegionDesc> catalog; // ptr, size of region
    int regions =0;
+   uint64_t timeToReady = 0;
+   // -------------------------------------------------------------------------------------
+   void writeCatalog(rdma::InitMessage* init){
+      init->num_regions = catalog.size();
+      ensure(init->num_regions < MAX_REGIONS);
+      for (auto& it : catalog) {
+         auto& region = init->mem_regions[it.second.region_id];
+         region.offset = (uintptr_t)it.second.start;
+         region.size_bytes = (uintptr_t)it.second.size_bytes;
+         region.rkey = it.second.rkey;
+         strncpy(region.name, it.first.c_str(), rdma::MAX_REGION_NAME);
+      }
+   }
 
 };
 // -------------------------------------------------------------------------------------
@@ -3,6 +3,7 @@
 #include "nam/Config.hpp"
 #include "Defs.hpp"
 #include "nam/utils/MemoryManagement.hpp"
+#include "Transport.hpp"
 // -------------------------------------------------------------------------------------
 #include <arpa/inet.h>
 #include <gflags/gflags.h>
@@ -16,7 +17,10 @@
 #include <unistd.h>
 #include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
 #include <fstream>  // std::ifstream
+#include <initializer_list>
 #include <iostream>
 #include <memory_resource>
 #include <string>
@@ -38,9 +42,13 @@ namespace nam
 namespace rdma
 {
 
+static constexpr uint64_t MAX_REGION_NAME = 32;
+
 struct MemoryRegions{
    uintptr_t offset;
    size_t size_bytes;
+   uint32_t rkey;
+   char name[MAX_REGION_NAME];
 };
    
 struct InitMessage {
@@ -52,6 +60,9 @@ struct InitMessage {
 
 // smaller inline size reduces WQE, max with our cards would be 220
 static constexpr uint64_t INLINE_SIZE = 64; // LARGEST MESSAGE
+static constexpr uint64_t SEND_QUEUE_DEPTH = 1024;
+static constexpr uint64_t COMPLETION_QUEUE_DEPTH = 128;  // send and recv completions of one connection
+static constexpr uint64_t MAX_SEND_SGE = 4;  // local buffers of one read or write
 
 
 enum completion : bool {
@@ -76,6 +87,32 @@ struct RdmaContext {
    NodeID nodeId;
 };
 
+// -------------------------------------------------------------------------------------
+// Keys of the registrations a request goes through. The RdmaContext helpers use the keys of the connection
+// (the global buffers on both sides), regions with their own registration (registerMemoryRegion with a
+// numa placement or page size) are only reachable with their keys passed explicitly.
+// -------------------------------------------------------------------------------------
+struct MemoryKeys {
+   uint32_t lkey;  // local buffers
+   uint32_t rkey;  // remote addresses
+};
+
+inline MemoryKeys keysOf(RdmaContext& context)
+{
+   return {context.mr->lkey, context.rkey};
+}
+
+// remote addresses in remote, local buffers in the global buffer
+inline MemoryKeys keysOf(RdmaContext& context, const MemoryRegionDesc& remote)
+{
+   return {context.mr->lkey, remote.rkey};
+}
+
+// local buffers in a region of this node, e.g. a NAM region mapped on its own
+inline MemoryKeys keysOf(const MemoryRegionDesc& local, const MemoryRegionDesc& remote)
+{
+   return {local.lkey, remote.rkey};
+}
 
 // -------------------------------------------------------------------------------------
 // Compile time batching 
@@ -122,6 +159,240 @@ void postWriteBatch(RdmaContext& context, completion wc, ARGS&&... args){
       throw std::runtime_error("Failed to post send request" + std::to_string(ret) + " " + std::to_string(errno));
 }
 
+// -------------------------------------------------------------------------------------
+// Scatter/gather
+// one remote range read into or written from up to MAX_SEND_SGE local buffers with a single work request
+// -------------------------------------------------------------------------------------
+struct LocalBuffer {
+   void* memAddr;
+   size_t size;
+};
+
+inline size_t totalSize(std::initializer_list<LocalBuffer> buffers)
+{
+   size_t size = 0;
+   for (auto& buffer : buffers)
+      size += buffer.size;
+   return size;
+}
+
+inline void postScatterGather(ibv_wr_opcode opcode, std::initializer_list<LocalBuffer> buffers, RdmaContext& context, MemoryKeys keys,
+                              completion wc, size_t remoteOffset, size_t wcId, bool needFence)
+{
+   ensure(buffers.size() > 0 && buffers.size() <= MAX_SEND_SGE);
+   struct ibv_send_wr sq_wr;
+   struct ibv_sge send_sgl[MAX_SEND_SGE];
+   struct ibv_send_wr* bad_wr;
+   uint64_t s_i = 0;
+   for (auto& buffer : buffers) {
+      send_sgl[s_i].addr = (uintptr_t)buffer.memAddr;
+      send_sgl[s_i].length = buffer.size;
+      send_sgl[s_i].lkey = keys.lkey;
+      s_i++;
+   }
+   sq_wr.opcode = opcode;
+   sq_wr.send_flags = wc ? IBV_SEND_SIGNALED : 0;
+   if (needFence)
+      sq_wr.send_flags |= IBV_SEND_FENCE;
+#ifdef USE_INLINE
+   if (opcode == IBV_WR_RDMA_WRITE)
+      sq_wr.send_flags |= (totalSize(buffers) <= INLINE_SIZE) ? IBV_SEND_INLINE : 0;
+#endif
+   sq_wr.sg_list = &send_sgl[0];
+   sq_wr.num_sge = buffers.size();
+   sq_wr.wr.rdma.rkey = keys.rkey;
+   sq_wr.wr.rdma.remote_addr = remoteOffset;
+   sq_wr.wr_id = wcId;
+   sq_wr.next = nullptr;
+   auto ret = ibv_post_send(context.id->qp, &sq_wr, &bad_wr);
+   if (ret)
+      throw std::runtime_error("Failed to post send request" + std::to_string(ret) + " " + std::to_string(errno));
+}
+
+// e.g. the version words into one buffer and the payload into another
+inline void postReadScatter(std::initializer_list<LocalBuffer> buffers, RdmaContext& context, completion wc, size_t remoteOffset,
+                            size_t wcId = 0, bool needFence = false)
+{
+   postScatterGather(IBV_WR_RDMA_READ, buffers, context, keysOf(context), wc, remoteOffset, wcId, needFence);
+}
+
+inline void postReadScatter(std::initializer_list<LocalBuffer> buffers, RdmaContext& context, MemoryKeys keys, completion wc,
+                            size_t remoteOffset, size_t wcId = 0, bool needFence = false)
+{
+   postScatterGather(IBV_WR_RDMA_READ, buffers, context, keys, wc, remoteOffset, wcId, needFence);
+}
+
+// e.g. non-contiguous local cachelines written back to one remote range
+inline void postWriteGather(std::initializer_list<LocalBuffer> buffers, RdmaContext& context, completion wc, size_t remoteOffset,
+                            size_t wcId = 0)
+{
+   postScatterGather(IBV_WR_RDMA_WRITE, buffers, context, keysOf(context), wc, remoteOffset, wcId, false);
+}
+
+inline void postWriteGather(std::initializer_list<LocalBuffer> buffers, RdmaContext& context, MemoryKeys keys, completion wc,
+                            size_t remoteOffset, size_t wcId = 0)
+{
+   postScatterGather(IBV_WR_RDMA_WRITE, buffers, context, keys, wc, remoteOffset, wcId, false);
+}
+
+// -------------------------------------------------------------------------------------
+// Runtime batching
+// links READ/WRITE/CAS/FA work requests and posts them with a single doorbell
+// ordering and fence semantics are the same as for consecutive post* calls
+// requests use the keys of the connection unless withKeys() switched them for the following requests
+// -------------------------------------------------------------------------------------
+template <uint64_t MAX_WRS = 8>
+class WorkRequestChain
+{
+   RdmaContext& context;
+   MemoryKeys keys;
+   struct ibv_send_wr sq_wr[MAX_WRS];
+   struct ibv_sge send_sgl[MAX_WRS][MAX_SEND_SGE];
+   uint64_t numberElements = 0;
+
+   ibv_send_wr& add(ibv_wr_opcode opcode, void* memAddr, size_t size, completion wc, bool needFence, size_t wcId)
+   {
+      return add(opcode, {{memAddr, size}}, wc, needFence, wcId);
+   }
+
+   ibv_send_wr& add(ibv_wr_opcode opcode, std::initializer_list<LocalBuffer> buffers, completion wc, bool needFence, size_t wcId)
+   {
+      ensure(numberElements < MAX_WRS);
+      ensure(buffers.size() > 0 && buffers.size() <= MAX_SEND_SGE);
+      auto b_i = numberElements++;
+      uint64_t s_i = 0;
+      for (auto& buffer : buffers) {
+         send_sgl[b_i][s_i].addr = (uintptr_t)buffer.memAddr;
+         send_sgl[b_i][s_i].length = buffer.size;
+         send_sgl[b_i][s_i].lkey = keys.lkey;
+         s_i++;
+      }
+      auto& wr = sq_wr[b_i];
+      wr.opcode = opcode;
+      wr.send_flags = wc ? IBV_SEND_SIGNALED : 0;
+      if (needFence)
+         wr.send_flags |= IBV_SEND_FENCE;
+      wr.sg_list = &send_sgl[b_i][0];
+      wr.num_sge = buffers.size();
+      wr.wr_id = wcId;
+      wr.next = nullptr;
+      if (b_i > 0)
+         sq_wr[b_i - 1].next = &wr;
+      return wr;
+   }
+
+  public:
+   explicit WorkRequestChain(RdmaContext& context) : context(context), keys(keysOf(context)) {}
+   WorkRequestChain(RdmaContext& context, MemoryKeys keys) : context(context), keys(keys) {}
+
+   WorkRequestChain& withKeys(MemoryKeys requestKeys)
+   {
+      keys = requestKeys;
+      return *this;
+   }
+
+   WorkRequestChain& read(void* memAddr, size_t size, size_t remoteOffset, completion wc, bool needFence = false, size_t wcId = 0)
+   {
+      auto& wr = add(IBV_WR_RDMA_READ, memAddr, size, wc, needFence, wcId);
+      wr.wr.rdma.rkey = keys.rkey;
+      wr.wr.rdma.remote_addr = remoteOffset;
+      return *this;
+   }
+
+   WorkRequestChain& write(void* memAddr, size_t size, size_t remoteOffset, completion wc, bool needFence = false, size_t wcId = 0)
+   {
+      auto& wr = add(IBV_WR_RDMA_WRITE, memAddr, size, wc, needFence, wcId);
+#ifdef USE_INLINE
+      wr.send_flags |= (size <= INLINE_SIZE) ? IBV_SEND_INLINE : 0;
+#endif
+      wr.wr.rdma.rkey = keys.rkey;
+      wr.wr.rdma.remote_addr = remoteOffset;
+      return *this;
+   }
+
+   // one remote range scattered into the local buffers in order
+   WorkRequestChain& readScatter(std::initializer_list<LocalBuffer> buffers, size_t remoteOffset, completion wc, bool needFence = false,
+                                 size_t wcId = 0)
+   {
+      auto& wr = add(IBV_WR_RDMA_READ, buffers, wc, needFence, wcId);
+      wr.wr.rdma.rkey = keys.rkey;
+      wr.wr.rdma.remote_addr = remoteOffset;
+      return *this;
+   }
+
+   // the local buffers gathered into one remote range
+   WorkRequestChain& writeGather(std::initializer_list<LocalBuffer> buffers, size_t remoteOffset, completion wc, bool needFence = false,
+                                 size_t wcId = 0)
+   {
+      auto& wr = add(IBV_WR_RDMA_WRITE, buffers, wc, needFence, wcId);
+#ifdef USE_INLINE
+      wr.send_flags |= (totalSize(buffers) <= INLINE_SIZE) ? IBV_SEND_INLINE : 0;
+#endif
+      wr.wr.rdma.rkey = keys.rkey;
+      wr.wr.rdma.remote_addr = remoteOffset;
+      return *this;
+   }
+
+   WorkRequestChain& compareSwap(uint64_t expected, uint64_t desired, uint64_t* memAddr, size_t remoteOffset, completion wc,
+                                 bool needFence = false, size_t wcId = 0)
+   {
+      auto& wr = add(IBV_WR_ATOMIC_CMP_AND_SWP, memAddr, sizeof(uint64_t), wc, needFence, wcId);
+      wr.wr.atomic.remote_addr = remoteOffset;
+      wr.wr.atomic.rkey = keys.rkey;
+      wr.wr.atomic.compare_add = expected;
+      wr.wr.atomic.swap = desired;
+      return *this;
+   }
+
+   WorkRequestChain& fetchAdd(uint64_t to_add, uint64_t* memAddr, size_t remoteOffset, completion wc, bool needFence = false, size_t wcId = 0)
+   {
+      auto& wr = add(IBV_WR_ATOMIC_FETCH_AND_ADD, memAddr, sizeof(uint64_t), wc, needFence, wcId);
+      wr.wr.atomic.remote_addr = remoteOffset;
+      wr.wr.atomic.rkey = keys.rkey;
+      wr.wr.atomic.compare_add = to_add;
+      return *this;
+   }
+
+   uint64_t size() { return numberElements; }
+   static constexpr uint64_t capacity() { return MAX_WRS; }
+
+   // signals the last request, for chains whose end is only known after the fact
+   WorkRequestChain& signalLast()
+   {
+      ensure(numberElements > 0);
+      sq_wr[numberElements - 1].send_flags |= IBV_SEND_SIGNALED;
+      return *this;
+   }
+
+   // one ibv_post_send for the whole chain, the chain can be reused afterwards
+   void post()
+   {
+      if (numberElements == 0)
+         return;
+      struct ibv_send_wr* bad_wr;
+      auto ret = ibv_post_send(context.id->qp, &sq_wr[0], &bad_wr);
+      numberElements = 0;
+      if (ret)
+         throw std::runtime_error("Failed to post send request" + std::to_string(ret) + " " + std::to_string(errno));
+   }
+
+   // one ibv_post_send (and doorbell) per request in chain order, pauses between consecutive posts
+   void postEach(uint64_t pauses = 0)
+   {
+      struct ibv_send_wr* bad_wr;
+      auto count = numberElements;
+      numberElements = 0;
+      for (uint64_t b_i = 0; b_i < count; b_i++) {
+         for (uint64_t p_i = 0; b_i > 0 && p_i < pauses; p_i++)
+            _mm_pause();
+         sq_wr[b_i].next = nullptr;
+         auto ret = ibv_post_send(context.id->qp, &sq_wr[b_i], &bad_wr);
+         if (ret)
+            throw std::runtime_error("Failed to post send request" + std::to_string(ret) + " " + std::to_string(errno));
+      }
+   }
+};
+
 // -------------------------------------------------------------------------------------
 
 inline void postReceive(void* memAddr, size_t size, ibv_qp* qp, ibv_mr* mr)
@@ -163,6 +434,7 @@ inline void postSend(void* memAddr, size_t size, ibv_qp* qp, ibv_mr* mr, complet
    send_sgl.addr = (uintptr_t)memAddr;
    send_sgl.length = size;
    send_sgl.lkey = mr->lkey;
+   sq_wr.wr_id = 0;
    sq_wr.opcode = IBV_WR_SEND;
    sq_wr.send_flags = wc ? IBV_SEND_SIGNALED : 0;
 #ifdef USE_INLINE
@@ -190,14 +462,15 @@ inline void postSend(T* memAddr, RdmaContext& context, completion wc)
    postSend(memAddr, sizeof(T), context.id->qp, context.mr, wc);
 }
 
-inline void postFetchAdd(uint64_t to_add, void* memAddr, size_t size, ibv_qp* qp, ibv_mr* mr, completion wc, size_t rkey, size_t remoteOffset, bool needFence)
+inline void postFetchAdd(uint64_t to_add, void* memAddr, size_t size, ibv_qp* qp, uint32_t lkey, completion wc, size_t rkey, size_t remoteOffset, bool needFence, size_t wcId = 0)
 {
    struct ibv_send_wr sq_wr;
    struct ibv_sge send_sgl;
    struct ibv_send_wr* bad_wr;
    send_sgl.addr = (uintptr_t)memAddr;
    send_sgl.length = size;
-   send_sgl.lkey = mr->lkey;
+   send_sgl.lkey = lkey;
+   sq_wr.wr_id = wcId;
    sq_wr.opcode = IBV_WR_ATOMIC_FETCH_AND_ADD;
    sq_wr.send_flags = wc ? IBV_SEND_SIGNALED : 0;
    if(needFence)
@@ -214,25 +487,37 @@ inline void postFetchAdd(uint64_t to_add, void* memAddr, size_t size, ibv_qp* qp
       throw std::runtime_error("Failed to post send request");
 }
 
+inline void postFetchAdd(uint64_t to_add, void* memAddr, size_t size, ibv_qp* qp, ibv_mr* mr, completion wc, size_t rkey, size_t remoteOffset, bool needFence, size_t wcId = 0)
+{
+   postFetchAdd(to_add, memAddr, size, qp, mr->lkey, wc, rkey, remoteOffset, needFence, wcId);
+}
+
 inline void postFetchAdd(uint64_t to_add ,uint64_t* memAddr, ibv_qp* qp, ibv_mr* mr, completion wc, size_t rkey, size_t remoteOffset, bool needFence = false)
 {
    postFetchAdd(to_add ,memAddr, sizeof(uint64_t), qp, mr, wc, rkey, remoteOffset,needFence);
 }
 
-inline void postFetchAdd(uint64_t to_add ,uint64_t* memAddr, RdmaContext& context, completion wc, size_t remoteOffset, bool needFence = false)
+inline void postFetchAdd(uint64_t to_add ,uint64_t* memAddr, RdmaContext& context, completion wc, size_t remoteOffset, bool needFence = false, size_t wcId = 0)
+{
+   postFetchAdd(to_add, memAddr, sizeof(uint64_t), context.id->qp, context.mr, wc, context.rkey, remoteOffset, needFence, wcId);
+}
+
+inline void postFetchAdd(uint64_t to_add, uint64_t* memAddr, RdmaContext& context, MemoryKeys keys, completion wc, size_t remoteOffset,
+                         bool needFence = false, size_t wcId = 0)
 {
-   postFetchAdd(to_add, memAddr, sizeof(uint64_t), context.id->qp, context.mr, wc, context.rkey, remoteOffset, needFence);
+   postFetchAdd(to_add, memAddr, sizeof(uint64_t), context.id->qp, keys.lkey, wc, keys.rkey, remoteOffset, needFence, wcId);
 }
 
 
-inline void postCompareSwap(uint64_t expected, uint64_t desired, void* memAddr, size_t size, ibv_qp* qp, ibv_mr* mr, completion wc, size_t rkey, size_t remoteOffset)
+inline void postCompareSwap(uint64_t expected, uint64_t desired, void* memAddr, size_t size, ibv_qp* qp, uint32_t lkey, completion wc, size_t rkey, size_t remoteOffset, size_t wcId = 0)
 {
    struct ibv_send_wr sq_wr;
    struct ibv_sge send_sgl;
    struct ibv_send_wr* bad_wr;
    send_sgl.addr = (uintptr_t)memAddr;
    send_sgl.length = size;
-   send_sgl.lkey = mr->lkey;
+   send_sgl.lkey = lkey;
+   sq_wr.wr_id = wcId;
    sq_wr.opcode = IBV_WR_ATOMIC_CMP_AND_SWP;
    sq_wr.send_flags = wc ? IBV_SEND_SIGNALED : 0;
    sq_wr.wr.atomic.remote_addr    = remoteOffset;
@@ -248,25 +533,37 @@ inline void postCompareSwap(uint64_t expected, uint64_t desired, void* memAddr,
       throw std::runtime_error("Failed to post send request");
 }
 
+inline void postCompareSwap(uint64_t expected, uint64_t desired, void* memAddr, size_t size, ibv_qp* qp, ibv_mr* mr, completion wc, size_t rkey, size_t remoteOffset, size_t wcId = 0)
+{
+   postCompareSwap(expected, desired, memAddr, size, qp, mr->lkey, wc, rkey, remoteOffset, wcId);
+}
+
 inline void postCompareSwap(uintptr_t expected, uint64_t desired ,uint64_t* memAddr, ibv_qp* qp, ibv_mr* mr, completion wc, size_t rkey, size_t remoteOffset)
 {
    postCompareSwap(expected, desired ,memAddr, sizeof(uint64_t), qp, mr, wc, rkey, remoteOffset);
 }
 
-inline void postCompareSwap(uint64_t expected, uint64_t desired ,uint64_t* memAddr, RdmaContext& context, completion wc, size_t remoteOffset)
+inline void postCompareSwap(uint64_t expected, uint64_t desired ,uint64_t* memAddr, RdmaContext& context, completion wc, size_t remoteOffset, size_t wcId = 0)
+{
+   postCompareSwap(expected, desired, memAddr, sizeof(uint64_t), context.id->qp, context.mr, wc, context.rkey, remoteOffset, wcId);
+}
+
+inline void postCompareSwap(uint64_t expected, uint64_t desired, uint64_t* memAddr, RdmaContext& context, MemoryKeys keys, completion wc,
+                            size_t remoteOffset, size_t wcId = 0)
 {
-   postCompareSwap(expected, desired, memAddr, sizeof(uint64_t), context.id->qp, context.mr, wc, context.rkey, remoteOffset);
+   postCompareSwap(expected, desired, memAddr, sizeof(uint64_t), context.id->qp, keys.lkey, wc, keys.rkey, remoteOffset, wcId);
 }
 
 
-inline void postWrite(void* memAddr, size_t size, ibv_qp* qp, ibv_mr* mr, completion wc, size_t rkey, size_t remoteOffset)
+inline void postWrite(void* memAddr, size_t size, ibv_qp* qp, uint32_t lkey, completion wc, size_t rkey, size_t remoteOffset, size_t wcId = 0)
 {
    struct ibv_send_wr sq_wr;
    struct ibv_sge send_sgl;
    struct ibv_send_wr* bad_wr;
    send_sgl.addr = (uint64_t)(unsigned long)memAddr;
    send_sgl.length = size;
-   send_sgl.lkey = mr->lkey;
+   send_sgl.lkey = lkey;
+   sq_wr.wr_id = wcId;
    sq_wr.opcode = IBV_WR_RDMA_WRITE;
    sq_wr.send_flags = wc ? IBV_SEND_SIGNALED : 0;
 #ifdef USE_INLINE
@@ -282,6 +579,11 @@ inline void postWrite(void* memAddr, size_t size, ibv_qp* qp, ibv_mr* mr, comple
       throw std::runtime_error("Failed to post send request" + std::to_string(ret) + " " + std::to_string(errno));
 }
 
+inline void postWrite(void* memAddr, size_t size, ibv_qp* qp, ibv_mr* mr, completion wc, size_t rkey, size_t remoteOffset, size_t wcId = 0)
+{
+   postWrite(memAddr, size, qp, mr->lkey, wc, rkey, remoteOffset, wcId);
+}
+
 template <typename T>
 inline void postWrite(T* memAddr, ibv_qp* qp, ibv_mr* mr, completion wc, size_t rkey, size_t remoteOffset)
 {
@@ -298,20 +600,25 @@ inline void postWrite(T* memAddr, RdmaContext& context, completion wc, size_t re
 
 
 template <typename T>
-inline void postWrite(T* memAddr, RdmaContext& context, completion wc, size_t remoteOffset, size_t bytes)
+inline void postWrite(T* memAddr, RdmaContext& context, completion wc, size_t remoteOffset, size_t bytes, size_t wcId = 0)
 {
    static_assert(!std::is_void<T>::value, "post write cannot be called with void");
-   postWrite(memAddr, bytes, context.id->qp, context.mr, wc, context.rkey, remoteOffset);
+   postWrite(memAddr, bytes, context.id->qp, context.mr, wc, context.rkey, remoteOffset, wcId);
 }
 
-inline void postRead(void* memAddr, size_t size, ibv_qp* qp, ibv_mr* mr, completion wc, size_t rkey, size_t remoteOffset, size_t wcId  = 0, bool needFence = false)
+inline void postWrite(void* memAddr, size_t size, RdmaContext& context, MemoryKeys keys, completion wc, size_t remoteOffset, size_t wcId = 0)
+{
+   postWrite(memAddr, size, context.id->qp, keys.lkey, wc, keys.rkey, remoteOffset, wcId);
+}
+
+inline void postRead(void* memAddr, size_t size, ibv_qp* qp, uint32_t lkey, completion wc, size_t rkey, size_t remoteOffset, size_t wcId  = 0, bool needFence = false)
 {
    struct ibv_send_wr sq_wr;
    struct ibv_sge send_sgl;
    struct ibv_send_wr* bad_wr;
    send_sgl.addr = (uint64_t)(unsigned long)memAddr;
    send_sgl.length = size;
-   send_sgl.lkey = mr->lkey;
+   send_sgl.lkey = lkey;
    sq_wr.opcode = IBV_WR_RDMA_READ;
    sq_wr.send_flags = wc ? IBV_SEND_SIGNALED : 0;
    if(needFence)
@@ -327,6 +634,11 @@ inline void postRead(void* memAddr, size_t size, ibv_qp* qp, ibv_mr* mr, complet
       throw std::runtime_error("Failed to post send request" + std::to_string(ret) + " " + std::to_string(errno));
 }
 
+inline void postRead(void* memAddr, size_t size, ibv_qp* qp, ibv_mr* mr, completion wc, size_t rkey, size_t remoteOffset, size_t wcId  = 0, bool needFence = false)
+{
+   postRead(memAddr, size, qp, mr->lkey, wc, rkey, remoteOffset, wcId, needFence);
+}
+
 
 template <typename T>
 inline void postReadFenced(T* memAddr, ibv_qp* qp, ibv_mr* mr, completion wc, size_t rkey, size_t remoteOffset, size_t wcId  = 0 )
@@ -370,6 +682,12 @@ inline void postRead(T* memAddr, RdmaContext& context, completion wc, size_t rem
    postRead(memAddr, sizeof(T), context.id->qp, context.mr, wc, context.rkey, remoteOffset, wcId);
 }
 
+inline void postRead(void* memAddr, size_t size, RdmaContext& context, MemoryKeys keys, completion wc, size_t remoteOffset, size_t wcId = 0,
+                     bool needFence = false)
+{
+   postRead(memAddr, size, context.id->qp, keys.lkey, wc, keys.rkey, remoteOffset, wcId, needFence);
+}
+
 // low level wrapper; once returned every wc need to be checked for success
 inline int pollCompletion(ibv_cq* cq, size_t expected, ibv_wc* wcReturn)
 {
@@ -394,14 +712,21 @@ class CM
 {
   public:
    //! Default constructor
-   CM() : port(htons(FLAGS_port)), mbr(FLAGS_dramGB * FLAGS_rdmaMemoryFactor * 1024 * 1024 * 1024), running(FLAGS_storage_node), handler(&CM::handle, this)
+   //! listen: accept incoming connections, e.g. storage and compute can share one process with the emulated transport
+   CM(bool listen = FLAGS_storage_node)
+       : transport(getTransport()),
+         port(htons(FLAGS_port)),
+         mbr(FLAGS_dramGB * FLAGS_rdmaMemoryFactor * 1024 * 1024 * 1024, FLAGS_hugePageSizeMB << 20, utils::parseNumaPolicy(FLAGS_rdmaNumaPolicy),
+             FLAGS_prefaultThreads),
+         running(listen),
+         handler(&CM::handle, this)
    {
       // create thread
-      incomingChannel = rdma_create_event_channel();
+      incomingChannel = transport.createEventChannel();
       if (!incomingChannel)
          throw std::runtime_error("Could not create rdma_event_channels");
 
-      int ret = rdma_create_id(incomingChannel, &incomingCmId, nullptr, RDMA_PS_TCP);
+      int ret = transport.createId(incomingChannel, &incomingCmId, nullptr, RDMA_PS_TCP);
       if (ret != 0)
          throw std::runtime_error("Could not create id");
 
@@ -419,28 +744,30 @@ class CM
    {
       // disconnect and delete application context
       for (auto* context : outgoingIds) {
-         [[maybe_unused]] auto ret = rdma_disconnect(context->id);
+         [[maybe_unused]] auto ret = transport.disconnect(context->id);
          assert(ret == 0);
       }
       for (auto* context : incomingIds) {
-         [[maybe_unused]] auto ret = rdma_disconnect(context->id);
+         [[maybe_unused]] auto ret = transport.disconnect(context->id);
          assert(ret == 0);
       }
       // drain disconnect events
-      for (auto* c : outgoingChannels) {
-         struct rdma_cm_event* event;
-         [[maybe_unused]] auto ret = rdma_get_cm_event(c, &event);
-         rdma_ack_cm_event(event);
-         assert(ret == 0);
+      for (auto& [c, connections] : outgoingChannels) {
+         for (uint64_t c_i = 0; c_i < connections; c_i++) {
+            struct rdma_cm_event* event;
+            [[maybe_unused]] auto ret = transport.getCmEvent(c, &event);
+            transport.ackCmEvent(event);
+            assert(ret == 0);
+         }
       }
       for (auto* context : outgoingIds) {
-         rdma_destroy_qp(context->id);
+         transport.destroyQP(context->id);
       }
       for (auto* cq : outgoingCqs) {
-         ibv_destroy_cq(cq);
+         transport.destroyCQ(cq);
       }
       for (auto* context : outgoingIds) {
-         rdma_destroy_id(context->id);
+         transport.destroyId(context->id);
       }
 
       std::vector<ibv_cq*> cqs; // order is important
@@ -448,25 +775,27 @@ class CM
          cqs.push_back(context->id->qp->send_cq);
       }
       for (auto* context : incomingIds) {
-         rdma_destroy_qp(context->id);
+         transport.destroyQP(context->id);
       }
 
       for (auto* cq : cqs) {
-         ibv_destroy_cq(cq);
+         transport.destroyCQ(cq);
       }
       
       for (auto* context : incomingIds) {
-         rdma_destroy_id(context->id);
+         transport.destroyId(context->id);
       }
 
-      rdma_destroy_id(incomingCmId);
-      rdma_destroy_event_channel(incomingChannel);
+      transport.destroyId(incomingCmId);
+      transport.destroyEventChannel(incomingChannel);
 
-      for (auto* c : outgoingChannels) {
-         rdma_destroy_event_channel(c);
+      for (auto& [c, connections] : outgoingChannels) {
+         transport.destroyEventChannel(c);
       }
-      ibv_dereg_mr(mr);
-      ibv_dealloc_pd(pd);
+      for (auto* regionMr : regionMrs)
+         transport.deregMR(regionMr);
+      transport.deregMR(mr);
+      transport.deallocPD(pd);
       handler.join();  // handler joins last to drain incoming disconnection events
 
       for (auto* context : outgoingIds)
@@ -483,7 +812,7 @@ class CM
       std::unordered_map<uintptr_t, ComSetupContext*> connections;
       while (running) {
          struct rdma_cm_event* event;
-         auto ret = rdma_get_cm_event(incomingChannel, &event);
+         auto ret = transport.getCmEvent(incomingChannel, &event);
          if (ret)
             throw;
          struct rdma_cm_id* currentId = event->id;
@@ -504,7 +833,7 @@ class CM
             case RDMA_CM_EVENT_CONNECT_REQUEST: {
                DEBUG_LOG("RDMA_CM_EVENT_CONNECT_REQUEST received");
                numberConnections++;
-               rdma_ack_cm_event(event);
+               transport.ackCmEvent(event);
                ibv_cq* incomingCQ = createCQ(currentId);
                createQP(currentId, incomingCQ);
                context->response = static_cast<RdmaInfo*>(mbr.allocate(sizeof(RdmaInfo)));
@@ -524,7 +853,7 @@ class CM
                conn_param.responder_resources = RDMA_MAX_RESP_RES;
                conn_param.initiator_depth = RDMA_MAX_INIT_DEPTH;
 
-               ret = rdma_accept(currentId, &conn_param);
+               ret = transport.accept(currentId, &conn_param);
                if (ret)
                   throw std::runtime_error("Rdma accept failed");
 
@@ -540,8 +869,8 @@ class CM
                ((RdmaContext*)currentId->context)->typeId = context->response->typeId;
                ((RdmaContext*)currentId->context)->nodeId = context->response->nodeId;
                // std::cout <<"************* received  RKEY << "<<  context->response->rkey << std::endl;
-               rdma_ack_cm_event(event);
-               auto* sock = rdma_get_peer_addr(currentId);
+               transport.ackCmEvent(event);
+               auto* sock = transport.getPeerAddr(currentId);
                std::string ip(inet_ntoa(((sockaddr_in*)sock)->sin_addr));
                DEBUG_VAR(ip);
                numberConnectionsEstablished++;
@@ -556,7 +885,7 @@ class CM
                break;
             case RDMA_CM_EVENT_DISCONNECTED: {
                DEBUG_LOG("RDMA_CM_EVENT_DISCONNECTED");
-               rdma_ack_cm_event(event);
+               transport.ackCmEvent(event);
                numberConnections--;
                numberConnectionsEstablished--;
                break;
@@ -566,7 +895,7 @@ class CM
                break;
             case RDMA_CM_EVENT_TIMEWAIT_EXIT: {
                DEBUG_LOG("RDMA_CM_EVENT_TIMEWAIT_EXIT");
-               rdma_ack_cm_event(event);
+               transport.ackCmEvent(event);
                break;
             }
             default:
@@ -587,67 +916,151 @@ class CM
    // should be thread safe
    RdmaContext& initiateConnection(std::string ip, Type type, uint64_t typeId, NodeID nodeId)
    {
-      auto* response = static_cast<RdmaInfo*>(mbr.allocate(sizeof(RdmaInfo)));  // to not reallocate every restart and drain memory
-      auto* applicationData = static_cast<INITIAL_MSG*>(mbr.allocate(sizeof(INITIAL_MSG)));
+      return *initiateConnections({ip}, type, typeId, nodeId)[0];
+   }
 
-   RETRY:
-      std::unique_lock<std::mutex> l(outgoingMut);
-      rdma_event_channel* outgoingChannel = rdma_create_event_channel();
+   // connects to all ips at once: address/route resolution and connects of all connections are in flight
+   // concurrently and driven by one event loop on a shared channel; returns the contexts in order of ips
+   std::vector<RdmaContext*> initiateConnections(const std::vector<std::string>& ips, Type type, uint64_t typeId, NodeID nodeId)
+   {
+      struct Outgoing {
+         rdma_cm_id* id = nullptr;
+         ibv_cq* cq = nullptr;
+         RdmaContext* context = nullptr;
+         RdmaInfo* response = nullptr;
+         INITIAL_MSG* applicationData = nullptr;
+         bool established = false;
+         bool retry = false;
+         std::chrono::steady_clock::time_point retryAt;
+      };
+      constexpr auto RETRY_DELAY = std::chrono::seconds(1);  // remote not up yet
+      rdma_event_channel* outgoingChannel = transport.createEventChannel();
       if (!outgoingChannel)
          throw std::runtime_error("Could not create outgoing event channel");
-
-      struct rdma_cm_id* outgoingCmId;
-      auto ret = rdma_create_id(outgoingChannel, &outgoingCmId, nullptr, RDMA_PS_TCP);
-      if (ret == -1)
-         throw std::runtime_error("Could not create id");
-
-      struct sockaddr_storage sin;
-      getAddr(ip, (struct sockaddr*)&sin);
-      resolveAddr(outgoingChannel, outgoingCmId, sin);
-      ibv_cq* clientCq = createCQ(outgoingCmId);
-      createQP(outgoingCmId, clientCq);
-
-      postReceive(response, outgoingCmId->qp, mr);
-      auto* rdmaContext = createRdmaContext(outgoingCmId, applicationData);
-      outgoingCmId->context = rdmaContext;
-
-      struct rdma_cm_event* event;
-      struct rdma_conn_param conn_param;
-      memset(&conn_param, 0, sizeof conn_param);
-
-      // not yet sure if those have effect if we use plain qp's
-      conn_param.responder_resources = RDMA_MAX_RESP_RES;
-      conn_param.initiator_depth = RDMA_MAX_INIT_DEPTH;
-      if (rdma_connect(outgoingCmId, &conn_param))
-         throw std::runtime_error("Could not connect to RDMA endpoint");
-      if (rdma_get_cm_event(outgoingChannel, &event))
-         throw std::runtime_error("Rdma CM event failed");
-      if (event->event != RDMA_CM_EVENT_ESTABLISHED) {
-         DEBUG_LOG("Retry with sleep");
-         rdma_ack_cm_event(event);
-         rdma_destroy_id(outgoingCmId);
-         rdma_destroy_event_channel(outgoingChannel);
-         delete rdmaContext;
-         l.unlock();
-         sleep(1);
-         goto RETRY;
+      std::vector<Outgoing> outgoing(ips.size());
+      std::unordered_map<rdma_cm_id*, uint64_t> connectionOf;
+      auto resolve = [&](uint64_t c_i) {
+         auto& o = outgoing[c_i];
+         if (transport.createId(outgoingChannel, &o.id, nullptr, RDMA_PS_TCP))
+            throw std::runtime_error("Could not create id");
+         connectionOf[o.id] = c_i;
+         struct sockaddr_storage sin;
+         getAddr(ips[c_i], (struct sockaddr*)&sin);
+         setPort(sin);
+         if (transport.resolveAddr(o.id, nullptr, (struct sockaddr*)&sin, 2000))
+            throw std::runtime_error("could not resolve addr");
       };
-      DEBUG_LOG("Connection established");
-      rdma_ack_cm_event(event);
-      exchangeRdmaInfo(outgoingCmId, mr, type, typeId, nodeId);
-      rdmaContext->rkey = response->rkey;
-      rdmaContext->type = response->type;
-      rdmaContext->typeId = response->typeId;
-      rdmaContext->nodeId = response->nodeId;
-      // std::cout << " ****** client got RKEY "  << response->rkey << std::endl;
-      outgoingIds.push_back(rdmaContext);
-      outgoingCqs.push_back(clientCq);
-      outgoingChannels.push_back(outgoingChannel);
-      return *rdmaContext;
+      for (uint64_t c_i = 0; c_i < ips.size(); c_i++) {
+         // to not reallocate every restart and drain memory
+         outgoing[c_i].response = static_cast<RdmaInfo*>(mbr.allocate(sizeof(RdmaInfo)));
+         outgoing[c_i].applicationData = static_cast<INITIAL_MSG*>(mbr.allocate(sizeof(INITIAL_MSG)));
+         resolve(c_i);
+      }
+      // -------------------------------------------------------------------------------------
+      uint64_t established = 0;
+      while (established < ips.size()) {
+         // due retries are started, the wait for events ends at the next one that is not due yet
+         auto now = std::chrono::steady_clock::now();
+         int timeoutMs = -1;
+         for (uint64_t c_i = 0; c_i < ips.size(); c_i++) {
+            auto& o = outgoing[c_i];
+            if (!o.retry)
+               continue;
+            if (o.retryAt <= now) {
+               o.retry = false;
+               resolve(c_i);
+               continue;
+            }
+            int untilDue = std::chrono::duration_cast<std::chrono::milliseconds>(o.retryAt - now).count() + 1;
+            timeoutMs = (timeoutMs < 0) ? untilDue : std::min(timeoutMs, untilDue);
+         }
+         struct rdma_cm_event* event;
+         if (transport.getCmEvent(outgoingChannel, &event, timeoutMs)) {
+            if (errno == ETIMEDOUT)
+               continue;
+            throw std::runtime_error("Rdma CM event failed");
+         }
+         auto c_i = connectionOf.at(event->id);
+         auto eventType = event->event;
+         transport.ackCmEvent(event);
+         auto& o = outgoing[c_i];
+         switch (eventType) {
+            case RDMA_CM_EVENT_ADDR_RESOLVED:
+               DEBUG_LOG("Addr resolved");
+               if (transport.resolveRoute(o.id, 2000))
+                  throw std::runtime_error("could not resolve route");
+               break;
+            case RDMA_CM_EVENT_ROUTE_RESOLVED: {
+               DEBUG_LOG("Route Resolved");
+               o.cq = createCQ(o.id);
+               createQP(o.id, o.cq);
+               postReceive(o.response, o.id->qp, mr);
+               o.context = createRdmaContext(o.id, o.applicationData);
+               o.id->context = o.context;
+               struct rdma_conn_param conn_param;
+               memset(&conn_param, 0, sizeof conn_param);
+               // not yet sure if those have effect if we use plain qp's
+               conn_param.responder_resources = RDMA_MAX_RESP_RES;
+               conn_param.initiator_depth = RDMA_MAX_INIT_DEPTH;
+               if (transport.connect(o.id, &conn_param))
+                  throw std::runtime_error("Could not connect to RDMA endpoint");
+               break;
+            }
+            case RDMA_CM_EVENT_ESTABLISHED:
+               DEBUG_LOG("Connection established");
+               // send right away, the remote handler waits for it before it handles the next connection
+               postRdmaInfo(o.id, mr, type, typeId, nodeId);
+               o.established = true;
+               established++;
+               break;
+            default: {
+               if (o.established)
+                  throw std::runtime_error("Connection lost during setup");
+               // remote not up yet, retried from the loop without blocking the other connections
+               DEBUG_LOG("Retry later");
+               connectionOf.erase(o.id);
+               if (o.context) {
+                  transport.destroyQP(o.id);
+                  transport.destroyCQ(o.cq);
+                  delete o.context;
+                  o.context = nullptr;
+               }
+               transport.destroyId(o.id);
+               o.retry = true;
+               o.retryAt = std::chrono::steady_clock::now() + RETRY_DELAY;
+            }
+         }
+      }
+      // -------------------------------------------------------------------------------------
+      std::vector<RdmaContext*> contexts;
+      for (auto& o : outgoing) {
+         waitRdmaInfo(o.id);
+         o.context->rkey = o.response->rkey;
+         o.context->type = o.response->type;
+         o.context->typeId = o.response->typeId;
+         o.context->nodeId = o.response->nodeId;
+         contexts.push_back(o.context);
+      }
+      std::unique_lock<std::mutex> l(outgoingMut);
+      for (auto& o : outgoing) {
+         outgoingIds.push_back(o.context);
+         outgoingCqs.push_back(o.cq);
+      }
+      outgoingChannels.push_back({outgoingChannel, ips.size()});
+      return contexts;
    }
 
    size_t getNumberIncomingConnections() { return numberConnectionsEstablished; }
 
+   // true if RDMA atomics of the nic are atomic with respect to cpu atomics on the registered memory
+   bool hostCoherentAtomics()
+   {
+      ibv_device_attr attr{};
+      if (transport.queryDevice(pd->context, &attr) != 0)
+         throw std::runtime_error("Could not query device");
+      return attr.atomic_cap == IBV_ATOMIC_GLOB;
+   }
+
    // attention no latch/ wait until all connections are finished
    std::vector<RdmaContext*> getIncomingConnections() {
       std::unique_lock<std::mutex> l(incomingMut);
@@ -655,30 +1068,51 @@ class CM
    };
 
    utils::SynchronizedMonotonicBufferRessource& getGlobalBuffer() { return mbr; }
+   // registered buffers that are freed again, e.g. per benchmark stage
+   utils::SlabAllocator& getSlabs() { return slabs; }
+   // -------------------------------------------------------------------------------------
+   // additional registration on the shared pd, deregistered with the CM
+   ibv_mr* registerMemory(void* addr, size_t bytes)
+   {
+      auto* regionMr = transport.regMR(pd, addr, bytes, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC);
+      if (!regionMr)
+         throw std::runtime_error("Memory region could not be registered");
+      regionMrs.push_back(regionMr);
+      return regionMr;
+   }
 
    void exchangeInitialMesssage(RdmaContext& context, INITIAL_MSG* initialMessage)
    {
-      DEBUG_LOG("Exchanging Experimetn Infos");
-      rdma::postSend(initialMessage, context, rdma::completion::signaled);
-      int completions{0};
-      ibv_wc wcs[2];
+      std::vector<RdmaContext*> contexts{&context};
+      exchangeInitialMessages(contexts, initialMessage);
+   }
 
-      while (completions != 2) {
-         auto expected = 2 - completions;  // prevents over polling the q and draining it from next phase
-         auto comp = pollCompletion(context.id->qp->send_cq, expected,
-                                    wcs);  // assumes that the completion qs are the same for send and recv
-         for (int i = 0; i < comp; i++) {
-            /* verify the completion status */
-            if (wcs[i].status != IBV_WC_SUCCESS) {
-               throw;
+   // sends to all contexts first and then waits, the same message is sent to every context
+   void exchangeInitialMessages(const std::vector<RdmaContext*>& contexts, INITIAL_MSG* initialMessage)
+   {
+      DEBUG_LOG("Exchanging Experimetn Infos");
+      for (auto* context : contexts)
+         rdma::postSend(initialMessage, *context, rdma::completion::signaled);
+      for (auto* context : contexts) {
+         int completions{0};
+         ibv_wc wcs[2];
+         while (completions != 2) {
+            auto expected = 2 - completions;  // prevents over polling the q and draining it from next phase
+            auto comp = pollCompletion(context->id->qp->send_cq, expected,
+                                       wcs);  // assumes that the completion qs are the same for send and recv
+            for (int i = 0; i < comp; i++) {
+               /* verify the completion status */
+               if (wcs[i].status != IBV_WC_SUCCESS)
+                  throw std::runtime_error("Initial message exchange failed");
+               ensure(wcs[i].qp_num == context->id->qp->qp_num);
             }
-            ensure(wcs[i].qp_num == context.id->qp->qp_num);
+            completions += comp;
          }
-         completions += comp;
       }
    }
 
   private:
+   Transport& transport;  // libibverbs or emulated
    struct RdmaInfo {
       uint32_t rkey;  // remote key
       Type type;
@@ -695,7 +1129,9 @@ class CM
 
    uint16_t port;
    utils::SynchronizedMonotonicBufferRessource mbr;  // can we chunk that buffer into sub buffers for clients?
+   utils::SlabAllocator slabs{mbr};
    struct ibv_pd* pd;
+   std::vector<ibv_mr*> regionMrs;
    struct ibv_mr* mr;
    // handler section
    std::atomic<bool> running{false};
@@ -709,37 +1145,15 @@ class CM
    std::mutex outgoingMut;
    std::vector<RdmaContext*> outgoingIds;
    std::vector<ibv_cq*> outgoingCqs;
-   std::vector<rdma_event_channel*> outgoingChannels;
+   std::vector<std::pair<rdma_event_channel*, uint64_t>> outgoingChannels;  // channel, connections on it
    std::vector<RdmaContext*> incomingIds;
 
-   void resolveAddr(rdma_event_channel* outgoingChannel, rdma_cm_id* outgoingCmId, struct sockaddr_storage& sin)
+   void setPort(struct sockaddr_storage& sin)
    {
       if (sin.ss_family == AF_INET)
          ((struct sockaddr_in*)&sin)->sin_port = port;
       else
          ((struct sockaddr_in6*)&sin)->sin6_port = port;
-
-      auto ret = rdma_resolve_addr(outgoingCmId, nullptr, (struct sockaddr*)&sin, 2000);
-      if (ret == -1)
-         throw std::runtime_error("could not resolve addr");
-      struct rdma_cm_event* event;
-      ret = rdma_get_cm_event(outgoingChannel, &event);
-      if (ret == -1)
-         throw std::runtime_error("could not get CM event");;
-      if (event->event != RDMA_CM_EVENT_ADDR_RESOLVED)
-         throw;
-      rdma_ack_cm_event(event);
-      DEBUG_LOG("Addr resolved");
-      ret = rdma_resolve_route(outgoingCmId, 2000);
-      if (ret)
-         throw;
-      ret = rdma_get_cm_event(outgoingChannel, &event);
-      if (ret)
-         throw;
-      if (event->event != RDMA_CM_EVENT_ROUTE_RESOLVED)
-         throw;
-      rdma_ack_cm_event(event);
-      DEBUG_LOG("Route Resolved");
    }
 
    // Helper Functions
@@ -752,13 +1166,14 @@ class CM
          ((struct sockaddr_in6*)&sin)->sin6_port = port;
       else throw std::runtime_error("bind handler failed");
 
-      ret = rdma_bind_addr(incomingCmId, (struct sockaddr*)&sin);
+      ret = transport.bindAddr(incomingCmId, (struct sockaddr*)&sin);
       if (ret == -1) {
          throw std::runtime_error("Could not bind to rdma device");
       }
       DEBUG_LOG("rdma_bind_addr successful");
+      if (!running) return;  // handler does not accept connections anyway
       DEBUG_LOG("rdma_listen");
-      ret = rdma_listen(incomingCmId, 3);
+      ret = transport.listen(incomingCmId, 3);
       if (ret == -1) {
          throw std::runtime_error("Could not listen");
       }
@@ -767,9 +1182,19 @@ class CM
    // function to exchange rdma info including rkey
    // must ensure that before calling that an receive has been posted
    void exchangeRdmaInfo(rdma_cm_id* cmId, ibv_mr* mr, Type type, uint64_t typeId, NodeID nodeId)
+   {
+      postRdmaInfo(cmId, mr, type, typeId, nodeId);
+      waitRdmaInfo(cmId);
+   }
+
+   void postRdmaInfo(rdma_cm_id* cmId, ibv_mr* mr, Type type, uint64_t typeId, NodeID nodeId)
    {
       RdmaInfo* ownInfo = new (mbr.allocate(sizeof(RdmaInfo))) RdmaInfo(mr->rkey, type, typeId, nodeId);
       postSend(ownInfo, cmId->qp, mr, completion::signaled);
+   }
+
+   void waitRdmaInfo(rdma_cm_id* cmId)
+   {
       // poll completion for IBV_WC_RECV and
       int completions{0};
       ibv_wc wcs[2];
@@ -791,7 +1216,7 @@ class CM
    // we only create one CQ for the handler and only send CQ
    struct ibv_cq* createCQ(rdma_cm_id* cmId)
    {
-      struct ibv_cq* cq = ibv_create_cq(cmId->verbs, 16, nullptr, nullptr, 0);
+      struct ibv_cq* cq = transport.createCQ(cmId->verbs, COMPLETION_QUEUE_DEPTH);
       if (!cq)
          throw std::runtime_error("Could not create cq");
       DEBUG_LOG("CQ created");
@@ -801,7 +1226,7 @@ class CM
    // can we create a single one?
    void createPD(rdma_cm_id* cmId)
    {
-      pd = ibv_alloc_pd(cmId->verbs);
+      pd = transport.allocPD(cmId->verbs);
       if (!pd)
          throw std::runtime_error("Could not create PD");
       DEBUG_LOG("PD created");
@@ -821,7 +1246,7 @@ class CM
    {
       // std::cout << "memory created " << std::endl;
       DEBUG_VAR(mbr.getUnderlyingBuffer());
-      mr = ibv_reg_mr(pd, mbr.getUnderlyingBuffer(), mbr.getBufferSize(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC);
+      mr = transport.regMR(pd, mbr.getUnderlyingBuffer(), mbr.getBufferSize(), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC);
       DEBUG_VAR(mr);
       if (!mr)
          throw std::runtime_error("Memory region could not be registered");
@@ -840,17 +1265,17 @@ class CM
       struct ibv_qp_init_attr init_attr;
       int ret;
       memset(&init_attr, 0, sizeof(init_attr));
-      init_attr.cap.max_send_wr = 1024;//4096;
+      init_attr.cap.max_send_wr = SEND_QUEUE_DEPTH;//4096;
       init_attr.cap.max_recv_wr = 1024;//4096;
       init_attr.cap.max_recv_sge = 1;
-      init_attr.cap.max_send_sge = 1;
+      init_attr.cap.max_send_sge = MAX_SEND_SGE;
 #ifdef USE_INLINE
       init_attr.cap.max_inline_data = INLINE_SIZE;
 #endif
       init_attr.qp_type = IBV_QPT_RC;
       init_attr.send_cq = completionQueue;
       init_attr.recv_cq = completionQueue;
-      ret = rdma_create_qp(cm_id, pd, &init_attr);
+      ret = transport.createQP(cm_id, pd, &init_attr);
       if (ret)
          throw std::runtime_error("Could not create QP " + std::to_string(ret) + " errno " + std::to_string(errno));
       DEBUG_VAR(init_attr.cap.max_send_wr);
@@ -0,0 +1,129 @@
+#pragma once
+// -------------------------------------------------------------------------------------
+#include "CommunicationManager.hpp"
+#include "Defs.hpp"
+// -------------------------------------------------------------------------------------
+#include <functional>
+#include <string>
+#include <vector>
+// -------------------------------------------------------------------------------------
+namespace nam
+{
+namespace rdma
+{
+// -------------------------------------------------------------------------------------
+// Polls a send CQ in batches and routes every completion by its wr_id.
+// wr_id 0 is reserved for untracked requests (the default of all post* helpers), their completions
+// are only counted and consumed with waitUntracked(). Tracked requests get their wr_id from track()
+// and either run a callback on completion or are waited for with wait().
+// The status of every completion is checked here, a failed request throws.
+// One dispatcher per CQ and thread; while tracked requests are in flight the CQ must not be polled
+// directly.
+// -------------------------------------------------------------------------------------
+class CompletionDispatcher
+{
+  public:
+   using Callback = std::function<void(const ibv_wc&)>;
+   static constexpr uint64_t UNTRACKED = 0;
+   static constexpr int POLL_BATCH = 16;
+   // -------------------------------------------------------------------------------------
+   CompletionDispatcher() = default;
+   explicit CompletionDispatcher(ibv_cq* cq, uint64_t maxOutstanding = 1024) : cq(cq), slots(maxOutstanding)
+   {
+      freeSlots.reserve(maxOutstanding);
+      for (uint64_t s_i = maxOutstanding; s_i > 0; s_i--)
+         freeSlots.push_back(s_i - 1);
+   }
+   // -------------------------------------------------------------------------------------
+   // returns the wr_id for the post* helper, the request has to be signaled
+   uint64_t track(Callback callback = {})
+   {
+      if (freeSlots.empty())
+         throw std::runtime_error("Too many outstanding requests");
+      auto s_i = freeSlots.back();
+      freeSlots.pop_back();
+      slots[s_i].callback = std::move(callback);
+      slots[s_i].inUse = true;
+      slots[s_i].done = false;
+      return s_i + 1;
+   }
+   // -------------------------------------------------------------------------------------
+   bool done(uint64_t wrId) const { return slots[wrId - 1].done; }
+   // -------------------------------------------------------------------------------------
+   // polls until the request completed and releases its wr_id
+   void wait(uint64_t wrId)
+   {
+      auto& slot = slots[wrId - 1];
+      ensure(slot.inUse && !slot.callback);
+      while (!slot.done) {
+         if (poll() == 0)
+            _mm_pause();
+      }
+      release(wrId - 1);
+   }
+   // -------------------------------------------------------------------------------------
+   // polls until count untracked completions are available and consumes them
+   void waitUntracked(uint64_t count = 1)
+   {
+      while (untracked < count) {
+         if (poll() == 0)
+            _mm_pause();
+      }
+      untracked -= count;
+   }
+   // -------------------------------------------------------------------------------------
+   // polls up to POLL_BATCH completions and dispatches them, returns the number of completions
+   int poll()
+   {
+      ibv_wc wcs[POLL_BATCH];
+      int comp = pollCompletion(cq, POLL_BATCH, wcs);
+      for (int c_i = 0; c_i < comp; c_i++) {
+         auto& wc = wcs[c_i];
+         if (wc.status != IBV_WC_SUCCESS)
+            throw std::runtime_error("Work request " + std::to_string(wc.wr_id) + " failed: " + ibv_wc_status_str(wc.status));
+         // receives share the cq and carry their own wr_ids
+         if (wc.opcode & IBV_WC_RECV)
+            continue;
+         if (wc.wr_id == UNTRACKED || wc.wr_id > slots.size() || !slots[wc.wr_id - 1].inUse) {
+            untracked++;
+            continue;
+         }
+         auto& slot = slots[wc.wr_id - 1];
+         if (slot.callback) {
+            // release first, the callback may post and track the next request
+            auto callback = std::move(slot.callback);
+            release(wc.wr_id - 1);
+            callback(wc);
+         } else {
+            slot.done = true;
+         }
+      }
+      return comp;
+   }
+   // -------------------------------------------------------------------------------------
+   uint64_t outstanding() const { return slots.size() - freeSlots.size(); }
+   uint64_t untrackedAvailable() const { return untracked; }
+   ibv_cq* getCQ() { return cq; }
+
+  private:
+   struct Slot {
+      Callback callback;
+      bool inUse = false;
+      bool done = false;
+   };
+   ibv_cq* cq = nullptr;
+   std::vector<Slot> slots;
+   std::vector<uint64_t> freeSlots;
+   uint64_t untracked = 0;  // completed untracked requests not consumed yet
+   // -------------------------------------------------------------------------------------
+   void release(uint64_t s_i)
+   {
+      slots[s_i].callback = nullptr;
+      slots[s_i].inUse = false;
+      slots[s_i].done = false;
+      freeSlots.push_back(s_i);
+   }
+};
+// -------------------------------------------------------------------------------------
+}  // namespace rdma
+}  // namespace nam
@@ -0,0 +1,669 @@
+#include "EmulatedTransport.hpp"
+#include "Defs.hpp"
+#include "nam/Config.hpp"
+#include "nam/utils/Time.hpp"
+// -------------------------------------------------------------------------------------
+#include <arpa/inet.h>
+#include <immintrin.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+// -------------------------------------------------------------------------------------
+namespace nam
+{
+namespace rdma
+{
+namespace emulated
+{
+// -------------------------------------------------------------------------------------
+// Device
+// -------------------------------------------------------------------------------------
+Device::Device() : latencyNs(FLAGS_emulatedLatencyNs), bytesPerNs(FLAGS_emulatedBandwidthGBs)  // 1 GB/s == 1 byte/ns
+{
+   context.ops.post_send = &Device::postSend;
+   context.ops.post_recv = &Device::postRecv;
+   context.ops.poll_cq = &Device::pollCq;
+   // -------------------------------------------------------------------------------------
+   uint64_t numberThreads = std::max<uint64_t>(FLAGS_emulatedNicThreads, 1);
+   for (uint64_t t_i = 0; t_i < numberThreads; t_i++)
+      nicThreads.emplace_back(std::make_unique<NicThread>());
+   for (uint64_t t_i = 0; t_i < numberThreads; t_i++)
+      threads.emplace_back(&Device::nicLoop, this, t_i);
+}
+// -------------------------------------------------------------------------------------
+Device::~Device()
+{
+   running = false;
+   for (auto& t : threads)
+      t.join();
+}
+// -------------------------------------------------------------------------------------
+ibv_mr* Device::registerMR(ibv_pd* pd, void* addr, size_t length, int access)
+{
+   auto* mr = new ibv_mr();
+   uint32_t key = nextKey++;
+   mr->context = &context;
+   mr->pd = pd;
+   mr->addr = addr;
+   mr->length = length;
+   mr->handle = key;
+   mr->lkey = key;
+   mr->rkey = key;
+   std::unique_lock<std::shared_mutex> guard(mrMut);
+   mrs[key] = {(uintptr_t)addr, (uintptr_t)addr + length, access};
+   return mr;
+}
+// -------------------------------------------------------------------------------------
+void Device::deregisterMR(ibv_mr* mr)
+{
+   {
+      std::unique_lock<std::shared_mutex> guard(mrMut);
+      mrs.erase(mr->lkey);
+   }
+   delete mr;
+}
+// -------------------------------------------------------------------------------------
+ibv_cq* Device::createCQ(int cqe)
+{
+   auto* cq = new CompletionQueue();
+   // providers round up the depth as well, e.g. mlx5 uses the next power of two
+   cq->depth = Helper::nextPowerTwo(cqe + 1) - 1;
+   cq->cq.context = &context;
+   cq->cq.cq_context = cq;
+   cq->cq.cqe = cq->depth;
+   return &cq->cq;
+}
+// -------------------------------------------------------------------------------------
+void Device::destroyCQ(ibv_cq* cq)
+{
+   delete static_cast<CompletionQueue*>(cq->cq_context);
+}
+// -------------------------------------------------------------------------------------
+ibv_qp* Device::createQP(ibv_pd* pd, ibv_qp_init_attr* attr)
+{
+   auto* qp = new QueuePair();
+   qp->qp.context = &context;
+   qp->qp.qp_context = qp;
+   qp->qp.pd = pd;
+   qp->qp.send_cq = attr->send_cq;
+   qp->qp.recv_cq = attr->recv_cq;
+   qp->qp.qp_num = nextQpNum++;
+   qp->qp.qp_type = attr->qp_type;
+   qp->qp.state = IBV_QPS_RTS;
+   qp->sendCq = static_cast<CompletionQueue*>(attr->send_cq->cq_context);
+   qp->recvCq = static_cast<CompletionQueue*>(attr->recv_cq->cq_context);
+   qp->maxSendWr = attr->cap.max_send_wr;
+   qp->maxSge = attr->cap.max_send_sge;
+   qp->maxInline = attr->cap.max_inline_data;
+   qp->nicThread = qp->qp.qp_num % nicThreads.size();
+   auto& nic = *nicThreads[qp->nicThread];
+   std::unique_lock<std::mutex> guard(nic.mut);
+   nic.qps.push_back(qp);
+   return &qp->qp;
+}
+// -------------------------------------------------------------------------------------
+void Device::destroyQP(ibv_qp* ibvQp)
+{
+   disconnect(ibvQp);
+   auto* qp = static_cast<QueuePair*>(ibvQp->qp_context);
+   auto& nic = *nicThreads[qp->nicThread];
+   {
+      std::unique_lock<std::mutex> guard(nic.mut);
+      nic.qps.erase(std::remove(nic.qps.begin(), nic.qps.end(), qp), nic.qps.end());
+   }
+   delete qp;
+}
+// -------------------------------------------------------------------------------------
+void Device::connect(ibv_qp* a, ibv_qp* b)
+{
+   std::unique_lock<std::mutex> guard(connectionMut);
+   static_cast<QueuePair*>(a->qp_context)->peer = static_cast<QueuePair*>(b->qp_context);
+   static_cast<QueuePair*>(b->qp_context)->peer = static_cast<QueuePair*>(a->qp_context);
+}
+// -------------------------------------------------------------------------------------
+void Device::disconnect(ibv_qp* ibvQp)
+{
+   std::unique_lock<std::mutex> guard(connectionMut);
+   auto* qp = static_cast<QueuePair*>(ibvQp->qp_context);
+   if (qp->peer) qp->peer->peer = nullptr;
+   qp->peer = nullptr;
+}
+// -------------------------------------------------------------------------------------
+int Device::postSend(ibv_qp* ibvQp, ibv_send_wr* wr, ibv_send_wr** badWr)
+{
+   auto& device = getInstance();
+   auto& qp = *static_cast<QueuePair*>(ibvQp->qp_context);
+   auto now = utils::getTimePointNanoseconds();
+   std::unique_lock<std::mutex> guard(qp.mut);
+   for (; wr; wr = wr->next) {
+      if (qp.posted - qp.retired.load(std::memory_order_acquire) >= qp.maxSendWr) {
+         *badWr = wr;
+         return ENOMEM;
+      }
+      if ((uint64_t)wr->num_sge > qp.maxSge) {
+         *badWr = wr;
+         return EINVAL;
+      }
+      WorkRequest w;
+      w.wr = *wr;
+      w.wr.next = nullptr;
+      w.wr.sg_list = nullptr;
+      w.sges.assign(wr->sg_list, wr->sg_list + wr->num_sge);
+      for (auto& sge : w.sges)
+         w.bytes += sge.length;
+      if (wr->send_flags & IBV_SEND_INLINE) {
+         if (w.bytes > qp.maxInline) {
+            *badWr = wr;
+            return EINVAL;
+         }
+         w.inlineData.resize(w.bytes);
+         uint64_t offset = 0;
+         for (auto& sge : w.sges) {
+            std::memcpy(w.inlineData.data() + offset, (void*)sge.addr, sge.length);
+            offset += sge.length;
+         }
+      }
+      // -------------------------------------------------------------------------------------
+      uint64_t due = std::max(now + device.latencyNs, qp.lastDue);
+      if (wr->send_flags & IBV_SEND_FENCE) due = std::max(due, qp.lastDue + device.latencyNs);
+      if (device.bytesPerNs > 0) due += static_cast<uint64_t>(w.bytes / device.bytesPerNs);
+      qp.lastDue = due;
+      w.due = due;
+      w.wqeIdx = qp.posted++;
+      qp.sq.push_back(std::move(w));
+   }
+   return 0;
+}
+// -------------------------------------------------------------------------------------
+int Device::postRecv(ibv_qp* ibvQp, ibv_recv_wr* wr, [[maybe_unused]] ibv_recv_wr** badWr)
+{
+   auto& qp = *static_cast<QueuePair*>(ibvQp->qp_context);
+   std::unique_lock<std::mutex> guard(qp.mut);
+   for (; wr; wr = wr->next)
+      qp.rq.push_back({wr->wr_id, std::vector<ibv_sge>(wr->sg_list, wr->sg_list + wr->num_sge)});
+   return 0;
+}
+// -------------------------------------------------------------------------------------
+int Device::pollCq(ibv_cq* ibvCq, int numEntries, ibv_wc* wc)
+{
+   auto& cq = *static_cast<CompletionQueue*>(ibvCq->cq_context);
+   if (cq.overrun) return -1;
+   if (cq.size.load(std::memory_order_acquire) == 0) return 0;
+   std::unique_lock<std::mutex> guard(cq.mut);
+   int polled = 0;
+   while (polled < numEntries && !cq.entries.empty()) {
+      auto& c = cq.entries.front();
+      wc[polled++] = c.wc;
+      // frees the slot of this and all previous unsignaled WQEs
+      if (c.qp) c.qp->retired.store(c.wqeIdx + 1, std::memory_order_release);
+      cq.entries.pop_front();
+   }
+   cq.size -= polled;
+   return polled;
+}
+// -------------------------------------------------------------------------------------
+void Device::nicLoop(uint64_t t_i)
+{
+   std::string threadName("emulated_nic_" + std::to_string(t_i));
+   pthread_setname_np(pthread_self(), threadName.c_str());
+   auto& nic = *nicThreads[t_i];
+   uint64_t idle = 0;
+   while (running) {
+      bool worked = false;
+      {
+         std::unique_lock<std::mutex> guard(nic.mut);
+         auto now = utils::getTimePointNanoseconds();
+         for (auto* qp : nic.qps) {
+            for (uint64_t b_i = 0; b_i < BATCH_SIZE && progress(*qp, now); b_i++)
+               worked = true;
+         }
+      }
+      if (worked) {
+         idle = 0;
+      } else if (++idle < 1024) {
+         _mm_pause();
+      } else {
+         std::this_thread::yield();
+      }
+   }
+}
+// -------------------------------------------------------------------------------------
+bool Device::progress(QueuePair& qp, uint64_t now)
+{
+   WorkRequest* w = nullptr;
+   {
+      // only this thread pops, the reference stays valid while posters append
+      std::unique_lock<std::mutex> guard(qp.mut);
+      if (qp.sq.empty() || qp.sq.front().due > now) return false;
+      w = &qp.sq.front();
+   }
+   // a failed request moves the QP into the error state and flushes all following ones
+   ibv_wc_status status = IBV_WC_WR_FLUSH_ERR;
+   if (!qp.error) {
+      if (!execute(qp, *w, status)) return false;  // receiver not ready, retry
+      qp.error = (status != IBV_WC_SUCCESS);
+   }
+   if ((w->wr.send_flags & IBV_SEND_SIGNALED) || status != IBV_WC_SUCCESS) {
+      Completion c;
+      c.wc = {};
+      c.wc.wr_id = w->wr.wr_id;
+      c.wc.status = status;
+      c.wc.byte_len = w->bytes;
+      c.wc.qp_num = qp.qp.qp_num;
+      switch (w->wr.opcode) {
+         case IBV_WR_RDMA_READ: c.wc.opcode = IBV_WC_RDMA_READ; break;
+         case IBV_WR_ATOMIC_CMP_AND_SWP: c.wc.opcode = IBV_WC_COMP_SWAP; break;
+         case IBV_WR_ATOMIC_FETCH_AND_ADD: c.wc.opcode = IBV_WC_FETCH_ADD; break;
+         case IBV_WR_SEND: c.wc.opcode = IBV_WC_SEND; break;
+         default: c.wc.opcode = IBV_WC_RDMA_WRITE; break;
+      }
+      c.qp = &qp;
+      c.wqeIdx = w->wqeIdx;
+      complete(*qp.sendCq, c);
+   }
+   std::unique_lock<std::mutex> guard(qp.mut);
+   qp.sq.pop_front();
+   return true;
+}
+// -------------------------------------------------------------------------------------
+bool Device::execute(QueuePair& qp, WorkRequest& w, ibv_wc_status& status)
+{
+   auto& wr = w.wr;
+   status = IBV_WC_SUCCESS;
+   // gathers the local payload of writes and sends
+   auto gather = [&](uint8_t* destination) {
+      if (!w.inlineData.empty()) {
+         std::memcpy(destination, w.inlineData.data(), w.bytes);
+         return true;
+      }
+      for (auto& sge : w.sges) {
+         auto* local = resolve(sge.lkey, sge.addr, sge.length, 0);
+         if (!local) return false;
+         std::memcpy(destination, local, sge.length);
+         destination += sge.length;
+      }
+      return true;
+   };
+   switch (wr.opcode) {
+      case IBV_WR_RDMA_WRITE: {
+         auto* remote = resolve(wr.wr.rdma.rkey, wr.wr.rdma.remote_addr, w.bytes, IBV_ACCESS_REMOTE_WRITE);
+         if (!remote) {
+            status = IBV_WC_REM_ACCESS_ERR;
+         } else if (!gather(remote)) {
+            status = IBV_WC_LOC_PROT_ERR;
+         }
+         return true;
+      }
+      case IBV_WR_RDMA_READ: {
+         auto* remote = resolve(wr.wr.rdma.rkey, wr.wr.rdma.remote_addr, w.bytes, IBV_ACCESS_REMOTE_READ);
+         if (!remote) {
+            status = IBV_WC_REM_ACCESS_ERR;
+            return true;
+         }
+         for (auto& sge : w.sges) {
+            auto* local = resolve(sge.lkey, sge.addr, sge.length, IBV_ACCESS_LOCAL_WRITE);
+            if (!local) {
+               status = IBV_WC_LOC_PROT_ERR;
+               return true;
+            }
+            std::memcpy(local, remote, sge.length);
+            remote += sge.length;
+         }
+         return true;
+      }
+      case IBV_WR_ATOMIC_CMP_AND_SWP:
+      case IBV_WR_ATOMIC_FETCH_AND_ADD: {
+         if (wr.wr.atomic.remote_addr % sizeof(uint64_t) != 0 || w.sges.size() != 1 || w.bytes != sizeof(uint64_t)) {
+            status = IBV_WC_REM_INV_REQ_ERR;
+            return true;
+         }
+         auto* remote = resolve(wr.wr.atomic.rkey, wr.wr.atomic.remote_addr, sizeof(uint64_t), IBV_ACCESS_REMOTE_ATOMIC);
+         auto* local = resolve(w.sges[0].lkey, w.sges[0].addr, sizeof(uint64_t), IBV_ACCESS_LOCAL_WRITE);
+         if (!remote) {
+            status = IBV_WC_REM_ACCESS_ERR;
+            return true;
+         }
+         if (!local) {
+            status = IBV_WC_LOC_PROT_ERR;
+            return true;
+         }
+         auto* word = reinterpret_cast<uint64_t*>(remote);
+         uint64_t old = wr.wr.atomic.compare_add;
+         if (wr.opcode == IBV_WR_ATOMIC_CMP_AND_SWP)
+            __atomic_compare_exchange_n(word, &old, wr.wr.atomic.swap, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+         else
+            old = __atomic_fetch_add(word, wr.wr.atomic.compare_add, __ATOMIC_SEQ_CST);
+         std::memcpy(local, &old, sizeof(old));  // previous value in both cases
+         return true;
+      }
+      case IBV_WR_SEND: {
+         std::unique_lock<std::mutex> connectionGuard(connectionMut);
+         auto* peer = qp.peer;
+         if (!peer) {
+            status = IBV_WC_RETRY_EXC_ERR;
+            return true;
+         }
+         ReceiveRequest recv;
+         {
+            std::unique_lock<std::mutex> guard(peer->mut);
+            if (peer->rq.empty()) return false;  // receiver not ready
+            recv = std::move(peer->rq.front());
+            peer->rq.pop_front();
+         }
+         std::vector<uint8_t> payload(w.bytes);
+         if (!gather(payload.data())) {
+            status = IBV_WC_LOC_PROT_ERR;
+            return true;
+         }
+         Completion c;
+         c.wc = {};
+         c.wc.wr_id = recv.wrId;
+         c.wc.status = IBV_WC_SUCCESS;
+         c.wc.opcode = IBV_WC_RECV;
+         c.wc.byte_len = w.bytes;
+         c.wc.qp_num = peer->qp.qp_num;
+         uint64_t offset = 0;
+         for (auto& sge : recv.sges) {
+            if (offset == w.bytes) break;
+            auto length = std::min<uint64_t>(sge.length, w.bytes - offset);
+            auto* local = resolve(sge.lkey, sge.addr, length, IBV_ACCESS_LOCAL_WRITE);
+            if (!local) break;
+            std::memcpy(local, payload.data() + offset, length);
+            offset += length;
+         }
+         if (offset != w.bytes) {
+            c.wc.status = IBV_WC_LOC_LEN_ERR;
+            status = IBV_WC_REM_INV_REQ_ERR;
+         }
+         complete(*peer->recvCq, c);
+         return true;
+      }
+      default:
+         status = IBV_WC_REM_INV_REQ_ERR;
+         return true;
+   }
+}
+// -------------------------------------------------------------------------------------
+uint8_t* Device::resolve(uint32_t key, uint64_t addr, uint64_t length, int access)
+{
+   std::shared_lock<std::shared_mutex> guard(mrMut);
+   auto it = mrs.find(key);
+   if (it == mrs.end()) return nullptr;
+   auto& region = it->second;
+   if ((region.access & access) != access) return nullptr;
+   if (addr < region.begin || addr + length > region.end) return nullptr;
+   return reinterpret_cast<uint8_t*>(addr);
+}
+// -------------------------------------------------------------------------------------
+void Device::complete(CompletionQueue& cq, const Completion& c)
+{
+   std::unique_lock<std::mutex> guard(cq.mut);
+   if (cq.entries.size() >= cq.depth) {
+      cq.overrun = true;  // same as a real CQ overrun, the next poll fails
+      return;
+   }
+   cq.entries.push_back(c);
+   cq.size++;
+}
+// -------------------------------------------------------------------------------------
+// EmulatedTransport
+// -------------------------------------------------------------------------------------
+std::string EmulatedTransport::endpoint(const sockaddr_storage& addr)
+{
+   char ip[INET6_ADDRSTRLEN] = {0};
+   uint16_t port = 0;
+   if (addr.ss_family == AF_INET) {
+      auto* in = reinterpret_cast<const sockaddr_in*>(&addr);
+      inet_ntop(AF_INET, &in->sin_addr, ip, sizeof(ip));
+      port = ntohs(in->sin_port);
+   } else if (addr.ss_family == AF_INET6) {
+      auto* in6 = reinterpret_cast<const sockaddr_in6*>(&addr);
+      inet_ntop(AF_INET6, &in6->sin6_addr, ip, sizeof(ip));
+      port = ntohs(in6->sin6_port);
+   }
+   return std::string(ip) + ":" + std::to_string(port);
+}
+// -------------------------------------------------------------------------------------
+void EmulatedTransport::pushEvent(CmId& id, rdma_cm_event_type type, CmId* listenId, int status)
+{
+   auto* event = new rdma_cm_event();
+   event->id = &id.id;
+   event->listen_id = listenId ? &listenId->id : nullptr;
+   event->event = type;
+   event->status = status;
+   std::unique_lock<std::mutex> guard(id.channel->mut);
+   id.channel->events.push_back(event);
+   id.channel->cv.notify_one();
+}
+// -------------------------------------------------------------------------------------
+rdma_event_channel* EmulatedTransport::createEventChannel()
+{
+   auto channel = std::make_unique<EventChannel>();
+   auto* ptr = &channel->channel;
+   std::unique_lock<std::mutex> guard(mut);
+   channels[ptr] = std::move(channel);
+   return ptr;
+}
+// -------------------------------------------------------------------------------------
+void EmulatedTransport::destroyEventChannel(rdma_event_channel* channel)
+{
+   std::unique_lock<std::mutex> guard(mut);
+   channels.erase(channel);
+}
+// -------------------------------------------------------------------------------------
+int EmulatedTransport::createId(rdma_event_channel* channel, rdma_cm_id** id, void* context, rdma_port_space ps)
+{
+   std::unique_lock<std::mutex> guard(mut);
+   auto it = channels.find(channel);
+   if (it == channels.end()) return -1;
+   auto cmId = std::make_unique<CmId>();
+   cmId->channel = it->second.get();
+   cmId->id.channel = channel;
+   cmId->id.context = context;
+   cmId->id.ps = ps;
+   *id = &cmId->id;
+   ids[*id] = std::move(cmId);
+   return 0;
+}
+// -------------------------------------------------------------------------------------
+int EmulatedTransport::destroyId(rdma_cm_id* id)
+{
+   std::unique_lock<std::mutex> guard(mut);
+   auto it = ids.find(id);
+   if (it == ids.end()) return -1;
+   auto& cmId = *it->second;
+   if (cmId.listening) listeners.erase(endpoint(cmId.localAddr));
+   if (cmId.remote) cmId.remote->remote = nullptr;
+   ids.erase(it);
+   return 0;
+}
+// -------------------------------------------------------------------------------------
+int EmulatedTransport::bindAddr(rdma_cm_id* id, sockaddr* addr)
+{
+   std::unique_lock<std::mutex> guard(mut);
+   auto& cmId = *ids.at(id);
+   std::memcpy(&cmId.localAddr, addr, (addr->sa_family == AF_INET) ? sizeof(sockaddr_in) : sizeof(sockaddr_in6));
+   id->verbs = Device::getInstance().getContext();
+   return 0;
+}
+// -------------------------------------------------------------------------------------
+int EmulatedTransport::listen(rdma_cm_id* id, [[maybe_unused]] int backlog)
+{
+   std::unique_lock<std::mutex> guard(mut);
+   auto& cmId = *ids.at(id);
+   auto key = endpoint(cmId.localAddr);
+   if (listeners.count(key)) {
+      errno = EADDRINUSE;
+      return -1;
+   }
+   listeners[key] = &cmId;
+   cmId.listening = true;
+   return 0;
+}
+// -------------------------------------------------------------------------------------
+int EmulatedTransport::resolveAddr(rdma_cm_id* id, [[maybe_unused]] sockaddr* src, sockaddr* dst, [[maybe_unused]] int timeoutMs)
+{
+   std::unique_lock<std::mutex> guard(mut);
+   auto& cmId = *ids.at(id);
+   std::memcpy(&cmId.peerAddr, dst, (dst->sa_family == AF_INET) ? sizeof(sockaddr_in) : sizeof(sockaddr_in6));
+   id->verbs = Device::getInstance().getContext();
+   pushEvent(cmId, RDMA_CM_EVENT_ADDR_RESOLVED);
+   return 0;
+}
+// -------------------------------------------------------------------------------------
+int EmulatedTransport::resolveRoute(rdma_cm_id* id, [[maybe_unused]] int timeoutMs)
+{
+   std::unique_lock<std::mutex> guard(mut);
+   pushEvent(*ids.at(id), RDMA_CM_EVENT_ROUTE_RESOLVED);
+   return 0;
+}
+// -------------------------------------------------------------------------------------
+int EmulatedTransport::connect(rdma_cm_id* id, [[maybe_unused]] rdma_conn_param* param)
+{
+   std::unique_lock<std::mutex> guard(mut);
+   auto& client = *ids.at(id);
+   auto it = listeners.find(endpoint(client.peerAddr));
+   if (it == listeners.end()) {
+      pushEvent(client, RDMA_CM_EVENT_REJECTED, nullptr, ECONNREFUSED);
+      return 0;
+   }
+   auto& listener = *it->second;
+   auto server = std::make_unique<CmId>();
+   server->channel = listener.channel;
+   server->id.channel = listener.id.channel;
+   server->id.verbs = Device::getInstance().getContext();
+   server->id.ps = listener.id.ps;
+   server->localAddr = listener.localAddr;
+   server->peerAddr = (client.localAddr.ss_family != 0) ? client.localAddr : client.peerAddr;
+   server->remote = &client;
+   client.remote = server.get();
+   auto& serverRef = *server;
+   ids[&server->id] = std::move(server);
+   pushEvent(serverRef, RDMA_CM_EVENT_CONNECT_REQUEST, &listener);
+   return 0;
+}
+// -------------------------------------------------------------------------------------
+int EmulatedTransport::accept(rdma_cm_id* id, [[maybe_unused]] rdma_conn_param* param)
+{
+   std::unique_lock<std::mutex> guard(mut);
+   auto& server = *ids.at(id);
+   if (!server.remote || !server.id.qp || !server.remote->id.qp) return -1;
+   Device::getInstance().connect(server.id.qp, server.remote->id.qp);
+   pushEvent(*server.remote, RDMA_CM_EVENT_ESTABLISHED);
+   pushEvent(server, RDMA_CM_EVENT_ESTABLISHED);
+   return 0;
+}
+// -------------------------------------------------------------------------------------
+int EmulatedTransport::disconnect(rdma_cm_id* id)
+{
+   std::unique_lock<std::mutex> guard(mut);
+   auto& cmId = *ids.at(id);
+   auto* remote = cmId.remote;
+   if (!remote) return 0;  // already disconnected by the other side
+   if (cmId.id.qp) Device::getInstance().disconnect(cmId.id.qp);
+   cmId.remote = nullptr;
+   remote->remote = nullptr;
+   pushEvent(cmId, RDMA_CM_EVENT_DISCONNECTED);
+   pushEvent(*remote, RDMA_CM_EVENT_DISCONNECTED);
+   return 0;
+}
+// -------------------------------------------------------------------------------------
+int EmulatedTransport::getCmEvent(rdma_event_channel* channel, rdma_cm_event** event)
+{
+   return getCmEvent(channel, event, -1);
+}
+// -------------------------------------------------------------------------------------
+int EmulatedTransport::getCmEvent(rdma_event_channel* channel, rdma_cm_event** event, int timeoutMs)
+{
+   EventChannel* ch = nullptr;
+   {
+      std::unique_lock<std::mutex> guard(mut);
+      auto it = channels.find(channel);
+      if (it == channels.end()) return -1;
+      ch = it->second.get();
+   }
+   std::unique_lock<std::mutex> guard(ch->mut);
+   auto pending = [&]() { return !ch->events.empty(); };
+   if (timeoutMs < 0) {
+      ch->cv.wait(guard, pending);
+   } else if (!ch->cv.wait_for(guard, std::chrono::milliseconds(timeoutMs), pending)) {
+      errno = ETIMEDOUT;
+      return -1;
+   }
+   *event = ch->events.front();
+   ch->events.pop_front();
+   return 0;
+}
+// -------------------------------------------------------------------------------------
+int EmulatedTransport::ackCmEvent(rdma_cm_event* event)
+{
+   delete event;
+   return 0;
+}
+// -------------------------------------------------------------------------------------
+sockaddr* EmulatedTransport::getPeerAddr(rdma_cm_id* id)
+{
+   std::unique_lock<std::mutex> guard(mut);
+   return reinterpret_cast<sockaddr*>(&ids.at(id)->peerAddr);
+}
+// -------------------------------------------------------------------------------------
+int EmulatedTransport::createQP(rdma_cm_id* id, ibv_pd* pd, ibv_qp_init_attr* attr)
+{
+   id->qp = Device::getInstance().createQP(pd, attr);
+   id->pd = pd;
+   id->send_cq = attr->send_cq;
+   id->recv_cq = attr->recv_cq;
+   return 0;
+}
+// -------------------------------------------------------------------------------------
+void EmulatedTransport::destroyQP(rdma_cm_id* id)
+{
+   Device::getInstance().destroyQP(id->qp);
+   id->qp = nullptr;
+}
+// -------------------------------------------------------------------------------------
+ibv_pd* EmulatedTransport::allocPD(ibv_context* context)
+{
+   auto* pd = new ibv_pd();
+   pd->context = context;
+   return pd;
+}
+// -------------------------------------------------------------------------------------
+int EmulatedTransport::deallocPD(ibv_pd* pd)
+{
+   delete pd;
+   return 0;
+}
+// -------------------------------------------------------------------------------------
+int EmulatedTransport::queryDevice(ibv_context*, ibv_device_attr* attr)
+{
+   *attr = {};
+   attr->atomic_cap = IBV_ATOMIC_GLOB;
+   return 0;
+}
+// -------------------------------------------------------------------------------------
+ibv_mr* EmulatedTransport::regMR(ibv_pd* pd, void* addr, size_t length, int access)
+{
+   return Device::getInstance().registerMR(pd, addr, length, access);
+}
+// -------------------------------------------------------------------------------------
+int EmulatedTransport::deregMR(ibv_mr* mr)
+{
+   Device::getInstance().deregisterMR(mr);
+   return 0;
+}
+// -------------------------------------------------------------------------------------
+ibv_cq* EmulatedTransport::createCQ([[maybe_unused]] ibv_context* context, int cqe)
+{
+   return Device::getInstance().createCQ(cqe);
+}
+// -------------------------------------------------------------------------------------
+int EmulatedTransport::destroyCQ(ibv_cq* cq)
+{
+   Device::getInstance().destroyCQ(cq);
+   return 0;
+}
+// -------------------------------------------------------------------------------------
+}  // namespace emulated
+}  // namespace rdma
+}  // namespace nam
@@ -0,0 +1,200 @@
+#pragma once
+// -------------------------------------------------------------------------------------
+#include "Transport.hpp"
+// -------------------------------------------------------------------------------------
+#include <sys/socket.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+// -------------------------------------------------------------------------------------
+namespace nam
+{
+namespace rdma
+{
+namespace emulated
+{
+// -------------------------------------------------------------------------------------
+// In-process RDMA: a shared memory "NIC" whose threads execute the queued work requests
+// directly against the registered memory of the target.
+// Per QP the requests are executed in posting order (RC semantics) at
+// max(post + latency, previous) + bytes / bandwidth; a fence additionally waits one latency
+// for the preceding requests. Only signaled requests generate completions and unsignaled
+// send queue slots are freed once a later completion of the same QP is polled.
+// -------------------------------------------------------------------------------------
+struct QueuePair;
+// -------------------------------------------------------------------------------------
+struct Completion {
+   ibv_wc wc;
+   QueuePair* qp = nullptr;  // nullptr for receive completions
+   uint64_t wqeIdx = 0;
+};
+// -------------------------------------------------------------------------------------
+struct CompletionQueue {
+   ibv_cq cq;
+   std::mutex mut;
+   std::atomic<uint64_t> size{0};
+   std::atomic<bool> overrun{false};
+   std::deque<Completion> entries;
+   uint64_t depth = 0;
+};
+// -------------------------------------------------------------------------------------
+struct WorkRequest {
+   ibv_send_wr wr;
+   std::vector<ibv_sge> sges;
+   std::vector<uint8_t> inlineData;  // inline payloads are copied at post time
+   uint64_t bytes = 0;
+   uint64_t wqeIdx = 0;
+   uint64_t due = 0;  // ns
+};
+// -------------------------------------------------------------------------------------
+struct ReceiveRequest {
+   uint64_t wrId;
+   std::vector<ibv_sge> sges;
+};
+// -------------------------------------------------------------------------------------
+struct QueuePair {
+   ibv_qp qp;
+   CompletionQueue* sendCq = nullptr;
+   CompletionQueue* recvCq = nullptr;
+   QueuePair* peer = nullptr;  // protected by Device::connectionMut
+   std::mutex mut;
+   std::deque<WorkRequest> sq;
+   std::deque<ReceiveRequest> rq;
+   uint64_t maxSendWr = 0;
+   uint64_t maxSge = 0;
+   uint64_t maxInline = 0;
+   uint64_t posted = 0;               // WQEs ever posted
+   std::atomic<uint64_t> retired{0};  // WQEs freed by polled completions
+   uint64_t lastDue = 0;
+   bool error = false;  // only touched by the NIC thread
+   uint64_t nicThread = 0;
+};
+// -------------------------------------------------------------------------------------
+class Device
+{
+  public:
+   static Device& getInstance()
+   {
+      static Device device;
+      return device;
+   }
+   ~Device();
+   // -------------------------------------------------------------------------------------
+   ibv_context* getContext() { return &context; }
+   ibv_mr* registerMR(ibv_pd* pd, void* addr, size_t length, int access);
+   void deregisterMR(ibv_mr* mr);
+   ibv_cq* createCQ(int cqe);
+   void destroyCQ(ibv_cq* cq);
+   ibv_qp* createQP(ibv_pd* pd, ibv_qp_init_attr* attr);
+   void destroyQP(ibv_qp* qp);
+   void connect(ibv_qp* a, ibv_qp* b);
+   void disconnect(ibv_qp* qp);
+   // -------------------------------------------------------------------------------------
+   // ibv_context ops
+   static int postSend(ibv_qp* qp, ibv_send_wr* wr, ibv_send_wr** badWr);
+   static int postRecv(ibv_qp* qp, ibv_recv_wr* wr, ibv_recv_wr** badWr);
+   static int pollCq(ibv_cq* cq, int numEntries, ibv_wc* wc);
+
+  private:
+   Device();
+   struct NicThread {
+      std::mutex mut;  // held while the thread works on its QPs
+      std::vector<QueuePair*> qps;
+   };
+   struct MemoryRegion {
+      uintptr_t begin;
+      uintptr_t end;
+      int access;
+   };
+   ibv_context context{};
+   std::atomic<bool> running{true};
+   std::atomic<uint32_t> nextQpNum{1};
+   std::atomic<uint32_t> nextKey{1};
+   uint64_t latencyNs;
+   double bytesPerNs;  // 0 means unlimited
+   std::mutex connectionMut;
+   std::shared_mutex mrMut;
+   std::unordered_map<uint32_t, MemoryRegion> mrs;  // key -> region, lkey == rkey
+   std::vector<std::unique_ptr<NicThread>> nicThreads;
+   std::vector<std::thread> threads;
+   // -------------------------------------------------------------------------------------
+   void nicLoop(uint64_t t_i);
+   bool progress(QueuePair& qp, uint64_t now);
+   bool execute(QueuePair& qp, WorkRequest& w, ibv_wc_status& status);  // false if it has to be retried
+   uint8_t* resolve(uint32_t key, uint64_t addr, uint64_t length, int access);
+   void complete(CompletionQueue& cq, const Completion& c);
+};
+// -------------------------------------------------------------------------------------
+// rdma_cm emulation, connections are matched by ip:port within the process
+// -------------------------------------------------------------------------------------
+class EmulatedTransport : public Transport
+{
+  public:
+   static EmulatedTransport& getInstance()
+   {
+      static EmulatedTransport transport;
+      return transport;
+   }
+   // -------------------------------------------------------------------------------------
+   rdma_event_channel* createEventChannel() override;
+   void destroyEventChannel(rdma_event_channel* channel) override;
+   int createId(rdma_event_channel* channel, rdma_cm_id** id, void* context, rdma_port_space ps) override;
+   int destroyId(rdma_cm_id* id) override;
+   int bindAddr(rdma_cm_id* id, sockaddr* addr) override;
+   int listen(rdma_cm_id* id, int backlog) override;
+   int resolveAddr(rdma_cm_id* id, sockaddr* src, sockaddr* dst, int timeoutMs) override;
+   int resolveRoute(rdma_cm_id* id, int timeoutMs) override;
+   int connect(rdma_cm_id* id, rdma_conn_param* param) override;
+   int accept(rdma_cm_id* id, rdma_conn_param* param) override;
+   int disconnect(rdma_cm_id* id) override;
+   int getCmEvent(rdma_event_channel* channel, rdma_cm_event** event) override;
+   int getCmEvent(rdma_event_channel* channel, rdma_cm_event** event, int timeoutMs) override;
+   int ackCmEvent(rdma_cm_event* event) override;
+   sockaddr* getPeerAddr(rdma_cm_id* id) override;
+   int createQP(rdma_cm_id* id, ibv_pd* pd, ibv_qp_init_attr* attr) override;
+   void destroyQP(rdma_cm_id* id) override;
+   // -------------------------------------------------------------------------------------
+   ibv_pd* allocPD(ibv_context* context) override;
+   int deallocPD(ibv_pd* pd) override;
+   ibv_mr* regMR(ibv_pd* pd, void* addr, size_t length, int access) override;
+   int deregMR(ibv_mr* mr) override;
+   ibv_cq* createCQ(ibv_context* context, int cqe) override;
+   int destroyCQ(ibv_cq* cq) override;
+   // atomics are cpu atomics on the registered memory, coherent with the host (IBV_ATOMIC_GLOB)
+   int queryDevice(ibv_context* context, ibv_device_attr* attr) override;
+
+  private:
+   EmulatedTransport() = default;
+   struct EventChannel {
+      rdma_event_channel channel{};
+      std::mutex mut;
+      std::condition_variable cv;
+      std::deque<rdma_cm_event*> events;
+   };
+   struct CmId {
+      rdma_cm_id id{};
+      EventChannel* channel = nullptr;
+      sockaddr_storage localAddr{};
+      sockaddr_storage peerAddr{};
+      CmId* remote = nullptr;  // connected counterpart
+      bool listening = false;
+   };
+   std::mutex mut;  // protects all members
+   std::unordered_map<rdma_event_channel*, std::unique_ptr<EventChannel>> channels;
+   std::unordered_map<rdma_cm_id*, std::unique_ptr<CmId>> ids;
+   std::unordered_map<std::string, CmId*> listeners;  // ip:port -> listening id
+   // -------------------------------------------------------------------------------------
+   void pushEvent(CmId& id, rdma_cm_event_type type, CmId* listenId = nullptr, int status = 0);
+   static std::string endpoint(const sockaddr_storage& addr);
+};
+// -------------------------------------------------------------------------------------
+}  // namespace emulated
+}  // namespace rdma
+}  // namespace nam
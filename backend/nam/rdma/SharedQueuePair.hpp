@@ -0,0 +1,237 @@
+#pragma once
+// -------------------------------------------------------------------------------------
+#include "CommunicationManager.hpp"
+#include "Defs.hpp"
+#include "nam/utils/MPMCQueue.hpp"
+// -------------------------------------------------------------------------------------
+#include <atomic>
+#include <memory>
+// -------------------------------------------------------------------------------------
+namespace nam
+{
+namespace rdma
+{
+// -------------------------------------------------------------------------------------
+// One RC QP shared by a group of worker threads (FLAGS_qpSharing).
+// Members enqueue their work requests into a lock-free submission ring; whoever gets the post latch
+// drains the ring and posts everything with a single ibv_post_send. The shared cq is polled the same
+// way and completions are routed back to the member by wr_id (member << 48 | ticket).
+// The order of the requests of one member is preserved, unsignaled requests of a member must be
+// followed by a signaled one as usual. Every member owns a budget of SEND_QUEUE_DEPTH / members send
+// queue slots and of COMPLETION_QUEUE_DEPTH / 2 / members signaled requests (the other half of the cq
+// is left to receives), a signaled completion retires it and all requests the member posted before;
+// a member at its budget helps polling until it has a free slot. Local buffers must stay valid until the member
+// waited for a later signaled request.
+// -------------------------------------------------------------------------------------
+class SharedQueuePair
+{
+  public:
+   static constexpr uint64_t MEMBER_SHIFT = 48;
+   static constexpr uint64_t TICKET_MASK = (1ul << MEMBER_SHIFT) - 1;
+   static constexpr uint64_t MAX_BATCH = 32;
+   // -------------------------------------------------------------------------------------
+   SharedQueuePair(RdmaContext& context, uint64_t members)
+       : context(context),
+         members(members),
+         budget(SEND_QUEUE_DEPTH / members),
+         signaledBudget(COMPLETION_QUEUE_DEPTH / 2 / members),
+         memberState(std::make_unique<MemberState[]>(members)),
+         ring(SEND_QUEUE_DEPTH)
+   {
+      ensure(members > 0 && members <= COMPLETION_QUEUE_DEPTH / 2);
+      for (uint64_t m_i = 0; m_i < members; m_i++)
+         memberState[m_i].postedAt = std::make_unique<uint64_t[]>(signaledBudget + 1);
+   }
+   // -------------------------------------------------------------------------------------
+   RdmaContext& getContext() { return context; }
+   uint64_t getMembers() { return members; }
+   // per member
+   uint64_t getBudget() { return budget; }
+   uint64_t getSignaledBudget() { return signaledBudget; }
+   // -------------------------------------------------------------------------------------
+   // all return the ticket to wait for, 0 for unsignaled requests
+   // keys default to the ones of the connection, see MemoryKeys
+   uint64_t read(uint64_t member, void* memAddr, size_t size, size_t remoteOffset, completion wc, bool needFence = false)
+   {
+      return read(member, keysOf(context), memAddr, size, remoteOffset, wc, needFence);
+   }
+   uint64_t read(uint64_t member, MemoryKeys keys, void* memAddr, size_t size, size_t remoteOffset, completion wc, bool needFence = false)
+   {
+      Submission s = build(IBV_WR_RDMA_READ, keys, memAddr, size, wc, needFence);
+      s.wr.wr.rdma.rkey = keys.rkey;
+      s.wr.wr.rdma.remote_addr = remoteOffset;
+      return submit(member, s);
+   }
+
+   uint64_t write(uint64_t member, void* memAddr, size_t size, size_t remoteOffset, completion wc, bool needFence = false)
+   {
+      return write(member, keysOf(context), memAddr, size, remoteOffset, wc, needFence);
+   }
+   uint64_t write(uint64_t member, MemoryKeys keys, void* memAddr, size_t size, size_t remoteOffset, completion wc, bool needFence = false)
+   {
+      Submission s = build(IBV_WR_RDMA_WRITE, keys, memAddr, size, wc, needFence);
+      s.wr.wr.rdma.rkey = keys.rkey;
+      s.wr.wr.rdma.remote_addr = remoteOffset;
+      return submit(member, s);
+   }
+
+   uint64_t compareSwap(uint64_t member, uint64_t expected, uint64_t desired, uint64_t* memAddr, size_t remoteOffset, completion wc,
+                        bool needFence = false)
+   {
+      return compareSwap(member, keysOf(context), expected, desired, memAddr, remoteOffset, wc, needFence);
+   }
+   uint64_t compareSwap(uint64_t member, MemoryKeys keys, uint64_t expected, uint64_t desired, uint64_t* memAddr, size_t remoteOffset,
+                        completion wc, bool needFence = false)
+   {
+      Submission s = build(IBV_WR_ATOMIC_CMP_AND_SWP, keys, memAddr, sizeof(uint64_t), wc, needFence);
+      s.wr.wr.atomic.remote_addr = remoteOffset;
+      s.wr.wr.atomic.rkey = keys.rkey;
+      s.wr.wr.atomic.compare_add = expected;
+      s.wr.wr.atomic.swap = desired;
+      return submit(member, s);
+   }
+
+   uint64_t fetchAdd(uint64_t member, uint64_t to_add, uint64_t* memAddr, size_t remoteOffset, completion wc, bool needFence = false)
+   {
+      return fetchAdd(member, keysOf(context), to_add, memAddr, remoteOffset, wc, needFence);
+   }
+   uint64_t fetchAdd(uint64_t member, MemoryKeys keys, uint64_t to_add, uint64_t* memAddr, size_t remoteOffset, completion wc,
+                     bool needFence = false)
+   {
+      Submission s = build(IBV_WR_ATOMIC_FETCH_AND_ADD, keys, memAddr, sizeof(uint64_t), wc, needFence);
+      s.wr.wr.atomic.remote_addr = remoteOffset;
+      s.wr.wr.atomic.rkey = keys.rkey;
+      s.wr.wr.atomic.compare_add = to_add;
+      return submit(member, s);
+   }
+   // -------------------------------------------------------------------------------------
+   // helps posting and polling until the ticket of the member completed
+   void wait(uint64_t member, uint64_t ticket)
+   {
+      auto& state = memberState[member];
+      while (state.completed.load(std::memory_order_acquire) < ticket) {
+         flush();
+         if (poll() == 0)
+            _mm_pause();
+      }
+      if (state.status.load() != IBV_WC_SUCCESS || failed.load())
+         throw std::runtime_error("Shared QP request failed");
+   }
+   // -------------------------------------------------------------------------------------
+   // posts the queued requests as one chain unless another member is already posting
+   void flush()
+   {
+      if (postLatch.test_and_set(std::memory_order_acquire))
+         return;
+      Submission batch[MAX_BATCH];
+      uint64_t b_i = 0;
+      while (b_i < MAX_BATCH && ring.try_pop(batch[b_i])) {
+         batch[b_i].wr.sg_list = &batch[b_i].sge;
+         batch[b_i].wr.next = nullptr;
+         if (b_i > 0)
+            batch[b_i - 1].wr.next = &batch[b_i].wr;
+         b_i++;
+      }
+      if (b_i > 0) {
+         struct ibv_send_wr* bad_wr;
+         auto ret = ibv_post_send(context.id->qp, &batch[0].wr, &bad_wr);
+         if (ret) {
+            postLatch.clear(std::memory_order_release);
+            throw std::runtime_error("Failed to post send request" + std::to_string(ret) + " " + std::to_string(errno));
+         }
+      }
+      postLatch.clear(std::memory_order_release);
+   }
+   // -------------------------------------------------------------------------------------
+   // routes up to 16 completions unless another member is already polling
+   int poll()
+   {
+      if (pollLatch.test_and_set(std::memory_order_acquire))
+         return 0;
+      ibv_wc wcs[16];
+      int comp = pollCompletion(context.id->qp->send_cq, 16, wcs);
+      for (int c_i = 0; c_i < comp; c_i++) {
+         if (wcs[c_i].wr_id == 0) {  // failed unsignaled request, owner unknown
+            failed = true;
+            continue;
+         }
+         auto& state = memberState[wcs[c_i].wr_id >> MEMBER_SHIFT];
+         if (wcs[c_i].status != IBV_WC_SUCCESS)
+            state.status = wcs[c_i].status;
+         state.completed.store(wcs[c_i].wr_id & TICKET_MASK, std::memory_order_release);
+      }
+      pollLatch.clear(std::memory_order_release);
+      return comp;
+   }
+
+  private:
+   struct Submission {
+      ibv_send_wr wr;
+      ibv_sge sge;
+   };
+   struct alignas(64) MemberState {
+      std::atomic<uint64_t> completed{0};  // last completed ticket, completions of one member arrive in order
+      std::atomic<int> status{IBV_WC_SUCCESS};
+      // only touched by the member
+      uint64_t issued = 0;
+      uint64_t posted = 0;  // signaled or not
+      std::unique_ptr<uint64_t[]> postedAt;  // posted when a ticket was issued, by ticket % (signaledBudget + 1)
+   };
+   RdmaContext& context;
+   uint64_t members;
+   uint64_t budget;
+   uint64_t signaledBudget;
+   std::unique_ptr<MemberState[]> memberState;
+   rigtorp::mpmc::Queue<Submission, true> ring;
+   alignas(64) std::atomic_flag postLatch = ATOMIC_FLAG_INIT;
+   alignas(64) std::atomic_flag pollLatch = ATOMIC_FLAG_INIT;
+   std::atomic<bool> failed{false};
+   // -------------------------------------------------------------------------------------
+   Submission build(ibv_wr_opcode opcode, MemoryKeys keys, void* memAddr, size_t size, completion wc, bool needFence)
+   {
+      Submission s;
+      memset(&s, 0, sizeof(s));
+      s.sge.addr = (uintptr_t)memAddr;
+      s.sge.length = size;
+      s.sge.lkey = keys.lkey;
+      s.wr.opcode = opcode;
+      s.wr.send_flags = wc ? IBV_SEND_SIGNALED : 0;
+      if (needFence)
+         s.wr.send_flags |= IBV_SEND_FENCE;
+      s.wr.num_sge = 1;
+      return s;
+   }
+
+   uint64_t submit(uint64_t member, Submission& s)
+   {
+      auto& state = memberState[member];
+      const bool signaled = s.wr.send_flags & IBV_SEND_SIGNALED;
+      // at most signaledBudget tickets are outstanding, their slots in postedAt do not collide
+      for (;;) {
+         auto completed = state.completed.load(std::memory_order_acquire);
+         auto retired = completed ? state.postedAt[completed % (signaledBudget + 1)] : 0;
+         if (state.posted - retired < budget && (!signaled || state.issued - completed < signaledBudget))
+            break;
+         if (completed == state.issued)
+            throw std::runtime_error("Unsignaled requests exceed the send queue budget of the member");
+         flush();
+         if (poll() == 0)
+            _mm_pause();
+      }
+      state.posted++;
+      uint64_t ticket = 0;
+      if (signaled) {
+         ticket = ++state.issued;
+         state.postedAt[ticket % (signaledBudget + 1)] = state.posted;
+         s.wr.wr_id = (member << MEMBER_SHIFT) | ticket;
+      }
+      // never block on a full ring, drain it instead
+      while (!ring.try_push(s))
+         flush();
+      flush();
+      return ticket;
+   }
+};
+// -------------------------------------------------------------------------------------
+}  // namespace rdma
+}  // namespace nam
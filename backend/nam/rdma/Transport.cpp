@@ -0,0 +1,18 @@
+#include "Transport.hpp"
+#include "EmulatedTransport.hpp"
+#include "nam/Config.hpp"
+// -------------------------------------------------------------------------------------
+namespace nam
+{
+namespace rdma
+{
+// -------------------------------------------------------------------------------------
+Transport& getTransport()
+{
+   static VerbsTransport verbs;
+   if (FLAGS_emulated) return emulated::EmulatedTransport::getInstance();
+   return verbs;
+}
+// -------------------------------------------------------------------------------------
+}  // namespace rdma
+}  // namespace nam
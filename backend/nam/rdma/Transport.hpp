@@ -0,0 +1,105 @@
+#pragma once
+// -------------------------------------------------------------------------------------
+#include <infiniband/verbs.h>
+#include <rdma/rdma_cma.h>
+#include <poll.h>
+// -------------------------------------------------------------------------------------
+#include <cerrno>
+// -------------------------------------------------------------------------------------
+namespace nam
+{
+namespace rdma
+{
+// -------------------------------------------------------------------------------------
+// Connection and resource setup used by the CM.
+// The data path (ibv_post_send, ibv_post_recv, ibv_poll_cq) is not part of the interface:
+// verbs dispatches it through the ibv_context ops of the device, therefore a transport only
+// needs to hand out its own context to take over all post* helpers.
+// -------------------------------------------------------------------------------------
+class Transport
+{
+  public:
+   virtual ~Transport() = default;
+   // -------------------------------------------------------------------------------------
+   // connection manager
+   virtual rdma_event_channel* createEventChannel() = 0;
+   virtual void destroyEventChannel(rdma_event_channel* channel) = 0;
+   virtual int createId(rdma_event_channel* channel, rdma_cm_id** id, void* context, rdma_port_space ps) = 0;
+   virtual int destroyId(rdma_cm_id* id) = 0;
+   virtual int bindAddr(rdma_cm_id* id, sockaddr* addr) = 0;
+   virtual int listen(rdma_cm_id* id, int backlog) = 0;
+   virtual int resolveAddr(rdma_cm_id* id, sockaddr* src, sockaddr* dst, int timeoutMs) = 0;
+   virtual int resolveRoute(rdma_cm_id* id, int timeoutMs) = 0;
+   virtual int connect(rdma_cm_id* id, rdma_conn_param* param) = 0;
+   virtual int accept(rdma_cm_id* id, rdma_conn_param* param) = 0;
+   virtual int disconnect(rdma_cm_id* id) = 0;
+   virtual int getCmEvent(rdma_event_channel* channel, rdma_cm_event** event) = 0;
+   // waits at most timeoutMs (-1 = forever), fails with errno ETIMEDOUT if no event arrived
+   virtual int getCmEvent(rdma_event_channel* channel, rdma_cm_event** event, int timeoutMs) = 0;
+   virtual int ackCmEvent(rdma_cm_event* event) = 0;
+   virtual sockaddr* getPeerAddr(rdma_cm_id* id) = 0;
+   virtual int createQP(rdma_cm_id* id, ibv_pd* pd, ibv_qp_init_attr* attr) = 0;
+   virtual void destroyQP(rdma_cm_id* id) = 0;
+   // -------------------------------------------------------------------------------------
+   // verbs resources
+   virtual ibv_pd* allocPD(ibv_context* context) = 0;
+   virtual int deallocPD(ibv_pd* pd) = 0;
+   virtual ibv_mr* regMR(ibv_pd* pd, void* addr, size_t length, int access) = 0;
+   virtual int deregMR(ibv_mr* mr) = 0;
+   virtual ibv_cq* createCQ(ibv_context* context, int cqe) = 0;
+   virtual int destroyCQ(ibv_cq* cq) = 0;
+   virtual int queryDevice(ibv_context* context, ibv_device_attr* attr) = 0;
+};
+// -------------------------------------------------------------------------------------
+// libibverbs / librdmacm
+// -------------------------------------------------------------------------------------
+class VerbsTransport : public Transport
+{
+  public:
+   rdma_event_channel* createEventChannel() override { return rdma_create_event_channel(); }
+   void destroyEventChannel(rdma_event_channel* channel) override { rdma_destroy_event_channel(channel); }
+   int createId(rdma_event_channel* channel, rdma_cm_id** id, void* context, rdma_port_space ps) override
+   {
+      return rdma_create_id(channel, id, context, ps);
+   }
+   int destroyId(rdma_cm_id* id) override { return rdma_destroy_id(id); }
+   int bindAddr(rdma_cm_id* id, sockaddr* addr) override { return rdma_bind_addr(id, addr); }
+   int listen(rdma_cm_id* id, int backlog) override { return rdma_listen(id, backlog); }
+   int resolveAddr(rdma_cm_id* id, sockaddr* src, sockaddr* dst, int timeoutMs) override
+   {
+      return rdma_resolve_addr(id, src, dst, timeoutMs);
+   }
+   int resolveRoute(rdma_cm_id* id, int timeoutMs) override { return rdma_resolve_route(id, timeoutMs); }
+   int connect(rdma_cm_id* id, rdma_conn_param* param) override { return rdma_connect(id, param); }
+   int accept(rdma_cm_id* id, rdma_conn_param* param) override { return rdma_accept(id, param); }
+   int disconnect(rdma_cm_id* id) override { return rdma_disconnect(id); }
+   int getCmEvent(rdma_event_channel* channel, rdma_cm_event** event) override { return rdma_get_cm_event(channel, event); }
+   int getCmEvent(rdma_event_channel* channel, rdma_cm_event** event, int timeoutMs) override
+   {
+      pollfd channelFd{channel->fd, POLLIN, 0};
+      int ready = ::poll(&channelFd, 1, timeoutMs);
+      if (ready == 0)
+         errno = ETIMEDOUT;
+      if (ready <= 0)
+         return -1;
+      return rdma_get_cm_event(channel, event);
+   }
+   int ackCmEvent(rdma_cm_event* event) override { return rdma_ack_cm_event(event); }
+   sockaddr* getPeerAddr(rdma_cm_id* id) override { return rdma_get_peer_addr(id); }
+   int createQP(rdma_cm_id* id, ibv_pd* pd, ibv_qp_init_attr* attr) override { return rdma_create_qp(id, pd, attr); }
+   void destroyQP(rdma_cm_id* id) override { rdma_destroy_qp(id); }
+   // -------------------------------------------------------------------------------------
+   ibv_pd* allocPD(ibv_context* context) override { return ibv_alloc_pd(context); }
+   int deallocPD(ibv_pd* pd) override { return ibv_dealloc_pd(pd); }
+   ibv_mr* regMR(ibv_pd* pd, void* addr, size_t length, int access) override { return ibv_reg_mr(pd, addr, length, access); }
+   int deregMR(ibv_mr* mr) override { return ibv_dereg_mr(mr); }
+   ibv_cq* createCQ(ibv_context* context, int cqe) override { return ibv_create_cq(context, cqe, nullptr, nullptr, 0); }
+   int destroyCQ(ibv_cq* cq) override { return ibv_destroy_cq(cq); }
+   int queryDevice(ibv_context* context, ibv_device_attr* attr) override { return ibv_query_device(context, attr); }
+};
+// -------------------------------------------------------------------------------------
+// returns the emulated transport if FLAGS_emulated is set, libibverbs otherwise
+Transport& getTransport();
+// -------------------------------------------------------------------------------------
+}  // namespace rdma
+}  // namespace nam
@@ -0,0 +1,170 @@
+#pragma once
+// -------------------------------------------------------------------------------------
+#include "Defs.hpp"
+#include "nam/Config.hpp"
+#include "nam/threads/CoroutineScheduler.hpp"
+#include "nam/utils/RandomGenerator.hpp"
+// -------------------------------------------------------------------------------------
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+// -------------------------------------------------------------------------------------
+namespace nam
+{
+namespace sync
+{
+// -------------------------------------------------------------------------------------
+// Per compute node retry counters of the remote locks, one entry per hashed lock address; colliding
+// locks share an entry, so size it to a multiple of the contended locks. The failure rate of an entry
+// (moving average of the attempts, RATE_ONE = all failed) drives the adaptive backoff. The counters are
+// relaxed and the rate is updated without synchronization, it is only a hint.
+// -------------------------------------------------------------------------------------
+class ContentionTable
+{
+  public:
+   static constexpr uint64_t RATE_ONE = 1ul << 16;
+   static constexpr uint64_t RATE_SHIFT = 3;  // weight 1/8 of a new attempt
+   struct alignas(64) Entry {
+      std::atomic<uintptr_t> lockAddr{0};  // last lock counted
+      std::atomic<uint64_t> acquires{0};
+      std::atomic<uint64_t> retries{0};
+      std::atomic<uint64_t> pauses{0};
+      std::atomic<uint64_t> failureRate{0};
+      // -------------------------------------------------------------------------------------
+      void count(uintptr_t addr, bool failed, uint64_t paused)
+      {
+         lockAddr.store(addr, std::memory_order_relaxed);
+         (failed ? retries : acquires).fetch_add(1, std::memory_order_relaxed);
+         if (paused)
+            pauses.fetch_add(paused, std::memory_order_relaxed);
+         int64_t rate = failureRate.load(std::memory_order_relaxed);
+         int64_t sample = failed ? RATE_ONE : 0;
+         failureRate.store(rate + ((sample - rate) >> RATE_SHIFT), std::memory_order_relaxed);
+      }
+   };
+   // -------------------------------------------------------------------------------------
+   explicit ContentionTable(uint64_t slots = 4096) : slots(slots), bits(__builtin_ctzl(slots)), entries(std::make_unique<Entry[]>(slots))
+   {
+      ensure(slots > 1 && Helper::powerOfTwo(slots));
+   }
+   Entry& entry(uintptr_t lockAddr) { return entries[((lockAddr >> 3) * 0x9E3779B97F4A7C15ul) >> (64 - bits)]; }
+   // csv of the entries that were used: lock,acquires,retries,pauses,failure_rate
+   void write(std::ostream& out) const
+   {
+      out << "lock,acquires,retries,pauses,failure_rate\n";
+      for (uint64_t e_i = 0; e_i < slots; e_i++) {
+         auto& e = entries[e_i];
+         if (e.acquires == 0 && e.retries == 0)
+            continue;
+         out << e.lockAddr << "," << e.acquires << "," << e.retries << "," << e.pauses << ","
+             << static_cast<double>(e.failureRate) / RATE_ONE << "\n";
+      }
+   }
+
+  private:
+   uint64_t slots;
+   uint64_t bits;
+   std::unique_ptr<Entry[]> entries;
+};
+// -------------------------------------------------------------------------------------
+enum class BackoffPolicy : uint8_t { NONE, EXPONENTIAL, PROPORTIONAL, ADAPTIVE };
+
+inline BackoffPolicy parseBackoffPolicy(const std::string& name)
+{
+   if (name == "none")
+      return BackoffPolicy::NONE;
+   if (name == "exponential")
+      return BackoffPolicy::EXPONENTIAL;
+   if (name == "proportional")
+      return BackoffPolicy::PROPORTIONAL;
+   if (name == "adaptive")
+      return BackoffPolicy::ADAPTIVE;
+   throw std::runtime_error("Unknown backoff policy " + name);
+}
+// -------------------------------------------------------------------------------------
+// Pauses between the failed attempts of remote lock acquires, one object per lock object:
+//  NONE:         retry immediately.
+//  EXPONENTIAL:  basePauses doubled per consecutive failure up to maxPauses, jittered within [p/2, p]
+//                so that the retries of the contenders spread out instead of hitting the NIC together.
+//  PROPORTIONAL: basePauses per waiter ahead of us as observed by the lock (e.g. the ticket distance).
+//  ADAPTIVE:     up to maxPauses in proportion to the recent failure rate of this lock in the table,
+//                jittered; uncontended locks are retried immediately, hot ones are left alone.
+// The lock calls failed() after every failed attempt and acquired() once it holds the lock, with a
+// table both are counted per lock. Within a coroutine the pauses yield to the other coroutines instead.
+// -------------------------------------------------------------------------------------
+class Backoff
+{
+  public:
+   Backoff(BackoffPolicy policy, ContentionTable* table = nullptr, uint64_t basePauses = 16, uint64_t maxPauses = 4096)
+       : policy(policy), table(table), basePauses(basePauses), maxPauses(maxPauses)
+   {
+      ensure(policy != BackoffPolicy::ADAPTIVE || table);
+      ensure(basePauses > 0 && basePauses <= maxPauses);
+   }
+   // -backoffPolicy, -backoffPauses and -backoffMaxPauses, the default of the lock without -backoffPolicy;
+   // -nobackoff retries immediately
+   static Backoff fromFlags(const Backoff& lockDefault, ContentionTable* table = nullptr)
+   {
+      if (!FLAGS_backoff)
+         return Backoff(BackoffPolicy::NONE, table);
+      if (FLAGS_backoffPolicy.empty())
+         return Backoff(lockDefault.policy, table, lockDefault.basePauses, lockDefault.maxPauses);
+      return Backoff(parseBackoffPolicy(FLAGS_backoffPolicy), table, FLAGS_backoffPauses, FLAGS_backoffMaxPauses);
+   }
+   // the adaptive policy needs a ContentionTable; otherwise pass none, the shared entries cost a cache
+   // line transfer per attempt
+   static bool adaptiveFromFlags() { return FLAGS_backoff && FLAGS_backoffPolicy == "adaptive"; }
+   // -------------------------------------------------------------------------------------
+   BackoffPolicy getPolicy() const { return policy; }
+   uint64_t getRetries() const { return retries; }
+   uint64_t getPauses() const { return paused; }
+   // -------------------------------------------------------------------------------------
+   void failed(uintptr_t lockAddr, uint64_t queueDepth = 1)
+   {
+      uint64_t pauses = 0;
+      switch (policy) {
+         case BackoffPolicy::NONE:
+            break;
+         case BackoffPolicy::EXPONENTIAL:
+            pauses = jitter(std::min(maxPauses, basePauses << std::min<uint64_t>(consecutive, 32)));
+            break;
+         case BackoffPolicy::PROPORTIONAL:
+            pauses = std::min(maxPauses, basePauses * std::max<uint64_t>(queueDepth, 1));
+            break;
+         case BackoffPolicy::ADAPTIVE:
+            pauses = jitter((maxPauses * table->entry(lockAddr).failureRate.load(std::memory_order_relaxed)) / ContentionTable::RATE_ONE);
+            break;
+      }
+      consecutive++;
+      retries++;
+      paused += pauses;
+      if (table)
+         table->entry(lockAddr).count(lockAddr, true, pauses);
+      if (pauses)
+         threads::async::pause(pauses);
+   }
+
+   void acquired(uintptr_t lockAddr)
+   {
+      consecutive = 0;
+      if (table)
+         table->entry(lockAddr).count(lockAddr, false, 0);
+   }
+
+  private:
+   BackoffPolicy policy;
+   ContentionTable* table;
+   uint64_t basePauses;
+   uint64_t maxPauses;
+   uint64_t consecutive = 0;
+   uint64_t retries = 0;
+   uint64_t paused = 0;
+   // -------------------------------------------------------------------------------------
+   static uint64_t jitter(uint64_t pauses) { return pauses / 2 + utils::RandomGenerator::getRandU64Fast() % (pauses / 2 + 1); }
+};
+// -------------------------------------------------------------------------------------
+}  // namespace sync
+}  // namespace nam
@@ -0,0 +1,138 @@
+#pragma once
+// -------------------------------------------------------------------------------------
+#include "Backoff.hpp"
+#include "HybridLatch.hpp"
+#include "nam/threads/CoroutineScheduler.hpp"
+#include "nam/threads/Worker.hpp"
+// -------------------------------------------------------------------------------------
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+// -------------------------------------------------------------------------------------
+namespace nam
+{
+namespace sync
+{
+// -------------------------------------------------------------------------------------
+// Per compute node table of cohorts, one slot per hashed remote lock address. A slot pairs a local
+// latch with the ownership of the remote lock by this node. Colliding addresses share a slot, which
+// only serializes them locally.
+// -------------------------------------------------------------------------------------
+class CohortTable
+{
+  public:
+   struct alignas(64) Slot {
+      storage::OptimisticLatch latch;  // no thread ownership, coroutines of one thread may contend
+      std::atomic<uint64_t> waiting{0};  // local threads queued on the latch
+      // protected by the latch
+      bool remoteHeld = false;
+      uintptr_t heldAddr = 0;
+      uint64_t passes = 0;  // local handovers since the remote acquire
+   };
+   // -------------------------------------------------------------------------------------
+   explicit CohortTable(uint64_t slots = 4096, uint64_t fairnessBound = 16)
+       : mask(slots - 1), fairnessBound(fairnessBound), slots(std::make_unique<Slot[]>(slots))
+   {
+      ensure(slots > 0 && (slots & mask) == 0);
+   }
+   Slot& slot(uintptr_t addr) { return slots[(addr >> 6) & mask]; }
+   uint64_t getFairnessBound() const { return fairnessBound; }
+
+  private:
+   uint64_t mask;
+   uint64_t fairnessBound;
+   std::unique_ptr<Slot[]> slots;
+};
+// -------------------------------------------------------------------------------------
+// Cohort lock: exclusive acquires first take the local latch of the slot, only the first thread of a
+// cohort acquires the remote lock. On release the remote lock is handed to the next local waiter
+// (write back only) up to the fairness bound of the table, then it is released remotely so other
+// compute nodes get their turn. Shared acquires go to the remote lock directly.
+// RemoteLock must be releasable by any thread of the node, i.e. a RemoteRWLock with HeadLock placement
+// (the fetch and add release does not depend on the acquiring object). One object per thread or
+// coroutine, the table is shared.
+// -------------------------------------------------------------------------------------
+template <typename RemoteLock>
+class CohortLock
+{
+  public:
+   using Remote = RemoteLock;
+   static_assert(!RemoteLock::Placement::RESET_ON_RELEASE, "the release of the remote lock must not depend on the acquirer");
+   static Backoff defaultBackoff() { return RemoteLock::defaultBackoff(); }
+   // -------------------------------------------------------------------------------------
+   CohortLock(CohortTable& table, threads::Worker::ConnectionContext& cctx, uint64_t* buffer, size_t tupleSize,
+              Backoff backoff = defaultBackoff())
+       : table(table), cctx(cctx), remote(cctx, buffer, tupleSize, backoff)
+   {
+   }
+   // -------------------------------------------------------------------------------------
+   uint64_t* data() { return remote.data(); }
+   size_t dataSize() const { return remote.dataSize(); }
+   uint64_t getRemoteAcquires() const { return remoteAcquires; }
+   uint64_t getLocalHandovers() const { return localHandovers; }
+   // -------------------------------------------------------------------------------------
+   bool tryLockShared(uintptr_t tupleAddr) { return remote.tryLockShared(tupleAddr); }
+   void unlockShared(uintptr_t tupleAddr) { remote.unlockShared(tupleAddr); }
+   // -------------------------------------------------------------------------------------
+   bool tryLockExclusive(uintptr_t tupleAddr)
+   {
+      auto& slot = table.slot(tupleAddr);
+      slot.waiting++;
+      while (!slot.latch.tryLatchExclusive())
+         threads::async::pause(16);
+      slot.waiting--;
+      if (slot.remoteHeld && slot.heldAddr != tupleAddr) {
+         // colliding address, its last holder wrote the data back already
+         remote.release(slot.heldAddr);
+         slot.remoteHeld = false;
+      }
+      if (slot.remoteHeld) {
+         threads::async::read(cctx, data(), dataSize(), remote.dataAddr(tupleAddr));
+         slot.passes++;
+         localHandovers++;
+         return true;
+      }
+      if (!remote.tryLockExclusive(tupleAddr)) {
+         slot.latch.unlatchExclusive();
+         return false;
+      }
+      remoteAcquires++;
+      slot.remoteHeld = true;
+      slot.heldAddr = tupleAddr;
+      slot.passes = 0;
+      return true;
+   }
+
+   void unlockExclusive(uintptr_t tupleAddr)
+   {
+      auto& slot = table.slot(tupleAddr);
+      if (slot.waiting > 0 && slot.passes < table.getFairnessBound()) {
+         // completed before the next local holder reads
+         threads::async::write(cctx, data(), dataSize(), remote.dataAddr(tupleAddr));
+      } else {
+         remote.unlockExclusive(tupleAddr);
+         slot.remoteHeld = false;
+      }
+      slot.latch.unlatchExclusive();
+   }
+
+   void drain(uintptr_t tupleAddr) { remote.drain(tupleAddr); }
+
+  private:
+   CohortTable& table;
+   threads::Worker::ConnectionContext& cctx;
+   RemoteLock remote;
+   uint64_t remoteAcquires = 0;
+   uint64_t localHandovers = 0;
+};
+// -------------------------------------------------------------------------------------
+template <typename T>
+struct IsCohortLock : std::false_type {
+};
+template <typename RemoteLock>
+struct IsCohortLock<CohortLock<RemoteLock>> : std::true_type {
+};
+// -------------------------------------------------------------------------------------
+}  // namespace sync
+}  // namespace nam
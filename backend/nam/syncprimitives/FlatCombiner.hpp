@@ -0,0 +1,281 @@
+#pragma once
+// -------------------------------------------------------------------------------------
+#include "Backoff.hpp"
+#include "Defs.hpp"
+#include "RemoteRWLock.hpp"
+#include "nam/rdma/CommunicationManager.hpp"
+#include "nam/threads/CoroutineScheduler.hpp"
+#include "nam/threads/Worker.hpp"
+// -------------------------------------------------------------------------------------
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+// -------------------------------------------------------------------------------------
+namespace nam
+{
+namespace sync
+{
+// -------------------------------------------------------------------------------------
+// Flat combining of remote operations within a compute node. Every thread (or coroutine) owns one
+// cache line of the publication array and publishes its request there; whoever gets the combiner role
+// collects the pending requests and executes them on its own qp as one doorbell batch:
+//  - writes attached to a request, then the atomics, then the reads, all unsignaled but the last.
+//  - fetch and adds on the same word are merged into one, every request gets its prefix of the sum.
+//  - equal compare and swaps on the same word are merged, the first one wins the result of the NIC,
+//    the others observe the swapped value (and fail as they would have behind it).
+//  - reads of the same remote range are done once and copied to the other requesters.
+// All local buffers must be in the registered memory of the node (global buffer or slabs), the combiner
+// posts them with its own context.
+// -------------------------------------------------------------------------------------
+class FlatCombiner
+{
+  public:
+   static constexpr uint64_t MAX_BATCH = 16;  // requests per doorbell
+   enum class Op : uint8_t { READ, FETCH_ADD, COMPARE_SWAP };
+   // remote range written before or read after the atomic of a request, none if local is null
+   struct Attachment {
+      void* local;
+      uint32_t size;
+      bool writeBefore;
+      uintptr_t remoteAddr;
+      static Attachment readAfter(void* local, size_t size, uintptr_t remoteAddr) { return {local, static_cast<uint32_t>(size), false, remoteAddr}; }
+      static Attachment write(void* local, size_t size, uintptr_t remoteAddr) { return {local, static_cast<uint32_t>(size), true, remoteAddr}; }
+   };
+   // publication record, written by its owner while FREE and by the combiner while PENDING
+   struct alignas(64) Request {
+      static constexpr uint64_t FREE = 0;
+      static constexpr uint64_t PENDING = 1;
+      static constexpr uint64_t DONE = 2;
+      std::atomic<uint64_t> state{FREE};
+      uintptr_t remoteAddr = 0;  // word of the atomic
+      uint64_t compareAdd = 0;
+      uint64_t swap = 0;
+      uint64_t result = 0;  // value fetched by the atomic
+      // the attachment, flattened to fit the cache line
+      void* local = nullptr;
+      uintptr_t dataAddr = 0;
+      uint32_t dataSize = 0;
+      bool writeBefore = false;
+      Op op = Op::READ;
+      // -------------------------------------------------------------------------------------
+      bool writes() const { return local && writeBefore; }
+      bool reads() const { return local && !writeBefore; }
+   };
+   static_assert(sizeof(Request) == 64);
+   // -------------------------------------------------------------------------------------
+   explicit FlatCombiner(uint64_t slots) : slots(slots), requests(std::make_unique<Request[]>(slots)) { ensure(slots > 0); }
+   uint64_t getSlots() const { return slots; }
+   uint64_t getBatches() const { return batches; }
+   uint64_t getCombined() const { return combined; }
+   uint64_t getMerged() const { return merged; }  // atomics and reads that needed no work request
+   // -------------------------------------------------------------------------------------
+   // one per thread or coroutine, scratch holds MAX_BATCH registered words for the fetched values
+   class Client
+   {
+     public:
+      Client(FlatCombiner& combiner, uint64_t slot, threads::Worker::ConnectionContext& cctx, uint64_t* scratch)
+          : combiner(combiner), request(combiner.requests[slot]), cctx(cctx), chain(std::make_unique<Chain>(*cctx.rctx)), scratch(scratch)
+      {
+         ensure(slot < combiner.slots);
+      }
+      // -------------------------------------------------------------------------------------
+      uint64_t fetchAdd(uintptr_t remoteAddr, uint64_t add, Attachment data = {})
+      {
+         return execute(Op::FETCH_ADD, remoteAddr, add, 0, data);
+      }
+      uint64_t compareSwap(uintptr_t remoteAddr, uint64_t expected, uint64_t desired, Attachment data = {})
+      {
+         return execute(Op::COMPARE_SWAP, remoteAddr, expected, desired, data);
+      }
+      void read(void* local, size_t size, uintptr_t remoteAddr) { execute(Op::READ, 0, 0, 0, Attachment::readAfter(local, size, remoteAddr)); }
+
+     private:
+      // writes, atomics and reads of a full batch
+      using Chain = rdma::WorkRequestChain<3 * MAX_BATCH>;
+      FlatCombiner& combiner;
+      Request& request;
+      threads::Worker::ConnectionContext& cctx;
+      std::unique_ptr<Chain> chain;
+      uint64_t* scratch;
+      // -------------------------------------------------------------------------------------
+      uint64_t execute(Op op, uintptr_t remoteAddr, uint64_t compareAdd, uint64_t swap, Attachment data)
+      {
+         request.op = op;
+         request.remoteAddr = remoteAddr;
+         request.compareAdd = compareAdd;
+         request.swap = swap;
+         request.local = data.local;
+         request.dataAddr = data.remoteAddr;
+         request.dataSize = data.size;
+         request.writeBefore = data.writeBefore;
+         request.state.store(Request::PENDING, std::memory_order_release);
+         while (request.state.load(std::memory_order_acquire) != Request::DONE) {
+            if (!combiner.combining.test_and_set(std::memory_order_acquire)) {
+               combine();
+               combiner.combining.clear(std::memory_order_release);
+               continue;
+            }
+            threads::async::pause(16);
+         }
+         uint64_t result = request.result;
+         request.state.store(Request::FREE, std::memory_order_relaxed);
+         return result;
+      }
+
+      void combine()
+      {
+         Request* batch[MAX_BATCH];
+         uint64_t b_n = 0;
+         for (uint64_t s_i = 0; s_i < combiner.slots && b_n < MAX_BATCH; s_i++) {
+            if (combiner.requests[s_i].state.load(std::memory_order_acquire) == Request::PENDING)
+               batch[b_n++] = &combiner.requests[s_i];
+         }
+         if (b_n == 0)
+            return;
+         // batch index of the request whose atomic (read) is executed for this one, NONE without any
+         constexpr uint64_t NONE = MAX_BATCH;
+         uint64_t leader[MAX_BATCH];
+         uint64_t readLeader[MAX_BATCH];
+         uint64_t toAdd[MAX_BATCH] = {};  // a fetch and add leader carries the sum of its group
+         uint64_t wanted = 0;  // atomics and reads requested
+         uint64_t executed = 0;
+         uint64_t total = 0;
+         for (uint64_t b_i = 0; b_i < b_n; b_i++) {
+            auto& r = *batch[b_i];
+            leader[b_i] = (r.op == Op::READ) ? NONE : b_i;
+            readLeader[b_i] = r.reads() ? b_i : NONE;
+            for (uint64_t l_i = 0; l_i < b_i; l_i++) {
+               auto& l = *batch[l_i];
+               if (leader[b_i] == b_i && leader[l_i] == l_i && l.op == r.op && l.remoteAddr == r.remoteAddr &&
+                   (r.op == Op::FETCH_ADD || (l.compareAdd == r.compareAdd && l.swap == r.swap)))
+                  leader[b_i] = l_i;
+               if (readLeader[b_i] == b_i && readLeader[l_i] == l_i && l.dataAddr == r.dataAddr && l.dataSize == r.dataSize)
+                  readLeader[b_i] = l_i;
+            }
+            if (leader[b_i] != NONE)
+               toAdd[leader[b_i]] += r.compareAdd;
+            wanted += (leader[b_i] != NONE) + r.reads();
+            executed += (leader[b_i] == b_i) + (readLeader[b_i] == b_i);
+            total += r.writes();
+         }
+         total += executed;
+         // writes, atomics, reads; only the last request of the chain is signaled
+         uint64_t posted = 0;
+         auto completion = [&]() { return (++posted == total) ? rdma::completion::signaled : rdma::completion::unsignaled; };
+         for (uint64_t b_i = 0; b_i < b_n; b_i++) {
+            auto& r = *batch[b_i];
+            if (r.writes())
+               chain->write(r.local, r.dataSize, r.dataAddr, completion());
+         }
+         for (uint64_t b_i = 0; b_i < b_n; b_i++) {
+            auto& r = *batch[b_i];
+            if (leader[b_i] != b_i)
+               continue;
+            if (r.op == Op::FETCH_ADD)
+               chain->fetchAdd(toAdd[b_i], &scratch[b_i], r.remoteAddr, completion());
+            else
+               chain->compareSwap(r.compareAdd, r.swap, &scratch[b_i], r.remoteAddr, completion());
+         }
+         for (uint64_t b_i = 0; b_i < b_n; b_i++) {
+            auto& r = *batch[b_i];
+            if (readLeader[b_i] == b_i)
+               chain->read(r.local, r.dataSize, r.dataAddr, completion());
+         }
+         chain->post();
+         threads::async::wait(cctx);
+         // hand out the results in batch order, merged requests are ordered behind their leader
+         uint64_t prefix[MAX_BATCH] = {};
+         for (uint64_t b_i = 0; b_i < b_n; b_i++) {
+            auto& r = *batch[b_i];
+            if (leader[b_i] != NONE) {
+               uint64_t fetched = *static_cast<volatile uint64_t*>(&scratch[leader[b_i]]);
+               if (r.op == Op::FETCH_ADD) {
+                  r.result = fetched + prefix[leader[b_i]];
+                  prefix[leader[b_i]] += r.compareAdd;
+               } else {
+                  r.result = (leader[b_i] == b_i || fetched != r.compareAdd) ? fetched : r.swap;
+               }
+            }
+            if (readLeader[b_i] != NONE && readLeader[b_i] != b_i)
+               std::memcpy(r.local, batch[readLeader[b_i]]->local, r.dataSize);
+         }
+         combiner.batches++;
+         combiner.combined += b_n;
+         combiner.merged += wanted - executed;
+         for (uint64_t b_i = 0; b_i < b_n; b_i++)
+            batch[b_i]->state.store(Request::DONE, std::memory_order_release);
+      }
+   };
+
+  private:
+   uint64_t slots;
+   std::unique_ptr<Request[]> requests;
+   alignas(64) std::atomic_flag combining = ATOMIC_FLAG_INIT;
+   // only updated by the combiner
+   uint64_t batches = 0;
+   uint64_t combined = 0;
+   uint64_t merged = 0;
+};
+// -------------------------------------------------------------------------------------
+// Reader/writer lock with the HeadLock protocol whose requests go through the flat combiner: readers of
+// the same tuple share one fetch and add and one read, writers of the same tuple one compare and swap,
+// and the write back is chained in front of the release. The local buffer mirrors the tuple, followed
+// by the scratch words of the client (bufferSize()). A failed try backs off before it returns.
+// -------------------------------------------------------------------------------------
+class CombiningLock
+{
+  public:
+   using Placement = HeadLock;
+   static Backoff defaultBackoff() { return Backoff(BackoffPolicy::NONE); }
+   static constexpr size_t bufferSize(size_t tupleSize) { return tupleSize + FlatCombiner::MAX_BATCH * sizeof(uint64_t); }
+   // -------------------------------------------------------------------------------------
+   CombiningLock(FlatCombiner& combiner, uint64_t slot, threads::Worker::ConnectionContext& cctx, uint64_t* buffer, size_t tupleSize,
+                 Backoff backoff = defaultBackoff())
+       : client(combiner, slot, cctx, buffer + tupleSize / sizeof(uint64_t)), buffer(buffer), tupleSize(tupleSize), backoff(backoff)
+   {
+      ensure(tupleSize > sizeof(uint64_t) && tupleSize % sizeof(uint64_t) == 0);
+   }
+   // -------------------------------------------------------------------------------------
+   uint64_t* data() { return buffer + 1; }
+   size_t dataSize() const { return tupleSize - sizeof(uint64_t); }
+   // -------------------------------------------------------------------------------------
+   bool tryLockShared(uintptr_t tupleAddr)
+   {
+      uint64_t word = client.fetchAdd(tupleAddr, HeadLock::SHARED, readData(tupleAddr));
+      if (HeadLock::exclusivelyLocked(word)) {
+         unlockShared(tupleAddr);
+         backoff.failed(tupleAddr);
+         return false;
+      }
+      backoff.acquired(tupleAddr);
+      return true;
+   }
+   void unlockShared(uintptr_t tupleAddr) { client.fetchAdd(tupleAddr, -HeadLock::SHARED); }
+   // -------------------------------------------------------------------------------------
+   bool tryLockExclusive(uintptr_t tupleAddr)
+   {
+      if (client.compareSwap(tupleAddr, 0, HeadLock::EXCLUSIVE, readData(tupleAddr)) != 0) {
+         backoff.failed(tupleAddr);
+         return false;
+      }
+      backoff.acquired(tupleAddr);
+      return true;
+   }
+   void unlockExclusive(uintptr_t tupleAddr)
+   {
+      client.fetchAdd(tupleAddr, -HeadLock::EXCLUSIVE, FlatCombiner::Attachment::write(data(), dataSize(), tupleAddr + sizeof(uint64_t)));
+   }
+   void drain(uintptr_t) {}
+
+  private:
+   FlatCombiner::Client client;
+   uint64_t* buffer;
+   size_t tupleSize;
+   Backoff backoff;
+   // -------------------------------------------------------------------------------------
+   FlatCombiner::Attachment readData(uintptr_t tupleAddr) { return FlatCombiner::Attachment::readAfter(data(), dataSize(), tupleAddr + sizeof(uint64_t)); }
+};
+// -------------------------------------------------------------------------------------
+}  // namespace sync
+}  // namespace nam
@@ -0,0 +1,74 @@
+#include "LeaseReaper.hpp"
+// -------------------------------------------------------------------------------------
+#include <chrono>
+// -------------------------------------------------------------------------------------
+namespace nam
+{
+namespace sync
+{
+// -------------------------------------------------------------------------------------
+LeaseReaper::LeaseReaper(uint64_t* clockWord, uint64_t tickUs, uint64_t scanUs)
+    : clockWord(reinterpret_cast<std::atomic<uint64_t>*>(clockWord)), tickUs(tickUs), scanUs(scanUs)
+{
+   static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t));
+   ensure(tickUs > 0 && scanUs >= tickUs);
+}
+// -------------------------------------------------------------------------------------
+LeaseReaper::~LeaseReaper()
+{
+   stop();
+}
+// -------------------------------------------------------------------------------------
+void LeaseReaper::watch(uint64_t* first, uint64_t count, uint64_t strideBytes)
+{
+   ensure(!running);
+   ensure(strideBytes % sizeof(uint64_t) == 0);
+   ranges.push_back({reinterpret_cast<uint8_t*>(first), count, strideBytes});
+}
+// -------------------------------------------------------------------------------------
+void LeaseReaper::start()
+{
+   ensure(!running);
+   startTime = utils::getTimePoint();
+   clockWord->store(0);
+   running = true;
+   thread = std::thread([&]() { run(); });
+}
+// -------------------------------------------------------------------------------------
+void LeaseReaper::stop()
+{
+   if (!running)
+      return;
+   running = false;
+   thread.join();
+}
+// -------------------------------------------------------------------------------------
+void LeaseReaper::run()
+{
+   uint64_t lastScan = 0;
+   while (running) {
+      uint64_t now = utils::getTimePoint() - startTime;
+      clockWord->store(now, std::memory_order_release);
+      if (now - lastScan >= scanUs) {
+         scan(now);
+         lastScan = now;
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(tickUs));
+   }
+}
+// -------------------------------------------------------------------------------------
+void LeaseReaper::scan(uint64_t now)
+{
+   for (auto& range : ranges) {
+      for (uint64_t l_i = 0; l_i < range.count; l_i++) {
+         auto* word = reinterpret_cast<std::atomic<uint64_t>*>(range.first + l_i * range.strideBytes);
+         uint64_t observed = word->load(std::memory_order_acquire);
+         // a renewal or unlock in between makes the cas fail
+         if (LeaseWord::expired(observed, now) && word->compare_exchange_strong(observed, 0))
+            reclaimed++;
+      }
+   }
+}
+// -------------------------------------------------------------------------------------
+}  // namespace sync
+}  // namespace nam
@@ -0,0 +1,54 @@
+#pragma once
+// -------------------------------------------------------------------------------------
+#include "RemoteLeaseLock.hpp"
+// -------------------------------------------------------------------------------------
+#include <atomic>
+#include <thread>
+#include <vector>
+// -------------------------------------------------------------------------------------
+namespace nam
+{
+namespace sync
+{
+// -------------------------------------------------------------------------------------
+// Storage side of the lease locks. A background thread publishes the lease clock (us since start) in
+// a registered word for the clients and periodically clears lease lock words that expired, so locks of
+// crashed clients are freed even if nobody contends for them.
+// The reaper clears with a CPU CAS on the registered memory, this needs a NIC whose atomics are
+// coherent with the host (IBV_ATOMIC_GLOB, CM::hostCoherentAtomics()). Otherwise a CPU CAS can free a
+// lease the NIC just installed; then watch nothing, the reaper only publishes the clock and the
+// clients break expired leases.
+// -------------------------------------------------------------------------------------
+class LeaseReaper
+{
+  public:
+   LeaseReaper(uint64_t* clockWord, uint64_t tickUs = 10, uint64_t scanUs = 1000);
+   ~LeaseReaper();
+   // -------------------------------------------------------------------------------------
+   // count lock words starting at first, strideBytes apart; before start()
+   void watch(uint64_t* first, uint64_t count, uint64_t strideBytes);
+   void start();
+   void stop();
+   uint64_t getReclaimed() const { return reclaimed; }
+
+  private:
+   struct Range {
+      uint8_t* first;
+      uint64_t count;
+      uint64_t strideBytes;
+   };
+   std::atomic<uint64_t>* clockWord;
+   uint64_t tickUs;
+   uint64_t scanUs;
+   uint64_t startTime = 0;
+   std::vector<Range> ranges;
+   std::atomic<bool> running{false};
+   std::atomic<uint64_t> reclaimed{0};
+   std::thread thread;
+   // -------------------------------------------------------------------------------------
+   void run();
+   void scan(uint64_t now);
+};
+// -------------------------------------------------------------------------------------
+}  // namespace sync
+}  // namespace nam
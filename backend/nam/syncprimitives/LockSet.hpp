@@ -0,0 +1,220 @@
+#pragma once
+// -------------------------------------------------------------------------------------
+#include "Backoff.hpp"
+#include "Defs.hpp"
+#include "RemoteRWLock.hpp"
+#include "nam/rdma/CommunicationManager.hpp"
+#include "nam/threads/CoroutineScheduler.hpp"
+#include "nam/threads/Worker.hpp"
+// -------------------------------------------------------------------------------------
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+// -------------------------------------------------------------------------------------
+namespace nam
+{
+namespace sync
+{
+// -------------------------------------------------------------------------------------
+// Locks a set of remote tuples, possibly on several storage nodes, all or nothing. The tuples are sorted
+// by storage node and address; per storage node the lock atomics and the speculative data reads of all
+// its tuples go out as one doorbell chain with only the last request signaled, the chains of all nodes
+// are in flight together and validated in one pass after the completions. If any lock failed, the held
+// ones are released (failed readers undo their increment) and the try backs off, so holders never wait
+// for each other and there is no deadlock; the sorted order keeps competing sets from failing each
+// other in cycles. unlock() writes back the exclusive tuples and releases the whole set with one fenced
+// chain per storage node.
+// Same lock words as RemoteRWLock<..., LockPlacement>, both can be used on the same tuples.
+// Local buffer: bufferSize(tupleSize, maxLocks), one tuple per entry; the data of an entry is valid
+// while the set is locked. One object per thread or coroutine, cctxs are the connections of the worker.
+// -------------------------------------------------------------------------------------
+template <typename LockPlacement>
+class LockSet
+{
+  public:
+   using Placement = LockPlacement;
+   static constexpr uint64_t MAX_LOCKS = 32;
+   static constexpr size_t bufferSize(size_t tupleSize, uint64_t maxLocks) { return tupleSize * maxLocks; }
+   // retries of whole sets collide more often than single locks
+   static Backoff defaultBackoff() { return Backoff(BackoffPolicy::EXPONENTIAL); }
+   // -------------------------------------------------------------------------------------
+   LockSet(std::vector<threads::Worker::ConnectionContext>& cctxs, uint64_t* buffer, size_t tupleSize, uint64_t maxLocks,
+           Backoff backoff = defaultBackoff())
+       : cctxs(cctxs), chains(cctxs.size()), buffer(buffer), tupleSize(tupleSize), maxLocks(maxLocks), backoff(backoff)
+   {
+      ensure(tupleSize > sizeof(uint64_t) && tupleSize % sizeof(uint64_t) == 0);
+      ensure(maxLocks > 0 && maxLocks <= MAX_LOCKS);
+      entries.reserve(maxLocks);
+      order.reserve(maxLocks);
+   }
+   // -------------------------------------------------------------------------------------
+   // returns the index of the entry, a tuple added twice is locked once (exclusively if one asked for it)
+   uint64_t add(uint64_t storageNode, uintptr_t tupleAddr, bool exclusive)
+   {
+      ensure(!locked && storageNode < cctxs.size());
+      for (uint64_t e_i = 0; e_i < entries.size(); e_i++) {
+         if (entries[e_i].storageNode == storageNode && entries[e_i].tupleAddr == tupleAddr) {
+            entries[e_i].exclusive |= exclusive;
+            return e_i;
+         }
+      }
+      ensure(entries.size() < maxLocks);
+      entries.push_back({storageNode, tupleAddr, exclusive, false, buffer + entries.size() * tupleSize / sizeof(uint64_t)});
+      sorted = false;
+      return entries.size() - 1;
+   }
+   void clear()
+   {
+      ensure(!locked);
+      entries.clear();
+      order.clear();
+   }
+   uint64_t size() const { return entries.size(); }
+   // -------------------------------------------------------------------------------------
+   bool exclusive(uint64_t e_i) const { return entries[e_i].exclusive; }
+   uint64_t* data(uint64_t e_i) { return dataOf(entries[e_i]); }
+   size_t dataSize() const { return tupleSize - sizeof(uint64_t); }
+   // -------------------------------------------------------------------------------------
+   bool tryLock()
+   {
+      ensure(!locked && !entries.empty());
+      sort();
+      forEachNode([&](uint64_t storageNode, uint64_t begin, uint64_t end) {
+         auto& chain = chainOf(storageNode);
+         for (uint64_t o_i = begin; o_i < end; o_i++) {
+            auto& e = entries[order[o_i]];
+            if (e.exclusive)
+               chain.compareSwap(UNLOCKED, Placement::EXCLUSIVE, lockWord(e), lockAddr(e), rdma::completion::unsignaled);
+            else
+               chain.fetchAdd(Placement::SHARED, lockWord(e), lockAddr(e), rdma::completion::unsignaled);
+            // speculative, must not cover the lock word
+            chain.read(dataOf(e), dataSize(), dataAddr(e), (o_i == end - 1) ? rdma::completion::signaled : rdma::completion::unsignaled);
+         }
+         chain.post();
+      });
+      forEachNode([&](uint64_t storageNode, uint64_t, uint64_t) { threads::async::wait(cctxs[storageNode]); });
+      // -------------------------------------------------------------------------------------
+      uintptr_t failedAddr = 0;
+      uint64_t failed = 0;
+      for (auto& e : entries) {
+         uint64_t word = *static_cast<volatile uint64_t*>(lockWord(e));
+         e.held = e.exclusive ? word == UNLOCKED : !Placement::exclusivelyLocked(word);
+         if (!e.held && failed++ == 0)
+            failedAddr = e.tupleAddr;
+      }
+      if (failed) {
+         release(false);
+         backoff.failed(failedAddr, failed);
+         return false;
+      }
+      backoff.acquired(entries[order[0]].tupleAddr);
+      locked = true;
+      return true;
+   }
+
+   // writes back the data of the exclusive entries and releases all
+   void unlock()
+   {
+      ensure(locked);
+      release(true);
+      locked = false;
+   }
+
+  private:
+   static constexpr uint64_t UNLOCKED = 0;
+   using Chain = rdma::WorkRequestChain<2 * MAX_LOCKS>;
+   struct Entry {
+      uint64_t storageNode;
+      uintptr_t tupleAddr;
+      bool exclusive;
+      bool held;
+      uint64_t* tuple;  // local copy
+   };
+   std::vector<threads::Worker::ConnectionContext>& cctxs;
+   std::vector<std::unique_ptr<Chain>> chains;  // per storage node, created on first use
+   uint64_t* buffer;
+   size_t tupleSize;
+   uint64_t maxLocks;
+   Backoff backoff;
+   std::vector<Entry> entries;
+   std::vector<uint64_t> order;  // entries by storage node and address
+   std::vector<uint64_t> posted;  // storage nodes of the release chains
+   bool sorted = false;
+   bool locked = false;
+   // -------------------------------------------------------------------------------------
+   uint64_t* lockWord(Entry& e) { return e.tuple + Placement::lockOffset(tupleSize) / sizeof(uint64_t); }
+   uint64_t* dataOf(Entry& e) { return e.tuple + Placement::dataOffset(tupleSize) / sizeof(uint64_t); }
+   uintptr_t lockAddr(const Entry& e) const { return e.tupleAddr + Placement::lockOffset(tupleSize); }
+   uintptr_t dataAddr(const Entry& e) const { return e.tupleAddr + Placement::dataOffset(tupleSize); }
+   Chain& chainOf(uint64_t storageNode)
+   {
+      if (!chains[storageNode])
+         chains[storageNode] = std::make_unique<Chain>(*cctxs[storageNode].rctx);
+      return *chains[storageNode];
+   }
+   // -------------------------------------------------------------------------------------
+   void sort()
+   {
+      if (sorted)
+         return;
+      order.resize(entries.size());
+      for (uint64_t e_i = 0; e_i < entries.size(); e_i++)
+         order[e_i] = e_i;
+      std::sort(order.begin(), order.end(), [&](uint64_t a, uint64_t b) {
+         return std::make_pair(entries[a].storageNode, entries[a].tupleAddr) < std::make_pair(entries[b].storageNode, entries[b].tupleAddr);
+      });
+      sorted = true;
+   }
+   // f(storageNode, begin, end) per run of order on the same storage node
+   template <typename F>
+   void forEachNode(F&& f)
+   {
+      for (uint64_t begin = 0, end; begin < order.size(); begin = end) {
+         uint64_t storageNode = entries[order[begin]].storageNode;
+         for (end = begin + 1; end < order.size() && entries[order[end]].storageNode == storageNode; end++) {}
+         f(storageNode, begin, end);
+      }
+   }
+   // -------------------------------------------------------------------------------------
+   // one chain per storage node, fenced behind the requests posted before, only its last request signaled
+   void release(bool writeBack)
+   {
+      posted.clear();
+      forEachNode([&](uint64_t storageNode, uint64_t begin, uint64_t end) {
+         auto& chain = chainOf(storageNode);
+         constexpr auto unsignaled = rdma::completion::unsignaled;
+         for (uint64_t o_i = begin; o_i < end; o_i++) {
+            auto& e = entries[order[o_i]];
+            bool fence = chain.size() == 0;
+            if (e.exclusive && e.held) {
+               if constexpr (Placement::RESET_ON_RELEASE) {
+                  // data and lock word in one write, the lock word comes last
+                  *lockWord(e) = UNLOCKED;
+                  if (writeBack)
+                     chain.write(e.tuple, tupleSize, e.tupleAddr, unsignaled, fence);
+                  else
+                     chain.write(lockWord(e), sizeof(uint64_t), lockAddr(e), unsignaled, fence);
+               } else {
+                  if (writeBack)
+                     chain.write(dataOf(e), dataSize(), dataAddr(e), unsignaled, fence);
+                  chain.fetchAdd(-Placement::EXCLUSIVE, lockWord(e), lockAddr(e), unsignaled, fence);
+               }
+            } else if (!e.exclusive && (e.held || !Placement::RESET_ON_RELEASE)) {
+               chain.fetchAdd(-Placement::SHARED, lockWord(e), lockAddr(e), unsignaled, fence);
+            }
+            e.held = false;
+         }
+         if (chain.size() == 0)
+            return;
+         chain.signalLast();
+         chain.post();
+         posted.push_back(storageNode);
+      });
+      for (auto storageNode : posted)
+         threads::async::wait(cctxs[storageNode]);
+   }
+};
+// -------------------------------------------------------------------------------------
+}  // namespace sync
+}  // namespace nam
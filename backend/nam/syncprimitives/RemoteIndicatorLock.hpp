@@ -0,0 +1,159 @@
+#pragma once
+// -------------------------------------------------------------------------------------
+#include "Backoff.hpp"
+#include "Defs.hpp"
+#include "nam/rdma/CommunicationManager.hpp"
+#include "nam/threads/CoroutineScheduler.hpp"
+#include "nam/threads/Worker.hpp"
+// -------------------------------------------------------------------------------------
+#include <atomic>
+#include <cstdint>
+// -------------------------------------------------------------------------------------
+namespace nam
+{
+namespace sync
+{
+// -------------------------------------------------------------------------------------
+// Slot of this compute node in every reader indicator. Compute nodes do not know their index, so the
+// first worker that needs it claims the next one with a fetch and add on the allocator word (zeroed,
+// same for all compute nodes) of the storage node; one object per compute node.
+// -------------------------------------------------------------------------------------
+class IndicatorSlot
+{
+  public:
+   explicit IndicatorSlot(uint64_t slots) : slots(slots) {}
+   uint64_t getSlots() const { return slots; }
+   // scratch: one registered word
+   uint64_t get(threads::Worker::ConnectionContext& cctx, uintptr_t allocatorAddr, uint64_t* scratch)
+   {
+      uint64_t current = slot.load(std::memory_order_acquire);
+      if (current < CLAIMING)
+         return current;
+      if (current == UNASSIGNED && slot.compare_exchange_strong(current, CLAIMING)) {
+         threads::async::fetchAdd(cctx, 1, scratch, allocatorAddr);
+         uint64_t claimed = *static_cast<volatile uint64_t*>(scratch);
+         if (claimed >= slots) {
+            slot = UNASSIGNED;
+            throw std::runtime_error("Reader indicator slots exhausted");
+         }
+         slot.store(claimed, std::memory_order_release);
+         return claimed;
+      }
+      while ((current = slot.load(std::memory_order_acquire)) >= CLAIMING)
+         threads::async::pause(64);
+      return current;
+   }
+
+  private:
+   static constexpr uint64_t UNASSIGNED = ~0ul;
+   static constexpr uint64_t CLAIMING = ~0ul - 1;
+   uint64_t slots;
+   std::atomic<uint64_t> slot{UNASSIGNED};
+};
+// -------------------------------------------------------------------------------------
+// Reader/writer lock with a distributed reader indicator for read-mostly remote tuples (e.g. the root
+// of a B-tree). Readers do not share a lock word: every compute node counts its readers in its own
+// cache line behind the tuple, so their atomics are spread over as many addresses as there are compute
+// nodes. The word in front of the data is the writer flag.
+//  reader: fetch and add on the own slot, then a fenced read of flag and data in the same doorbell;
+//          a set flag undoes the increment and fails.
+//  writer: compare and swap of the flag, then a fenced read of data and all slots in the same doorbell
+//          and polls the slots until the readers that came first left.
+// The fences order the second step behind the atomic, hence either the reader sees the flag or the
+// writer sees the reader. Writers pay one read of slots * 64 bytes instead.
+// Remote footprint(tupleSize, slots): tuple, padding to the next line, one line per slot. The local
+// buffer mirrors the footprint followed by a scratch line (bufferSize()).
+// -------------------------------------------------------------------------------------
+class RemoteIndicatorLock
+{
+  public:
+   static constexpr size_t LINE = 64;
+   static constexpr size_t slotsOffset(size_t tupleSize) { return (tupleSize + LINE - 1) & ~(LINE - 1); }
+   static constexpr size_t footprint(size_t tupleSize, uint64_t slots) { return slotsOffset(tupleSize) + slots * LINE; }
+   static constexpr size_t bufferSize(size_t tupleSize, uint64_t slots) { return footprint(tupleSize, slots) + LINE; }
+   static Backoff defaultBackoff() { return Backoff(BackoffPolicy::NONE); }
+   // -------------------------------------------------------------------------------------
+   RemoteIndicatorLock(threads::Worker::ConnectionContext& cctx, uint64_t* buffer, size_t tupleSize, IndicatorSlot& slot,
+                       uintptr_t allocatorAddr, Backoff backoff = defaultBackoff())
+       : cctx(cctx), chain(*cctx.rctx), buffer(buffer), tupleSize(tupleSize), slots(slot.getSlots()), backoff(backoff)
+   {
+      ensure(tupleSize > sizeof(uint64_t) && tupleSize % sizeof(uint64_t) == 0);
+      mySlot = slot.get(cctx, allocatorAddr, scratch());
+   }
+   // -------------------------------------------------------------------------------------
+   uint64_t* data() { return buffer + 1; }
+   size_t dataSize() const { return tupleSize - sizeof(uint64_t); }
+   // -------------------------------------------------------------------------------------
+   bool tryLockShared(uintptr_t tupleAddr)
+   {
+      chain.fetchAdd(1, scratch(), slotAddr(tupleAddr, mySlot), rdma::completion::unsignaled)
+          .read(buffer, tupleSize, tupleAddr, rdma::completion::signaled, true);
+      chain.post();
+      threads::async::wait(cctx);
+      if (*static_cast<volatile uint64_t*>(buffer) != UNLOCKED) {
+         unlockShared(tupleAddr);
+         backoff.failed(tupleAddr);
+         return false;
+      }
+      backoff.acquired(tupleAddr);
+      return true;
+   }
+
+   void unlockShared(uintptr_t tupleAddr) { threads::async::fetchAdd(cctx, -1, scratch(), slotAddr(tupleAddr, mySlot)); }
+   // -------------------------------------------------------------------------------------
+   bool tryLockExclusive(uintptr_t tupleAddr)
+   {
+      chain.compareSwap(UNLOCKED, LOCKED, scratch(), tupleAddr, rdma::completion::unsignaled)
+          .read(data(), footprint(tupleSize, slots) - sizeof(uint64_t), tupleAddr + sizeof(uint64_t), rdma::completion::signaled, true);
+      chain.post();
+      threads::async::wait(cctx);
+      if (*static_cast<volatile uint64_t*>(scratch()) != UNLOCKED) {
+         backoff.failed(tupleAddr);
+         return false;
+      }
+      // readers that registered before the flag was set
+      uint64_t readers;
+      while ((readers = countReaders()) > 0) {
+         backoff.failed(tupleAddr, readers);
+         threads::async::read(cctx, slotLine(0), slots * LINE, slotAddr(tupleAddr, 0));
+      }
+      backoff.acquired(tupleAddr);
+      return true;
+   }
+
+   // writes data() back, the flag is cleared behind it
+   void unlockExclusive(uintptr_t tupleAddr)
+   {
+      buffer[0] = UNLOCKED;
+      chain.write(data(), dataSize(), tupleAddr + sizeof(uint64_t), rdma::completion::unsignaled)
+          .write(buffer, sizeof(uint64_t), tupleAddr, rdma::completion::signaled);
+      chain.post();
+      threads::async::wait(cctx);
+   }
+   void drain(uintptr_t) {}  // every release is waited for
+
+  private:
+   static constexpr uint64_t UNLOCKED = 0;
+   static constexpr uint64_t LOCKED = 1;
+   threads::Worker::ConnectionContext& cctx;
+   rdma::WorkRequestChain<> chain;
+   uint64_t* buffer;
+   size_t tupleSize;
+   uint64_t slots;
+   uint64_t mySlot;
+   Backoff backoff;
+   // -------------------------------------------------------------------------------------
+   uint64_t* scratch() { return buffer + footprint(tupleSize, slots) / sizeof(uint64_t); }
+   uint64_t* slotLine(uint64_t s_i) { return buffer + (slotsOffset(tupleSize) + s_i * LINE) / sizeof(uint64_t); }
+   uintptr_t slotAddr(uintptr_t tupleAddr, uint64_t s_i) const { return tupleAddr + slotsOffset(tupleSize) + s_i * LINE; }
+   uint64_t countReaders()
+   {
+      uint64_t readers = 0;
+      for (uint64_t s_i = 0; s_i < slots; s_i++)
+         readers += *static_cast<volatile uint64_t*>(slotLine(s_i));
+      return readers;
+   }
+};
+// -------------------------------------------------------------------------------------
+}  // namespace sync
+}  // namespace nam
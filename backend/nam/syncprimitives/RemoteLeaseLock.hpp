@@ -0,0 +1,182 @@
+#pragma once
+// -------------------------------------------------------------------------------------
+#include "Backoff.hpp"
+#include "Defs.hpp"
+#include "nam/rdma/CommunicationManager.hpp"
+#include "nam/threads/CoroutineScheduler.hpp"
+#include "nam/threads/Worker.hpp"
+#include "nam/utils/Time.hpp"
+// -------------------------------------------------------------------------------------
+#include <cstdint>
+// -------------------------------------------------------------------------------------
+namespace nam
+{
+namespace sync
+{
+// -------------------------------------------------------------------------------------
+// Lease lock word: owner id in the upper 16 bits, expiry of the lease in the lower 48 bits, 0 = free.
+// Expiries are in us of the storage node's lease clock (LeaseReaper publishes it in registered memory),
+// a lease counts as expired GRACE_US after its expiry to absorb the extrapolation of the clients.
+// -------------------------------------------------------------------------------------
+struct LeaseWord {
+   static constexpr uint64_t OWNER_SHIFT = 48;
+   static constexpr uint64_t EXPIRY_MASK = (1ul << OWNER_SHIFT) - 1;
+   static constexpr uint64_t GRACE_US = 100;
+   static constexpr uint64_t make(uint64_t owner, uint64_t expiry) { return (owner << OWNER_SHIFT) | (expiry & EXPIRY_MASK); }
+   static constexpr uint64_t owner(uint64_t word) { return word >> OWNER_SHIFT; }
+   static constexpr uint64_t expiry(uint64_t word) { return word & EXPIRY_MASK; }
+   static constexpr bool expired(uint64_t word, uint64_t now) { return word != 0 && expiry(word) + GRACE_US < now; }
+};
+// -------------------------------------------------------------------------------------
+// Compute side view of the storage lease clock. The clock word is read at most every resyncUs and
+// extrapolated with the local clock in between, so the clocks of the nodes need not be synchronized.
+// -------------------------------------------------------------------------------------
+class LeaseClock
+{
+  public:
+   LeaseClock(threads::Worker::ConnectionContext& cctx, uint64_t* buffer, uintptr_t clockAddr, uint64_t resyncUs = 1000)
+       : cctx(cctx), buffer(buffer), clockAddr(clockAddr), resyncUs(resyncUs)
+   {
+   }
+
+   uint64_t now()
+   {
+      auto local = utils::getTimePoint();
+      if (local - syncedAt >= resyncUs) {
+         threads::async::read(cctx, buffer, sizeof(uint64_t), clockAddr);
+         synced = *static_cast<volatile uint64_t*>(buffer);
+         syncedAt = local;
+      }
+      return synced + (local - syncedAt);
+   }
+
+  private:
+   threads::Worker::ConnectionContext& cctx;
+   uint64_t* buffer;  // one registered word
+   uintptr_t clockAddr;
+   uint64_t resyncUs;
+   uint64_t synced = 0;
+   uint64_t syncedAt = 0;
+};
+// -------------------------------------------------------------------------------------
+// Exclusive lock with a lease on a remote tuple, lock word in front of the data.
+// A bounded acquire gives up after maxAttempts and breaks leases that expired with a CAS from the
+// observed word, a holder that stalls therefore blocks the others for at most its lease. The holder
+// must finish or renew() within its lease. unlock() only writes back while at least SAFETY_MARGIN_US
+// of the lease are left, otherwise it renews the lease first; if the lease was lost already, the write
+// back is skipped (it could overwrite the tuple of the next owner) and unlock() returns false, the
+// caller has to treat the critical section as aborted.
+// Owner ids (16 bits) are allocated with a fetch and add on ownerAllocator, a word on the storage node
+// that starts at 0, so they are unique across compute nodes and lock objects.
+// Attempts that found a valid lease back off, by default a constant pause.
+// The local buffer mirrors the tuple.
+// -------------------------------------------------------------------------------------
+class RemoteLeaseLock
+{
+  public:
+   // left of the lease for the write back and the release to land, others break it GRACE_US after expiry
+   static constexpr uint64_t SAFETY_MARGIN_US = 50;
+   static Backoff defaultBackoff() { return Backoff(BackoffPolicy::PROPORTIONAL, nullptr, 64); }
+   // -------------------------------------------------------------------------------------
+   RemoteLeaseLock(threads::Worker::ConnectionContext& cctx, uint64_t* buffer, size_t tupleSize, LeaseClock& clock,
+                   uintptr_t ownerAllocator, uint64_t leaseUs = 1000, uint64_t maxAttempts = 1024, Backoff backoff = defaultBackoff())
+       : cctx(cctx), chain(*cctx.rctx), buffer(buffer), tupleSize(tupleSize), clock(clock), leaseUs(leaseUs), maxAttempts(maxAttempts),
+         backoff(backoff)
+   {
+      ensure(tupleSize > sizeof(uint64_t) && tupleSize % sizeof(uint64_t) == 0);
+      ensure(leaseUs > 2 * SAFETY_MARGIN_US);
+      threads::async::fetchAdd(cctx, 1, buffer, ownerAllocator);
+      owner = *static_cast<volatile uint64_t*>(buffer) + 1;
+      if (owner >= (1ul << (64 - LeaseWord::OWNER_SHIFT)))
+         throw std::runtime_error("Lease owner ids exhausted");
+   }
+   // -------------------------------------------------------------------------------------
+   uint64_t* data() { return buffer + 1; }
+   size_t dataSize() const { return tupleSize - sizeof(uint64_t); }
+   uint64_t getBrokenLeases() const { return brokenLeases; }
+   uint64_t getLostLeases() const { return lostLeases; }
+   uint64_t getOwner() const { return owner; }
+   // -------------------------------------------------------------------------------------
+   // returns false after maxAttempts, the data is read in the same doorbell as the cas
+   bool lock(uintptr_t tupleAddr)
+   {
+      volatile uint64_t* word = buffer;
+      uint64_t expected = 0;
+      for (uint64_t a_i = 0; a_i < maxAttempts; a_i++) {
+         held = LeaseWord::make(owner, clock.now() + leaseUs);
+         chain.compareSwap(expected, held, buffer, tupleAddr, rdma::completion::unsignaled)
+             .read(data(), dataSize(), tupleAddr + sizeof(uint64_t), rdma::completion::signaled);
+         chain.post();
+         threads::async::wait(cctx);
+         uint64_t observed = *word;
+         if (observed == expected) {
+            brokenLeases += (expected != 0);
+            backoff.acquired(tupleAddr);
+            return true;
+         }
+         if (LeaseWord::expired(observed, clock.now())) {
+            expected = observed;  // break it with the next cas
+            continue;
+         }
+         expected = 0;
+         backoff.failed(tupleAddr);
+      }
+      held = 0;
+      return false;
+   }
+
+   // extends the lease, false if it was lost already
+   bool renew(uintptr_t tupleAddr)
+   {
+      uint64_t extended = LeaseWord::make(owner, clock.now() + leaseUs);
+      threads::async::compareSwap(cctx, held, extended, buffer, tupleAddr);
+      if (*static_cast<volatile uint64_t*>(buffer) != held) {
+         lostLeases++;
+         return false;
+      }
+      held = extended;
+      return true;
+   }
+
+   // writes data() back if requested and frees the word if we still own it, false if the lease was lost
+   bool unlock(uintptr_t tupleAddr, bool writeBack = true)
+   {
+      if (writeBack && LeaseWord::expiry(held) < clock.now() + SAFETY_MARGIN_US && !renew(tupleAddr)) {
+         held = 0;
+         return false;
+      }
+      if (writeBack)
+         chain.write(data(), dataSize(), tupleAddr + sizeof(uint64_t), rdma::completion::unsignaled);
+      chain.compareSwap(held, 0, buffer, tupleAddr, rdma::completion::signaled);
+      chain.post();
+      threads::async::wait(cctx);
+      bool owned = *static_cast<volatile uint64_t*>(buffer) == held;
+      lostLeases += !owned;
+      held = 0;
+      return owned;
+   }
+   // -------------------------------------------------------------------------------------
+   // interface of RemoteRWLock, readers lock exclusively
+   bool tryLockShared(uintptr_t tupleAddr) { return lock(tupleAddr); }
+   void unlockShared(uintptr_t tupleAddr) { unlock(tupleAddr, false); }
+   bool tryLockExclusive(uintptr_t tupleAddr) { return lock(tupleAddr); }
+   void unlockExclusive(uintptr_t tupleAddr) { unlock(tupleAddr); }
+   void drain(uintptr_t) {}
+
+  private:
+   threads::Worker::ConnectionContext& cctx;
+   rdma::WorkRequestChain<> chain;
+   uint64_t* buffer;
+   size_t tupleSize;
+   LeaseClock& clock;
+   uint64_t owner;
+   uint64_t leaseUs;
+   uint64_t maxAttempts;
+   Backoff backoff;
+   uint64_t held = 0;  // our lock word while locked
+   uint64_t brokenLeases = 0;
+   uint64_t lostLeases = 0;
+};
+// -------------------------------------------------------------------------------------
+}  // namespace sync
+}  // namespace nam
@@ -0,0 +1,197 @@
+#pragma once
+// -------------------------------------------------------------------------------------
+#include "Backoff.hpp"
+#include "Defs.hpp"
+#include "nam/rdma/CommunicationManager.hpp"
+#include "nam/threads/CoroutineScheduler.hpp"
+#include "nam/threads/Worker.hpp"
+// -------------------------------------------------------------------------------------
+#include <atomic>
+#include <cstdint>
+#include <memory>
+// -------------------------------------------------------------------------------------
+namespace nam
+{
+namespace sync
+{
+// -------------------------------------------------------------------------------------
+// The queue nodes of the lock objects of this compute node by id, the local half of RemoteMCSLock.
+// Ids are handed out once by the allocator on the storage node, so entries are never reused.
+// -------------------------------------------------------------------------------------
+class LocalQueueNodes
+{
+  public:
+   struct alignas(64) Node {
+      std::atomic<bool> enrolled{false};
+      std::atomic<uint64_t> granted{0};
+   };
+   // -------------------------------------------------------------------------------------
+   explicit LocalQueueNodes(uint64_t capacity) : capacity(capacity), nodes(std::make_unique<Node[]>(capacity + 1)) {}
+   Node& enroll(uint64_t id)
+   {
+      ensure(id <= capacity);
+      nodes[id].enrolled.store(true, std::memory_order_release);
+      return nodes[id];
+   }
+   // nullptr if the lock object of id lives on another compute node
+   Node* find(uint64_t id)
+   {
+      if (id > capacity || !nodes[id].enrolled.load(std::memory_order_acquire))
+         return nullptr;
+      return &nodes[id];
+   }
+
+  private:
+   uint64_t capacity;
+   std::unique_ptr<Node[]> nodes;
+};
+// -------------------------------------------------------------------------------------
+// MCS queue lock on a remote tuple. The lock word in front of the data holds the id of the last
+// queued waiter (0 = free). A waiter swaps its id into the lock word, links itself behind its
+// predecessor and then polls only its own queue node until the predecessor hands the lock over.
+// Compute nodes are not connected to each other, so a predecessor cannot write into the memory of a
+// waiter on another compute node. The queue nodes therefore live in a region on the storage node next
+// to the locks. Such a waiter polls its own queue node remotely, paced by the backoff (exponential by
+// default), so its remote traffic per acquisition grows with the hold time of the predecessor and is
+// not O(1); only the lock word sees one atomic per acquire and release instead of a CAS per retry.
+// Likewise a releaser polls its queue node remotely, with the same backoff, until its successor linked.
+// If predecessor and waiter share the compute node (both in LocalQueueNodes), the predecessor hands
+// over with a local store and the waiter spins on its own local cache line.
+// RDMA has no swap, it is a CAS loop that retries with the returned tail and only conflicts with
+// concurrent enqueues, not with the lock holder.
+// Queue region: the first line is the id allocator, followed by one line per queue node
+// (next id, granted). Every lock object allocates one node for its lifetime and holds at most one
+// lock at a time. The local buffer needs bufferSize(tupleSize) bytes, the tuple mirror followed by
+// the local image of the queue node. The backoff paces the remote polls of the own queue node.
+// -------------------------------------------------------------------------------------
+class RemoteMCSLock
+{
+  public:
+   static constexpr uint64_t QNODE_SIZE = 64;
+   static constexpr size_t regionSize(uint64_t capacity) { return (capacity + 1) * QNODE_SIZE; }
+   static constexpr size_t bufferSize(size_t tupleSize) { return tupleSize + QNODE_SIZE; }
+   // paces the remote polls of waiters behind a predecessor on another compute node and of releasers
+   static Backoff defaultBackoff() { return Backoff(BackoffPolicy::EXPONENTIAL, nullptr, 16, 1024); }
+   // -------------------------------------------------------------------------------------
+   RemoteMCSLock(threads::Worker::ConnectionContext& cctx, uint64_t* buffer, size_t tupleSize, uintptr_t qnodes, uint64_t capacity,
+                 LocalQueueNodes* localNodes = nullptr, Backoff backoff = defaultBackoff())
+       : cctx(cctx),
+         buffer(buffer),
+         qnode(buffer + tupleSize / sizeof(uint64_t)),
+         tupleSize(tupleSize),
+         qnodes(qnodes),
+         localNodes(localNodes),
+         backoff(backoff)
+   {
+      ensure(tupleSize > sizeof(uint64_t) && tupleSize % sizeof(uint64_t) == 0);
+      threads::async::fetchAdd(cctx, 1, &qnode[NEXT], qnodes);
+      id = qnode[NEXT] + 1;
+      if (id > capacity)
+         throw std::runtime_error("MCS queue region exhausted");
+      if (localNodes)
+         localNode = &localNodes->enroll(id);
+   }
+   // -------------------------------------------------------------------------------------
+   uint64_t* data() { return buffer + 1; }
+   size_t dataSize() const { return tupleSize - sizeof(uint64_t); }
+   uint64_t getId() const { return id; }
+   // -------------------------------------------------------------------------------------
+   // blocks until the lock is granted and reads the data
+   void lock(uintptr_t tupleAddr)
+   {
+      volatile uint64_t* local = qnode;
+      qnode[NEXT] = 0;
+      qnode[GRANTED] = 0;
+      if (localNode)
+         localNode->granted.store(0, std::memory_order_relaxed);
+      // ordered before the swap, nobody can link behind us earlier
+      rdma::postWrite(qnode, *cctx.rctx, rdma::completion::unsignaled, nodeAddr(id), 2 * sizeof(uint64_t));
+      uint64_t expected = 0;
+      while (true) {
+         threads::async::compareSwap(cctx, expected, id, buffer, tupleAddr);
+         uint64_t tail = static_cast<volatile uint64_t*>(buffer)[0];
+         if (tail == expected)
+            break;
+         expected = tail;
+      }
+      if (expected != 0) {
+         qnode[LINK] = id;
+         rdma::postWrite(&qnode[LINK], *cctx.rctx, rdma::completion::unsignaled, nodeAddr(expected) + NEXT * sizeof(uint64_t));
+         if (localNode && localNodes->find(expected)) {
+            // the predecessor grants with a local store
+            while (localNode->granted.load(std::memory_order_acquire) == 0)
+               threads::async::pause(1);
+         } else {
+            while (true) {
+               threads::async::read(cctx, &qnode[GRANTED], sizeof(uint64_t), nodeAddr(id) + GRANTED * sizeof(uint64_t));
+               if (local[GRANTED] != 0)
+                  break;
+               backoff.failed(tupleAddr);
+            }
+         }
+      }
+      backoff.acquired(tupleAddr);
+      threads::async::read(cctx, data(), dataSize(), tupleAddr + sizeof(uint64_t));
+   }
+
+   // writes data() back if requested and hands the lock to the successor
+   void unlock(uintptr_t tupleAddr, bool writeBack = true)
+   {
+      volatile uint64_t* local = qnode;
+      if (writeBack)
+         rdma::postWrite(data(), *cctx.rctx, rdma::completion::unsignaled, tupleAddr + sizeof(uint64_t), dataSize());
+      threads::async::compareSwap(cctx, id, 0, buffer, tupleAddr);
+      if (static_cast<volatile uint64_t*>(buffer)[0] == id)
+         return;
+      // a successor swapped itself in, wait until it linked behind us
+      while (true) {
+         threads::async::read(cctx, &qnode[NEXT], sizeof(uint64_t), nodeAddr(id) + NEXT * sizeof(uint64_t));
+         if (local[NEXT] != 0)
+            break;
+         backoff.failed(tupleAddr);
+      }
+      // the write back completed before the cas, the successor reads the data afterwards
+      if (auto* successor = localNodes ? localNodes->find(local[NEXT]) : nullptr) {
+         successor->granted.store(1, std::memory_order_release);
+         return;
+      }
+      qnode[HANDOFF] = 1;
+      threads::async::write(cctx, &qnode[HANDOFF], sizeof(uint64_t), nodeAddr(local[NEXT]) + GRANTED * sizeof(uint64_t));
+   }
+   // -------------------------------------------------------------------------------------
+   // interface of RemoteRWLock, readers queue like writers
+   bool tryLockShared(uintptr_t tupleAddr)
+   {
+      lock(tupleAddr);
+      return true;
+   }
+   void unlockShared(uintptr_t tupleAddr) { unlock(tupleAddr, false); }
+   bool tryLockExclusive(uintptr_t tupleAddr)
+   {
+      lock(tupleAddr);
+      return true;
+   }
+   void unlockExclusive(uintptr_t tupleAddr) { unlock(tupleAddr); }
+   void drain(uintptr_t) {}  // every release is waited for
+
+  private:
+   // words of the queue node, LINK and HANDOFF are local sources for writes into other nodes
+   static constexpr uint64_t NEXT = 0;
+   static constexpr uint64_t GRANTED = 1;
+   static constexpr uint64_t LINK = 2;
+   static constexpr uint64_t HANDOFF = 3;
+   threads::Worker::ConnectionContext& cctx;
+   uint64_t* buffer;
+   uint64_t* qnode;
+   size_t tupleSize;
+   uintptr_t qnodes;
+   uint64_t id;
+   LocalQueueNodes* localNodes;
+   LocalQueueNodes::Node* localNode = nullptr;
+   Backoff backoff;
+   // -------------------------------------------------------------------------------------
+   uintptr_t nodeAddr(uint64_t qnodeId) const { return qnodes + qnodeId * QNODE_SIZE; }
+};
+// -------------------------------------------------------------------------------------
+}  // namespace sync
+}  // namespace nam
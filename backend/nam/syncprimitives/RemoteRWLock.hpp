@@ -0,0 +1,256 @@
+#pragma once
+// -------------------------------------------------------------------------------------
+#include "Backoff.hpp"
+#include "Defs.hpp"
+#include "nam/rdma/CommunicationManager.hpp"
+#include "nam/threads/CoroutineScheduler.hpp"
+#include "nam/threads/Worker.hpp"
+#include "nam/utils/DirtyLines.hpp"
+// -------------------------------------------------------------------------------------
+#include <cstdint>
+#include <type_traits>
+// -------------------------------------------------------------------------------------
+namespace nam
+{
+namespace sync
+{
+// -------------------------------------------------------------------------------------
+// Where the 64 bit lock word lives in the remote tuple and how it is released.
+// -------------------------------------------------------------------------------------
+// Lock word in front of the data, readers count in the low bits, the writer adds EXCLUSIVE.
+// Failed readers undo their increment and the writer releases with a fetch and add.
+struct HeadLock {
+   static constexpr uint64_t SHARED = 1;
+   static constexpr uint64_t EXCLUSIVE = 0x1000000000000000;
+   static constexpr bool RESET_ON_RELEASE = false;
+   static constexpr size_t lockOffset(size_t) { return 0; }
+   static constexpr size_t dataOffset(size_t) { return sizeof(uint64_t); }
+   static constexpr bool exclusivelyLocked(uint64_t word) { return word >= EXCLUSIVE; }
+};
+// Lock word behind the data, readers count in steps of 2, the writer sets bit 0.
+// The writer releases by overwriting the word with 0, which also discards the increments of readers
+// that failed meanwhile, so they do not undo them. Data and release then fit into one write, the NIC
+// places it in ascending address order and the lock word comes last.
+struct TailLock {
+   static constexpr uint64_t SHARED = 2;
+   static constexpr uint64_t EXCLUSIVE = 1;
+   static constexpr bool RESET_ON_RELEASE = true;
+   static constexpr size_t lockOffset(size_t tupleSize) { return tupleSize - sizeof(uint64_t); }
+   static constexpr size_t dataOffset(size_t) { return 0; }
+   static constexpr bool exclusivelyLocked(uint64_t word) { return word & EXCLUSIVE; }
+};
+// -------------------------------------------------------------------------------------
+// Pessimistic reader/writer lock on a remote tuple, the protocol variants of the locking benchmarks:
+//  SpeculativeRead: the data read is chained behind the lock atomic (one doorbell, one round trip),
+//                   the data is only valid if the lock succeeded.
+//  OrderRelease:    the release is unsignaled and not waited for, RC ordering keeps it behind the
+//                   preceding requests of the qp.
+//  WriteCombining:  write back and release are posted as one chain, only the release is signaled.
+//  DoorbellBatching: the chains of SpeculativeRead and WriteCombining go out with one doorbell,
+//                   otherwise every request is posted on its own (the doorbell batching comparison).
+// All variants are resolved at compile time. The local buffer mirrors the tuple (tupleSize bytes, 8 byte
+// aligned, registered) and is owned by the lock object until drain(). A failed try backs off before it
+// returns, the caller retries. Completions are waited for with
+// threads::async::wait, hence it also works within coroutines; the qp must not be shared
+// (no FLAGS_qpSharing).
+// -------------------------------------------------------------------------------------
+template <bool SpeculativeRead, bool OrderRelease, bool WriteCombining, typename LockPlacement, bool DoorbellBatching = true>
+class RemoteRWLock
+{
+  public:
+   using Placement = LockPlacement;
+   static Backoff defaultBackoff() { return Backoff(BackoffPolicy::NONE); }
+   // -------------------------------------------------------------------------------------
+   RemoteRWLock(threads::Worker::ConnectionContext& cctx, uint64_t* buffer, size_t tupleSize, Backoff backoff = defaultBackoff())
+       : cctx(cctx), chain(*cctx.rctx), buffer(buffer), tupleSize(tupleSize), backoff(backoff)
+   {
+      ensure(tupleSize > sizeof(uint64_t) && tupleSize % sizeof(uint64_t) == 0);
+   }
+   // -------------------------------------------------------------------------------------
+   // the tuple without the lock word, valid while the lock is held
+   uint64_t* data() { return buffer + Placement::dataOffset(tupleSize) / sizeof(uint64_t); }
+   size_t dataSize() const { return tupleSize - sizeof(uint64_t); }
+   uintptr_t dataAddr(uintptr_t tupleAddr) const { return tupleAddr + Placement::dataOffset(tupleSize); }
+   // pauses between posting the fetch and add and the speculative read of tryLockShared, widens the
+   // window in which a writer can slip in between (the sleep experiments), needs separate posts
+   void setPostGap(uint64_t pauses)
+   {
+      ensure(!DoorbellBatching || pauses == 0);
+      postGap = pauses;
+   }
+   // -------------------------------------------------------------------------------------
+   bool tryLockShared(uintptr_t tupleAddr)
+   {
+      if constexpr (SpeculativeRead) {
+         chain.fetchAdd(Placement::SHARED, lockWord(), lockAddr(tupleAddr), rdma::completion::unsignaled)
+             .read(data(), dataSize(), dataAddr(tupleAddr), rdma::completion::signaled);
+         postChain(postGap);
+         threads::async::wait(cctx);
+      } else {
+         threads::async::fetchAdd(cctx, Placement::SHARED, lockWord(), lockAddr(tupleAddr));
+      }
+      if (Placement::exclusivelyLocked(*static_cast<volatile uint64_t*>(lockWord()))) {
+         if constexpr (!Placement::RESET_ON_RELEASE)
+            unlockShared(tupleAddr);
+         backoff.failed(tupleAddr);
+         return false;
+      }
+      backoff.acquired(tupleAddr);
+      if constexpr (!SpeculativeRead)
+         threads::async::read(cctx, data(), dataSize(), dataAddr(tupleAddr));
+      return true;
+   }
+
+   void unlockShared(uintptr_t tupleAddr)
+   {
+      // the data was read already, no fence needed
+      if constexpr (OrderRelease) {
+         rdma::postFetchAdd(-Placement::SHARED, lockWord(), *cctx.rctx, rdma::completion::unsignaled, lockAddr(tupleAddr));
+      } else {
+         threads::async::fetchAdd(cctx, -Placement::SHARED, lockWord(), lockAddr(tupleAddr));
+      }
+   }
+   // -------------------------------------------------------------------------------------
+   bool tryLockExclusive(uintptr_t tupleAddr)
+   {
+      if constexpr (SpeculativeRead) {
+         // the read must not cover the lock word, it could overtake the result of the cas
+         chain.compareSwap(UNLOCKED, Placement::EXCLUSIVE, lockWord(), lockAddr(tupleAddr), rdma::completion::unsignaled)
+             .read(data(), dataSize(), dataAddr(tupleAddr), rdma::completion::signaled);
+         postChain();
+         threads::async::wait(cctx);
+      } else {
+         threads::async::compareSwap(cctx, UNLOCKED, Placement::EXCLUSIVE, lockWord(), lockAddr(tupleAddr));
+      }
+      if (*static_cast<volatile uint64_t*>(lockWord()) != UNLOCKED) {
+         backoff.failed(tupleAddr);
+         return false;
+      }
+      backoff.acquired(tupleAddr);
+      if constexpr (!SpeculativeRead)
+         threads::async::read(cctx, data(), dataSize(), dataAddr(tupleAddr));
+      return true;
+   }
+
+   // writes data() back and releases the lock
+   void unlockExclusive(uintptr_t tupleAddr) { unlockExclusive(tupleAddr, utils::DirtyLines::all(tupleSize)); }
+   // writes back only the dirty lines of the buffer (offsets from the start of the tuple, not of data())
+   void unlockExclusive(uintptr_t tupleAddr, const utils::DirtyLines& dirty)
+   {
+      constexpr auto release = OrderRelease ? rdma::completion::unsignaled : rdma::completion::signaled;
+      const uint64_t begin = Placement::dataOffset(tupleSize), end = begin + dataSize();
+      // one request per run, the release behind them
+      auto writeRuns = [&](const utils::DirtyLines& lines, uint64_t writeEnd) {
+         lines.forEachRun(begin, writeEnd, chain.capacity() - 1, [&](uint64_t offset, uint64_t length) {
+            chain.write(reinterpret_cast<uint8_t*>(buffer) + offset, length, tupleAddr + offset, rdma::completion::unsignaled);
+         });
+      };
+      if constexpr (Placement::RESET_ON_RELEASE && WriteCombining) {
+         // the lock word is written with the last run, the writes of the qp are placed in order
+         *lockWord() = UNLOCKED;
+         auto lines = dirty;
+         lines.mark(Placement::lockOffset(tupleSize), sizeof(uint64_t));
+         writeRuns(lines, tupleSize);
+         if constexpr (!OrderRelease)
+            chain.signalLast();
+         postChain();
+      } else if constexpr (WriteCombining) {
+         writeRuns(dirty, end);
+         chain.fetchAdd(-Placement::EXCLUSIVE, lockWord(), lockAddr(tupleAddr), release);
+         postChain();
+      } else {
+         writeRuns(dirty, end);
+         if (chain.size() > 0) {
+            chain.signalLast().post();
+            threads::async::wait(cctx);
+         }
+         if constexpr (Placement::RESET_ON_RELEASE) {
+            *lockWord() = UNLOCKED;
+            rdma::postWrite(lockWord(), *cctx.rctx, release, lockAddr(tupleAddr));
+         } else {
+            rdma::postFetchAdd(-Placement::EXCLUSIVE, lockWord(), *cctx.rctx, release, lockAddr(tupleAddr));
+         }
+      }
+      if constexpr (!OrderRelease)
+         threads::async::wait(cctx);
+   }
+   // releases an exclusive lock without writing back, the acquirer may have been another lock object
+   void release(uintptr_t tupleAddr)
+   {
+      static_assert(!Placement::RESET_ON_RELEASE, "the reset would discard the increments of failed readers");
+      constexpr auto release = OrderRelease ? rdma::completion::unsignaled : rdma::completion::signaled;
+      rdma::postFetchAdd(-Placement::EXCLUSIVE, lockWord(), *cctx.rctx, release, lockAddr(tupleAddr));
+      if constexpr (!OrderRelease)
+         threads::async::wait(cctx);
+   }
+   // -------------------------------------------------------------------------------------
+   // unsignaled releases may still access the buffer, a signaled read of the lock word behind them
+   // drains the qp before the buffer is reused
+   void drain(uintptr_t tupleAddr)
+   {
+      if constexpr (OrderRelease)
+         threads::async::read(cctx, lockWord(), sizeof(uint64_t), lockAddr(tupleAddr));
+   }
+
+  private:
+   static constexpr uint64_t UNLOCKED = 0;
+   threads::Worker::ConnectionContext& cctx;
+   rdma::WorkRequestChain<> chain;
+   uint64_t* buffer;
+   size_t tupleSize;
+   Backoff backoff;
+   uint64_t postGap = 0;
+   // -------------------------------------------------------------------------------------
+   uint64_t* lockWord() { return buffer + Placement::lockOffset(tupleSize) / sizeof(uint64_t); }
+   uintptr_t lockAddr(uintptr_t tupleAddr) const { return tupleAddr + Placement::lockOffset(tupleSize); }
+   void postChain(uint64_t pauses = 0)
+   {
+      if constexpr (DoorbellBatching)
+         chain.post();
+      else
+         chain.postEach(pauses);
+   }
+};
+// -------------------------------------------------------------------------------------
+template <typename T>
+struct IsRemoteRWLock : std::false_type {
+};
+template <bool SpeculativeRead, bool OrderRelease, bool WriteCombining, typename LockPlacement, bool DoorbellBatching>
+struct IsRemoteRWLock<RemoteRWLock<SpeculativeRead, OrderRelease, WriteCombining, LockPlacement, DoorbellBatching>> : std::true_type {
+};
+// -------------------------------------------------------------------------------------
+template <typename T>
+struct TypeTag {
+   using type = T;
+};
+// Maps the runtime protocol flags to the RemoteRWLock instantiation once, outside of the hot loop:
+// f(TypeTag<RemoteRWLock<...>>{}) is called with the matching lock type.
+template <typename LockPlacement, typename F>
+decltype(auto) withRemoteRWLock(bool speculativeRead, bool orderRelease, bool writeCombining, bool doorbellBatching, F&& f)
+{
+   auto dispatch = [&](auto speculative, auto order, auto combining, auto batching) -> decltype(auto) {
+      return f(TypeTag<RemoteRWLock<decltype(speculative)::value, decltype(order)::value, decltype(combining)::value, LockPlacement,
+                                    decltype(batching)::value>>{});
+   };
+   auto withBatching = [&](auto speculative, auto order, auto combining) -> decltype(auto) {
+      if (doorbellBatching)
+         return dispatch(speculative, order, combining, std::true_type{});
+      return dispatch(speculative, order, combining, std::false_type{});
+   };
+   auto withCombining = [&](auto speculative, auto order) -> decltype(auto) {
+      if (writeCombining)
+         return withBatching(speculative, order, std::true_type{});
+      return withBatching(speculative, order, std::false_type{});
+   };
+   auto withOrder = [&](auto speculative) -> decltype(auto) {
+      if (orderRelease)
+         return withCombining(speculative, std::true_type{});
+      return withCombining(speculative, std::false_type{});
+   };
+   if (speculativeRead)
+      return withOrder(std::true_type{});
+   return withOrder(std::false_type{});
+}
+// -------------------------------------------------------------------------------------
+}  // namespace sync
+}  // namespace nam
@@ -0,0 +1,211 @@
+#pragma once
+// -------------------------------------------------------------------------------------
+#include "Backoff.hpp"
+#include "Defs.hpp"
+#include "nam/rdma/CommunicationManager.hpp"
+#include "nam/threads/CoroutineScheduler.hpp"
+#include "nam/threads/Worker.hpp"
+// -------------------------------------------------------------------------------------
+#include <cstdint>
+// -------------------------------------------------------------------------------------
+namespace nam
+{
+namespace sync
+{
+// -------------------------------------------------------------------------------------
+// Fair remote locks built on fetch and add, the lock words sit at the tail of the tuple behind the
+// data. Both offer the interface of RemoteRWLock; acquires block and always succeed, waiters are
+// served in arrival order. A waiter polls only the counter that admits it and passes its distance in
+// the queue to the backoff, by default it pauses in proportion to it. The local buffer needs bufferSize(tupleSize) bytes, the
+// tuple mirror followed by a scratch line for the fetched values.
+// -------------------------------------------------------------------------------------
+// Ticket lock: 16 byte lock area (next ticket, now serving). Readers queue like writers.
+class RemoteTicketLock
+{
+  public:
+   static constexpr size_t LOCK_BYTES = 2 * sizeof(uint64_t);
+   static constexpr size_t bufferSize(size_t tupleSize) { return tupleSize + 64; }
+   static Backoff defaultBackoff() { return Backoff(BackoffPolicy::PROPORTIONAL, nullptr, 64); }
+   // -------------------------------------------------------------------------------------
+   RemoteTicketLock(threads::Worker::ConnectionContext& cctx, uint64_t* buffer, size_t tupleSize,
+                    Backoff backoff = defaultBackoff())
+       : cctx(cctx), chain(*cctx.rctx), buffer(buffer), tupleSize(tupleSize), backoff(backoff)
+   {
+      ensure(tupleSize > LOCK_BYTES && tupleSize % sizeof(uint64_t) == 0);
+   }
+   // -------------------------------------------------------------------------------------
+   uint64_t* data() { return buffer; }
+   size_t dataSize() const { return tupleSize - LOCK_BYTES; }
+   // -------------------------------------------------------------------------------------
+   // takes a ticket and reads the whole tuple within the same doorbell, valid if we are served already
+   void lock(uintptr_t tupleAddr)
+   {
+      volatile uint64_t* area = lockArea();
+      chain.fetchAdd(1, scratch(), offset(tupleAddr, NEXT), rdma::completion::unsignaled)
+          .read(buffer, tupleSize, tupleAddr, rdma::completion::signaled);
+      chain.post();
+      threads::async::wait(cctx);
+      ticket = *static_cast<volatile uint64_t*>(scratch());
+      if (area[SERVING] == ticket) {
+         backoff.acquired(tupleAddr);
+         return;
+      }
+      do {
+         backoff.failed(tupleAddr, ticket - area[SERVING]);
+         threads::async::read(cctx, const_cast<uint64_t*>(&area[SERVING]), sizeof(uint64_t), offset(tupleAddr, SERVING));
+      } while (area[SERVING] != ticket);
+      backoff.acquired(tupleAddr);
+      threads::async::read(cctx, data(), dataSize(), tupleAddr);
+   }
+
+   // only the holder changes the serving counter, a write behind the data hands over
+   void unlock(uintptr_t tupleAddr, bool writeBack = true)
+   {
+      lockArea()[SERVING] = ticket + 1;
+      if (writeBack)
+         chain.write(data(), dataSize(), tupleAddr, rdma::completion::unsignaled);
+      chain.write(&lockArea()[SERVING], sizeof(uint64_t), offset(tupleAddr, SERVING), rdma::completion::signaled);
+      chain.post();
+      threads::async::wait(cctx);
+   }
+   // -------------------------------------------------------------------------------------
+   // interface of RemoteRWLock
+   bool tryLockShared(uintptr_t tupleAddr)
+   {
+      lock(tupleAddr);
+      return true;
+   }
+   void unlockShared(uintptr_t tupleAddr) { unlock(tupleAddr, false); }
+   bool tryLockExclusive(uintptr_t tupleAddr)
+   {
+      lock(tupleAddr);
+      return true;
+   }
+   void unlockExclusive(uintptr_t tupleAddr) { unlock(tupleAddr); }
+   void drain(uintptr_t) {}
+
+  private:
+   static constexpr uint64_t NEXT = 0;
+   static constexpr uint64_t SERVING = 1;
+   threads::Worker::ConnectionContext& cctx;
+   rdma::WorkRequestChain<> chain;
+   uint64_t* buffer;
+   size_t tupleSize;
+   Backoff backoff;
+   uint64_t ticket = 0;
+   // -------------------------------------------------------------------------------------
+   uint64_t* lockArea() { return buffer + dataSize() / sizeof(uint64_t); }
+   uint64_t* scratch() { return buffer + tupleSize / sizeof(uint64_t); }
+   uintptr_t offset(uintptr_t tupleAddr, uint64_t word) const { return tupleAddr + dataSize() + word * sizeof(uint64_t); }
+};
+// -------------------------------------------------------------------------------------
+// Phase-fair reader/writer ticket lock (PF-T, Brandenburg and Anderson): 32 byte lock area
+// (reader in, reader out, writer in, writer out). Readers count in rin/rout in steps of RINC, a writer
+// marks its presence and phase in the low bits of rin. Readers wait for at most one writer phase,
+// writers are served in ticket order and wait only for the readers that arrived before them.
+class RemotePhaseFairLock
+{
+  public:
+   static constexpr size_t LOCK_BYTES = 4 * sizeof(uint64_t);
+   static constexpr size_t bufferSize(size_t tupleSize) { return tupleSize + 64; }
+   static Backoff defaultBackoff() { return Backoff(BackoffPolicy::PROPORTIONAL, nullptr, 64); }
+   // -------------------------------------------------------------------------------------
+   RemotePhaseFairLock(threads::Worker::ConnectionContext& cctx, uint64_t* buffer, size_t tupleSize,
+                       Backoff backoff = defaultBackoff())
+       : cctx(cctx), chain(*cctx.rctx), buffer(buffer), tupleSize(tupleSize), backoff(backoff)
+   {
+      ensure(tupleSize > LOCK_BYTES && tupleSize % sizeof(uint64_t) == 0);
+   }
+   // -------------------------------------------------------------------------------------
+   uint64_t* data() { return buffer; }
+   size_t dataSize() const { return tupleSize - LOCK_BYTES; }
+   // -------------------------------------------------------------------------------------
+   bool tryLockShared(uintptr_t tupleAddr)
+   {
+      volatile uint64_t* area = lockArea();
+      chain.fetchAdd(RINC, scratch(), offset(tupleAddr, RIN), rdma::completion::unsignaled)
+          .read(data(), dataSize(), tupleAddr, rdma::completion::signaled);
+      chain.post();
+      threads::async::wait(cctx);
+      uint64_t writer = *static_cast<volatile uint64_t*>(scratch()) & WBITS;
+      if (writer == 0) {
+         backoff.acquired(tupleAddr);
+         return true;
+      }
+      // wait until the writer phase we observed ended, then read again
+      do {
+         backoff.failed(tupleAddr);
+         threads::async::read(cctx, const_cast<uint64_t*>(&area[RIN]), sizeof(uint64_t), offset(tupleAddr, RIN));
+      } while ((area[RIN] & WBITS) == writer);
+      backoff.acquired(tupleAddr);
+      threads::async::read(cctx, data(), dataSize(), tupleAddr);
+      return true;
+   }
+
+   void unlockShared(uintptr_t tupleAddr) { threads::async::fetchAdd(cctx, RINC, scratch(), offset(tupleAddr, ROUT)); }
+   // -------------------------------------------------------------------------------------
+   bool tryLockExclusive(uintptr_t tupleAddr)
+   {
+      volatile uint64_t* area = lockArea();
+      // writer ticket
+      chain.fetchAdd(1, scratch(), offset(tupleAddr, WIN), rdma::completion::unsignaled)
+          .read(const_cast<uint64_t*>(&area[WOUT]), sizeof(uint64_t), offset(tupleAddr, WOUT), rdma::completion::signaled);
+      chain.post();
+      threads::async::wait(cctx);
+      ticket = *static_cast<volatile uint64_t*>(scratch());
+      while (area[WOUT] != ticket) {
+         backoff.failed(tupleAddr, ticket - area[WOUT]);
+         threads::async::read(cctx, const_cast<uint64_t*>(&area[WOUT]), sizeof(uint64_t), offset(tupleAddr, WOUT));
+      }
+      // block new readers and wait for the ones that arrived before
+      phase = PRES | (ticket & PHID);
+      chain.fetchAdd(phase, scratch(), offset(tupleAddr, RIN), rdma::completion::unsignaled)
+          .read(const_cast<uint64_t*>(&area[ROUT]), sizeof(uint64_t), offset(tupleAddr, ROUT), rdma::completion::signaled);
+      chain.post();
+      threads::async::wait(cctx);
+      uint64_t readers = *static_cast<volatile uint64_t*>(scratch()) & ~WBITS;
+      while (area[ROUT] != readers) {
+         backoff.failed(tupleAddr, (readers - area[ROUT]) / RINC);
+         threads::async::read(cctx, const_cast<uint64_t*>(&area[ROUT]), sizeof(uint64_t), offset(tupleAddr, ROUT));
+      }
+      backoff.acquired(tupleAddr);
+      threads::async::read(cctx, data(), dataSize(), tupleAddr);
+      return true;
+   }
+
+   // data, readers admitted, next writer admitted; one doorbell in this order
+   void unlockExclusive(uintptr_t tupleAddr)
+   {
+      lockArea()[WOUT] = ticket + 1;
+      chain.write(data(), dataSize(), tupleAddr, rdma::completion::unsignaled)
+          .fetchAdd(-phase, scratch(), offset(tupleAddr, RIN), rdma::completion::unsignaled)
+          .write(&lockArea()[WOUT], sizeof(uint64_t), offset(tupleAddr, WOUT), rdma::completion::signaled);
+      chain.post();
+      threads::async::wait(cctx);
+   }
+   void drain(uintptr_t) {}
+
+  private:
+   static constexpr uint64_t RINC = 0x100;  // reader increment
+   static constexpr uint64_t WBITS = 0x3;   // writer bits in rin
+   static constexpr uint64_t PRES = 0x2;    // writer present
+   static constexpr uint64_t PHID = 0x1;    // writer phase
+   static constexpr uint64_t RIN = 0;
+   static constexpr uint64_t ROUT = 1;
+   static constexpr uint64_t WIN = 2;
+   static constexpr uint64_t WOUT = 3;
+   threads::Worker::ConnectionContext& cctx;
+   rdma::WorkRequestChain<> chain;
+   uint64_t* buffer;
+   size_t tupleSize;
+   Backoff backoff;
+   uint64_t ticket = 0;
+   uint64_t phase = 0;
+   // -------------------------------------------------------------------------------------
+   uint64_t* lockArea() { return buffer + dataSize() / sizeof(uint64_t); }
+   uint64_t* scratch() { return buffer + tupleSize / sizeof(uint64_t); }
+   uintptr_t offset(uintptr_t tupleAddr, uint64_t word) const { return tupleAddr + dataSize() + word * sizeof(uint64_t); }
+};
+// -------------------------------------------------------------------------------------
+}  // namespace sync
+}  // namespace nam
@@ -0,0 +1,221 @@
+#include "CoroutineScheduler.hpp"
+// -------------------------------------------------------------------------------------
+#include <algorithm>
+#include <utility>
+// -------------------------------------------------------------------------------------
+#if !defined(__x86_64__)
+#error "CoroutineScheduler switches contexts with x86-64 assembly"
+#endif
+#if defined(__SANITIZE_ADDRESS__)
+#define NAM_ASAN_FIBERS 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define NAM_ASAN_FIBERS 1
+#endif
+#endif
+#ifdef NAM_ASAN_FIBERS
+#include <sanitizer/asan_interface.h>
+#include <sanitizer/common_interface_defs.h>
+#endif
+// -------------------------------------------------------------------------------------
+// Saves the callee-saved registers, mxcsr and the x87 control word on the current stack, stores the
+// stack pointer in *from and resumes the stack to by restoring the same frame (System V ABI).
+extern "C" void nam_switch_context(void** from, void* to);
+asm(R"(
+   .text
+   .globl nam_switch_context
+   .type nam_switch_context, @function
+nam_switch_context:
+   pushq %rbp
+   pushq %rbx
+   pushq %r15
+   pushq %r14
+   pushq %r13
+   pushq %r12
+   subq $16, %rsp
+   stmxcsr 8(%rsp)
+   fnstcw 12(%rsp)
+   movq %rsp, (%rdi)
+   movq %rsi, %rsp
+   ldmxcsr 8(%rsp)
+   fldcw 12(%rsp)
+   addq $16, %rsp
+   popq %r12
+   popq %r13
+   popq %r14
+   popq %r15
+   popq %rbx
+   popq %rbp
+   ret
+   .size nam_switch_context, .-nam_switch_context
+)");
+// -------------------------------------------------------------------------------------
+namespace nam
+{
+namespace threads
+{
+// -------------------------------------------------------------------------------------
+namespace
+{
+// frame popped by nam_switch_context when a coroutine is resumed the first time
+struct InitialFrame {
+   uint64_t pad;
+   uint32_t mxcsr;
+   uint16_t fpucw;
+   uint16_t pad2;
+   uint64_t registers[6];  // r12-r15, rbx, rbp
+   uint64_t returnAddress;  // entry
+   uint64_t entryReturnAddress;  // entry never returns
+};
+static_assert(sizeof(InitialFrame) == 80);
+// -------------------------------------------------------------------------------------
+// ASan (-DSANI=ON) tracks the stack it runs on, every switch is announced before and confirmed after;
+// a null fakeStack when leaving marks the stack as finished
+inline void startSwitch([[maybe_unused]] void** fakeStack, [[maybe_unused]] const void* bottom, [[maybe_unused]] size_t size)
+{
+#ifdef NAM_ASAN_FIBERS
+   __sanitizer_start_switch_fiber(fakeStack, bottom, size);
+#endif
+}
+inline void finishSwitch([[maybe_unused]] void* fakeStack, [[maybe_unused]] const void** bottomOld, [[maybe_unused]] size_t* sizeOld)
+{
+#ifdef NAM_ASAN_FIBERS
+   __sanitizer_finish_switch_fiber(fakeStack, bottomOld, sizeOld);
+#endif
+}
+// a reused stack still carries the poisoned redzones of the frames of its last coroutine
+inline void unpoisonStack([[maybe_unused]] void* stack, [[maybe_unused]] size_t size)
+{
+#ifdef NAM_ASAN_FIBERS
+   ASAN_UNPOISON_MEMORY_REGION(stack, size);
+#endif
+}
+}  // namespace
+// -------------------------------------------------------------------------------------
+thread_local CoroutineScheduler* CoroutineScheduler::tlsPtr = nullptr;
+// -------------------------------------------------------------------------------------
+void CoroutineScheduler::spawn(std::function<void()> task)
+{
+   Coroutine* coroutine;
+   if (finished.empty()) {
+      coroutines.push_back(std::make_unique<Coroutine>());
+      coroutine = coroutines.back().get();
+      coroutine->stack = std::make_unique<uint8_t[]>(stackSize);
+   } else {
+      coroutine = finished.back();
+      finished.pop_back();
+      unpoisonStack(coroutine->stack.get(), stackSize);
+   }
+   // entry starts as if it was called: rsp + 8 is 16 byte aligned
+   auto top = (reinterpret_cast<uintptr_t>(coroutine->stack.get()) + stackSize) & ~uintptr_t(15);
+   auto* frame = reinterpret_cast<InitialFrame*>(top - sizeof(InitialFrame));
+   *frame = {};
+   asm volatile("stmxcsr %0" : "=m"(frame->mxcsr));
+   asm volatile("fnstcw %0" : "=m"(frame->fpucw));
+   frame->returnAddress = reinterpret_cast<uint64_t>(&CoroutineScheduler::entry);
+   coroutine->sp = frame;
+   coroutine->task = std::move(task);
+   coroutine->finished = false;
+   ready.push_back(coroutine);
+   alive++;
+}
+// -------------------------------------------------------------------------------------
+void CoroutineScheduler::run()
+{
+   ensure(!running);
+   tlsPtr = this;
+   while (alive > 0 && !error) {
+      // coroutines that yield in a spin loop must not starve the ones waiting for completions
+      if (ready.empty() || yielded) {
+         yielded = false;
+         if (!pollWaiters() && ready.empty()) {
+            _mm_pause();
+            continue;
+         }
+      }
+      running = ready.front();
+      ready.pop_front();
+      startSwitch(&schedulerFakeStack, running->stack.get(), stackSize);
+      nam_switch_context(&schedulerSp, running->sp);
+      finishSwitch(schedulerFakeStack, nullptr, nullptr);
+      if (running->finished) {
+         finished.push_back(running);
+         alive--;
+      }
+      running = nullptr;
+   }
+   tlsPtr = nullptr;
+   if (error) {
+      // the remaining coroutines are abandoned
+      ready.clear();
+      waiters.clear();
+      alive = 0;
+      std::rethrow_exception(std::exchange(error, nullptr));
+   }
+}
+// -------------------------------------------------------------------------------------
+void CoroutineScheduler::entry()
+{
+   auto& scheduler = *tlsPtr;
+   auto* coroutine = scheduler.running;
+   finishSwitch(nullptr, &scheduler.schedulerStackBottom, &scheduler.schedulerStackSize);
+   // exceptions must not unwind past the first frame of the stack
+   try {
+      coroutine->task();
+   } catch (...) {
+      scheduler.error = std::current_exception();
+   }
+   coroutine->task = nullptr;
+   coroutine->finished = true;
+   // never resumed, spawn builds a new initial frame
+   startSwitch(nullptr, scheduler.schedulerStackBottom, scheduler.schedulerStackSize);
+   nam_switch_context(&coroutine->sp, scheduler.schedulerSp);
+   __builtin_unreachable();
+}
+// -------------------------------------------------------------------------------------
+void CoroutineScheduler::suspend()
+{
+   auto* self = running;
+   startSwitch(&self->fakeStack, schedulerStackBottom, schedulerStackSize);
+   nam_switch_context(&self->sp, schedulerSp);
+   finishSwitch(self->fakeStack, nullptr, nullptr);
+}
+// -------------------------------------------------------------------------------------
+void CoroutineScheduler::yield()
+{
+   ensure(running);
+   ready.push_back(running);
+   yielded = true;
+   suspend();
+}
+// -------------------------------------------------------------------------------------
+void CoroutineScheduler::awaitCompletion(rdma::CompletionDispatcher& completions)
+{
+   ensure(running);
+   auto it = std::find_if(waiters.begin(), waiters.end(), [&](auto& w) { return w.completions == &completions; });
+   if (it == waiters.end())
+      it = waiters.insert(waiters.end(), {&completions, {}});
+   it->queue.push_back(running);
+   suspend();
+}
+// -------------------------------------------------------------------------------------
+// polls every connection with waiting coroutines and makes them ready, returns false if nothing completed
+bool CoroutineScheduler::pollWaiters()
+{
+   bool progress = false;
+   for (auto& w : waiters) {
+      if (w.queue.empty())
+         continue;
+      w.completions->poll();
+      while (!w.queue.empty() && w.completions->untrackedAvailable() > 0) {
+         w.completions->waitUntracked();
+         ready.push_back(w.queue.front());
+         w.queue.pop_front();
+         progress = true;
+      }
+   }
+   return progress;
+}
+// -------------------------------------------------------------------------------------
+}  // namespace threads
+}  // namespace nam
@@ -0,0 +1,165 @@
+#pragma once
+// -------------------------------------------------------------------------------------
+#include "Worker.hpp"
+#include "nam/utils/Time.hpp"
+// -------------------------------------------------------------------------------------
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <vector>
+// -------------------------------------------------------------------------------------
+namespace nam
+{
+namespace threads
+{
+// -------------------------------------------------------------------------------------
+// Stackful coroutines on one worker thread. The tree is C++17, so coroutines switch stacks with a
+// hand-written context switch that saves only the callee-saved registers (swapcontext would save and
+// restore the signal mask with a syscall on every switch). Under ASan (-DSANI=ON) the switches are
+// announced as fiber switches.
+// A coroutine suspends while its RDMA request is in flight and is resumed once the completion was
+// polled; meanwhile the other coroutines of the worker post their requests and hide the round trip.
+// Protocols keep their post-then-wait structure, only the spin on the cq becomes async::wait().
+// Untracked completions of a connection arrive in posting order (RC) and are handed to the waiting
+// coroutines in the order they started waiting. Hence a coroutine has to wait for its signaled request
+// before it suspends for anything else and every connection needs its own cq (no FLAGS_qpSharing).
+// -------------------------------------------------------------------------------------
+class CoroutineScheduler
+{
+  public:
+   static constexpr uint64_t STACK_SIZE = 64 * 1024;
+   static thread_local CoroutineScheduler* tlsPtr;  // set while run() is active
+   // -------------------------------------------------------------------------------------
+   explicit CoroutineScheduler(uint64_t stackSize = STACK_SIZE) : stackSize(stackSize) {}
+   // -------------------------------------------------------------------------------------
+   void spawn(std::function<void()> task);
+   // runs until all coroutines finished, rethrows the first exception of a coroutine
+   void run();
+   // -------------------------------------------------------------------------------------
+   // only within a coroutine
+   bool inCoroutine() const { return running != nullptr; }
+   void awaitCompletion(rdma::CompletionDispatcher& completions);
+   void yield();
+
+  private:
+   struct Coroutine {
+      void* sp = nullptr;  // saved stack pointer while suspended
+      void* fakeStack = nullptr;  // ASan state of the suspended stack
+      std::unique_ptr<uint8_t[]> stack;
+      std::function<void()> task;
+      bool finished = false;
+   };
+   struct Waiters {
+      rdma::CompletionDispatcher* completions;
+      std::deque<Coroutine*> queue;
+   };
+   uint64_t stackSize;
+   void* schedulerSp = nullptr;
+   // stack of run() for ASan, learned when the first coroutine starts
+   void* schedulerFakeStack = nullptr;
+   const void* schedulerStackBottom = nullptr;
+   size_t schedulerStackSize = 0;
+   Coroutine* running = nullptr;
+   uint64_t alive = 0;
+   bool yielded = false;  // poll the waiters before resuming the next ready coroutine
+   std::vector<std::unique_ptr<Coroutine>> coroutines;
+   std::vector<Coroutine*> finished;  // stacks are reused by spawn
+   std::deque<Coroutine*> ready;
+   std::vector<Waiters> waiters;  // per connection, few storage nodes
+   std::exception_ptr error;
+   // -------------------------------------------------------------------------------------
+   static void entry();
+   void suspend();
+   bool pollWaiters();
+};
+// -------------------------------------------------------------------------------------
+// Awaitable RDMA operations, signaled with wr_id 0. Within a coroutine they suspend until the completion
+// arrived, otherwise they block on the dispatcher of the connection.
+// -------------------------------------------------------------------------------------
+namespace async
+{
+inline void wait(Worker::ConnectionContext& cctx)
+{
+   auto* scheduler = CoroutineScheduler::tlsPtr;
+   if (scheduler && scheduler->inCoroutine())
+      scheduler->awaitCompletion(cctx.completions);
+   else
+      cctx.completions.waitUntracked();
+}
+
+// backoff between remote polls, a coroutine lets the others run instead of spinning; it stays away
+// for about as long as the pauses would have taken (PAUSE_NS each, skylake and later) and yields
+// until then, so longer backoffs keep it suspended for more rounds of the scheduler
+static constexpr uint64_t PAUSE_NS = 40;
+
+inline void pause(uint64_t pauses)
+{
+   auto* scheduler = CoroutineScheduler::tlsPtr;
+   if (scheduler && scheduler->inCoroutine()) {
+      uint64_t deadline = utils::getTimePointNanoseconds() + pauses * PAUSE_NS;
+      do {
+         scheduler->yield();
+      } while (utils::getTimePointNanoseconds() < deadline);
+      return;
+   }
+   for (uint64_t p_i = 0; p_i < pauses; p_i++)
+      _mm_pause();
+}
+
+inline void read(Worker::ConnectionContext& cctx, void* memAddr, size_t size, size_t remoteOffset, bool needFence = false)
+{
+   auto& rctx = *cctx.rctx;
+   rdma::postRead(memAddr, size, rctx.id->qp, rctx.mr, rdma::completion::signaled, rctx.rkey, remoteOffset, 0, needFence);
+   wait(cctx);
+}
+
+inline void write(Worker::ConnectionContext& cctx, void* memAddr, size_t size, size_t remoteOffset)
+{
+   auto& rctx = *cctx.rctx;
+   rdma::postWrite(memAddr, size, rctx.id->qp, rctx.mr, rdma::completion::signaled, rctx.rkey, remoteOffset);
+   wait(cctx);
+}
+
+inline void compareSwap(Worker::ConnectionContext& cctx, uint64_t expected, uint64_t desired, uint64_t* memAddr, size_t remoteOffset)
+{
+   rdma::postCompareSwap(expected, desired, memAddr, *cctx.rctx, rdma::completion::signaled, remoteOffset);
+   wait(cctx);
+}
+
+inline void fetchAdd(Worker::ConnectionContext& cctx, uint64_t toAdd, uint64_t* memAddr, size_t remoteOffset, bool needFence = false)
+{
+   rdma::postFetchAdd(toAdd, memAddr, *cctx.rctx, rdma::completion::signaled, remoteOffset, needFence);
+   wait(cctx);
+}
+// -------------------------------------------------------------------------------------
+// the same for regions with their own registration, see rdma::MemoryKeys
+inline void read(Worker::ConnectionContext& cctx, rdma::MemoryKeys keys, void* memAddr, size_t size, size_t remoteOffset, bool needFence = false)
+{
+   rdma::postRead(memAddr, size, *cctx.rctx, keys, rdma::completion::signaled, remoteOffset, 0, needFence);
+   wait(cctx);
+}
+
+inline void write(Worker::ConnectionContext& cctx, rdma::MemoryKeys keys, void* memAddr, size_t size, size_t remoteOffset)
+{
+   rdma::postWrite(memAddr, size, *cctx.rctx, keys, rdma::completion::signaled, remoteOffset);
+   wait(cctx);
+}
+
+inline void compareSwap(Worker::ConnectionContext& cctx, rdma::MemoryKeys keys, uint64_t expected, uint64_t desired, uint64_t* memAddr,
+                        size_t remoteOffset)
+{
+   rdma::postCompareSwap(expected, desired, memAddr, *cctx.rctx, keys, rdma::completion::signaled, remoteOffset);
+   wait(cctx);
+}
+
+inline void fetchAdd(Worker::ConnectionContext& cctx, rdma::MemoryKeys keys, uint64_t toAdd, uint64_t* memAddr, size_t remoteOffset,
+                     bool needFence = false)
+{
+   rdma::postFetchAdd(toAdd, memAddr, *cctx.rctx, keys, rdma::completion::signaled, remoteOffset, needFence);
+   wait(cctx);
+}
+}  // namespace async
+// -------------------------------------------------------------------------------------
+}  // namespace threads
+}  // namespace nam
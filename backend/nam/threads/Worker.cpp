@@ -1,50 +1,67 @@
 #include "Worker.hpp"
+#include "nam/utils/Time.hpp"
 // -------------------------------------------------------------------------------------
 namespace nam {
 namespace threads {
 // -------------------------------------------------------------------------------------
 thread_local Worker* Worker::tlsPtr = nullptr;
 // -------------------------------------------------------------------------------------
-Worker::Worker(uint64_t workerId, std::string name, rdma::CM<rdma::InitMessage>& cm, NodeID nodeId)
+Worker::Worker(uint64_t workerId, std::string name, rdma::CM<rdma::InitMessage>& cm, NodeID nodeId, Worker* leader)
     : workerId(workerId),
       name(name),
       cpuCounters(name),
       cm(cm),
       nodeId_(nodeId),
       cctxs(FLAGS_storage_nodes),
-      threadContext(std::make_unique<ThreadContext>()) {
+      threadContext(std::make_unique<ThreadContext>()),
+      regions(FLAGS_storage_nodes) {
    ThreadContext::tlsPtr = threadContext.get();
+   ensure(FLAGS_pollingInterval > 0 && FLAGS_pollingInterval <= rdma::SEND_QUEUE_DEPTH);
+   if (leader) {
+      auto start = utils::getTimePoint();
+      cctxs = leader->cctxs;
+      for (auto& cctx : cctxs)
+         cctx.member = workerId % FLAGS_qpSharing;
+      catalog = leader->catalog;
+      regions = leader->regions;
+      connectTime = leader->connectTime + (utils::getTimePoint() - start);
+      return;
+   }
    // -------------------------------------------------------------------------------------
    // Connection to MessageHandler
    // -------------------------------------------------------------------------------------
-   // First initiate connection
+   // First initiate connections to all storage nodes concurrently
+   auto start = utils::getTimePoint();
+   std::vector<std::string> ips(STORAGE_NODES[FLAGS_storage_nodes].begin(), STORAGE_NODES[FLAGS_storage_nodes].begin() + FLAGS_storage_nodes);
+   auto rctxs = cm.initiateConnections(ips, rdma::Type::WORKER, workerId, nodeId);
    for (uint64_t n_i = 0; n_i < FLAGS_storage_nodes; n_i++) {
       // -------------------------------------------------------------------------------------
-      auto& ip = STORAGE_NODES[FLAGS_storage_nodes][n_i];
-      cctxs[n_i].rctx = &(cm.initiateConnection(ip, rdma::Type::WORKER, workerId, nodeId));
+      cctxs[n_i].rctx = rctxs[n_i];
       cctxs[n_i].wqe = 0;
+      cctxs[n_i].completions = rdma::CompletionDispatcher(cctxs[n_i].rctx->id->qp->send_cq);
+      if (FLAGS_qpSharing > 1)
+         cctxs[n_i].sharedQp = std::make_shared<rdma::SharedQueuePair>(*cctxs[n_i].rctx, FLAGS_qpSharing);
       // -------------------------------------------------------------------------------------
    }
 
    // -------------------------------------------------------------------------------------
    // Second finish connection
    rdma::InitMessage* init = (rdma::InitMessage*)cm.getGlobalBuffer().allocate(sizeof(rdma::InitMessage)); 
+   init->nodeId = nodeId;
+   init->threadId = workerId + (nodeId*FLAGS_worker);
+   cm.exchangeInitialMessages(rctxs, init);
    for (uint64_t n_i = 0; n_i < FLAGS_storage_nodes; n_i++) {
-      init->nodeId = nodeId;
-      init->threadId = workerId + (nodeId*FLAGS_worker);
-      // -------------------------------------------------------------------------------------
-      cm.exchangeInitialMesssage(*(cctxs[n_i].rctx), init);
-      // -------------------------------------------------------------------------------------
-
       auto& msg = *reinterpret_cast<InitMessage*>((cctxs[n_i].rctx->applicationData));
       auto num_regions = msg.num_regions;
       std::cout << "num regions " << num_regions << "\n";
-      // for(uint64_t t_i = 0; t_i < num_regions; t_i++){
-      // hack only supports one region at the moment 
-         catalog.insert({n_i,{.start = msg.mem_regions[0].offset, .size_bytes = msg.mem_regions[0].size_bytes, .region_id = (int)0}});
-      // }
+      for (uint64_t r_i = 0; r_i < num_regions; r_i++) {
+         auto& region = msg.mem_regions[r_i];
+         regions[n_i][region.name] = {.start = region.offset, .size_bytes = region.size_bytes, .region_id = (int)r_i, .rkey = region.rkey};
+      }
+      catalog.insert({(int)n_i, {.start = msg.mem_regions[0].offset, .size_bytes = msg.mem_regions[0].size_bytes, .region_id = 0, .rkey = msg.mem_regions[0].rkey}});
    }
 
+   connectTime = utils::getTimePoint() - start;
    std::cout << "Connected" << std::endl;
 }
 
@@ -4,6 +4,8 @@
 #include "nam/profiling/counters/CPUCounters.hpp"
 #include "nam/profiling/counters/WorkerCounters.hpp"
 #include "nam/rdma/CommunicationManager.hpp"
+#include "nam/rdma/CompletionDispatcher.hpp"
+#include "nam/rdma/SharedQueuePair.hpp"
 // -------------------------------------------------------------------------------------
 namespace nam {
 namespace threads {
@@ -28,6 +30,39 @@ struct Worker{
    struct ConnectionContext {
       rdma::RdmaContext* rctx;
       uint64_t wqe;  // wqe currently outstanding
+      uint64_t unsignaled = 0;  // wqe posted since the last signaled one
+      rdma::CompletionDispatcher completions;  // send cq of rctx
+      // with FLAGS_qpSharing > 1 rctx belongs to the group leader and all requests go through sharedQp,
+      // rctx and completions must not be used directly
+      std::shared_ptr<rdma::SharedQueuePair> sharedQp;
+      uint64_t member = 0;  // index in sharedQp
+      // -------------------------------------------------------------------------------------
+      // selective signaling for unsignaled pipelines, call before every post on rctx.
+      // Every FLAGS_pollingInterval-th request is signaled and tracked, its completion retires all requests
+      // posted before it. Completions are reaped before the send queue or the cq could overflow;
+      // half of the cq is left to signaled requests of the application.
+      // returns the completion and the wr_id the request has to be posted with
+      std::pair<rdma::completion, uint64_t> nextWQE()
+      {
+         constexpr uint64_t maxSignaled = rdma::COMPLETION_QUEUE_DEPTH / 2;
+         const uint64_t maxWqe = std::min(rdma::SEND_QUEUE_DEPTH, maxSignaled * FLAGS_pollingInterval);
+         while (wqe >= maxWqe) {
+            if (completions.poll() == 0)
+               _mm_pause();
+         }
+         wqe++;
+         if (++unsignaled < FLAGS_pollingInterval)
+            return {rdma::completion::unsignaled, rdma::CompletionDispatcher::UNTRACKED};
+         auto retire = unsignaled;
+         unsignaled = 0;
+         return {rdma::completion::signaled, completions.track([this, retire](const ibv_wc&) { wqe -= retire; })};
+      }
+      // polls until all signaled requests retired, the unsignaled tail is not waited for
+      void drain()
+      {
+         while (wqe > unsignaled)
+            completions.poll();
+      }
    };
    // -------------------------------------------------------------------------------------
    struct PartitionInfo {
@@ -42,8 +77,17 @@ struct Worker{
    NodeID nodeId_;
    std::vector<ConnectionContext> cctxs;
    std::unique_ptr<ThreadContext> threadContext;
-   std::unordered_map<int,MemoryRegionDesc> catalog; // ptr, size of region
-   Worker(uint64_t workerId, std::string name, rdma::CM<rdma::InitMessage>& cm, NodeID nodeId);
+   std::unordered_map<int,MemoryRegionDesc> catalog; // first region of every storage node
+   std::vector<std::unordered_map<std::string, MemoryRegionDesc>> regions;  // storage node -> region name -> region
+   uint64_t connectTime = 0;  // us until all connections were ready
+   // -------------------------------------------------------------------------------------
+   MemoryRegionDesc& getRegion(uint64_t storageNode, const std::string& regionName) {
+      auto it = regions[storageNode].find(regionName);
+      if (it == regions[storageNode].end()) throw std::runtime_error("Unknown memory region " + regionName);
+      return it->second;
+   }
+   // members of a QP sharing group pass their group leader and reuse its connections
+   Worker(uint64_t workerId, std::string name, rdma::CM<rdma::InitMessage>& cm, NodeID nodeId, Worker* leader = nullptr);
    ~Worker();
 };
 // -------------------------------------------------------------------------------------
@@ -10,17 +10,34 @@ namespace threads
 {
 // -------------------------------------------------------------------------------------
 
-WorkerPool::WorkerPool(rdma::CM<rdma::InitMessage>& cm, NodeID nodeId): workers(MAX_WORKER_THREADS,nullptr)
+WorkerPool::WorkerPool(rdma::CM<rdma::InitMessage>& cm, NodeID nodeId, bool sharedQpAware): workers(MAX_WORKER_THREADS,nullptr)
 {
    workersCount = FLAGS_worker;
    ensure(workersCount < MAX_WORKER_THREADS);
+   ensure(FLAGS_qpSharing > 0 && FLAGS_qpSharing <= rdma::COMPLETION_QUEUE_DEPTH / 2);
+   // the storage nodes expect FLAGS_worker / FLAGS_qpSharing connections per compute node
+   if (workersCount % FLAGS_qpSharing != 0)
+      throw std::runtime_error("-worker has to be a multiple of -qpSharing");
+   // the members of a group poll the same cq, posting and polling it directly steals completions
+   if (FLAGS_qpSharing > 1 && !sharedQpAware)
+      throw std::runtime_error("-qpSharing > 1 is not supported by this benchmark");
    workerThreads.reserve(workersCount);
    for (uint64_t t_i = 0; t_i < workersCount; t_i++) {
       workerThreads.emplace_back([&, t_i]() {
          std::string threadName("worker_" + std::to_string(t_i));
          pthread_setname_np(pthread_self(), threadName.c_str());
          // -------------------------------------------------------------------------------------
-         workers[t_i] = new Worker(t_i, threadName, cm, nodeId);
+         // only the first worker of a sharing group connects, the others wait for it
+         auto g_i = t_i / FLAGS_qpSharing;
+         if (t_i % FLAGS_qpSharing == 0) {
+            workers[t_i] = new Worker(t_i, threadName, cm, nodeId);
+            groupLeaders[g_i] = workers[t_i];
+         } else {
+            Worker* leader;
+            while ((leader = groupLeaders[g_i].load()) == nullptr)
+               _mm_pause();
+            workers[t_i] = new Worker(t_i, threadName, cm, nodeId, leader);
+         }
          Worker::tlsPtr = workers[t_i];
          // -------------------------------------------------------------------------------------
          runningThreads++;
@@ -32,12 +32,14 @@ class WorkerPool
    // -------------------------------------------------------------------------------------
    std::vector<std::thread> workerThreads;
    std::vector<Worker*> workers;
+   std::atomic<Worker*> groupLeaders[MAX_WORKER_THREADS]{};  // first worker of every QP sharing group
    WorkerThread workerThreadsMeta [MAX_WORKER_THREADS];
    uint32_t workersCount;
   public:
    
    // -------------------------------------------------------------------------------------
-   WorkerPool(rdma::CM<rdma::InitMessage>& cm, NodeID nodeId);
+   // sharedQpAware: the jobs post through ConnectionContext::sharedQp, required for FLAGS_qpSharing > 1
+   WorkerPool(rdma::CM<rdma::InitMessage>& cm, NodeID nodeId, bool sharedQpAware = false);
    ~WorkerPool();
    // -------------------------------------------------------------------------------------
    void scheduleJobAsync(uint64_t t_i, std::function<void()> job);
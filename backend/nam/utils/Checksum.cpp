@@ -0,0 +1,225 @@
+#include "Checksum.hpp"
+#include "crc64.hpp"
+// -------------------------------------------------------------------------------------
+#include <immintrin.h>
+#include <cstring>
+#include <stdexcept>
+// -------------------------------------------------------------------------------------
+// -------------------------------------------------------------------------------------
+namespace nam
+{
+namespace utils
+{
+namespace
+{
+// -------------------------------------------------------------------------------------
+// crc64 folding constants: the crc is reflected, so a 16 byte block d bits ahead of the next one is
+// folded into it with its first 8 bytes times x^(d+63) mod P and its last 8 bytes times x^(d-1) mod P
+// (reflected, the carry-less product of reflected operands is one bit short).
+// -------------------------------------------------------------------------------------
+constexpr uint64_t CRC64_POLY = 0xad93d23594c935a9;
+constexpr uint64_t xPowMod(uint64_t e)
+{
+   uint64_t r = 1;
+   for (uint64_t e_i = 0; e_i < e; e_i++)
+      r = (r << 1) ^ ((r >> 63) ? CRC64_POLY : 0);
+   return r;
+}
+constexpr uint64_t reflect64(uint64_t v)
+{
+   uint64_t r = 0;
+   for (uint64_t b_i = 0; b_i < 64; b_i++)
+      r |= ((v >> b_i) & 1) << (63 - b_i);
+   return r;
+}
+struct FoldConstants {
+   uint64_t first;
+   uint64_t second;
+};
+constexpr FoldConstants foldBy(uint64_t bits)
+{
+   return {reflect64(xPowMod(bits + 63)), reflect64(xPowMod(bits - 1))};
+}
+constexpr FoldConstants FOLD_128 = foldBy(128), FOLD_256 = foldBy(256), FOLD_384 = foldBy(384), FOLD_512 = foldBy(512);
+// -------------------------------------------------------------------------------------
+void initCrc64Table()
+{
+   static bool initialized = (crc64_init(), true);
+   (void)initialized;
+}
+// -------------------------------------------------------------------------------------
+__attribute__((target("pclmul,sse4.1"))) inline __m128i fold(__m128i block, FoldConstants k)
+{
+   const __m128i constants = _mm_set_epi64x(k.second, k.first);
+   return _mm_xor_si128(_mm_clmulepi64_si128(block, constants, 0x00), _mm_clmulepi64_si128(block, constants, 0x11));
+}
+__attribute__((target("pclmul,sse4.1"))) uint64_t crc64Folded(uint64_t crc, const uint8_t* p, uint64_t bytes)
+{
+   auto load = [](const uint8_t* at) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(at)); };
+   // four blocks in flight hide the latency of the multiplication
+   __m128i b0 = _mm_xor_si128(load(p), _mm_cvtsi64_si128(crc)), b1 = load(p + 16), b2 = load(p + 32), b3 = load(p + 48);
+   p += 64;
+   bytes -= 64;
+   for (; bytes >= 64; p += 64, bytes -= 64) {
+      b0 = _mm_xor_si128(fold(b0, FOLD_512), load(p));
+      b1 = _mm_xor_si128(fold(b1, FOLD_512), load(p + 16));
+      b2 = _mm_xor_si128(fold(b2, FOLD_512), load(p + 32));
+      b3 = _mm_xor_si128(fold(b3, FOLD_512), load(p + 48));
+   }
+   __m128i folded = _mm_xor_si128(_mm_xor_si128(fold(b0, FOLD_384), fold(b1, FOLD_256)), _mm_xor_si128(fold(b2, FOLD_128), b3));
+   for (; bytes >= 16; p += 16, bytes -= 16)
+      folded = _mm_xor_si128(fold(folded, FOLD_128), load(p));
+   // the last block and the tail through the table
+   alignas(16) uint8_t last[16];
+   _mm_store_si128(reinterpret_cast<__m128i*>(last), folded);
+   return crc64(crc64(0, last, sizeof(last)), p, bytes);
+}
+// -------------------------------------------------------------------------------------
+__attribute__((target("sse4.2"))) uint32_t crc32cHardware(uint32_t crc, const uint8_t* p, uint64_t bytes)
+{
+   uint64_t c = ~crc;
+   for (; bytes >= 8; p += 8, bytes -= 8) {
+      uint64_t word;
+      std::memcpy(&word, p, sizeof(word));
+      c = _mm_crc32_u64(c, word);
+   }
+   auto c32 = static_cast<uint32_t>(c);
+   for (; bytes > 0; p++, bytes--)
+      c32 = _mm_crc32_u8(c32, *p);
+   return ~c32;
+}
+// -------------------------------------------------------------------------------------
+// xxHash64
+constexpr uint64_t P1 = 11400714785074694791ull, P2 = 14029467366897019727ull, P3 = 1609587929392839161ull;
+constexpr uint64_t P4 = 9650029242287828579ull, P5 = 2870177450012600261ull;
+inline uint64_t rotl(uint64_t v, int r) { return (v << r) | (v >> (64 - r)); }
+inline uint64_t read64(const uint8_t* p)
+{
+   uint64_t v;
+   std::memcpy(&v, p, sizeof(v));
+   return v;
+}
+inline uint64_t xxRound(uint64_t acc, uint64_t input) { return rotl(acc + input * P2, 31) * P1; }
+inline uint64_t merge(uint64_t acc, uint64_t lane) { return (acc ^ xxRound(0, lane)) * P1 + P4; }
+// -------------------------------------------------------------------------------------
+uint64_t crc64Checksum(const void* data, uint64_t bytes)
+{
+   return crc64(0, static_cast<const unsigned char*>(data), bytes);
+}
+uint64_t crc64ClmulChecksum(const void* data, uint64_t bytes) { return crc64Clmul(0, data, bytes); }
+uint64_t crc32cChecksum(const void* data, uint64_t bytes) { return crc32c(0, data, bytes); }
+uint64_t hash64Checksum(const void* data, uint64_t bytes) { return hash64(data, bytes); }
+}  // namespace
+// -------------------------------------------------------------------------------------
+ChecksumKind parseChecksum(const std::string& name)
+{
+   if (name == "crc64")
+      return ChecksumKind::CRC64;
+   if (name == "crc64_clmul")
+      return ChecksumKind::CRC64_CLMUL;
+   if (name == "crc32c")
+      return ChecksumKind::CRC32C;
+   if (name == "hash64")
+      return ChecksumKind::HASH64;
+   throw std::runtime_error("Unknown checksum " + name);
+}
+// -------------------------------------------------------------------------------------
+const char* checksumName(ChecksumKind kind)
+{
+   switch (kind) {
+      case ChecksumKind::CRC64:
+         return "crc64";
+      case ChecksumKind::CRC64_CLMUL:
+         return "crc64_clmul";
+      case ChecksumKind::CRC32C:
+         return "crc32c";
+      case ChecksumKind::HASH64:
+         return "hash64";
+   }
+   return "unknown";
+}
+// -------------------------------------------------------------------------------------
+bool checksumSupported(ChecksumKind kind)
+{
+   __builtin_cpu_init();
+   switch (kind) {
+      case ChecksumKind::CRC64_CLMUL:
+         return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+      case ChecksumKind::CRC32C:
+         return __builtin_cpu_supports("sse4.2");
+      default:
+         return true;
+   }
+}
+// -------------------------------------------------------------------------------------
+ChecksumFunction checksumFunction(ChecksumKind kind)
+{
+   if (!checksumSupported(kind))
+      throw std::runtime_error(std::string("Checksum not supported by the cpu ") + checksumName(kind));
+   initCrc64Table();
+   switch (kind) {
+      case ChecksumKind::CRC64:
+         return crc64Checksum;
+      case ChecksumKind::CRC64_CLMUL:
+         return crc64ClmulChecksum;
+      case ChecksumKind::CRC32C:
+         return crc32cChecksum;
+      case ChecksumKind::HASH64:
+         return hash64Checksum;
+   }
+   throw std::runtime_error("Unknown checksum");
+}
+// -------------------------------------------------------------------------------------
+uint64_t crc64Clmul(uint64_t crc, const void* data, uint64_t bytes)
+{
+   initCrc64Table();
+   if (bytes < 64)
+      return crc64(crc, static_cast<const unsigned char*>(data), bytes);
+   return crc64Folded(crc, static_cast<const uint8_t*>(data), bytes);
+}
+// -------------------------------------------------------------------------------------
+uint32_t crc32c(uint32_t crc, const void* data, uint64_t bytes)
+{
+   return crc32cHardware(crc, static_cast<const uint8_t*>(data), bytes);
+}
+// -------------------------------------------------------------------------------------
+uint64_t hash64(const void* data, uint64_t bytes, uint64_t seed)
+{
+   auto* p = static_cast<const uint8_t*>(data);
+   const uint64_t length = bytes;
+   uint64_t h;
+   if (bytes >= 32) {
+      uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+      for (; bytes >= 32; p += 32, bytes -= 32) {
+         v1 = xxRound(v1, read64(p));
+         v2 = xxRound(v2, read64(p + 8));
+         v3 = xxRound(v3, read64(p + 16));
+         v4 = xxRound(v4, read64(p + 24));
+      }
+      h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+      h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+   } else {
+      h = seed + P5;
+   }
+   h += length;
+   for (; bytes >= 8; p += 8, bytes -= 8)
+      h = rotl(h ^ xxRound(0, read64(p)), 27) * P1 + P4;
+   if (bytes >= 4) {
+      uint32_t word;
+      std::memcpy(&word, p, sizeof(word));
+      h = rotl(h ^ (word * P1), 23) * P2 + P3;
+      p += 4;
+      bytes -= 4;
+   }
+   for (; bytes > 0; p++, bytes--)
+      h = rotl(h ^ (*p * P5), 11) * P1;
+   h ^= h >> 33;
+   h *= P2;
+   h ^= h >> 29;
+   h *= P3;
+   h ^= h >> 32;
+   return h;
+}
+// -------------------------------------------------------------------------------------
+}  // namespace utils
+}  // namespace nam
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstdint>
+#include <string>
+// -------------------------------------------------------------------------------------
+// -------------------------------------------------------------------------------------
+// -------------------------------------------------------------------------------------
+namespace nam
+{
+namespace utils
+{
+// -------------------------------------------------------------------------------------
+// Checksums of the optimistic CRC consistency scheme, selected with -checksum:
+//  crc64:       table driven crc64 (Jones, as in Redis) of crc64.cpp, the reference.
+//  crc64_clmul: the same crc64 folded with carry-less multiplications (PCLMULQDQ), 64 bytes per step.
+//  crc32c:      SSE4.2 crc32 instruction (Castagnoli), 8 bytes per instruction.
+//  hash64:      xxHash64, not a crc, four independent multiply-rotate lanes.
+// All variants take the whole buffer and start from 0. checksumFunction() throws if the cpu lacks the
+// instructions of the variant.
+// -------------------------------------------------------------------------------------
+enum class ChecksumKind : uint8_t { CRC64, CRC64_CLMUL, CRC32C, HASH64 };
+using ChecksumFunction = uint64_t (*)(const void* data, uint64_t bytes);
+
+ChecksumKind parseChecksum(const std::string& name);
+const char* checksumName(ChecksumKind kind);
+bool checksumSupported(ChecksumKind kind);
+ChecksumFunction checksumFunction(ChecksumKind kind);
+// -------------------------------------------------------------------------------------
+// crc continues a previous crc64 / crc32c like crc64() does; callers check checksumSupported() first
+uint64_t crc64Clmul(uint64_t crc, const void* data, uint64_t bytes);
+uint32_t crc32c(uint32_t crc, const void* data, uint64_t bytes);
+uint64_t hash64(const void* data, uint64_t bytes, uint64_t seed = 0);
+// -------------------------------------------------------------------------------------
+}  // namespace utils
+}  // namespace nam
@@ -0,0 +1,97 @@
+#pragma once
+// -------------------------------------------------------------------------------------
+#include "Defs.hpp"
+// -------------------------------------------------------------------------------------
+#include <algorithm>
+#include <array>
+#include <cstdint>
+// -------------------------------------------------------------------------------------
+namespace nam
+{
+namespace utils
+{
+// -------------------------------------------------------------------------------------
+// The 64 byte lines of the local copy of a tuple that a critical section modified, an exclusive unlock
+// writes back only these instead of the whole tuple. Offsets are bytes from the start of the copy, the
+// lock protocols add the lines of their own words (version, lock, checksum) themselves.
+// -------------------------------------------------------------------------------------
+class DirtyLines
+{
+  public:
+   static constexpr uint64_t LINE = 64;
+   static constexpr uint64_t MAX_LINES = 1024;  // 64 KB, the largest blocks of the experiments
+   // -------------------------------------------------------------------------------------
+   explicit DirtyLines(uint64_t bytes) : lines((bytes + LINE - 1) / LINE) { ensure(lines > 0 && lines <= MAX_LINES); }
+   static DirtyLines all(uint64_t bytes)
+   {
+      DirtyLines dirty(bytes);
+      dirty.markAll();
+      return dirty;
+   }
+   // -------------------------------------------------------------------------------------
+   void mark(uint64_t offset, uint64_t length)
+   {
+      if (length == 0)
+         return;
+      ensure(offset + length <= lines * LINE);
+      for (uint64_t l_i = offset / LINE; l_i <= (offset + length - 1) / LINE; l_i++)
+         bits[l_i / 64] |= 1ul << (l_i % 64);
+   }
+   void markWord(uint64_t word) { mark(word * sizeof(uint64_t), sizeof(uint64_t)); }
+   void markAll() { mark(0, lines * LINE); }
+   void clear() { bits = {}; }
+   // -------------------------------------------------------------------------------------
+   bool dirty(uint64_t line) const { return bits[line / 64] & (1ul << (line % 64)); }
+   uint64_t count() const
+   {
+      uint64_t dirtyLines = 0;
+      for (auto word : bits)
+         dirtyLines += __builtin_popcountl(word);
+      return dirtyLines;
+   }
+   // -------------------------------------------------------------------------------------
+   // f(offset, length) per run of consecutive dirty lines within [begin, end), in ascending order. More
+   // than maxRuns runs become one run from the first to the last dirty line, a work request per run is
+   // not worth it for scattered lines.
+   template <typename F>
+   void forEachRun(uint64_t begin, uint64_t end, uint64_t maxRuns, F&& f) const
+   {
+      uint64_t runs = 0, first = end, last = begin;
+      scan(begin, end, [&](uint64_t offset, uint64_t length) {
+         runs++;
+         first = std::min(first, offset);
+         last = offset + length;
+      });
+      if (runs > maxRuns) {
+         f(first, last - first);
+         return;
+      }
+      scan(begin, end, f);
+   }
+
+  private:
+   uint64_t lines;
+   std::array<uint64_t, MAX_LINES / 64> bits{};
+   // -------------------------------------------------------------------------------------
+   template <typename F>
+   void scan(uint64_t begin, uint64_t end, F&& f) const
+   {
+      uint64_t l_i = begin / LINE;
+      const uint64_t endLine = (end + LINE - 1) / LINE;
+      while (l_i < endLine) {
+         if (!dirty(l_i)) {
+            l_i++;
+            continue;
+         }
+         uint64_t runEnd = l_i + 1;
+         while (runEnd < endLine && dirty(runEnd))
+            runEnd++;
+         uint64_t offset = std::max(l_i * LINE, begin);
+         f(offset, std::min(runEnd * LINE, end) - offset);
+         l_i = runEnd;
+      }
+   }
+};
+// -------------------------------------------------------------------------------------
+}  // namespace utils
+}  // namespace nam
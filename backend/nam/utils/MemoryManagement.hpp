@@ -1,9 +1,21 @@
 #pragma once
 // -------------------------------------------------------------------------------------
+#include <dirent.h>
+#include <numa.h>
+#include <numaif.h>
 #include <sys/mman.h>
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <fstream>
 #include <iostream>
+#include <memory>
 #include <memory_resource>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 // -------------------------------------------------------------------------------------
 namespace nam
 {
@@ -14,23 +26,111 @@ namespace utils
 
 // -------------------------------------------------------------------------------------
 
+// numa placement besides a node id
+static constexpr int NUMA_DEFAULT = -1;     // memory policy of the calling thread
+static constexpr int NUMA_INTERLEAVE = -2;  // pages round robin over all nodes
+// -------------------------------------------------------------------------------------
+// node of the first RDMA device, NUMA_DEFAULT if unknown (e.g. single socket or no device)
+inline int nicNumaNode()
+{
+   DIR* devices = opendir("/sys/class/infiniband");
+   if (!devices)
+      return NUMA_DEFAULT;
+   int node = NUMA_DEFAULT;
+   while (auto* entry = readdir(devices)) {
+      if (entry->d_name[0] == '.')
+         continue;
+      std::ifstream numaFile(std::string("/sys/class/infiniband/") + entry->d_name + "/device/numa_node");
+      if (numaFile >> node)
+         break;
+   }
+   closedir(devices);
+   return node < 0 ? NUMA_DEFAULT : node;
+}
+// -------------------------------------------------------------------------------------
+// "default", "interleave", "nic" or a node id
+inline int parseNumaPolicy(const std::string& policy)
+{
+   if (policy == "default")
+      return NUMA_DEFAULT;
+   if (policy == "interleave")
+      return NUMA_INTERLEAVE;
+   if (policy == "nic") {
+      auto node = nicNumaNode();
+      if (node == NUMA_DEFAULT)
+         std::cerr << "numa node of the NIC unknown, using the default policy" << std::endl;
+      return node;
+   }
+   return std::stoi(policy);
+}
+// -------------------------------------------------------------------------------------
 // RAII for huge pages
+// Falls back from the requested page size to the default huge pages and then to regular pages with
+// transparent huge pages. The numa policy is applied before the first touch, prefaulting with several
+// threads moves the page faults out of the registration and the first accesses.
 template <typename T>
 class HugePages
 {
    T* memory;
    size_t size; // in bytes
+   size_t mappedSize;  // rounded to the page size
+   size_t mappedPageSize = 0;  // 0 for the default huge page size
    size_t highWaterMark;  // max index
   public:
-   HugePages(size_t size) : size(size)
+   // pageSize 0 uses the default huge page size, numaNode a node id, NUMA_DEFAULT or NUMA_INTERLEAVE
+   HugePages(size_t size, size_t pageSize = 0, int numaNode = NUMA_DEFAULT, uint64_t prefaultThreads = 0) : size(size)
    {
-      void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      int hugeFlags = 0;
+      if (pageSize == (1ul << 30))
+         hugeFlags = (30 << MAP_HUGE_SHIFT);
+      else if (pageSize == (2ul << 20))
+         hugeFlags = (21 << MAP_HUGE_SHIFT);
+      else if (pageSize != 0)
+         throw std::runtime_error("unsupported huge page size " + std::to_string(pageSize));
+      void* p = MAP_FAILED;
+      if (pageSize != 0) {
+         p = map(pageSize, MAP_HUGETLB | hugeFlags);
+         if (p == MAP_FAILED)
+            std::cerr << "no " << (pageSize >> 20) << " MB huge pages available, falling back" << std::endl;
+         else
+            mappedPageSize = pageSize;
+      }
+      if (p == MAP_FAILED)
+         p = map(DEFAULT_HUGE_PAGE_SIZE, MAP_HUGETLB);
+      if (p == MAP_FAILED) {
+         std::cerr << "no huge pages available, falling back to transparent huge pages" << std::endl;
+         p = map(DEFAULT_HUGE_PAGE_SIZE, 0);
+         if (p != MAP_FAILED) {
+            madvise(p, mappedSize, MADV_HUGEPAGE);
+            mappedPageSize = SMALL_PAGE_SIZE;
+         }
+      }
       if (p == MAP_FAILED)
          throw std::runtime_error("mallocHugePages failed");
+      if (numaNode != NUMA_DEFAULT) {
+         // bind before the first touch, pages are placed on fault
+         unsigned long nodemask = 0;
+         int mode = MPOL_BIND;
+         if (numaNode == NUMA_INTERLEAVE) {
+            mode = MPOL_INTERLEAVE;
+            for (int n_i = 0; n_i <= numa_max_node() && n_i < 64; n_i++)
+               nodemask |= 1ul << n_i;
+         } else if (numaNode >= 0 && numaNode < 64) {
+            nodemask = 1ul << numaNode;
+         }
+         if (nodemask == 0 || mbind(p, mappedSize, mode, &nodemask, sizeof(nodemask) * 8, 0) != 0) {
+            munmap(p, mappedSize);
+            throw std::runtime_error("mbind to numa node " + std::to_string(numaNode) + " failed");
+         }
+      }
       memory = static_cast<T*>(p);
       highWaterMark = (size / sizeof(T));
+      if (prefaultThreads > 0)
+         prefault(prefaultThreads);
    }
 
+   size_t getPageSize() { return mappedPageSize; }
+
    size_t get_size(){
       return highWaterMark;
    }
@@ -42,7 +142,34 @@ class HugePages
    {
       return memory[index];
    }
-   ~HugePages() { munmap(memory, size); }
+   ~HugePages() { munmap(memory, mappedSize); }
+
+  private:
+   static constexpr size_t DEFAULT_HUGE_PAGE_SIZE = 2ul << 20;  // only used for rounding
+   static constexpr size_t SMALL_PAGE_SIZE = 4096;
+
+   void* map(size_t pageSize, int flags)
+   {
+      mappedSize = (size + pageSize - 1) / pageSize * pageSize;
+      return mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+   }
+
+   // touches every page, the threads take contiguous slices
+   void prefault(uint64_t threads)
+   {
+      auto* bytes = reinterpret_cast<volatile uint8_t*>(memory);
+      const size_t step = SMALL_PAGE_SIZE;
+      const size_t slice = (mappedSize / threads + step - 1) / step * step;
+      std::vector<std::thread> faulters;
+      for (uint64_t t_i = 0; t_i < threads; t_i++) {
+         faulters.emplace_back([=]() {
+            for (size_t offset = t_i * slice; offset < std::min(mappedSize, (t_i + 1) * slice); offset += step)
+               bytes[offset] = 0;
+         });
+      }
+      for (auto& t : faulters)
+         t.join();
+   }
 };
 
 // -------------------------------------------------------------------------------------
@@ -55,7 +182,8 @@ class MonotonicBufferResource : public std::pmr::memory_resource
    size_t sizeLeft;
    HugePages<uint8_t> buffer;
 
-   MonotonicBufferResource(size_t bufferSize) : bufferSize(bufferSize), sizeLeft(bufferSize), buffer(bufferSize) {
+   MonotonicBufferResource(size_t bufferSize, size_t pageSize = 0, int numaNode = NUMA_DEFAULT, uint64_t prefaultThreads = 0)
+       : bufferSize(bufferSize), sizeLeft(bufferSize), buffer(bufferSize, pageSize, numaNode, prefaultThreads) {
       bufferPosition = buffer;
    };
 
@@ -94,7 +222,8 @@ class SynchronizedMonotonicBufferRessource : public std::pmr::memory_resource
    std::mutex allocteMut;
 
   public:
-   SynchronizedMonotonicBufferRessource(size_t bufferSize) : parent(bufferSize){};
+   SynchronizedMonotonicBufferRessource(size_t bufferSize, size_t pageSize = 0, int numaNode = NUMA_DEFAULT, uint64_t prefaultThreads = 0)
+       : parent(bufferSize, pageSize, numaNode, prefaultThreads){};
    void* getUnderlyingBuffer() { return parent.getUnderlyingBuffer(); }
    size_t getSizeLeft() { return parent.getSizeLeft(); }
    size_t getBufferSize() { return parent.getBufferSize(); }
@@ -112,6 +241,157 @@ class SynchronizedMonotonicBufferRessource : public std::pmr::memory_resource
    bool do_is_equal(const memory_resource& other) const noexcept override { return this == &other; }
 };
 
+// -------------------------------------------------------------------------------------
+// Size class slab pools on top of the registered buffer, allocation and deallocation stay off the mutex.
+// Power of two classes from 64B to 64KB are carved from SLAB_SIZE aligned slabs owned by one thread.
+// A freed block goes back to the free list of the slab owner; other threads push it onto a lock-free
+// remote list which the owner drains once its local list ran empty. The cache of an exited thread is
+// adopted by the next new thread. Larger requests are recycled by size under a mutex. Blocks are never
+// returned to the parent, memory is bounded by the peak usage.
+// -------------------------------------------------------------------------------------
+class SlabAllocator : public std::pmr::memory_resource
+{
+  public:
+   static constexpr size_t SLAB_SIZE = 1ul << 20;
+   static constexpr size_t MIN_CLASS_SHIFT = 6;   // 64B, a cacheline
+   static constexpr size_t MAX_CLASS_SHIFT = 16;  // 64KB
+   static constexpr size_t CLASSES = MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1;
+   static constexpr size_t LARGE_ALIGNMENT = 4096;
+
+   explicit SlabAllocator(std::pmr::memory_resource& parent) : parent(parent), registry(std::make_shared<Registry>()) {}
+
+  protected:
+   void* do_allocate(size_t bytes, size_t alignment) override
+   {
+      auto c = sizeClass(bytes, alignment);
+      if (c >= CLASSES)
+         return allocateLarge(bytes, alignment);
+      auto& cache = threadCache();
+      auto*& list = cache.local[c];
+      if (!list)
+         list = cache.remote[c].exchange(nullptr, std::memory_order_acquire);
+      if (list) {
+         auto* block = list;
+         list = block->next;
+         return block;
+      }
+      if (cache.bump[c] == cache.bumpEnd[c])
+         newSlab(cache, c);
+      void* block = cache.bump[c];
+      cache.bump[c] += classSize(c);
+      return block;
+   }
+   void do_deallocate(void* p, size_t bytes, size_t alignment) override
+   {
+      auto c = sizeClass(bytes, alignment);
+      if (c >= CLASSES) {
+         std::unique_lock<std::mutex> guard(largeMut);
+         largeFree[bytes].push_back(p);
+         return;
+      }
+      auto* block = static_cast<FreeBlock*>(p);
+      auto& owner = *reinterpret_cast<SlabHeader*>(reinterpret_cast<uintptr_t>(p) & ~(SLAB_SIZE - 1))->owner;
+      if (&owner == &threadCache()) {
+         block->next = owner.local[c];
+         owner.local[c] = block;
+         return;
+      }
+      // single consumer takes the whole list, pushing is ABA safe
+      auto& head = owner.remote[c];
+      block->next = head.load(std::memory_order_relaxed);
+      while (!head.compare_exchange_weak(block->next, block, std::memory_order_release, std::memory_order_relaxed))
+         ;
+   }
+   bool do_is_equal(const memory_resource& other) const noexcept override { return this == &other; }
+
+  private:
+   struct FreeBlock {
+      FreeBlock* next;
+   };
+   struct alignas(64) ThreadCache {
+      FreeBlock* local[CLASSES] = {};
+      uint8_t* bump[CLASSES] = {};  // unused part of the current slab
+      uint8_t* bumpEnd[CLASSES] = {};
+      alignas(64) std::atomic<FreeBlock*> remote[CLASSES];  // returned by other threads
+      ThreadCache()
+      {
+         for (auto& r : remote)
+            r.store(nullptr);
+      }
+   };
+   struct SlabHeader {
+      ThreadCache* owner;  // in the first block of every slab
+   };
+   // caches outlive their threads for late remote frees, the registry outlives the allocator for exiting threads
+   struct Registry {
+      std::mutex mut;
+      std::vector<std::unique_ptr<ThreadCache>> caches;
+      std::vector<ThreadCache*> orphans;  // of exited threads
+   };
+   struct ThreadCaches {
+      std::vector<std::pair<std::shared_ptr<Registry>, ThreadCache*>> caches;  // per allocator
+      ~ThreadCaches()
+      {
+         for (auto& [registry, cache] : caches) {
+            std::unique_lock<std::mutex> guard(registry->mut);
+            registry->orphans.push_back(cache);
+         }
+      }
+   };
+   std::pmr::memory_resource& parent;
+   std::shared_ptr<Registry> registry;
+   std::mutex largeMut;
+   std::unordered_map<size_t, std::vector<void*>> largeFree;
+   // -------------------------------------------------------------------------------------
+   static size_t classSize(size_t c) { return 1ul << (c + MIN_CLASS_SHIFT); }
+   // blocks are aligned to their size, hence the alignment only raises the class
+   static size_t sizeClass(size_t bytes, size_t alignment)
+   {
+      auto size = std::max({bytes, alignment, classSize(0)});
+      return (64 - __builtin_clzl(size - 1)) - MIN_CLASS_SHIFT;
+   }
+   ThreadCache& threadCache()
+   {
+      thread_local ThreadCaches threadCaches;
+      for (auto& [r, cache] : threadCaches.caches)
+         if (r == registry)
+            return *cache;
+      std::unique_lock<std::mutex> guard(registry->mut);
+      ThreadCache* cache;
+      if (!registry->orphans.empty()) {
+         cache = registry->orphans.back();
+         registry->orphans.pop_back();
+      } else {
+         registry->caches.push_back(std::make_unique<ThreadCache>());
+         cache = registry->caches.back().get();
+      }
+      threadCaches.caches.push_back({registry, cache});
+      return *cache;
+   }
+   void newSlab(ThreadCache& cache, size_t c)
+   {
+      auto* slab = static_cast<uint8_t*>(parent.allocate(SLAB_SIZE, SLAB_SIZE));
+      reinterpret_cast<SlabHeader*>(slab)->owner = &cache;
+      cache.bump[c] = slab + classSize(c);  // first block holds the header
+      cache.bumpEnd[c] = slab + SLAB_SIZE;
+   }
+   void* allocateLarge(size_t bytes, size_t alignment)
+   {
+      if (alignment > LARGE_ALIGNMENT)
+         throw std::runtime_error("Unsupported alignment " + std::to_string(alignment));
+      {
+         std::unique_lock<std::mutex> guard(largeMut);
+         auto it = largeFree.find(bytes);
+         if (it != largeFree.end() && !it->second.empty()) {
+            auto* p = it->second.back();
+            it->second.pop_back();
+            return p;
+         }
+      }
+      return parent.allocate(bytes, LARGE_ALIGNMENT);
+   }
+};
+
 // -------------------------------------------------------------------------------------
 // wraps a thread local pointer to allow for proper destruction
 template <typename T>
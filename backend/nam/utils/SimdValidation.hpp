@@ -0,0 +1,206 @@
+#pragma once
+// -------------------------------------------------------------------------------------
+#include <immintrin.h>
+#include <cstdint>
+// -------------------------------------------------------------------------------------
+namespace nam
+{
+namespace utils
+{
+namespace simd
+{
+// -------------------------------------------------------------------------------------
+// Consistency checks of remote reads, the words are compared branch free over the whole buffer and
+// only the result is tested (a torn read is the rare case):
+//  uniform:             all words equal the first one (the counters of the locking benchmarks).
+//  stridedEqual:        every stride-th word equals expected (FaRM cache line versions), gathered.
+//  cachelineWordsEqual: per 64 byte line the words selected by wordMask (bit i = word i) equal expected.
+// The kernels are chosen once at runtime from the cpu (AVX-512F, AVX2 or scalar); the AVX-512 ones are
+// compiled with a target attribute, the build only guarantees -mavx2.
+// -------------------------------------------------------------------------------------
+enum class Isa : uint8_t { SCALAR, AVX2, AVX512 };
+// -------------------------------------------------------------------------------------
+namespace scalar
+{
+inline bool uniform(const uint64_t* words, uint64_t count)
+{
+   uint64_t diff = 0;
+   for (uint64_t w_i = 1; w_i < count; w_i++)
+      diff |= words[w_i] ^ words[0];
+   return diff == 0;
+}
+inline bool stridedEqual(const uint64_t* words, uint64_t count, uint64_t stride, uint64_t expected)
+{
+   uint64_t diff = 0;
+   for (uint64_t w_i = 0; w_i < count; w_i++)
+      diff |= words[w_i * stride] ^ expected;
+   return diff == 0;
+}
+inline bool cachelineWordsEqual(const uint64_t* lines, uint64_t count, uint8_t wordMask, uint64_t expected)
+{
+   uint64_t diff = 0;
+   for (uint64_t l_i = 0; l_i < count; l_i++)
+      for (uint64_t w_i = 0; w_i < 8; w_i++)
+         if (wordMask & (1u << w_i))
+            diff |= lines[l_i * 8 + w_i] ^ expected;
+   return diff == 0;
+}
+}  // namespace scalar
+// -------------------------------------------------------------------------------------
+namespace avx2
+{
+__attribute__((target("avx2"))) inline bool uniform(const uint64_t* words, uint64_t count)
+{
+   const __m256i ref = _mm256_set1_epi64x(words[0]);
+   __m256i diff = _mm256_setzero_si256(), diff2 = _mm256_setzero_si256();  // two loads per iteration
+   auto* vectors = reinterpret_cast<const __m256i*>(words);
+   uint64_t w_i = 0;
+   for (; w_i + 8 <= count; w_i += 8) {
+      diff = _mm256_or_si256(diff, _mm256_xor_si256(_mm256_loadu_si256(vectors + w_i / 4), ref));
+      diff2 = _mm256_or_si256(diff2, _mm256_xor_si256(_mm256_loadu_si256(vectors + w_i / 4 + 1), ref));
+   }
+   diff = _mm256_or_si256(diff, diff2);
+   return _mm256_testz_si256(diff, diff) && scalar::stridedEqual(words + w_i, count - w_i, 1, words[0]);
+}
+__attribute__((target("avx2"))) inline bool stridedEqual(const uint64_t* words, uint64_t count, uint64_t stride, uint64_t expected)
+{
+   const __m256i ref = _mm256_set1_epi64x(expected);
+   const __m256i index = _mm256_set_epi64x(3 * stride, 2 * stride, stride, 0);
+   __m256i diff = _mm256_setzero_si256();
+   uint64_t w_i = 0;
+   for (; w_i + 4 <= count; w_i += 4) {
+      auto versions = _mm256_i64gather_epi64(reinterpret_cast<const long long*>(words + w_i * stride), index, 8);
+      diff = _mm256_or_si256(diff, _mm256_xor_si256(versions, ref));
+   }
+   return _mm256_testz_si256(diff, diff) && scalar::stridedEqual(words + w_i * stride, count - w_i, stride, expected);
+}
+__attribute__((target("avx2"))) inline bool cachelineWordsEqual(const uint64_t* lines, uint64_t count, uint8_t wordMask, uint64_t expected)
+{
+   const __m256i ref = _mm256_set1_epi64x(expected);
+   auto select = [](uint64_t bits) {
+      return _mm256_set_epi64x(-((bits >> 3) & 1), -((bits >> 2) & 1), -((bits >> 1) & 1), -(bits & 1));
+   };
+   const __m256i low = select(wordMask), high = select(wordMask >> 4);
+   __m256i diff = _mm256_setzero_si256();
+   for (uint64_t l_i = 0; l_i < count; l_i++) {
+      auto* line = reinterpret_cast<const __m256i*>(lines + l_i * 8);
+      diff = _mm256_or_si256(diff, _mm256_and_si256(_mm256_xor_si256(_mm256_loadu_si256(line), ref), low));
+      diff = _mm256_or_si256(diff, _mm256_and_si256(_mm256_xor_si256(_mm256_loadu_si256(line + 1), ref), high));
+   }
+   return _mm256_testz_si256(diff, diff);
+}
+}  // namespace avx2
+// -------------------------------------------------------------------------------------
+namespace avx512
+{
+__attribute__((target("avx512f"))) inline bool uniform(const uint64_t* words, uint64_t count)
+{
+   const __m512i ref = _mm512_set1_epi64(words[0]);
+   __m512i diff = _mm512_setzero_si512();
+   uint64_t w_i = 0;
+   for (; w_i + 8 <= count; w_i += 8)
+      diff = _mm512_or_si512(diff, _mm512_xor_si512(_mm512_loadu_si512(words + w_i), ref));
+   if (w_i < count) {
+      __mmask8 tail = (1u << (count - w_i)) - 1;
+      diff = _mm512_or_si512(diff, _mm512_xor_si512(_mm512_maskz_loadu_epi64(tail, words + w_i), _mm512_maskz_mov_epi64(tail, ref)));
+   }
+   return _mm512_test_epi64_mask(diff, diff) == 0;
+}
+__attribute__((target("avx512f"))) inline bool stridedEqual(const uint64_t* words, uint64_t count, uint64_t stride, uint64_t expected)
+{
+   const __m512i ref = _mm512_set1_epi64(expected);
+   const int64_t s = stride;
+   const __m512i index = _mm512_set_epi64(7 * s, 6 * s, 5 * s, 4 * s, 3 * s, 2 * s, s, 0);
+   __m512i diff = _mm512_setzero_si512();
+   uint64_t w_i = 0;
+   // masked gathers only, lanes outside of the tail keep ref
+   for (; w_i < count; w_i += 8) {
+      __mmask8 lanes = (count - w_i >= 8) ? 0xFF : (1u << (count - w_i)) - 1;
+      auto versions = _mm512_mask_i64gather_epi64(ref, lanes, index, words + w_i * stride, 8);
+      diff = _mm512_or_si512(diff, _mm512_xor_si512(versions, ref));
+   }
+   return _mm512_test_epi64_mask(diff, diff) == 0;
+}
+__attribute__((target("avx512f"))) inline bool cachelineWordsEqual(const uint64_t* lines, uint64_t count, uint8_t wordMask, uint64_t expected)
+{
+   const __m512i ref = _mm512_set1_epi64(expected);
+   __mmask8 differs = 0;
+   for (uint64_t l_i = 0; l_i < count; l_i++)
+      differs |= _mm512_mask_cmpneq_epu64_mask(wordMask, _mm512_loadu_si512(lines + l_i * 8), ref);
+   return differs == 0;
+}
+}  // namespace avx512
+// -------------------------------------------------------------------------------------
+inline Isa detectIsa()
+{
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx512f"))
+      return Isa::AVX512;
+   if (__builtin_cpu_supports("avx2"))
+      return Isa::AVX2;
+   return Isa::SCALAR;
+}
+// the kernels of the best isa, forceIsa() overrides it (comparisons, never above the detected one)
+struct Kernels {
+   Isa isa;
+   bool (*uniform)(const uint64_t*, uint64_t);
+   bool (*stridedEqual)(const uint64_t*, uint64_t, uint64_t, uint64_t);
+   bool (*cachelineWordsEqual)(const uint64_t*, uint64_t, uint8_t, uint64_t);
+};
+inline Kernels kernelsFor(Isa isa)
+{
+   switch (isa) {
+      case Isa::AVX512:
+         return {isa, avx512::uniform, avx512::stridedEqual, avx512::cachelineWordsEqual};
+      case Isa::AVX2:
+         return {isa, avx2::uniform, avx2::stridedEqual, avx2::cachelineWordsEqual};
+      default:
+         return {Isa::SCALAR, scalar::uniform, scalar::stridedEqual, scalar::cachelineWordsEqual};
+   }
+}
+inline Kernels& kernels()
+{
+   static Kernels selected = kernelsFor(detectIsa());
+   return selected;
+}
+inline void forceIsa(Isa isa)
+{
+   if (isa <= detectIsa())
+      kernels() = kernelsFor(isa);
+}
+inline const char* isaName()
+{
+   switch (kernels().isa) {
+      case Isa::AVX512:
+         return "avx512";
+      case Isa::AVX2:
+         return "avx2";
+      default:
+         return "scalar";
+   }
+}
+// -------------------------------------------------------------------------------------
+inline bool uniform(const uint64_t* words, uint64_t count)
+{
+   return count == 0 || kernels().uniform(words, count);
+}
+inline bool stridedEqual(const uint64_t* words, uint64_t count, uint64_t stride, uint64_t expected)
+{
+   return kernels().stridedEqual(words, count, stride, expected);
+}
+inline bool cachelineWordsEqual(const uint64_t* lines, uint64_t count, uint8_t wordMask, uint64_t expected)
+{
+   return kernels().cachelineWordsEqual(lines, count, wordMask, expected);
+}
+// index of the first word that differs from the first one, count if none; for the error message
+inline uint64_t firstMismatch(const uint64_t* words, uint64_t count)
+{
+   uint64_t w_i = 1;
+   while (w_i < count && words[w_i] == words[0])
+      w_i++;
+   return count == 0 ? 0 : w_i;
+}
+// -------------------------------------------------------------------------------------
+}  // namespace simd
+}  // namespace utils
+}  // namespace nam
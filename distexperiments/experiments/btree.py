@@ -6,7 +6,7 @@ NUMBER_NODES = 5
 parameter_grid = ParameterGrid(
     padding = [8],
     worker=[1,2,4,8,16,32,64,128,256,512,1024,2048],
-    options=["","-unsynchronized"],
+    options=["","-unsynchronized","-reader_indicator"],
 )
 
 
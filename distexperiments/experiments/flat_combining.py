@@ -0,0 +1,46 @@
+import config
+from distexprunner import *
+
+NUMBER_NODES = 5
+
+# workers per compute node, 4 compute nodes
+parameter_grid = ParameterGrid(
+    worker=[1,2,4,8,16,32,64],
+    benchmark=["fa_benchmark", "locking_benchmark"],
+    combining=[False, True],
+)
+
+
+@reg_exp(servers=config.server_list[:NUMBER_NODES])
+def compile(servers):
+    servers.cd("/home/tziegler/rdma_synchronization/build/")
+    cmake_cmd = f'cmake -D CMAKE_C_COMPILER=gcc-10 -D CMAKE_CXX_COMPILER=g++-10 -DCMAKE_BUILD_TYPE=Release ..'
+    procs = [s.run_cmd(cmake_cmd) for s in servers]
+    assert(all(p.wait() == 0 for p in procs))
+
+    make_cmd = f'sudo make -j'
+    procs = [s.run_cmd(make_cmd) for s in servers]
+    assert(all(p.wait() == 0 for p in procs))
+    
+
+@reg_exp(servers=config.server_list[:NUMBER_NODES], params=parameter_grid, raise_on_rc=True, max_restarts=1)
+def flat_combining(servers, worker, benchmark, combining):
+    servers.cd("/home/tziegler/rdma_synchronization/build/frontend")        
+    all_worker = worker * (NUMBER_NODES - 1)
+    if benchmark == "fa_benchmark":
+        options = "-flat_combining" if combining else ""
+        csv = "atomic_contention_benchmark.csv"
+    else:
+        options = "-lock=flat_combining" if combining else "-lock=rwlock"
+        options += " -lock_count=16"
+        csv = "locking_benchmark.csv"
+    cmds = []
+    cmd = f'numactl --membind=0 --cpunodebind=0 sudo ip netns exec ib0 ./{benchmark} -ownIp={servers[0].ibIp} -storage_node -worker={all_worker} -lock_count=16'
+    cmds += [servers[0].run_cmd(cmd)]
+
+    for i in range(1, NUMBER_NODES):
+        cmd = f'numactl --membind=0 sudo ip netns exec ib0 ./{benchmark} -ownIp={servers[i].ibIp} -all_worker={all_worker} -worker={worker} -csvFile="flat_combining.csv" -run_for_seconds=30 -tag={worker} -nopinThreads {options}'
+        cmds += [servers[i].run_cmd(cmd)]
+        
+    if not all(cmd.wait() == 0 for cmd in cmds):
+        return Action.RESTART
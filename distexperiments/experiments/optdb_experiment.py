@@ -9,6 +9,7 @@ parameter_grid = ParameterGrid(
     locks=[2000000],
     options=["-CRC", "-farm" , "-versioning"],
     footer=["-nofooter","-footer"],
+    adaptive=["-noadaptive", "-adaptive", "-select_protocol"],
 )
 
 
@@ -24,7 +25,7 @@ def compile(servers):
     assert(all(p.wait() == 0 for p in procs))
         
 @reg_exp(servers=config.server_list[:NUMBER_NODES], params=parameter_grid, raise_on_rc=True, max_restarts=1)
-def nam_benchmark(servers, padding, worker,locks, options, footer):    
+def nam_benchmark(servers, padding, worker,locks, options, footer, adaptive):    
     servers.cd("/home/tziegler/rdma_synchronization/build/frontend")        
     cmds = []
     # if (options != "") and (padding == 0):
@@ -32,7 +33,7 @@ def nam_benchmark(servers, padding, worker,locks, options, footer):
     tag = "OPTDB"
     
     for i in range(0, NUMBER_NODES):
-        cmd = f'numactl --membind=0 sudo ip netns exec ib0  ./optdb_experiment -ownIp={servers[i].ibIp} -worker={worker} -csvFile="optdb_benchmark_full_new.csv" -run_for_seconds=30 -padding={padding} -tag={tag} -lock_count={locks} -storage_nodes={NUMBER_NODES} -storage_node {options} {footer} -dramGB=10'
+        cmd = f'numactl --membind=0 sudo ip netns exec ib0  ./optdb_experiment -ownIp={servers[i].ibIp} -worker={worker} -csvFile="optdb_benchmark_full_new.csv" -run_for_seconds=30 -padding={padding} -tag={tag} -lock_count={locks} -storage_nodes={NUMBER_NODES} -storage_node {options} {footer} {adaptive} -dramGB=10'
         cmds += [servers[i].run_cmd(cmd)]
         sleep(1)
     if not all(cmd.wait() == 0 for cmd in cmds):
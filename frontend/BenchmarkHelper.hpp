@@ -10,6 +10,7 @@
 #include "nam/utils/RandomGenerator.hpp"
 #include "nam/utils/Time.hpp"
 #include "nam/rdma/CommunicationManager.hpp"
+#include "nam/rdma/SharedQueuePair.hpp"
 // -------------------------------------------------------------------------------------
 #include <gflags/gflags.h>
 // -------------------------------------------------------------------------------------
@@ -529,6 +530,17 @@ void rdma_barrier_wait(uint64_t barrier_addr, uint64_t stage, uint64_t* local_ba
    }
 }
 
+// same barrier through a QP shared by FLAGS_qpSharing workers
+void rdma_barrier_wait(uint64_t barrier_addr, uint64_t stage, uint64_t* local_barrier_buffer, nam::rdma::SharedQueuePair& sqp, uint64_t member) {
+   using namespace nam;
+   sqp.wait(member, sqp.fetchAdd(member, 1, local_barrier_buffer, barrier_addr, nam::rdma::completion::signaled));
+   volatile auto* barrier_value = reinterpret_cast<uint64_t*>(local_barrier_buffer);
+   uint64_t expected = (FLAGS_all_worker) * stage;
+   while (*barrier_value != expected) {
+      sqp.wait(member, sqp.read(member, const_cast<uint64_t*>(barrier_value), sizeof(uint64_t), barrier_addr, nam::rdma::completion::signaled));
+   }
+}
+
 void rdma_barrier_nam_wait(uint64_t barrier_addr, uint64_t stage, uint64_t* local_barrier_buffer, nam::rdma::RdmaContext& rctx ) {
    {
       using namespace nam;
@@ -1,5 +1,8 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <memory>
 
 #include "Defs.hpp"
 #include "PerfEvent.hpp"
@@ -11,6 +14,9 @@
 #include "nam/rdma/CommunicationManager.hpp"
 #include "nam/threads/Concurrency.hpp"
 #include "nam/utils/RandomGenerator.hpp"
+#include "nam/utils/SimdValidation.hpp"
+#include "nam/utils/Checksum.hpp"
+#include "nam/utils/DirtyLines.hpp"
 #include "nam/utils/Time.hpp"
 #include "nam/utils/crc64.hpp"
 
@@ -45,27 +51,30 @@ struct FaRM {
       }
    }
    void checkConsistencyProof([[maybe_unused]] uint64_t* buffer, [[maybe_unused]] uint64_t bytes) {
-      // loop over all versions including the first latch version!
-      uint64_t prev = buffer[0];
-      for (uint64_t cl_i = 0; cl_i < (bytes / sizeof(uint64_t)); cl_i = cl_i + CL / sizeof(uint64_t)) {
-         if (prev != buffer[cl_i]) { throw OLRestartException(); }
-      }
+      // all versions including the first latch version, one per started cacheline
+      constexpr uint64_t stride = CL / sizeof(uint64_t);
+      uint64_t versions = ((bytes / sizeof(uint64_t)) + stride - 1) / stride;
+      if (!utils::simd::stridedEqual(buffer, versions, stride, buffer[0])) { throw OLRestartException(); }
    }
 };
 struct CRC {
+   // the reference crc64 unless main() selects the validated -checksum before the workers start
+   static inline utils::ChecksumFunction function = utils::checksumFunction(utils::ChecksumKind::CRC64);
+   static void select(utils::ChecksumFunction selected) { function = selected; }
+   static uint64_t checksum(const uint64_t* content, uint64_t length) { return function(content, length); }
    void generateConsistencyProof([[maybe_unused]] uint64_t* buffer, [[maybe_unused]] uint64_t bytes) {
       // create CRC remember to exclude the CRC itself from the calculation
       // exclude version, CRC and lock?
       auto* content = buffer + 1;
       auto length = bytes - sizeof(uint64_t);
       uint64_t& crc_v = buffer[0];
-      crc_v = crc64(0, (unsigned char*)(content), length); 
+      crc_v = checksum(content, length);
    }
    void checkConsistencyProof([[maybe_unused]] uint64_t* buffer, [[maybe_unused]] uint64_t bytes) {
       auto* content = buffer + 1;
       auto length = bytes - sizeof(uint64_t);
       uint64_t& crc_v = buffer[0];
-      auto crc_v2 = crc64(0, (unsigned char*)(content), length);
+      auto crc_v2 = checksum(content, length);
       if (crc_v != crc_v2) {
          throw OLRestartException();
       }
@@ -94,9 +103,11 @@ struct AbstractLock {
              uint64_t* tuple_buffer,
              size_t bytes) {
       volatile uint64_t& x_locked = lock_buffer[0];
-      rdma::postCompareSwap(W_UNLOCKED, W_LOCKED, lock_buffer, rctx, rdma::completion::unsignaled, (size_t)lockAddr);
       // do not read lock value again since could be f&a
-      rdma::postRead(tuple_buffer, rctx, rdma::completion::signaled, tupleAddr, bytes, 0);
+      rdma::WorkRequestChain(rctx)
+          .compareSwap(W_UNLOCKED, W_LOCKED, lock_buffer, (size_t)lockAddr, rdma::completion::unsignaled)
+          .read(tuple_buffer, bytes, tupleAddr, rdma::completion::signaled)
+          .post();
       int comp{0};
       ibv_wc wcReturn;
       while (comp == 0) {
@@ -106,6 +117,36 @@ struct AbstractLock {
       // -------------------------------------------------------------------------------------
       if (x_locked != W_UNLOCKED) throw OLRestartException();
    }
+   // one write per run of dirty lines within [begin, end) in ascending order, unsignaled, one request
+   // of the chain stays free for the release
+   template <typename Chain>
+   static void writeDirty(Chain& chain, uintptr_t tupleAddr, uint64_t* tuple_buffer, size_t begin, size_t end, const utils::DirtyLines& dirty) {
+      dirty.forEachRun(begin, end, chain.capacity() - chain.size() - 1, [&](uint64_t offset, uint64_t length) {
+         chain.write(reinterpret_cast<uint8_t*>(tuple_buffer) + offset, length, tupleAddr + offset, rdma::completion::unsignaled);
+      });
+   }
+   // writeDirty followed by the word at end taken from word_buffer, gathered into the last run when that
+   // ends right in front of it, otherwise written on its own instead of its whole line
+   template <typename Chain>
+   static void writeDirtyThenWord(Chain& chain, uintptr_t tupleAddr, uint64_t* tuple_buffer, size_t begin, size_t end,
+                                  const utils::DirtyLines& dirty, uint64_t* word_buffer) {
+      auto* content = reinterpret_cast<uint8_t*>(tuple_buffer);
+      uint64_t lastOffset = 0, lastLength = 0;
+      dirty.forEachRun(begin, end, chain.capacity() - chain.size() - 1, [&](uint64_t offset, uint64_t length) {
+         if (lastLength > 0)
+            chain.write(content + lastOffset, lastLength, tupleAddr + lastOffset, rdma::completion::unsignaled);
+         lastOffset = offset;
+         lastLength = length;
+      });
+      if (lastLength > 0 && lastOffset + lastLength == end) {
+         chain.writeGather({{content + lastOffset, lastLength}, {word_buffer, sizeof(uint64_t)}}, tupleAddr + lastOffset,
+                           rdma::completion::unsignaled);
+         return;
+      }
+      if (lastLength > 0)
+         chain.write(content + lastOffset, lastLength, tupleAddr + lastOffset, rdma::completion::unsignaled);
+      chain.write(word_buffer, sizeof(uint64_t), tupleAddr + end, rdma::completion::unsignaled);
+   }
 };
 
 struct FooterLock : public AbstractLock {
@@ -119,17 +160,58 @@ struct FooterLock : public AbstractLock {
       tuple_buffer[lock_idx] = 0;
       rdma::postWrite(tuple_buffer, rctx, rdma::completion::unsignaled, tupleAddr, bytes);
    }
+   // the released lock word comes from lock_buffer behind the runs, gathered into the last one if it
+   // reaches the footer; the writes of the qp are placed in order
+   void unlock(nam::rdma::RdmaContext& rctx,
+               [[maybe_unused]] uintptr_t lockAddr,
+               uint64_t* lock_buffer,
+               uintptr_t tupleAddr,
+               uint64_t* tuple_buffer,
+               size_t bytes,
+               const utils::DirtyLines& dirty) {
+      lock_buffer[0] = W_UNLOCKED;
+      rdma::WorkRequestChain chain(rctx);
+      writeDirtyThenWord(chain, tupleAddr, tuple_buffer, 0, bytes - sizeof(uint64_t), dirty, lock_buffer);
+      chain.post();
+   }
 };
 
+// With sharedReaders (AdaptiveReadLock in use) the write back leaves out the lock word, pessimistic
+// readers may count on it; that costs a second write, so without them the lock word is overwritten.
 struct HeaderLock : public AbstractLock {
+   bool sharedReaders = false;
    void unlock(nam::rdma::RdmaContext& rctx,
                uintptr_t lockAddr,
                uint64_t* lock_buffer,
                uintptr_t tupleAddr,
                uint64_t* tuple_buffer,
                size_t bytes) {
-      rdma::postWrite(tuple_buffer, rctx, rdma::completion::unsignaled, tupleAddr, bytes);
-      rdma::postFetchAdd(int64_t{-1}, lock_buffer, rctx, rdma::completion::unsignaled, lockAddr, true);
+      if (!sharedReaders) {
+         rdma::postWrite(tuple_buffer, rctx, rdma::completion::unsignaled, tupleAddr, bytes);
+         rdma::postFetchAdd(int64_t{-1}, lock_buffer, rctx, rdma::completion::unsignaled, lockAddr, true);
+         return;
+      }
+      rdma::WorkRequestChain(rctx)
+          .write(tuple_buffer, 8, tupleAddr, rdma::completion::unsignaled)
+          .write(tuple_buffer + 2, bytes - 16, tupleAddr + 16, rdma::completion::unsignaled)
+          .fetchAdd(int64_t{-1}, lock_buffer, lockAddr, rdma::completion::unsignaled, true)
+          .post();
+   }
+   void unlock(nam::rdma::RdmaContext& rctx,
+               uintptr_t lockAddr,
+               uint64_t* lock_buffer,
+               uintptr_t tupleAddr,
+               uint64_t* tuple_buffer,
+               size_t bytes,
+               const utils::DirtyLines& dirty) {
+      rdma::WorkRequestChain chain(rctx);
+      if (sharedReaders) {
+         writeDirty(chain, tupleAddr, tuple_buffer, 0, 8, dirty);
+         writeDirty(chain, tupleAddr, tuple_buffer, 16, bytes, dirty);
+      } else {
+         writeDirty(chain, tupleAddr, tuple_buffer, 0, bytes, dirty);
+      }
+      chain.fetchAdd(int64_t{-1}, lock_buffer, lockAddr, rdma::completion::unsignaled, true).post();
    }
 };
 
@@ -160,24 +242,18 @@ struct OptimisticLock {
          // for V2 and FARM it is the last slot
          lck = tuple_buffer + ((bytes / sizeof(uint64_t)) - 1);
       }
-      if (*lck != W_UNLOCKED) throw OLRestartException();
+      // pessimistic readers count above the writer bit
+      if (*lck & W_LOCKED) throw OLRestartException();
    }
    // -------------------------------------------------------------------------------------
    void lock() {
       if constexpr (std::is_same_v<V2, Consistency>) {
          // Header read version first and latch!
          if constexpr (std::is_same_v<HeaderLock, LockType>) {
-            rdma::postReadFenced(&tuple_buffer[0], rctx, rdma::completion::signaled, remote_address, 16, 0);
-            {
-               int comp{0};
-               ibv_wc wcReturn;
-               while (comp == 0) {
-                  _mm_pause();
-                  comp = rdma::pollCompletion(rctx.id->qp->send_cq, 1, &wcReturn);
-               }
-            }
-            
-            rdma::postRead(&tuple_buffer[2], rctx, rdma::completion::signaled, remote_address + 16, bytes - 16, 0);
+            // version words and payload scattered by one read, the range is read in ascending order so
+            // the version is read before the payload
+            rdma::postReadScatter({{&tuple_buffer[0], 16}, {&tuple_buffer[2], bytes - 16}}, rctx, rdma::completion::signaled,
+                                  remote_address, 0, true);
             {
                int comp{0};
                ibv_wc wcReturn;
@@ -321,8 +397,12 @@ struct ExclusiveLock {
       }
    }
    // -------------------------------------------------------------------------------------
-   ExclusiveLock(nam::rdma::RdmaContext& rctx, uintptr_t remote_address, uint64_t* lock_buffer, uint64_t* tuple_buffer, size_t bytes)
-       : rctx(rctx), remote_address(remote_address), lock_buffer(lock_buffer), tuple_buffer(tuple_buffer), bytes(bytes){};
+   // sharedReaders: AdaptiveReadLock readers may access the tuple concurrently
+   ExclusiveLock(nam::rdma::RdmaContext& rctx, uintptr_t remote_address, uint64_t* lock_buffer, uint64_t* tuple_buffer, size_t bytes,
+                 bool sharedReaders = false)
+       : rctx(rctx), remote_address(remote_address), lock_buffer(lock_buffer), tuple_buffer(tuple_buffer), bytes(bytes) {
+      if constexpr (std::is_same_v<HeaderLock, LockType>) l.sharedReaders = sharedReaders;
+   };
    // -------------------------------------------------------------------------------------
    // input position and buffer
    void lock() {
@@ -331,6 +411,26 @@ struct ExclusiveLock {
    }
    // -------------------------------------------------------------------------------------
    void unlock() {
+      generateProofAndVersion();
+      l.unlock(rctx, getLockPosition(), lock_buffer, remote_address, tuple_buffer, bytes);
+   }
+   // writes back only the modified lines and the ones of the version, the lock and the CRC; FaRM
+   // versions every line and always writes the whole tuple
+   void unlock(const utils::DirtyLines& modified) {
+      generateProofAndVersion();
+      auto dirty = modified;
+      if constexpr (std::is_same_v<FaRM, Consistency>) {
+         dirty.markAll();
+      } else if constexpr (std::is_same_v<V2, Consistency> && std::is_same_v<FooterLock, LockType>) {
+         dirty.markWord((bytes / sizeof(uint64_t)) - 2);
+      } else {
+         dirty.markWord(0);  // the CRC and a header lock share the line with the version
+      }
+      l.unlock(rctx, getLockPosition(), lock_buffer, remote_address, tuple_buffer, bytes, dirty);
+   }
+   // -------------------------------------------------------------------------------------
+  private:
+   void generateProofAndVersion() {
       if constexpr (std::is_same_v<CRC, Consistency>) {
          if constexpr (std::is_same_v<HeaderLock, LockType>) {
             auto* t = tuple_buffer + 2;
@@ -351,8 +451,273 @@ struct ExclusiveLock {
       }else{
          tuple_buffer[0]++;
       }
+   }
+};
+// -------------------------------------------------------------------------------------
+// Read mode per hashed tuple address, shared by the workers of a compute node. Consecutive validation
+// failures of optimistic reads are counted, after threshold of them the tuple is read pessimistically
+// for decayUs microseconds, then optimistically again. Relaxed and unsynchronized, it is only a hint;
+// colliding tuples share an entry.
+// -------------------------------------------------------------------------------------
+class ReadModeTable {
+  public:
+   struct alignas(64) Entry {
+      std::atomic<uint64_t> failures{0};
+      std::atomic<uint64_t> pessimisticUntil{0};  // getTimePoint(), 0 = optimistic
+   };
+   // -------------------------------------------------------------------------------------
+   ReadModeTable(uint64_t slots, uint64_t threshold, uint64_t decayUs)
+       : bits(__builtin_ctzl(slots)), threshold(threshold), decayUs(decayUs), entries(std::make_unique<Entry[]>(slots)) {
+      ensure(slots > 1 && Helper::powerOfTwo(slots));
+      ensure(threshold > 0);
+   }
+   // -------------------------------------------------------------------------------------
+   bool pessimistic(uintptr_t tupleAddr) {
+      auto until = entry(tupleAddr).pessimisticUntil.load(std::memory_order_relaxed);
+      return until != 0 && utils::getTimePoint() < until;  // cold tuples do not read the clock
+   }
+   void failed(uintptr_t tupleAddr, bool shared) {
+      if (shared) return;  // the pessimistic window ends by time, not by outcome
+      auto& e = entry(tupleAddr);
+      if (e.failures.fetch_add(1, std::memory_order_relaxed) + 1 < threshold) return;
+      e.failures.store(0, std::memory_order_relaxed);
+      e.pessimisticUntil.store(utils::getTimePoint() + decayUs, std::memory_order_relaxed);
+      switches.fetch_add(1, std::memory_order_relaxed);
+   }
+   void succeeded(uintptr_t tupleAddr, bool shared) {
+      if (shared) return;
+      auto& e = entry(tupleAddr);
+      if (e.failures.load(std::memory_order_relaxed) != 0) e.failures.store(0, std::memory_order_relaxed);
+   }
+   uint64_t getSwitches() const { return switches; }
 
-      l.unlock(rctx, getLockPosition(), lock_buffer, remote_address, tuple_buffer, bytes);
+  private:
+   uint64_t bits;
+   uint64_t threshold;
+   uint64_t decayUs;
+   std::unique_ptr<Entry[]> entries;
+   std::atomic<uint64_t> switches{0};  // to pessimistic
+   // -------------------------------------------------------------------------------------
+   Entry& entry(uintptr_t tupleAddr) { return entries[((tupleAddr >> 3) * 0x9E3779B97F4A7C15ul) >> (64 - bits)]; }
+};
+// -------------------------------------------------------------------------------------
+// Read protocol per range of tuple ids (a region), chosen from sampled statistics at epoch boundaries
+// instead of per tuple on each failure like ReadModeTable. Every sampleEvery-th event on average is
+// counted; the first worker that samples an event after the epoch ended evaluates all regions:
+//  optimistic -> shared:     failed read attempts per read >= TO_SHARED
+//  shared     -> optimistic: failed read attempts per read < TO_OPTIMISTIC (no writer to hide from) or
+//                            write aborts per write >= TO_OPTIMISTIC_WRITER (readers starve the writers)
+// Regions with fewer than MIN_SAMPLES samples keep their protocol. Both read protocols are valid against
+// the same writers and the same tuple layout, a reader samples the protocol once per attempt, so a
+// switch takes effect at any time without draining or rewriting the region. Lock placement and
+// consistency scheme are not chosen here: they define the remote layout and the proof every compute
+// node writes, switching them would need all nodes to agree and the tuples to be rewritten.
+// -------------------------------------------------------------------------------------
+class RegionProtocolSelector {
+  public:
+   static constexpr double TO_SHARED = 0.5;
+   static constexpr double TO_OPTIMISTIC = 0.05;
+   static constexpr double TO_OPTIMISTIC_WRITER = 1.0;
+   static constexpr uint64_t MIN_SAMPLES = 32;
+   // -------------------------------------------------------------------------------------
+   struct alignas(64) Region {
+      std::atomic<uint64_t> reads{0};
+      std::atomic<uint64_t> readFailures{0};  // validation failures or writer found by a shared reader
+      std::atomic<uint64_t> writes{0};
+      std::atomic<uint64_t> writeAborts{0};
+      std::atomic<bool> shared{false};
+   };
+   // -------------------------------------------------------------------------------------
+   RegionProtocolSelector(uint64_t tuples, uint64_t regionTuples, uint64_t epochUs, uint64_t sampleEvery)
+       : regionTuples(regionTuples),
+         regionCount((tuples + regionTuples - 1) / regionTuples),
+         epochUs(epochUs),
+         sampleMask(sampleEvery - 1),
+         regions(std::make_unique<Region[]>(regionCount)),
+         epochEnd(utils::getTimePoint() + epochUs) {
+      ensure(regionTuples > 0 && regionCount > 0);
+      ensure(sampleEvery > 0 && Helper::powerOfTwo(sampleEvery));
+   }
+   // -------------------------------------------------------------------------------------
+   // mode source of AdaptiveReadLock, keyed by tuple id
+   bool pessimistic(uint64_t tupleId) { return region(tupleId).shared.load(std::memory_order_relaxed); }
+   void failed(uint64_t tupleId, bool) {
+      if (sampled()) count(region(tupleId).readFailures, 1);
+   }
+   void succeeded(uint64_t tupleId, bool) {
+      if (sampled()) count(region(tupleId).reads, 1);
+   }
+   void wrote(uint64_t tupleId, uint64_t aborts) {
+      if (!sampled()) return;
+      auto& r = region(tupleId);
+      r.writeAborts.fetch_add(aborts, std::memory_order_relaxed);
+      count(r.writes, 1);
+   }
+   // -------------------------------------------------------------------------------------
+   uint64_t getSwitches() const { return switches; }
+   uint64_t getEpochs() const { return epochs; }
+   uint64_t getRegions() const { return regionCount; }
+   uint64_t getSharedRegions() const {
+      uint64_t shared = 0;
+      for (uint64_t r_i = 0; r_i < regionCount; r_i++)
+         shared += regions[r_i].shared.load(std::memory_order_relaxed);
+      return shared;
+   }
+
+  private:
+   uint64_t regionTuples;
+   uint64_t regionCount;
+   uint64_t epochUs;
+   uint64_t sampleMask;
+   std::unique_ptr<Region[]> regions;
+   std::atomic<uint64_t> epochEnd;  // getTimePoint()
+   std::atomic<uint64_t> epochs{0};
+   std::atomic<uint64_t> switches{0};
+   // -------------------------------------------------------------------------------------
+   Region& region(uint64_t tupleId) { return regions[std::min(tupleId / regionTuples, regionCount - 1)]; }
+   bool sampled() const { return (utils::RandomGenerator::getRandU64Fast() & sampleMask) == 0; }
+   // only sampled events read the clock
+   void count(std::atomic<uint64_t>& counter, uint64_t n) {
+      counter.fetch_add(n, std::memory_order_relaxed);
+      auto end = epochEnd.load(std::memory_order_relaxed);
+      auto now = utils::getTimePoint();
+      if (now < end || !epochEnd.compare_exchange_strong(end, now + epochUs)) return;
+      endEpoch();
+   }
+   void endEpoch() {
+      for (uint64_t r_i = 0; r_i < regionCount; r_i++) {
+         auto& r = regions[r_i];
+         auto reads = r.reads.exchange(0, std::memory_order_relaxed);
+         auto readFailures = r.readFailures.exchange(0, std::memory_order_relaxed);
+         auto writes = r.writes.exchange(0, std::memory_order_relaxed);
+         auto writeAborts = r.writeAborts.exchange(0, std::memory_order_relaxed);
+         if (reads + writes < MIN_SAMPLES) continue;
+         double readFailureRate = reads ? static_cast<double>(readFailures) / reads : 0;
+         double writeAbortRate = writes ? static_cast<double>(writeAborts) / writes : 0;
+         bool shared = r.shared.load(std::memory_order_relaxed);
+         bool next = shared ? !(readFailureRate < TO_OPTIMISTIC || writeAbortRate >= TO_OPTIMISTIC_WRITER)
+                            : readFailureRate >= TO_SHARED;
+         if (next == shared) continue;
+         r.shared.store(next, std::memory_order_relaxed);
+         switches.fetch_add(1, std::memory_order_relaxed);
+      }
+      epochs.fetch_add(1, std::memory_order_relaxed);
+   }
+};
+// -------------------------------------------------------------------------------------
+// Reader that falls back from the optimistic protocol to a shared lock while its mode source
+// (ReadModeTable or RegionProtocolSelector) says so.
+// The shared lock adds SHARED_READER to the lock word of the tuple (bit 0 stays the writer's), chained
+// with the read of the tuple, and writers cannot acquire until it is released, so a reader cannot
+// starve behind them. A reader that finds the writer bit set fails: with a header lock it undoes its
+// increment, the footer lock is released by overwriting the word, which discards the increment anyway.
+// -------------------------------------------------------------------------------------
+static constexpr uint64_t SHARED_READER = 2;
+
+template <typename Consistency, typename LockType, typename Modes = ReadModeTable>
+struct AdaptiveReadLock {
+   // -------------------------------------------------------------------------------------
+   OptimisticLock<Consistency, LockType> optimistic;
+   Modes& modes;
+   uintptr_t mode_key;  // the tuple address for ReadModeTable, the tuple id for RegionProtocolSelector
+   nam::rdma::RdmaContext& rctx;
+   uintptr_t remote_address;
+   uint64_t* lock_buffer;
+   uint64_t* tuple_buffer;
+   size_t bytes;
+   bool shared = false;
+   // -------------------------------------------------------------------------------------
+   AdaptiveReadLock(Modes& modes,
+                    nam::rdma::RdmaContext& rctx,
+                    uintptr_t remote_address,
+                    uint64_t* lock_buffer,
+                    uint64_t* tuple_buffer,
+                    size_t bytes)
+       : AdaptiveReadLock(modes, remote_address, rctx, remote_address, lock_buffer, tuple_buffer, bytes){};
+   AdaptiveReadLock(Modes& modes,
+                    uintptr_t mode_key,
+                    nam::rdma::RdmaContext& rctx,
+                    uintptr_t remote_address,
+                    uint64_t* lock_buffer,
+                    uint64_t* tuple_buffer,
+                    size_t bytes)
+       : optimistic(rctx, remote_address, tuple_buffer, bytes),
+         modes(modes),
+         mode_key(mode_key),
+         rctx(rctx),
+         remote_address(remote_address),
+         lock_buffer(lock_buffer),
+         tuple_buffer(tuple_buffer),
+         bytes(bytes){};
+   // -------------------------------------------------------------------------------------
+   // same interface as OptimisticLock, both can throw in case of restart
+   void lock() {
+      shared = modes.pessimistic(mode_key);
+      try {
+         if (shared)
+            lockShared();
+         else
+            optimistic.lock();
+      } catch (const OLRestartException&) {
+         modes.failed(mode_key, shared);
+         throw;
+      }
+   }
+   std::pair<uint64_t, uint64_t> unlock() {
+      if (shared) {
+         fetchAdd(-SHARED_READER);
+         modes.succeeded(mode_key, true);
+         auto version = tuple_buffer[versionIndex()];
+         return {version, version};
+      }
+      try {
+         auto versions = optimistic.unlock();
+         modes.succeeded(mode_key, false);
+         return versions;
+      } catch (const OLRestartException&) {
+         modes.failed(mode_key, false);
+         throw;
+      }
+   }
+   // -------------------------------------------------------------------------------------
+  private:
+   uintptr_t getLockPosition() {
+      if constexpr (std::is_same_v<HeaderLock, LockType>) {
+         return (remote_address + 8);
+      } else {
+         return remote_address + ((bytes)-8);
+      }
+   }
+   uint64_t versionIndex() {
+      if constexpr (std::is_same_v<V2, Consistency> && std::is_same_v<FooterLock, LockType>) {
+         return (bytes / sizeof(uint64_t)) - 2;
+      } else {
+         return 0;
+      }
+   }
+   void poll() {
+      int comp{0};
+      ibv_wc wcReturn;
+      while (comp == 0) {
+         _mm_pause();
+         comp = rdma::pollCompletion(rctx.id->qp->send_cq, 1, &wcReturn);
+      }
+   }
+   void fetchAdd(uint64_t value) {
+      rdma::postFetchAdd(value, lock_buffer, rctx, rdma::completion::signaled, getLockPosition());
+      poll();
+   }
+   void lockShared() {
+      volatile uint64_t& lock_word = lock_buffer[0];
+      rdma::WorkRequestChain(rctx)
+          .fetchAdd(SHARED_READER, lock_buffer, getLockPosition(), rdma::completion::unsignaled)
+          .read(tuple_buffer, bytes, remote_address, rdma::completion::signaled)
+          .post();
+      poll();
+      if (lock_word & W_LOCKED) {
+         if constexpr (std::is_same_v<HeaderLock, LockType>) fetchAdd(-SHARED_READER);
+         throw OLRestartException();
+      }
    }
 };
 
@@ -370,9 +735,11 @@ struct ExclusiveLock {
       // input position and buffer
       void lockExclusive() {
          volatile uint64_t& x_locked = lock_buffer[0];
-         rdma::postCompareSwap(UNLOCKED, EXCLUSIVE_LOCKED, lock_buffer, rctx, rdma::completion::unsignaled, remote_address);
          // do not read lock value again since could be f&a
-         rdma::postRead(tuple_buffer, rctx, rdma::completion::signaled, remote_address + 8, bytes - 8, 0);
+         rdma::WorkRequestChain(rctx)
+             .compareSwap(UNLOCKED, EXCLUSIVE_LOCKED, lock_buffer, remote_address, rdma::completion::unsignaled)
+             .read(tuple_buffer, bytes - 8, remote_address + 8, rdma::completion::signaled)
+             .post();
          int comp{0};
          ibv_wc wcReturn;
          while (comp == 0) {
@@ -384,14 +751,24 @@ struct ExclusiveLock {
       }
       // -------------------------------------------------------------------------------------
       void unlockExclusive() {
-         rdma::postWrite(tuple_buffer, rctx, rdma::completion::unsignaled, remote_address + 8, bytes - 8);
-         rdma::postFetchAdd(EXCLUSIVE_UNLOCK_TO_BE_ADDED, lock_buffer, rctx, rdma::completion::unsignaled, remote_address, true);
+         rdma::WorkRequestChain(rctx)
+             .write(tuple_buffer, bytes - 8, remote_address + 8, rdma::completion::unsignaled)
+             .fetchAdd(EXCLUSIVE_UNLOCK_TO_BE_ADDED, lock_buffer, remote_address, rdma::completion::unsignaled, true)
+             .post();
+      }
+      // tuple_buffer starts behind the lock word, so do the offsets of dirty
+      void unlockExclusive(const utils::DirtyLines& dirty) {
+         rdma::WorkRequestChain chain(rctx);
+         AbstractLock::writeDirty(chain, remote_address + 8, tuple_buffer, 0, bytes - 8, dirty);
+         chain.fetchAdd(EXCLUSIVE_UNLOCK_TO_BE_ADDED, lock_buffer, remote_address, rdma::completion::unsignaled, true).post();
       }
       // -------------------------------------------------------------------------------------
       void lockShared() {
          volatile uint64_t& s_locked = lock_buffer[0];
-         rdma::postFetchAdd(1, lock_buffer, rctx, rdma::completion::unsignaled, remote_address);
-         rdma::postRead(tuple_buffer, rctx, rdma::completion::signaled, remote_address + 8, bytes - 8, 0);
+         rdma::WorkRequestChain(rctx)
+             .fetchAdd(1, lock_buffer, remote_address, rdma::completion::unsignaled)
+             .read(tuple_buffer, bytes - 8, remote_address + 8, rdma::completion::signaled)
+             .post();
          int comp{0};
          ibv_wc wcReturn;
          while (comp == 0) {
@@ -23,6 +23,7 @@ DEFINE_double(run_for_seconds, 10.0, "");
 DEFINE_uint64(lock_count, 16, "");
 DEFINE_uint64(padding, 8, "");
 DEFINE_uint64(batch, 8, "");
+DEFINE_bool(pipelined, false, "keep batch independent reads in flight, every completion posts the next read");
 
 static constexpr uint64_t EXCLUSIVE_LOCKED = 0x1000000000000000;
 static constexpr uint64_t EXCLUSIVE_UNLOCK_TO_BE_ADDED = 0xFFFFFFFFFFFFFFFF - EXCLUSIVE_LOCKED + 1;
@@ -47,8 +48,15 @@ int main(int argc, char* argv[]) {
       // -------------------------------------------------------------------------------------
       while (db.getCM().getNumberIncomingConnections()) {}
    } else {
+      // a connection holds up to batch reads, pipelined reads are all signaled and each needs a cqe
+      uint64_t in_flight = FLAGS_pipelined ? (FLAGS_batch + FLAGS_storage_nodes - 1) / FLAGS_storage_nodes : FLAGS_batch;
+      if (FLAGS_batch == 0 || in_flight > rdma::SEND_QUEUE_DEPTH || (FLAGS_pipelined && in_flight > rdma::COMPLETION_QUEUE_DEPTH))
+         throw std::runtime_error("batch of " + std::to_string(in_flight) + " reads per connection exceeds the send queue (" +
+                                  std::to_string(rdma::SEND_QUEUE_DEPTH) + ") or completion queue (" +
+                                  std::to_string(rdma::COMPLETION_QUEUE_DEPTH) + ") depth");
       nam::Compute compute;
       std::string benchmark = "no_locking";
+      if (FLAGS_pipelined) { benchmark += "+pipelined"; }
       // -------------------------------------------------------------------------------------
       std::vector<std::string> workload_type;  // warm up or benchmark
       std::vector<double> zipfs;
@@ -71,9 +79,10 @@ int main(int argc, char* argv[]) {
                uint64_t updates = 0;
                auto& cm = compute.getCM();
                std::vector<uint64_t*> buffers(FLAGS_batch);
-               uint64_t* barrier_buffer = static_cast<uint64_t*>(cm.getGlobalBuffer().allocate(64, 64));
+               // slab buffers are returned after every stage
+               uint64_t* barrier_buffer = static_cast<uint64_t*>(cm.getSlabs().allocate(64, 64));
                for (uint64_t b_i = 0; b_i < FLAGS_batch; b_i++) {
-                  buffers[b_i] = static_cast<uint64_t*>(cm.getGlobalBuffer().allocate(TUPLE_SIZE, 64));
+                  buffers[b_i] = static_cast<uint64_t*>(cm.getSlabs().allocate(TUPLE_SIZE, 64));
                }
                std::atomic<uint64_t> inconsistencies = 0;
                auto poll_cq = [&](rdma::RdmaContext*& rctx) {
@@ -94,7 +103,35 @@ int main(int argc, char* argv[]) {
                auto barrier_addr = catalog[0].start;
                rdma_barrier_wait(barrier_addr,1,barrier_buffer, *cctxs[0].rctx );
                
-               while (keep_running) {
+               if (FLAGS_pipelined) {
+                  // every read is tracked by its wr_id, latency is per read
+                  std::function<void(uint64_t)> post_read = [&](uint64_t b_i) {
+                     uint64_t s_id = b_i % FLAGS_storage_nodes;
+                     uint64_t lock_id = utils::RandomGenerator::getRandU64Fast() % lock_count;
+                     auto lock_addr = catalog[s_id].start + 64 + (lock_id * TUPLE_SIZE) + (lock_id * FLAGS_padding);
+                     auto start = utils::getTimePoint();
+                     auto wrId = cctxs[s_id].completions.track([&, b_i, start](const ibv_wc&) {
+                        auto end = utils::getTimePoint();
+                        threads::Worker::my().counters.incr_by(profiling::WorkerCounters::latency, (end - start));
+                        threads::Worker::my().counters.incr(profiling::WorkerCounters::tx_p);
+                        if (keep_running) post_read(b_i);
+                     });
+                     rdma::postRead(buffers[b_i], *cctxs[s_id].rctx, rdma::completion::signaled, lock_addr + 8, TUPLE_SIZE - 8, wrId);
+                  };
+                  for (uint64_t b_i = 0; b_i < FLAGS_batch; b_i++) {
+                     post_read(b_i);
+                  }
+                  bool outstanding = true;
+                  while (outstanding) {
+                     outstanding = false;
+                     for (uint64_t n_i = 0; n_i < FLAGS_storage_nodes; n_i++) {
+                        cctxs[n_i].completions.poll();
+                        outstanding |= cctxs[n_i].completions.outstanding() > 0;
+                     }
+                  }
+               }
+
+               while (keep_running && !FLAGS_pipelined) {
                   uint64_t s_id = current_node % FLAGS_storage_nodes;
                   current_node++;
                   auto* rctx = cctxs[s_id].rctx;
@@ -116,6 +153,9 @@ int main(int argc, char* argv[]) {
                   threads::Worker::my().counters.incr_by(profiling::WorkerCounters::tx_p, FLAGS_batch);
                }
                g_updates += updates;
+               for (auto* buffer : buffers)
+                  cm.getSlabs().deallocate(buffer, TUPLE_SIZE, 64);
+               cm.getSlabs().deallocate(barrier_buffer, 64, 64);
                running_threads_counter--;
             });
          }
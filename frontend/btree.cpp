@@ -6,9 +6,12 @@
 #include "nam/Storage.hpp"
 #include "nam/profiling/ProfilingThread.hpp"
 #include "nam/profiling/counters/WorkerCounters.hpp"
+#include "nam/syncprimitives/RemoteIndicatorLock.hpp"
+#include "nam/syncprimitives/RemoteRWLock.hpp"
 #include "nam/threads/Concurrency.hpp"
 #include "nam/utils/RandomGenerator.hpp"
 #include "nam/utils/ScrambledZipfGenerator.hpp"
+#include "nam/utils/SimdValidation.hpp"
 #include "nam/utils/Time.hpp"
 // -------------------------------------------------------------------------------------
 #include <gflags/gflags.h>
@@ -26,13 +29,9 @@ DEFINE_bool(speculative_read, false, "");
 DEFINE_bool(write_combining, false, "");
 DEFINE_bool(order_release, false, "");
 DEFINE_uint64(padding, 8, "");
-DEFINE_uint64(sleep, 0, "sleep in microseconds ");
-
-static constexpr uint64_t EXCLUSIVE_LOCKED = 0x1000000000000000;
-static constexpr uint64_t EXCLUSIVE_UNLOCK_TO_BE_ADDED = 0xFFFFFFFFFFFFFFFF - EXCLUSIVE_LOCKED + 1;
-static constexpr uint64_t UNLOCKED = 0;
-static constexpr uint64_t MASKED_SHARED_LOCKS = 0x1000000000000000;
-static constexpr uint64_t SHARED_UNLOCK_TO_BE_ADDED = 0xFFFFFFFFFFFFFFFF;
+DEFINE_uint64(sleep, 0, "pauses between posting the fetch and add and the data read of speculative readers");
+DEFINE_bool(reader_indicator, false, "root behind the tree with one reader slot per compute node");
+DEFINE_uint64(reader_slots, 8, "compute nodes that can read the root with -reader_indicator");
 
 static constexpr uint64_t TUPLE_SIZE = 4096;  // spans multiple cl to get the correctness.
 static constexpr uint64_t B = 249; // fanout for 16 byte - lock
@@ -76,6 +75,10 @@ int main(int argc, char* argv[]) {
       std::string benchmark = "B-Tree traversal";
       if(FLAGS_unsynchronized)
          benchmark+="unsynchronized";
+      if (FLAGS_reader_indicator)
+         benchmark += "+reader_indicator";
+      if (!FLAGS_backoffPolicy.empty()) { benchmark += "+backoff=" + FLAGS_backoffPolicy; }
+      ensure(!FLAGS_reader_indicator || !FLAGS_unsynchronized);
       // -------------------------------------------------------------------------------------
       std::vector<std::string> workload_type;  // warm up or benchmark
       // -------------------------------------------------------------------------------------
@@ -87,6 +90,14 @@ int main(int argc, char* argv[]) {
          nodes += std::pow(B,h_i);
       }
 
+      // the root with its reader slots in an area of its own behind the nodes, the slot allocator behind
+      // the barrier word
+      uint64_t root_offset = (64 + nodes * (TUPLE_SIZE + FLAGS_padding) + 63) & ~63ul;
+      sync::IndicatorSlot reader_slot(FLAGS_reader_slots);
+      sync::ContentionTable contention(std::min<u64>(Helper::nextPowerTwo(4 * nodes), 1ul << 16));
+      sync::ContentionTable* counted = sync::Backoff::adaptiveFromFlags() ? &contention : nullptr;
+      auto buffer_size = std::max(TUPLE_SIZE * 2, sync::RemoteIndicatorLock::bufferSize(TUPLE_SIZE, FLAGS_reader_slots));
+
       std::atomic<bool> keep_running = true;
       std::atomic<u64> running_threads_counter = 0;
       benchmark::LOCKING_BENCHMARK_workloadInfo experimentInfo{benchmark, nodes, 100, 0,
@@ -98,13 +109,18 @@ int main(int argc, char* argv[]) {
             auto& cm = compute.getCM();
             auto* rctx = threads::Worker::my().cctxs[0].rctx;
             auto desc = threads::Worker::my().catalog[0];
-            auto* buffer = static_cast<uint64_t*>(cm.getGlobalBuffer().allocate(TUPLE_SIZE*2, 64));
+            auto* buffer = static_cast<uint64_t*>(cm.getGlobalBuffer().allocate(buffer_size, 64));
             uint64_t* barrier_buffer = static_cast<uint64_t*>(cm.getGlobalBuffer().allocate(64, 64));
             auto addr = desc.start + 64;
-            uint64_t* old = reinterpret_cast<uint64_t*>(buffer);
 
             auto barrier_addr = desc.start;
             rdma_barrier_wait(barrier_addr, stage, barrier_buffer, *rctx);
+            // buffer doubles as its local copy, buffer[0] is the writer flag
+            std::unique_ptr<sync::RemoteIndicatorLock> root_lock;
+            if (FLAGS_reader_indicator)
+               root_lock = std::make_unique<sync::RemoteIndicatorLock>(threads::Worker::my().cctxs[0], buffer, TUPLE_SIZE,
+                                                                       reader_slot, desc.start + 8,
+                                                                       sync::Backoff::fromFlags(sync::RemoteIndicatorLock::defaultBackoff(), counted));
 
             auto poll_cq = [&]() {
                int comp{0};
@@ -115,101 +131,60 @@ int main(int argc, char* argv[]) {
                }
             };
 
-            // -------------------------------------------------------------------------------------
-            // READ
-            // -------------------------------------------------------------------------------------
-            auto s_unlock = [&](uint64_t lock_addr) {
-               rdma::postFetchAdd(int64_t{-1}, old, *(rctx), rdma::completion::signaled, lock_addr);
-               poll_cq();
-            };
-            // + basic_read
-            auto basic_s_lock = [&](uint64_t lock_addr) {
-               volatile uint64_t& s_locked = old[0];
-               rdma::postFetchAdd(1, old, *(rctx), rdma::completion::signaled, lock_addr);
-               poll_cq();
-
-               if (s_locked >= EXCLUSIVE_LOCKED) {
-                  s_unlock(lock_addr);
-                  return false;
-               }
-               // -------------------------------------------------------------------------------------
-               // read
-               rdma::postRead(old, *rctx, rdma::completion::signaled, lock_addr, TUPLE_SIZE, 0);
-               poll_cq();
-               return true;
-            };
-
-            // + speculative read
-            auto speculative_read_s_lock = [&](uint64_t lock_addr) {
-               volatile uint64_t& s_locked = old[0];
-               rdma::postFetchAdd(1, old, *(rctx), rdma::completion::unsignaled, lock_addr);
-               // -------------------------------------------------------------------------------------
-               if (FLAGS_sleep > 0) {
-                  for (size_t i = 0; i < FLAGS_sleep; ++i) {
-                     _mm_pause();
-                  }
-               }
-               // -------------------------------------------------------------------------------------
-               rdma::postRead(&old[1], *rctx, rdma::completion::signaled, lock_addr + 8, TUPLE_SIZE - 8, 0);
-               poll_cq();
-               if (s_locked >= EXCLUSIVE_LOCKED) {
-                  s_unlock(lock_addr);
-                  return false;
-               }
-               return true;
-            };
-
-            // + order_release
-            auto s_order_release = [&](uint64_t lock_addr) {
-               // with fence!
-               rdma::postFetchAdd(int64_t{-1}, old, *(rctx), rdma::completion::unsignaled, lock_addr, true);
-               _mm_pause();
-            };
+            // the requests of a lock operation are posted separately, -sleep pauses in between
+            sync::withRemoteRWLock<sync::HeadLock>(FLAGS_speculative_read, FLAGS_order_release, FLAGS_write_combining, false, [&](auto tag) {
+               using Lock = typename decltype(tag)::type;
+               // shares the buffer with the root lock, one lock is held at a time
+               Lock lock(threads::Worker::my().cctxs[0], buffer, TUPLE_SIZE, sync::Backoff::fromFlags(Lock::defaultBackoff(), counted));
+               lock.setPostGap(FLAGS_sleep);
+               uint64_t* data = lock.data();
+               constexpr uint64_t DATA_WORDS = (TUPLE_SIZE - 8) / sizeof(uint64_t);
 
-            running_threads_counter++;
-            while (keep_running) {
-               uint64_t next_idx = 0;  // root
-               uint64_t prev_id = 0;  // previous b-tree node_id
-               for (uint64_t h_i = 0; h_i < H; h_i++) {
-                  // node address
-                  auto lock_addr = addr + (next_idx * TUPLE_SIZE) + (next_idx * FLAGS_padding);
-                  auto start = utils::getTimePoint();
-                  // read lock
-                  if (!FLAGS_unsynchronized) {
-                     bool locked = false;
-                     if (FLAGS_speculative_read) {
-                        locked = speculative_read_s_lock(lock_addr);
-                     } else
-                        locked = basic_s_lock(lock_addr);
-                     if (!locked) continue;
-                  }else{
-                     rdma::postRead(&old[1], *rctx, rdma::completion::signaled, lock_addr + 8, TUPLE_SIZE - 8, 0);
-                     poll_cq();
-                  }
-                  // verify cl counter
-                  uint64_t prev_version = old[1];
-                  for (uint64_t i = 1; i < TUPLE_SIZE / sizeof(uint64_t); ++i) {
-                     if (prev_version != old[i]) {
-                        std::cout << "prev " << prev_version << " " << old[i] << std::endl;
+               running_threads_counter++;
+               while (keep_running) {
+                  uint64_t next_idx = 0;  // root
+                  uint64_t prev_id = 0;  // previous b-tree node_id
+                  for (uint64_t h_i = 0; h_i < H; h_i++) {
+                     // node address
+                     auto lock_addr = addr + (next_idx * TUPLE_SIZE) + (next_idx * FLAGS_padding);
+                     bool indicator = root_lock && h_i == 0;
+                     if (indicator)
+                        lock_addr = desc.start + root_offset;
+                     auto start = utils::getTimePoint();
+                     // read lock
+                     if (!FLAGS_unsynchronized) {
+                        bool locked = false;
+                        if (indicator) {
+                           locked = root_lock->tryLockShared(lock_addr);
+                        } else
+                           locked = lock.tryLockShared(lock_addr);
+                        if (!locked) continue;
+                     }else{
+                        rdma::postRead(data, *rctx, rdma::completion::signaled, lock_addr + 8, TUPLE_SIZE - 8, 0);
+                        poll_cq();
+                     }
+                     // verify cl counter
+                     if (!utils::simd::uniform(data, DATA_WORDS)) {
+                        auto i = utils::simd::firstMismatch(data, DATA_WORDS);
+                        std::cout << "prev " << data[0] << " " << data[i] << std::endl;
                         throw;
                      }
-                     prev_version = old[i];
-                  }
-                  if (!FLAGS_unsynchronized) {
-                     if (FLAGS_order_release)
-                        s_order_release(lock_addr);
-                     else
-                        s_unlock(lock_addr);
+                     if (indicator) {
+                        root_lock->unlockShared(lock_addr);
+                     } else if (!FLAGS_unsynchronized) {
+                        lock.unlockShared(lock_addr);
+                     }
+                     auto end = utils::getTimePoint();
+                     threads::Worker::my().counters.incr_by(profiling::WorkerCounters::latency, (end - start));
+                     // calculate next node
+                     auto node_id = utils::RandomGenerator::getRandU64(0, B);
+                     next_idx = (B * h_i + 1) + (B * prev_id) + node_id;
+                     prev_id = node_id;
                   }
-                  auto end = utils::getTimePoint();
-                  threads::Worker::my().counters.incr_by(profiling::WorkerCounters::latency, (end - start));
-                  // calculate next node
-                  auto node_id = utils::RandomGenerator::getRandU64(0, B);
-                  next_idx = (B * h_i + 1) + (B * prev_id) + node_id;
-                  prev_id = node_id;
+                  threads::Worker::my().counters.incr(profiling::WorkerCounters::tx_p);
                }
-               threads::Worker::my().counters.incr(profiling::WorkerCounters::tx_p);
-            }
+               lock.drain(addr);
+            });
             g_updates += updates;
             running_threads_counter--;
          });
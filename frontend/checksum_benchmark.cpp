@@ -0,0 +1,67 @@
+#include "Defs.hpp"
+#include "nam/Config.hpp"
+#include "nam/utils/Checksum.hpp"
+#include "nam/utils/RandomGenerator.hpp"
+// -------------------------------------------------------------------------------------
+#include <gflags/gflags.h>
+// -------------------------------------------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string_view>
+#include <vector>
+// -------------------------------------------------------------------------------------
+// Single threaded throughput of the checksums of the CRC consistency scheme over tuple sizes, no RDMA.
+// -------------------------------------------------------------------------------------
+
+DEFINE_string(sizes, "64 256 1024 4096 16384 65536", "tuple sizes in bytes, space delimited");
+DEFINE_string(checksums, "crc64 crc64_clmul crc32c hash64", "space delimited, unsupported ones are skipped");
+DEFINE_uint64(bytes_per_run, 1ul << 30, "bytes checksummed per checksum and size");
+
+static std::vector<std::string> split(std::string_view desc) {
+   std::vector<std::string> splitted;
+   std::istringstream in{std::string(desc)};
+   for (std::string item; in >> item;)
+      splitted.push_back(item);
+   return splitted;
+}
+
+int main(int argc, char* argv[]) {
+   gflags::SetUsageMessage("Checksum throughput");
+   gflags::ParseCommandLineFlags(&argc, &argv, true);
+   // -------------------------------------------------------------------------------------
+   using namespace nam;
+   std::vector<uint64_t> sizes;
+   for (auto& size : split(FLAGS_sizes))
+      sizes.push_back(std::stoull(size));
+   uint64_t max_size = *std::max_element(sizes.begin(), sizes.end());
+   // a few tuples in turn, the working set stays in the cache like a tuple right after its read
+   constexpr uint64_t TUPLES = 8;
+   std::vector<uint8_t> buffer(max_size * TUPLES);
+   for (auto& byte : buffer)
+      byte = utils::RandomGenerator::getRandU64Fast();
+
+   std::cout << "checksum,bytes,GB/s,ns_per_tuple\n";
+   for (auto& name : split(FLAGS_checksums)) {
+      auto kind = utils::parseChecksum(name);
+      if (!utils::checksumSupported(kind)) {
+         std::cerr << "skipping " << name << ", not supported by the cpu\n";
+         continue;
+      }
+      auto checksum = utils::checksumFunction(kind);
+      for (auto size : sizes) {
+         uint64_t runs = std::max<uint64_t>(FLAGS_bytes_per_run / size, TUPLES);
+         uint64_t sink = 0;
+         auto start = std::chrono::steady_clock::now();
+         for (uint64_t r_i = 0; r_i < runs; r_i++)
+            sink ^= checksum(buffer.data() + (r_i % TUPLES) * size, size);
+         auto end = std::chrono::steady_clock::now();
+         double ns = std::chrono::duration<double, std::nano>(end - start).count();
+         asm volatile("" ::"r"(sink));
+         std::cout << name << "," << size << "," << std::fixed << std::setprecision(2) << (runs * size) / ns << "," << ns / runs << "\n";
+      }
+   }
+   return 0;
+}
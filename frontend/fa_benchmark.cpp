@@ -6,6 +6,7 @@
 #include "nam/Storage.hpp"
 #include "nam/profiling/ProfilingThread.hpp"
 #include "nam/profiling/counters/WorkerCounters.hpp"
+#include "nam/syncprimitives/FlatCombiner.hpp"
 #include "nam/threads/Concurrency.hpp"
 #include "nam/utils/RandomGenerator.hpp"
 #include "nam/utils/ScrambledZipfGenerator.hpp"
@@ -21,6 +22,7 @@
 
 DEFINE_double(run_for_seconds, 10.0, "");
 DEFINE_uint64(lock_count, 16, "");
+DEFINE_bool(flat_combining, false, "the workers of a compute node delegate their fetch and adds to a combiner");
 
 static constexpr uint64_t EXCLUSIVE_LOCKED = 0x1000000000000000;
 static constexpr uint64_t EXCLUSIVE_UNLOCK_TO_BE_ADDED = 0xFFFFFFFFFFFFFFFF - EXCLUSIVE_LOCKED + 1;
@@ -44,8 +46,14 @@ int main(int argc, char* argv[]) {
       // -------------------------------------------------------------------------------------
       while (db.getCM().getNumberIncomingConnections()) {}
    } else {
-      nam::Compute compute;
+      nam::Compute compute(/*sharedQpAware=*/true);
       std::string benchmark = "FAA";
+      if (FLAGS_qpSharing > 1)
+         benchmark += "+qps_per_storage_node=" + std::to_string((FLAGS_worker + FLAGS_qpSharing - 1) / FLAGS_qpSharing);
+      if (FLAGS_flat_combining)
+         benchmark += "+flat_combining";
+      ensure(!FLAGS_flat_combining || FLAGS_qpSharing <= 1);
+      sync::FlatCombiner combiner(FLAGS_worker);
       // -------------------------------------------------------------------------------------
       std::atomic<bool> keep_running = true;
       std::atomic<uint64_t> running_threads_counter = 0;
@@ -61,7 +69,11 @@ int main(int argc, char* argv[]) {
             auto& cctxs = threads::Worker::my().cctxs;
             auto& catalog = threads::Worker::my().catalog;
             auto barrier_addr = catalog[0].start;
-            rdma_barrier_wait(barrier_addr, stage, barrier_buffer, *cctxs[0].rctx);
+            auto& sqp = cctxs[0].sharedQp;
+            if (sqp)
+               rdma_barrier_wait(barrier_addr, stage, barrier_buffer, *sqp, cctxs[0].member);
+            else
+               rdma_barrier_wait(barrier_addr, stage, barrier_buffer, *cctxs[0].rctx);
 
             auto poll_cq = [&](rdma::RdmaContext*& rctx) {
                int comp{0};
@@ -73,6 +85,7 @@ int main(int argc, char* argv[]) {
             };
            
             const uint64_t s_id  = 0;
+            sync::FlatCombiner::Client client(combiner, t_i, cctxs[s_id], buffer + 8);
             running_threads_counter++;
             while (keep_running) {
                auto* rctx = cctxs[s_id].rctx;
@@ -81,8 +94,15 @@ int main(int argc, char* argv[]) {
                auto lock_addr = addr; // single contended lock 
                auto start = utils::getTimePoint();
                // -------------------------------------------------------------------------------------
-               rdma::postFetchAdd(1, old, *(rctx), rdma::completion::signaled, lock_addr, true);
-               poll_cq(rctx);
+               if (FLAGS_flat_combining) {
+                  *old = client.fetchAdd(lock_addr, 1);
+               } else if (sqp) {
+                  auto member = cctxs[s_id].member;
+                  sqp->wait(member, sqp->fetchAdd(member, 1, old, lock_addr, rdma::completion::signaled, true));
+               } else {
+                  rdma::postFetchAdd(1, old, *(rctx), rdma::completion::signaled, lock_addr, true);
+                  poll_cq(rctx);
+               }
                // -------------------------------------------------------------------------------------
                auto end = utils::getTimePoint();
                threads::Worker::my().counters.incr_by(profiling::WorkerCounters::latency, (end - start));
@@ -102,6 +122,8 @@ int main(int argc, char* argv[]) {
       compute.getWorkerPool().joinAll();
       // -------------------------------------------------------------------------------------
       compute.stopProfiler();
+      if (FLAGS_flat_combining)
+         std::cout << "combined " << combiner.getCombined() << " in " << combiner.getBatches() << " batches, merged " << combiner.getMerged() << "\n";
    }
    return 0;
 }
@@ -7,8 +7,16 @@
 #include "nam/profiling/ProfilingThread.hpp"
 #include "nam/profiling/counters/WorkerCounters.hpp"
 #include "nam/threads/Concurrency.hpp"
+#include "nam/syncprimitives/Backoff.hpp"
+#include "nam/syncprimitives/CohortLock.hpp"
+#include "nam/syncprimitives/FlatCombiner.hpp"
+#include "nam/syncprimitives/LeaseReaper.hpp"
+#include "nam/syncprimitives/RemoteMCSLock.hpp"
+#include "nam/syncprimitives/RemoteRWLock.hpp"
+#include "nam/threads/CoroutineScheduler.hpp"
 #include "nam/utils/RandomGenerator.hpp"
 #include "nam/utils/ScrambledZipfGenerator.hpp"
+#include "nam/utils/SimdValidation.hpp"
 #include "nam/utils/Time.hpp"
 // -------------------------------------------------------------------------------------
 #include <gflags/gflags.h>
@@ -25,13 +33,14 @@ DEFINE_bool(speculative_read, false, "");
 DEFINE_bool(write_combining, false, "");
 DEFINE_bool(order_release, false, "");
 DEFINE_uint64(padding, 8, "");
-DEFINE_uint64(sleep, 0, "sleep in microseconds ");
-
-static constexpr uint64_t EXCLUSIVE_LOCKED = 0x1000000000000000;
-static constexpr uint64_t EXCLUSIVE_UNLOCK_TO_BE_ADDED = 0xFFFFFFFFFFFFFFFF - EXCLUSIVE_LOCKED + 1;
-static constexpr uint64_t UNLOCKED = 0;
-static constexpr uint64_t MASKED_SHARED_LOCKS = 0x1000000000000000;
-static constexpr uint64_t SHARED_UNLOCK_TO_BE_ADDED = 0xFFFFFFFFFFFFFFFF;
+DEFINE_uint64(sleep, 0, "pauses between posting the lock atomic and the data read of speculative readers, writers pause behind it");
+DEFINE_bool(doorbell_batching, false, "post the work requests of a lock operation as one chain");
+DEFINE_uint64(coroutines, 1, "lock transactions in flight per worker, each one a coroutine");
+DEFINE_string(lock, "rwlock", "rwlock (speculative_read, write_combining and order_release apply), mcs, lease or flat_combining");
+DEFINE_uint64(lease_us, 1000, "lease of the lease lock");
+DEFINE_bool(cohort, false, "rwlock: hand exclusive locks over between the workers of a compute node before releasing them remotely");
+DEFINE_uint64(cohort_passes, 16, "local handovers before the remote lock is released");
+DEFINE_string(retry_counters_file, "", "csv of the per lock acquires and retries (-backoffPolicy), empty = not written");
 
 static constexpr uint64_t TUPLE_SIZE = 256;  // spans multiple cl to get the correctness.
 
@@ -46,9 +55,22 @@ int main(int argc, char* argv[]) {
       std::cout << "Storage Node" << std::endl;
       nam::Storage db;
       db.registerMemoryRegion("block", FLAGS_dramGB * 1024 * 1024 * 1024);
+      // lease clock next to the barrier; reclaims the leases of clients that stalled or crashed only if
+      // its cpu cas cannot race the cas of the nic, otherwise the clients break expired leases alone
+      auto block = db.getMemoryRegion("block");
+      sync::LeaseReaper reaper((uint64_t*)(block.start + 8));
+      if (FLAGS_lock == "lease") {
+         if (db.getCM().hostCoherentAtomics())
+            reaper.watch((uint64_t*)(block.start + 64), FLAGS_lock_count, TUPLE_SIZE + FLAGS_padding);
+         else
+            std::cout << "nic atomics are not coherent with the host, leases are only broken by the clients\n";
+         reaper.start();
+      }
       db.startAndConnect();
       // -------------------------------------------------------------------------------------
       while (db.getCM().getNumberIncomingConnections()) {}
+      reaper.stop();
+      if (FLAGS_lock == "lease") std::cout << "reclaimed leases " << reaper.getReclaimed() << "\n";
       // make consistency check
       sleep(5); // drain all open requests
       auto desc = db.getMemoryRegion("block");
@@ -71,11 +93,15 @@ int main(int argc, char* argv[]) {
       
    } else {
       nam::Compute compute;
-      std::string benchmark = "locking-basic";
+      std::string benchmark = (FLAGS_lock == "rwlock") ? "locking-basic" : "locking-" + FLAGS_lock;
       if (FLAGS_speculative_read) { benchmark += "+speculative_read"; }
       if (FLAGS_write_combining) { benchmark += "+write_combining"; }
       if (FLAGS_order_release) { benchmark += "+order_release_wo_fence"; }
       if (FLAGS_sleep > 0) { benchmark += "sleep_inbetween" + std::to_string(FLAGS_sleep); }
+      if (FLAGS_doorbell_batching) { benchmark += "+doorbell_batching"; }
+      if (FLAGS_coroutines > 1) { benchmark += "+coroutines=" + std::to_string(FLAGS_coroutines); }
+      if (FLAGS_cohort) { benchmark += "+cohort=" + std::to_string(FLAGS_cohort_passes); }
+      if (!FLAGS_backoffPolicy.empty()) { benchmark += "+backoff=" + FLAGS_backoffPolicy; }
       // -------------------------------------------------------------------------------------
       std::vector<std::string> workload_type;  // warm up or benchmark
       std::vector<uint32_t> workloads;
@@ -88,8 +114,26 @@ int main(int argc, char* argv[]) {
       zipfs.insert(zipfs.end(), {0});
       // -------------------------------------------------------------------------------------
       u64 lock_count = FLAGS_lock_count;
+      // mcs queue nodes behind the tuples, every transaction loop of every stage allocates one
+      uint64_t qnode_capacity = workloads.size() * zipfs.size() * FLAGS_all_worker * FLAGS_coroutines;
+      uint64_t qnode_offset = ((64 + lock_count * (TUPLE_SIZE + FLAGS_padding)) + 63) & ~63ul;
+      sync::LocalQueueNodes local_qnodes(qnode_capacity);  // handovers between the workers of this compute node
+      ensure(FLAGS_lock == "rwlock" || FLAGS_lock == "mcs" || FLAGS_lock == "lease" || FLAGS_lock == "flat_combining");
+      ensure(!FLAGS_cohort || FLAGS_lock == "rwlock");
+      // the pause sits between two separately posted requests of the rwlock
+      ensure(FLAGS_sleep == 0 || (FLAGS_lock == "rwlock" && !FLAGS_cohort && !FLAGS_doorbell_batching));
+      const uint64_t speculative_pauses = FLAGS_speculative_read ? FLAGS_sleep : 0;
+      sync::CohortTable cohorts(4096, FLAGS_cohort_passes);
+      std::atomic<uint64_t> g_remote_acquires = 0;
+      std::atomic<uint64_t> g_local_handovers = 0;
+      static_assert(sync::CombiningLock::bufferSize(TUPLE_SIZE) <= 1024);
+      sync::FlatCombiner combiner(FLAGS_worker * FLAGS_coroutines);  // one slot per transaction loop
+      sync::ContentionTable contention(std::min<u64>(Helper::nextPowerTwo(4 * lock_count), 1ul << 16));
+      sync::ContentionTable* counted = (sync::Backoff::adaptiveFromFlags() || !FLAGS_retry_counters_file.empty()) ? &contention : nullptr;
       // -------------------------------------------------------------------------------------
       std::atomic<uint64_t> g_updates =0;
+      std::atomic<uint64_t> g_broken_leases = 0;
+      std::atomic<uint64_t> g_lost_leases = 0;
       uint64_t stage =1;
       for (auto ZIPF : zipfs) {
          std::unique_ptr<utils::ScrambledZipfGenerator> zipf_random;
@@ -103,184 +147,119 @@ int main(int argc, char* argv[]) {
             compute.startProfiler(experimentInfo);
             for (uint64_t t_i = 0; t_i < FLAGS_worker; ++t_i) {
                compute.getWorkerPool().scheduleJobAsync(t_i, [&, t_i]() {
-                  uint64_t updates = 0;
                   auto& cm = compute.getCM();
-                  auto* rctx = threads::Worker::my().cctxs[0].rctx;
+                  auto& cctx = threads::Worker::my().cctxs[0];
+                  auto* rctx = cctx.rctx;
                   auto desc = threads::Worker::my().catalog[0];
-                  auto* buffer = static_cast<uint64_t*>(cm.getGlobalBuffer().allocate(1024, 64));
-                  uint64_t* barrier_buffer = static_cast<uint64_t*>(cm.getGlobalBuffer().allocate(64, 64));
+                  uint64_t* barrier_buffer = static_cast<uint64_t*>(cm.getSlabs().allocate(64, 64));
                   auto addr = desc.start + 64;
-                  uint64_t* old = reinterpret_cast<uint64_t*>(buffer);
 
                   auto barrier_addr = desc.start;
                   rdma_barrier_wait(barrier_addr,stage,barrier_buffer, *rctx );
-                  
-                  auto poll_cq = [&]() {
-                     int comp{0};
-                     ibv_wc wcReturn;
-                     while (comp == 0) {
-                        _mm_pause();
-                        comp = rdma::pollCompletion(rctx->id->qp->send_cq, 1, &wcReturn);
-                     }
-                  };
-                  // -------------------------------------------------------------------------------------
-                  // WRITE
-                  // -------------------------------------------------------------------------------------
-                  auto x_unlock = [&](uint64_t lock_addr) {
-                     rdma::postFetchAdd(EXCLUSIVE_UNLOCK_TO_BE_ADDED, old, *(rctx), rdma::completion::signaled, lock_addr);
-                     poll_cq();
-                  };
-                  // basic lock
-                  auto basic_x_lock = [&](uint64_t lock_addr) {
-                     volatile uint64_t& x_locked = old[0];
-                     rdma::postCompareSwap(UNLOCKED, EXCLUSIVE_LOCKED, old, *(rctx), rdma::completion::signaled, lock_addr);
-                     poll_cq();
-                     if (x_locked != UNLOCKED) { return false; }
-                     rdma::postRead(old, *rctx, rdma::completion::signaled, lock_addr, TUPLE_SIZE, 0);
-                     poll_cq();
-                     return true;
-                  };
-                  // + speculative read
-                  auto speculative_read_x_lock = [&](uint64_t lock_addr) {
-                     volatile uint64_t& x_locked = old[0];
-                     rdma::postCompareSwap(UNLOCKED, EXCLUSIVE_LOCKED, old, *(rctx), rdma::completion::unsignaled, lock_addr);
-                     // do not read lock value again since could be f&a
-                     rdma::postRead(&old[1], *rctx, rdma::completion::signaled, lock_addr + 8, TUPLE_SIZE - 8, 0);
-                     poll_cq();
-                     if (x_locked != UNLOCKED) { return false; } // must be unlocked
-                     return true;
-                  };
-                  // + write combining
-                  auto write_combining = [&](uint64_t lock_addr) {
-                     rdma::postWrite(&old[1], *rctx, rdma::completion::unsignaled, lock_addr + 8, TUPLE_SIZE - 8);
-                     x_unlock(lock_addr);
-                  };
-                  // + order_release
-                  auto x_order_release = [&](uint64_t lock_addr) {
-                     rdma::postWrite(&old[1], *rctx, rdma::completion::unsignaled, lock_addr + 8, TUPLE_SIZE - 8);
-                     // with fence! should ensure that memory buffer is not overwritten
-                     rdma::postFetchAdd(EXCLUSIVE_UNLOCK_TO_BE_ADDED, old, *(rctx), rdma::completion::unsignaled, lock_addr, false);
-                     _mm_pause();
-                  };
-                  // -------------------------------------------------------------------------------------
-                  // READ
-                  // -------------------------------------------------------------------------------------
-                  auto s_unlock = [&](uint64_t lock_addr) {
-                     rdma::postFetchAdd(int64_t{-1}, old, *(rctx), rdma::completion::signaled, lock_addr);
-                     poll_cq();
-                  };
-                  // + basic_read
-                  auto basic_s_lock = [&](uint64_t lock_addr) {
-                     volatile uint64_t& s_locked = old[0];
-                     rdma::postFetchAdd(1, old, *(rctx), rdma::completion::signaled, lock_addr);
-                     poll_cq();
-
-                     if (s_locked >= EXCLUSIVE_LOCKED) {
-                        s_unlock(lock_addr);
-                        return false;
-                     }
-                     // -------------------------------------------------------------------------------------
-                     // read
-                     rdma::postRead(old, *rctx, rdma::completion::signaled, lock_addr, TUPLE_SIZE, 0);
-                     poll_cq();
-                     return true;
-                  };
-
-                  // + speculative read
-                  auto speculative_read_s_lock = [&](uint64_t lock_addr) {
-                     volatile uint64_t& s_locked = old[0];
-                     rdma::postFetchAdd(1, old, *(rctx), rdma::completion::unsignaled, lock_addr);
-                     // -------------------------------------------------------------------------------------
-                     if (FLAGS_sleep > 0) {
-                        for (size_t i = 0; i < FLAGS_sleep; ++i) {
-                           _mm_pause();
-                        }
-                     }
-                     // -------------------------------------------------------------------------------------
-                     rdma::postRead(&old[1], *rctx, rdma::completion::signaled, lock_addr + 8, TUPLE_SIZE - 8, 0);
-                     poll_cq();
-                     if (s_locked >= EXCLUSIVE_LOCKED) {
-                        s_unlock(lock_addr);
-                        return false;
-                     }
-                     return true;
-                  };
-
-                  // + order_release
-                  auto s_order_release = [&](uint64_t lock_addr){
-                     // with fence! 
-                     rdma::postFetchAdd(int64_t{-1}, old, *(rctx), rdma::completion::unsignaled, lock_addr, false);
-                     _mm_pause();
-                  };
+                  cm.getSlabs().deallocate(barrier_buffer, 64, 64);
+                  // the flags select the lock type once, the transaction loop is compiled per variant
+                  auto run = [&](auto tag) {
+                     using Lock = typename decltype(tag)::type;
+                     // one transaction loop per coroutine, each with its own buffers
+                     auto transactions = [&](uint64_t c_i) {
+                        uint64_t updates = 0;
+                        auto* buffer = static_cast<uint64_t*>(cm.getSlabs().allocate(1024, 64));  // returned after the stage
+                        // lease clock and owner id allocator behind the barrier word
+                        sync::LeaseClock clock(cctx, buffer + TUPLE_SIZE / sizeof(uint64_t), desc.start + 8);
+                        auto backoff = sync::Backoff::fromFlags(Lock::defaultBackoff(), counted);
+                        auto lock = [&]() {
+                           if constexpr (std::is_same_v<Lock, sync::RemoteMCSLock>)
+                              return Lock(cctx, buffer, TUPLE_SIZE, desc.start + qnode_offset, qnode_capacity, &local_qnodes, backoff);
+                           else if constexpr (sync::IsCohortLock<Lock>::value)
+                              return Lock(cohorts, cctx, buffer, TUPLE_SIZE, backoff);
+                           else if constexpr (std::is_same_v<Lock, sync::CombiningLock>)
+                              return Lock(combiner, t_i * FLAGS_coroutines + c_i, cctx, buffer, TUPLE_SIZE, backoff);
+                           else if constexpr (std::is_same_v<Lock, sync::RemoteLeaseLock>)
+                              return Lock(cctx, buffer, TUPLE_SIZE, clock, desc.start + 16, FLAGS_lease_us, 1024, backoff);
+                           else
+                              return Lock(cctx, buffer, TUPLE_SIZE, backoff);
+                        }();
+                        if constexpr (sync::IsRemoteRWLock<Lock>::value)
+                           lock.setPostGap(speculative_pauses);
+                        uint64_t* data = lock.data();
+                        constexpr uint64_t DATA_WORDS = (TUPLE_SIZE - 8) / sizeof(uint64_t);
 
-                  running_threads_counter++;
-                  while (keep_running) {
-                     uint64_t lock_id = zipf_random->rand(0);
-                     auto lock_addr = addr + (lock_id * TUPLE_SIZE) + (lock_id * FLAGS_padding);
+                        running_threads_counter++;
+                        while (keep_running) {
+                           uint64_t lock_id = zipf_random->rand(0);
+                           auto lock_addr = addr + (lock_id * TUPLE_SIZE) + (lock_id * FLAGS_padding);
 
-                     ensure(lock_id < lock_count);
-                     if (READ_RATIO == 100 || utils::RandomGenerator::getRandU64(0, 100) < READ_RATIO) {
-                        auto start = utils::getTimePoint();
-                        // read lock
-                        bool locked = false;
-                        if (FLAGS_speculative_read) {
-                           locked = speculative_read_s_lock(lock_addr);
-                        } else
-                           locked = basic_s_lock(lock_addr);
-                        if (!locked) continue;
-                        // verify cl counter
-                        uint64_t prev_version = old[1];
-                        for (uint64_t i = 1; i < TUPLE_SIZE / sizeof(uint64_t); ++i) {
-                           if (prev_version != old[i]) {
-                              std::cout << "prev " << prev_version << " " << old[i] << std::endl;
-                              throw;
-                           }
-                           prev_version = old[i];
-                        }
-                        if (FLAGS_order_release)
-                           s_order_release(lock_addr);
-                        else
-                           s_unlock(lock_addr);
-                        auto end = utils::getTimePoint();
-                        threads::Worker::my().counters.incr_by(profiling::WorkerCounters::latency, (end - start));
-                     } else {
-                        auto start = utils::getTimePoint();
-                        // write lock
-                        bool locked = false;
-                        if (FLAGS_speculative_read) {
-                           locked = speculative_read_x_lock(lock_addr);
-                           if (FLAGS_sleep > 0) {
-                              for (size_t i = 0; i < FLAGS_sleep; ++i) {
+                           ensure(lock_id < lock_count);
+                           if (READ_RATIO == 100 || utils::RandomGenerator::getRandU64(0, 100) < READ_RATIO) {
+                              auto start = utils::getTimePoint();
+                              // read lock
+                              if (!lock.tryLockShared(lock_addr)) continue;
+                              // verify cl counter
+                              if (!utils::simd::uniform(data, DATA_WORDS)) {
+                                 auto i = utils::simd::firstMismatch(data, DATA_WORDS);
+                                 std::cout << "prev " << data[0] << " " << data[i] << std::endl;
+                                 throw;
+                              }
+                              lock.unlockShared(lock_addr);
+                              auto end = utils::getTimePoint();
+                              threads::Worker::my().counters.incr_by(profiling::WorkerCounters::latency, (end - start));
+                           } else {
+                              auto start = utils::getTimePoint();
+                              // write lock
+                              bool locked = lock.tryLockExclusive(lock_addr);
+                              for (size_t i = 0; i < speculative_pauses; ++i) {
                                  _mm_pause();
                               }
+                              if (!locked) continue;
+                              // increment counter
+                              uint64_t new_version = ++data[0];
+                              for (uint64_t i = 0; i < DATA_WORDS; ++i) {
+                                 data[i] = new_version;
+                              }
+                              // write back
+                              lock.unlockExclusive(lock_addr);
+                              auto end = utils::getTimePoint();
+                              updates++;
+                              threads::Worker::my().counters.incr_by(profiling::WorkerCounters::latency, (end - start));
                            }
-                        } else
-                           locked = basic_x_lock(lock_addr);
-                        if (!locked) continue;
-                        // increment counter
-                        uint64_t new_version = ++old[1];
-                        for (uint64_t i = 1; i < TUPLE_SIZE / sizeof(uint64_t); ++i) {
-                           old[i] = new_version;
+                           threads::Worker::my().counters.incr(profiling::WorkerCounters::tx_p);
                         }
-                        // write back
-                        if (FLAGS_write_combining) {
-                           if (FLAGS_order_release)
-                              x_order_release(lock_addr);
-                           else
-                              write_combining(lock_addr);
-                        } else {
-                           rdma::postWrite(&old[1], *rctx, rdma::completion::signaled, lock_addr + 8, TUPLE_SIZE - 8);
-                           poll_cq();
-                           x_unlock(lock_addr);
+                        g_updates += updates;
+                        if constexpr (std::is_same_v<Lock, sync::RemoteLeaseLock>) {
+                           g_broken_leases += lock.getBrokenLeases();
+                           g_lost_leases += lock.getLostLeases();
+                        }
+                        if constexpr (sync::IsCohortLock<Lock>::value) {
+                           g_remote_acquires += lock.getRemoteAcquires();
+                           g_local_handovers += lock.getLocalHandovers();
                         }
-                        auto end = utils::getTimePoint();
-                        updates++;
-                        threads::Worker::my().counters.incr_by(profiling::WorkerCounters::latency, (end - start));
+                        lock.drain(addr);
+                        cm.getSlabs().deallocate(buffer, 1024, 64);
+                        running_threads_counter--;
+                     };
+                     if (FLAGS_coroutines > 1) {
+                        threads::CoroutineScheduler scheduler;
+                        for (uint64_t c_i = 0; c_i < FLAGS_coroutines; c_i++)
+                           scheduler.spawn([&, c_i]() { transactions(c_i); });
+                        scheduler.run();
+                     } else {
+                        transactions(0);
                      }
-                     threads::Worker::my().counters.incr(profiling::WorkerCounters::tx_p);
-                  }
-                  g_updates += updates;
-                  running_threads_counter--;
+                  };
+                  if (FLAGS_lock == "mcs")
+                     run(sync::TypeTag<sync::RemoteMCSLock>{});
+                  else if (FLAGS_lock == "lease")
+                     run(sync::TypeTag<sync::RemoteLeaseLock>{});
+                  else if (FLAGS_lock == "flat_combining")
+                     run(sync::TypeTag<sync::CombiningLock>{});
+                  else
+                     sync::withRemoteRWLock<sync::HeadLock>(FLAGS_speculative_read, FLAGS_order_release, FLAGS_write_combining,
+                                                            FLAGS_doorbell_batching, [&](auto tag) {
+                        if (FLAGS_cohort)
+                           run(sync::TypeTag<sync::CohortLock<typename decltype(tag)::type>>{});
+                        else
+                           run(tag);
+                     });
                });
             }
             // -------------------------------------------------------------------------------------
@@ -297,6 +276,14 @@ int main(int argc, char* argv[]) {
             stage++;
          }
          std::cout << "updates " << g_updates << "\n";
+         if (FLAGS_lock == "lease") std::cout << "broken leases " << g_broken_leases << " lost leases " << g_lost_leases << "\n";
+         if (FLAGS_lock == "flat_combining")
+            std::cout << "combined " << combiner.getCombined() << " in " << combiner.getBatches() << " batches, merged " << combiner.getMerged() << "\n";
+         if (FLAGS_cohort) std::cout << "remote acquires " << g_remote_acquires << " local handovers " << g_local_handovers << "\n";
+      }
+      if (!FLAGS_retry_counters_file.empty()) {
+         std::ofstream retries(FLAGS_retry_counters_file);
+         contention.write(retries);
       }
    }
    return 0;
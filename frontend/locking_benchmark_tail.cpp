@@ -6,9 +6,13 @@
 #include "nam/Storage.hpp"
 #include "nam/profiling/ProfilingThread.hpp"
 #include "nam/profiling/counters/WorkerCounters.hpp"
+#include "nam/syncprimitives/Backoff.hpp"
+#include "nam/syncprimitives/RemoteRWLock.hpp"
+#include "nam/syncprimitives/RemoteTicketLock.hpp"
 #include "nam/threads/Concurrency.hpp"
 #include "nam/utils/RandomGenerator.hpp"
 #include "nam/utils/ScrambledZipfGenerator.hpp"
+#include "nam/utils/SimdValidation.hpp"
 #include "nam/utils/Time.hpp"
 // -------------------------------------------------------------------------------------
 #include <gflags/gflags.h>
@@ -24,14 +28,20 @@ DEFINE_uint64(lock_count, 16, "");
 DEFINE_bool(speculative_read, false, "");
 DEFINE_bool(order_release, false, "");
 DEFINE_uint64(padding, 8, "");
-
-static constexpr uint64_t UNLOCKED = 0;
-
+DEFINE_string(lock, "rwlock", "rwlock (speculative_read and order_release apply), ticket or phase_fair");
+DEFINE_string(retry_counters_file, "", "csv of the per lock acquires and retries (-backoffPolicy), empty = not written");
 
 static constexpr uint64_t TUPLE_SIZE = 64;  // spans multiple cl to get the correctness.
 static constexpr uint64_t LOCK_OFFSET_BYTE = TUPLE_SIZE-8;  // spans multiple cl to get the correctness.
 static constexpr uint64_t LOCK_OFFSET_INDEX = LOCK_OFFSET_BYTE / sizeof(uint64_t);  // spans multiple cl to get the correctness.
 
+// the fair locks need a larger lock area at the tail, the data in front shrinks accordingly
+static uint64_t dataBytes() {
+   if (FLAGS_lock == "ticket") return TUPLE_SIZE - nam::sync::RemoteTicketLock::LOCK_BYTES;
+   if (FLAGS_lock == "phase_fair") return TUPLE_SIZE - nam::sync::RemotePhaseFairLock::LOCK_BYTES;
+   return LOCK_OFFSET_BYTE;
+}
+
 int main(int argc, char* argv[]) {
    gflags::SetUsageMessage("Storage-DB Frontend");
    gflags::ParseCommandLineFlags(&argc, &argv, true);
@@ -62,7 +72,7 @@ int main(int argc, char* argv[]) {
          auto lock_addr = (uint64_t*)(buffer + (t_i * TUPLE_SIZE) + (t_i * FLAGS_padding));
          count += lock_addr[1];
          uint64_t prev_version = lock_addr[0];
-         for (uint64_t i = 0; i < (TUPLE_SIZE-8) / sizeof(uint64_t); ++i) {
+         for (uint64_t i = 0; i < dataBytes() / sizeof(uint64_t); ++i) {
             if (prev_version != lock_addr[i]) {
                std::cout << "prev " << prev_version << " " << lock_addr[i] << std::endl;
                throw;
@@ -77,9 +87,11 @@ int main(int argc, char* argv[]) {
 
    } else {
       nam::Compute compute;
-      std::string benchmark = "tail-locking-basic";
+      ensure(FLAGS_lock == "rwlock" || FLAGS_lock == "ticket" || FLAGS_lock == "phase_fair");
+      std::string benchmark = (FLAGS_lock == "rwlock") ? "tail-locking-basic" : "tail-locking-" + FLAGS_lock;
       if (FLAGS_speculative_read) { benchmark += "+speculative_read"; }
       if (FLAGS_order_release) { benchmark += "+order_release"; }
+      if (!FLAGS_backoffPolicy.empty()) { benchmark += "+backoff=" + FLAGS_backoffPolicy; }
       // -------------------------------------------------------------------------------------
       std::vector<std::string> workload_type;  // warm up or benchmark
       std::vector<uint32_t> workloads;
@@ -94,6 +106,8 @@ int main(int argc, char* argv[]) {
       u64 lock_count = FLAGS_lock_count;
       // -------------------------------------------------------------------------------------
       std::atomic<uint64_t> g_updates =0;
+      sync::ContentionTable contention(std::min<u64>(Helper::nextPowerTwo(4 * lock_count), 1ul << 16));
+      sync::ContentionTable* counted = (sync::Backoff::adaptiveFromFlags() || !FLAGS_retry_counters_file.empty()) ? &contention : nullptr;
       for (auto ZIPF : zipfs) {
          std::unique_ptr<utils::ScrambledZipfGenerator> zipf_random;
          zipf_random = std::make_unique<utils::ScrambledZipfGenerator>(0, lock_count, ZIPF);
@@ -106,149 +120,68 @@ int main(int argc, char* argv[]) {
             compute.startProfiler(experimentInfo);
             for (uint64_t t_i = 0; t_i < FLAGS_worker; ++t_i) {
                compute.getWorkerPool().scheduleJobAsync(t_i, [&, t_i]() {
-                  uint64_t updates = 0;
-                  auto& cm = compute.getCM();
-                  auto* rctx = threads::Worker::my().cctxs[0].rctx;
-                  auto desc = threads::Worker::my().catalog[0];
-                  auto* buffer = static_cast<uint64_t*>(cm.getGlobalBuffer().allocate(1024, 64));
-                  auto addr = desc.start;
-                  uint64_t* old = reinterpret_cast<uint64_t*>(buffer);
-
-                  auto poll_cq = [&]() {
-                     int comp{0};
-                     ibv_wc wcReturn;
-                     while (comp == 0) {
-                        _mm_pause();
-                        comp = rdma::pollCompletion(rctx->id->qp->send_cq, 1, &wcReturn);
-                     }
-                     if (wcReturn.status != IBV_WC_SUCCESS) { throw std::runtime_error("wc failed"); }
-                  };
-
-                  // basic lock
-                  auto basic_x_lock = [&](uint64_t lock_addr) {
-                     volatile uint64_t& x_locked = old[LOCK_OFFSET_INDEX];
-                     rdma::postCompareSwap(UNLOCKED, 1, &old[LOCK_OFFSET_INDEX], *(rctx), rdma::completion::signaled, lock_addr+LOCK_OFFSET_BYTE);
-                     poll_cq();
-                     if (x_locked != UNLOCKED) { return false; }
-                     rdma::postRead(old, *rctx, rdma::completion::signaled, lock_addr, TUPLE_SIZE, 0);
-                     poll_cq();
-                     return true;
-                  };
-                  // + speculative read
-                  auto speculative_read_x_lock = [&](uint64_t lock_addr) {
-                     volatile uint64_t& x_locked = old[LOCK_OFFSET_INDEX];
-                     rdma::postCompareSwap(UNLOCKED, 1, &old[LOCK_OFFSET_INDEX], *(rctx), rdma::completion::unsignaled, lock_addr+ LOCK_OFFSET_BYTE);
-                     // do not read lock value again since could be f&a
-                     rdma::postRead(&old[0], *rctx, rdma::completion::signaled, lock_addr, TUPLE_SIZE - 8, 0);
-                     poll_cq();
-                     if (x_locked != UNLOCKED) { return false; } // must be unlocked
-                     return true;
-                  };
-
-                  // -------------------------------------------------------------------------------------
-                  // READ
-                  // -------------------------------------------------------------------------------------
-                  auto s_unlock = [&](uint64_t lock_addr) {
-                     rdma::postFetchAdd(int64_t{-2}, &old[LOCK_OFFSET_INDEX], *(rctx), rdma::completion::signaled, lock_addr+LOCK_OFFSET_BYTE);
-                     poll_cq();
-                  };
-                  // + basic_read
-                  auto basic_s_lock = [&](uint64_t lock_addr) {
-                     volatile uint64_t& s_locked = old[LOCK_OFFSET_INDEX];
-                     rdma::postFetchAdd(2, &old[LOCK_OFFSET_INDEX], *(rctx), rdma::completion::signaled, lock_addr+LOCK_OFFSET_BYTE);
-                     poll_cq();
-
-                     if ((s_locked & 1) == 1) {
-                        _mm_pause();
-                        return false;
-                     }
-                     // -------------------------------------------------------------------------------------
-                     // read
-                     rdma::postRead(old, *rctx, rdma::completion::signaled, lock_addr, TUPLE_SIZE-8, 0);
-                     poll_cq();
-                     return true;
-                  };
-
-                  // + speculative read
-                  auto speculative_read_s_lock = [&](uint64_t lock_addr) {
-                     volatile uint64_t& s_locked = old[LOCK_OFFSET_INDEX];
-                     rdma::postFetchAdd(2, &old[LOCK_OFFSET_INDEX], *(rctx), rdma::completion::unsignaled, lock_addr+LOCK_OFFSET_BYTE);
-                     rdma::postRead(&old[0], *rctx, rdma::completion::signaled, lock_addr, TUPLE_SIZE-8, 0);
-                     poll_cq();
-                     if ((s_locked & 1) == 1) {
-                        _mm_pause();
-                        return false;
-                     }
-                     return true;
-                  };
-
-                  // + order_release
-                  auto s_order_release = [&](uint64_t lock_addr){
-                     // with fence! 
-                     rdma::postFetchAdd(int64_t{-2}, &old[LOCK_OFFSET_INDEX], *(rctx), rdma::completion::unsignaled, lock_addr+LOCK_OFFSET_INDEX, true);
-                     _mm_pause();
-                  };
-
-                  running_threads_counter++;
-                  while (keep_running) {
-                     uint64_t lock_id = zipf_random->rand(0);
-                     auto lock_addr = addr + (lock_id * TUPLE_SIZE) + (lock_id * FLAGS_padding);
-
-                     ensure(lock_id < lock_count);
-                     if (READ_RATIO == 100 || utils::RandomGenerator::getRandU64(0, 100) < READ_RATIO) {
-                        auto start = utils::getTimePoint();
-                        // read lock
-                        bool locked = false;
-                        if (FLAGS_speculative_read)
-                           locked = speculative_read_s_lock(lock_addr);
-                        else
-                           locked = basic_s_lock(lock_addr);
-                        if (!locked) continue;
-                        // verify cl counter
-                        uint64_t prev_version = old[0];
-                        for (uint64_t i = 0; i < (LOCK_OFFSET_BYTE) / sizeof(uint64_t); ++i) {
-                           if (prev_version != old[i]) {
-                              std::cout << "prev " << prev_version << " " << old[i] << std::endl;
+                  // the flags select the lock type once, the transaction loop is compiled per variant
+                  auto run = [&](auto tag) {
+                     using Lock = typename decltype(tag)::type;
+                     uint64_t updates = 0;
+                     auto& cm = compute.getCM();
+                     auto& cctx = threads::Worker::my().cctxs[0];
+                     auto desc = threads::Worker::my().catalog[0];
+                     auto* buffer = static_cast<uint64_t*>(cm.getSlabs().allocate(1024, 64));  // returned after the stage
+                     auto addr = desc.start;
+                     Lock lock(cctx, buffer, TUPLE_SIZE, sync::Backoff::fromFlags(Lock::defaultBackoff(), counted));
+                     uint64_t* data = lock.data();
+
+                     running_threads_counter++;
+                     while (keep_running) {
+                        uint64_t lock_id = zipf_random->rand(0);
+                        auto lock_addr = addr + (lock_id * TUPLE_SIZE) + (lock_id * FLAGS_padding);
+
+                        ensure(lock_id < lock_count);
+                        if (READ_RATIO == 100 || utils::RandomGenerator::getRandU64(0, 100) < READ_RATIO) {
+                           auto start = utils::getTimePoint();
+                           // read lock
+                           if (!lock.tryLockShared(lock_addr)) {
+                              _mm_pause();
+                              continue;
+                           }
+                           // verify cl counter
+                           if (!utils::simd::uniform(data, lock.dataSize() / sizeof(uint64_t))) {
+                              auto i = utils::simd::firstMismatch(data, lock.dataSize() / sizeof(uint64_t));
+                              std::cout << "prev " << data[0] << " " << data[i] << std::endl;
                               throw;
                            }
-                           prev_version = old[i];
-                        }
-                        if(FLAGS_order_release)
-                           s_order_release(lock_addr);
-                        else
-                           s_unlock(lock_addr);
-                        auto end = utils::getTimePoint();
-                        threads::Worker::my().counters.incr_by(profiling::WorkerCounters::latency, (end - start));
-                     } else {
-                        auto start = utils::getTimePoint();
-                        // write lock
-                        bool locked = false;
-                        if (FLAGS_speculative_read)
-                           locked = speculative_read_x_lock(lock_addr);
-                        else
-                           locked = basic_x_lock(lock_addr);
-                        if (!locked) continue;
-                        // increment counter
-                        uint64_t new_version = ++old[0];
-                        for (uint64_t i = 0; i < (LOCK_OFFSET_BYTE) / sizeof(uint64_t); ++i) {
-                           old[i] = new_version;
-                        }
-                        // write back
-                        old[LOCK_OFFSET_INDEX] = 0; // unlock
-                        if (FLAGS_order_release){
-                           rdma::postWrite(old, *rctx, rdma::completion::unsignaled, lock_addr, TUPLE_SIZE);
+                           lock.unlockShared(lock_addr);
+                           auto end = utils::getTimePoint();
+                           threads::Worker::my().counters.incr_by(profiling::WorkerCounters::latency, (end - start));
                         } else {
-                           rdma::postWrite(old, *rctx, rdma::completion::signaled, lock_addr, TUPLE_SIZE);
-                           poll_cq();
+                           auto start = utils::getTimePoint();
+                           // write lock
+                           if (!lock.tryLockExclusive(lock_addr)) continue;
+                           // increment counter
+                           uint64_t new_version = ++data[0];
+                           for (uint64_t i = 0; i < lock.dataSize() / sizeof(uint64_t); ++i) {
+                              data[i] = new_version;
+                           }
+                           // write back and unlock
+                           lock.unlockExclusive(lock_addr);
+                           auto end = utils::getTimePoint();
+                           updates++;
+                           threads::Worker::my().counters.incr_by(profiling::WorkerCounters::latency, (end - start));
                         }
-                        auto end = utils::getTimePoint();
-                        updates++;
-                        threads::Worker::my().counters.incr_by(profiling::WorkerCounters::latency, (end - start));
+                        threads::Worker::my().counters.incr(profiling::WorkerCounters::tx_p);
                      }
-                     threads::Worker::my().counters.incr(profiling::WorkerCounters::tx_p);
-                  }
-                  g_updates += updates;
-                  running_threads_counter--;
+                     g_updates += updates;
+                     lock.drain(addr);
+                     cm.getSlabs().deallocate(buffer, 1024, 64);
+                     running_threads_counter--;
+                  };
+                  if (FLAGS_lock == "ticket")
+                     run(sync::TypeTag<sync::RemoteTicketLock>{});
+                  else if (FLAGS_lock == "phase_fair")
+                     run(sync::TypeTag<sync::RemotePhaseFairLock>{});
+                  else  // the unlock always writes tuple and lock word together
+                     sync::withRemoteRWLock<sync::TailLock>(FLAGS_speculative_read, FLAGS_order_release, true, true, run);
                });
             }
             // -------------------------------------------------------------------------------------
@@ -265,6 +198,10 @@ int main(int argc, char* argv[]) {
          }
          std::cout << "updates " << g_updates << "\n";
       }
+      if (!FLAGS_retry_counters_file.empty()) {
+         std::ofstream retries(FLAGS_retry_counters_file);
+         contention.write(retries);
+      }
    }
    return 0;
 }
@@ -0,0 +1,202 @@
+#include "BenchmarkHelper.hpp"
+#include "Defs.hpp"
+#include "PerfEvent.hpp"
+#include "nam/Compute.hpp"
+#include "nam/Config.hpp"
+#include "nam/Storage.hpp"
+#include "nam/profiling/ProfilingThread.hpp"
+#include "nam/profiling/counters/WorkerCounters.hpp"
+#include "nam/syncprimitives/LockSet.hpp"
+#include "nam/syncprimitives/RemoteRWLock.hpp"
+#include "nam/threads/Concurrency.hpp"
+#include "nam/utils/RandomGenerator.hpp"
+#include "nam/utils/SimdValidation.hpp"
+#include "nam/utils/Time.hpp"
+// -------------------------------------------------------------------------------------
+#include <gflags/gflags.h>
+// -------------------------------------------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <random>
+// -------------------------------------------------------------------------------------
+
+DEFINE_double(run_for_seconds, 10.0, "");
+DEFINE_uint64(lock_count, 16, "tuples per storage node");
+DEFINE_uint64(padding, 8, "");
+DEFINE_uint64(batch, 8, "tuples locked per transaction, spread over the storage nodes");
+DEFINE_uint64(read_ratio, 50, "percentage of the tuples of a transaction that are only read");
+DEFINE_bool(lock_set, true, "one batched acquire and release of the whole set, otherwise one lock after the other in sorted order");
+
+static constexpr uint64_t TUPLE_SIZE = 256;  // spans multiple cl to get the correctness.
+
+int main(int argc, char* argv[]) {
+   gflags::SetUsageMessage("Storage-DB Frontend");
+   gflags::ParseCommandLineFlags(&argc, &argv, true);
+   // -------------------------------------------------------------------------------------
+   using namespace nam;
+
+   if (FLAGS_storage_node) {
+      ensure(((FLAGS_lock_count * TUPLE_SIZE) + (FLAGS_lock_count * FLAGS_padding)) < (FLAGS_dramGB * 1024 * 1024 * 1024));
+      std::cout << "Storage Node" << std::endl;
+      nam::Storage db;
+      db.registerMemoryRegion("block", FLAGS_dramGB * 1024 * 1024 * 1024);
+      db.startAndConnect();
+      // -------------------------------------------------------------------------------------
+      while (db.getCM().getNumberIncomingConnections()) {}
+      // make consistency check
+      sleep(5);  // drain all open requests
+      auto desc = db.getMemoryRegion("block");
+      uint8_t* buffer = (uint8_t*)desc.start + 64;
+      uint64_t count = 0;
+      for (uint64_t t_i = 0; t_i < FLAGS_lock_count; t_i++) {
+         auto lock_addr = (uint64_t*)(buffer + (t_i * TUPLE_SIZE) + (t_i * FLAGS_padding));
+         ensure(lock_addr[0] == 0);
+         count += lock_addr[1];
+         for (uint64_t i = 1; i < TUPLE_SIZE / sizeof(uint64_t); ++i) {
+            if (lock_addr[1] != lock_addr[i]) {
+               std::cout << "prev " << lock_addr[1] << " " << lock_addr[i] << std::endl;
+               throw;
+            }
+         }
+      }
+      std::cout << "aggregated updates  " << count << "\n";
+   } else {
+      nam::Compute compute;
+      ensure(FLAGS_batch > 0 && FLAGS_batch <= sync::LockSet<sync::HeadLock>::MAX_LOCKS);
+      ensure(FLAGS_batch <= FLAGS_lock_count * FLAGS_storage_nodes);
+      std::string benchmark = FLAGS_lock_set ? "multi-lock+lock_set" : "multi-lock";
+      if (!FLAGS_backoffPolicy.empty()) { benchmark += "+backoff=" + FLAGS_backoffPolicy; }
+      sync::ContentionTable contention(std::min<u64>(Helper::nextPowerTwo(4 * FLAGS_lock_count * FLAGS_storage_nodes), 1ul << 16));
+      sync::ContentionTable* counted = sync::Backoff::adaptiveFromFlags() ? &contention : nullptr;
+      // -------------------------------------------------------------------------------------
+      std::atomic<uint64_t> g_updates = 0;
+      std::atomic<uint64_t> g_aborts = 0;
+      std::atomic<bool> keep_running = true;
+      std::atomic<u64> running_threads_counter = 0;
+      benchmark::BATCHING_BENCHMARK_workloadInfo experimentInfo{benchmark, FLAGS_lock_count, FLAGS_batch, std::to_string(FLAGS_padding)};
+      compute.startProfiler(experimentInfo);
+      for (uint64_t t_i = 0; t_i < FLAGS_worker; ++t_i) {
+         compute.getWorkerPool().scheduleJobAsync(t_i, [&]() {
+            uint64_t updates = 0;
+            uint64_t aborts = 0;
+            auto& cm = compute.getCM();
+            auto& catalog = threads::Worker::my().catalog;
+            auto& cctxs = threads::Worker::my().cctxs;
+            auto size = sync::LockSet<sync::HeadLock>::bufferSize(TUPLE_SIZE, FLAGS_batch);
+            auto* buffer = static_cast<uint64_t*>(cm.getGlobalBuffer().allocate(size, 64));
+            uint64_t* barrier_buffer = static_cast<uint64_t*>(cm.getGlobalBuffer().allocate(64, 64));
+            // wait on barrier which is always node 0 and in the first cl
+            rdma_barrier_wait(catalog[0].start, 1, barrier_buffer, *cctxs[0].rctx);
+            // -------------------------------------------------------------------------------------
+            sync::LockSet<sync::HeadLock> set(cctxs, buffer, TUPLE_SIZE, FLAGS_batch,
+                                              sync::Backoff::fromFlags(sync::LockSet<sync::HeadLock>::defaultBackoff(), counted));
+            // baseline: per storage node one lock per tuple of the set, they share the buffer slots of the set
+            using SingleLock = sync::RemoteRWLock<true, false, false, sync::HeadLock>;
+            std::vector<std::vector<SingleLock>> locks(FLAGS_storage_nodes);
+            for (uint64_t s_i = 0; s_i < FLAGS_storage_nodes; s_i++)
+               for (uint64_t b_i = 0; b_i < FLAGS_batch; b_i++)
+                  locks[s_i].emplace_back(cctxs[s_i], buffer + b_i * TUPLE_SIZE / sizeof(uint64_t), TUPLE_SIZE,
+                                          sync::Backoff::fromFlags(SingleLock::defaultBackoff(), counted));
+            struct Tuple {
+               uint64_t node;
+               uintptr_t addr;
+               bool exclusive;
+            };
+            std::vector<Tuple> tuples(FLAGS_batch);
+            constexpr uint64_t DATA_WORDS = (TUPLE_SIZE - 8) / sizeof(uint64_t);
+
+            auto verify = [&](uint64_t* data) {
+               if (!utils::simd::uniform(data, DATA_WORDS)) {
+                  auto i = utils::simd::firstMismatch(data, DATA_WORDS);
+                  std::cout << "prev " << data[0] << " " << data[i] << std::endl;
+                  throw;
+               }
+            };
+            auto update = [&](uint64_t* data) {
+               uint64_t new_version = data[0] + 1;
+               for (uint64_t i = 0; i < DATA_WORDS; ++i)
+                  data[i] = new_version;
+               updates++;
+            };
+            // the baseline, acquires in sorted order and gives all back on the first failure
+            auto lock_one_by_one = [&]() {
+               // an exclusive duplicate first, unique keeps it
+               std::sort(tuples.begin(), tuples.end(),
+                         [](auto& a, auto& b) { return std::make_tuple(a.node, a.addr, !a.exclusive) < std::make_tuple(b.node, b.addr, !b.exclusive); });
+               tuples.erase(std::unique(tuples.begin(), tuples.end(), [](auto& a, auto& b) { return a.node == b.node && a.addr == b.addr; }),
+                            tuples.end());
+               uint64_t held = 0;
+               for (; held < tuples.size(); held++) {
+                  auto& t = tuples[held];
+                  auto& lock = locks[t.node][held];
+                  if (!(t.exclusive ? lock.tryLockExclusive(t.addr) : lock.tryLockShared(t.addr)))
+                     break;
+               }
+               bool success = held == tuples.size();
+               for (uint64_t l_i = 0; l_i < held; l_i++) {
+                  auto& t = tuples[l_i];
+                  auto& lock = locks[t.node][l_i];
+                  verify(lock.data());
+                  if (!t.exclusive) {
+                     lock.unlockShared(t.addr);
+                  } else {
+                     if (success) update(lock.data());
+                     lock.unlockExclusive(t.addr);
+                  }
+               }
+               return success;
+            };
+            auto lock_set = [&]() {
+               set.clear();
+               for (auto& t : tuples)
+                  set.add(t.node, t.addr, t.exclusive);
+               if (!set.tryLock())
+                  return false;
+               for (uint64_t e_i = 0; e_i < set.size(); e_i++) {
+                  verify(set.data(e_i));
+                  if (set.exclusive(e_i)) update(set.data(e_i));
+               }
+               set.unlock();
+               return true;
+            };
+
+            running_threads_counter++;
+            while (keep_running) {
+               tuples.resize(FLAGS_batch);
+               for (auto& t : tuples) {
+                  t.node = utils::RandomGenerator::getRandU64Fast() % FLAGS_storage_nodes;
+                  uint64_t lock_id = utils::RandomGenerator::getRandU64Fast() % FLAGS_lock_count;
+                  t.addr = catalog[t.node].start + 64 + (lock_id * TUPLE_SIZE) + (lock_id * FLAGS_padding);
+                  t.exclusive = utils::RandomGenerator::getRandU64(0, 100) >= FLAGS_read_ratio;
+               }
+               auto start = utils::getTimePoint();
+               if (!(FLAGS_lock_set ? lock_set() : lock_one_by_one())) {
+                  aborts++;
+                  continue;
+               }
+               auto end = utils::getTimePoint();
+               threads::Worker::my().counters.incr_by(profiling::WorkerCounters::latency, (end - start));
+               threads::Worker::my().counters.incr(profiling::WorkerCounters::tx_p);
+            }
+            g_updates += updates;
+            g_aborts += aborts;
+            running_threads_counter--;
+         });
+      }
+      // -------------------------------------------------------------------------------------
+      // Join Threads
+      // -------------------------------------------------------------------------------------
+      sleep(FLAGS_run_for_seconds);
+      keep_running = false;
+      while (running_threads_counter) {
+         _mm_pause();
+      }
+      compute.getWorkerPool().joinAll();
+      // -------------------------------------------------------------------------------------
+      compute.stopProfiler();
+      std::cout << "updates " << g_updates << " aborts " << g_aborts << "\n";
+   }
+   return 0;
+}
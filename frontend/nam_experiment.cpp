@@ -7,9 +7,11 @@
 #include "nam/Storage.hpp"
 #include "nam/profiling/ProfilingThread.hpp"
 #include "nam/profiling/counters/WorkerCounters.hpp"
+#include "nam/syncprimitives/RemoteRWLock.hpp"
 #include "nam/threads/Concurrency.hpp"
 #include "nam/utils/RandomGenerator.hpp"
 #include "nam/utils/ScrambledZipfGenerator.hpp"
+#include "nam/utils/SimdValidation.hpp"
 #include "nam/utils/Time.hpp"
 // -------------------------------------------------------------------------------------
 #include <gflags/gflags.h>
@@ -27,12 +29,6 @@ DEFINE_bool(write_combining, false, "");
 DEFINE_bool(order_release, false, "");
 DEFINE_uint64(padding, 8, "");
 
-static constexpr uint64_t EXCLUSIVE_LOCKED = 0x1000000000000000;
-static constexpr uint64_t EXCLUSIVE_UNLOCK_TO_BE_ADDED = 0xFFFFFFFFFFFFFFFF - EXCLUSIVE_LOCKED + 1;
-static constexpr uint64_t UNLOCKED = 0;
-static constexpr uint64_t MASKED_SHARED_LOCKS = 0x1000000000000000;
-static constexpr uint64_t SHARED_UNLOCK_TO_BE_ADDED = 0xFFFFFFFFFFFFFFFF;
-
 // static constexpr uint64_t TUPLE_SIZE = 256;  // spans multiple cl to get the correctness.
 static constexpr uint64_t TUPLE_SIZE = 512;  // spans multiple cl to get the correctness.
 
@@ -51,6 +47,7 @@ int main(int argc, char* argv[]) {
    if (FLAGS_speculative_read) { benchmark += "+speculative_read"; }
    if (FLAGS_write_combining) { benchmark += "+write_combining"; }
    if (FLAGS_order_release) { benchmark += "+order_release"; }
+   if (!FLAGS_backoffPolicy.empty()) { benchmark += "+backoff=" + FLAGS_backoffPolicy; }
    // -------------------------------------------------------------------------------------
    std::vector<std::string> workload_type;  // warm up or benchmark
    std::vector<uint32_t> workloads;
@@ -61,6 +58,8 @@ int main(int argc, char* argv[]) {
    zipfs.insert(zipfs.end(), {0, 1, 1.5, 2, 2.5});
    // -------------------------------------------------------------------------------------
    u64 lock_count = FLAGS_lock_count;
+   sync::ContentionTable contention(std::min<u64>(Helper::nextPowerTwo(4 * lock_count), 1ul << 16));
+   sync::ContentionTable* counted = sync::Backoff::adaptiveFromFlags() ? &contention : nullptr;
    // -------------------------------------------------------------------------------------
    std::atomic<uint64_t> g_updates = 0;
    uint64_t stage = 1;
@@ -90,171 +89,68 @@ int main(int argc, char* argv[]) {
                rdma_barrier_nam_wait(barrier_addr, stage, barrier_buffer, *cctxs[0].rctx);
                b.wait();
 
-               auto poll_cq = [&](rdma::RdmaContext*& rctx) {
-                  int comp{0};
-                  ibv_wc wcReturn;
-                  while (comp == 0) {
-                     _mm_pause();
-                     comp = rdma::pollCompletion(rctx->id->qp->send_cq, 1, &wcReturn);
-                  }
-               };
-               // -------------------------------------------------------------------------------------
-               // WRITE
-               // -------------------------------------------------------------------------------------
-               auto x_unlock = [&](uint64_t lock_addr, rdma::RdmaContext*& rctx, uint64_t*& old) {
-                  rdma::postFetchAdd(EXCLUSIVE_UNLOCK_TO_BE_ADDED, old, *(rctx), rdma::completion::signaled, lock_addr);
-                  poll_cq(rctx);
-               };
-               // basic lock
-               auto basic_x_lock = [&](uint64_t lock_addr, rdma::RdmaContext*& rctx, uint64_t*& old) {
-                  volatile uint64_t& x_locked = old[0];
-                  rdma::postCompareSwap(UNLOCKED, EXCLUSIVE_LOCKED, old, *(rctx), rdma::completion::signaled, lock_addr);
-                  poll_cq(rctx);
-                  if (x_locked != UNLOCKED) { return false; }
-                  rdma::postRead(old, *rctx, rdma::completion::signaled, lock_addr, TUPLE_SIZE, 0);
-                  poll_cq(rctx);
-                  return true;
-               };
-               // + speculative read
-               auto speculative_read_x_lock = [&](uint64_t lock_addr, rdma::RdmaContext*& rctx, uint64_t*& old) {
-                  volatile uint64_t& x_locked = old[0];
-                  rdma::postCompareSwap(UNLOCKED, EXCLUSIVE_LOCKED, old, *(rctx), rdma::completion::unsignaled, lock_addr);
-                  // do not read lock value again since could be f&a
-                  rdma::postRead(&old[1], *rctx, rdma::completion::signaled, lock_addr + 8, TUPLE_SIZE - 8, 0);
-                  poll_cq(rctx);
-                  if (x_locked != UNLOCKED) { return false; }  // must be unlocked
-                  return true;
-               };
-               // + write combining
-               auto write_combining = [&](uint64_t lock_addr, rdma::RdmaContext*& rctx, uint64_t*& old) {
-                  rdma::postWrite(&old[1], *rctx, rdma::completion::unsignaled, lock_addr + 8, TUPLE_SIZE - 8);
-                  x_unlock(lock_addr, rctx, old);
-               };
-               // + order_release
-               auto x_order_release = [&](uint64_t lock_addr, rdma::RdmaContext*& rctx, uint64_t*& old) {
-                  rdma::postWrite(&old[1], *rctx, rdma::completion::unsignaled, lock_addr + 8, TUPLE_SIZE - 8);
-                  // with fence! should ensure that memory buffer is not overwritten
-                  rdma::postFetchAdd(EXCLUSIVE_UNLOCK_TO_BE_ADDED, old, *(rctx), rdma::completion::unsignaled, lock_addr, true);
-                  _mm_pause();
-               };
-               // -------------------------------------------------------------------------------------
-               // READ
-               // -------------------------------------------------------------------------------------
-               auto s_unlock = [&](uint64_t lock_addr, rdma::RdmaContext*& rctx, uint64_t*& old) {
-                  rdma::postFetchAdd(int64_t{-1}, old, *(rctx), rdma::completion::signaled, lock_addr);
-                  poll_cq(rctx);
-               };
-               // + basic_read
-               auto basic_s_lock = [&](uint64_t lock_addr, rdma::RdmaContext*& rctx, uint64_t*& old) {
-                  volatile uint64_t& s_locked = old[0];
-                  rdma::postFetchAdd(1, old, *(rctx), rdma::completion::signaled, lock_addr);
-                  poll_cq(rctx);
-
-                  if (s_locked >= EXCLUSIVE_LOCKED) {
-                     s_unlock(lock_addr, rctx, old);
-                     return false;
-                  }
-                  // -------------------------------------------------------------------------------------
-                  // read
-                  rdma::postRead(old, *rctx, rdma::completion::signaled, lock_addr, TUPLE_SIZE, 0);
-                  poll_cq(rctx);
-                  return true;
-               };
-
-               // + speculative read
-               auto speculative_read_s_lock = [&](uint64_t lock_addr, rdma::RdmaContext*& rctx, uint64_t*& old) {
-                  volatile uint64_t& s_locked = old[0];
-                  rdma::postFetchAdd(1, old, *(rctx), rdma::completion::unsignaled, lock_addr);
-                  rdma::postRead(&old[1], *rctx, rdma::completion::signaled, lock_addr + 8, TUPLE_SIZE - 8, 0);
-                  poll_cq(rctx);
-                  if (s_locked >= EXCLUSIVE_LOCKED) {
-                     s_unlock(lock_addr, rctx, old);
-                     return false;
-                  }
-                  return true;
-               };
+               // the requests of a lock operation are posted separately
+               sync::withRemoteRWLock<sync::HeadLock>(FLAGS_speculative_read, FLAGS_order_release, FLAGS_write_combining, false, [&](auto tag) {
+                  using Lock = typename decltype(tag)::type;
+                  // one lock per storage node, each with its own buffer
+                  std::vector<Lock> locks;
+                  locks.reserve(FLAGS_storage_nodes);
+                  for (uint64_t s_i = 0; s_i < FLAGS_storage_nodes; s_i++)
+                     locks.emplace_back(cctxs[s_i], buffers[s_i], TUPLE_SIZE, sync::Backoff::fromFlags(Lock::defaultBackoff(), counted));
+                  constexpr uint64_t DATA_WORDS = (TUPLE_SIZE - 8) / sizeof(uint64_t);
 
-               // + order_release
-               auto s_order_release = [&](uint64_t lock_addr, rdma::RdmaContext*& rctx, uint64_t*& old) {
-                  // with fence!
-                  rdma::postFetchAdd(int64_t{-1}, old, *(rctx), rdma::completion::unsignaled, lock_addr, true);
-                  _mm_pause();
-               };
+                  uint64_t current_node = 0;
+                  running_threads_counter++;
+                  while (keep_running) {
+                     uint64_t s_id = current_node % FLAGS_storage_nodes;
+                     current_node++;
+                     auto& lock = locks[s_id];
+                     auto desc = catalog[s_id];
+                     auto addr = desc.start + 64;
+                     uint64_t lock_id = zipf_random->rand(0);
+                     auto lock_addr = addr + (lock_id * TUPLE_SIZE) + (lock_id * FLAGS_padding);
+                     uint64_t* data = lock.data();
+                     ensure(lock_id < lock_count);
 
-               uint64_t current_node = 0;
-               running_threads_counter++;
-               while (keep_running) {
-                  uint64_t s_id = current_node % FLAGS_storage_nodes;
-                  current_node++;
-                  auto* rctx = cctxs[s_id].rctx;
-                  auto desc = catalog[s_id];
-                  auto addr = desc.start + 64;
-                  uint64_t lock_id = zipf_random->rand(0);
-                  auto lock_addr = addr + (lock_id * TUPLE_SIZE) + (lock_id * FLAGS_padding);
-                  uint64_t* old = reinterpret_cast<uint64_t*>(buffers[s_id]);
-                  ensure(lock_id < lock_count);
-
-                  if (READ_RATIO == 100 || utils::RandomGenerator::getRandU64(0, 100) < READ_RATIO) {
-                     auto start = utils::getTimePoint();
-                     // read lock
-                     for (uint64_t repeatCounter = 0;; repeatCounter++) {
-                        bool locked = false;
-                        if (FLAGS_speculative_read)
-                           locked = speculative_read_s_lock(lock_addr, rctx, old);
-                        else
-                           locked = basic_s_lock(lock_addr, rctx, old);
-                        if (!locked) continue;
-                        // verify cl counter
-                        uint64_t prev_version = old[1];
-                        for (uint64_t i = 1; i < TUPLE_SIZE / sizeof(uint64_t); ++i) {
-                           if (prev_version != old[i]) {
-                              std::cout << "prev " << prev_version << " " << old[i] << std::endl;
+                     if (READ_RATIO == 100 || utils::RandomGenerator::getRandU64(0, 100) < READ_RATIO) {
+                        auto start = utils::getTimePoint();
+                        // read lock
+                        for (uint64_t repeatCounter = 0;; repeatCounter++) {
+                           if (!lock.tryLockShared(lock_addr)) continue;
+                           // verify cl counter
+                           if (!utils::simd::uniform(data, DATA_WORDS)) {
+                              auto i = utils::simd::firstMismatch(data, DATA_WORDS);
+                              std::cout << "prev " << data[0] << " " << data[i] << std::endl;
                               throw;
                            }
-                           prev_version = old[i];
-                        }
-                        if (FLAGS_order_release)
-                           s_order_release(lock_addr, rctx, old);
-                        else
-                           s_unlock(lock_addr, rctx, old);
-                        auto end = utils::getTimePoint();
-                        threads::Worker::my().counters.incr_by(profiling::WorkerCounters::latency, (end - start));
-                        break;
-                     }
-                  } else {
-                     auto start = utils::getTimePoint();
-                     // write lock
-                     for (uint64_t repeatCounter = 0;; repeatCounter++) {
-                        bool locked = false;
-                        if (FLAGS_speculative_read)
-                           locked = speculative_read_x_lock(lock_addr, rctx, old);
-                        else
-                           locked = basic_x_lock(lock_addr, rctx, old);
-                        if (!locked) continue;
-                        // increment counter
-                        uint64_t new_version = ++old[1];
-                        for (uint64_t i = 1; i < TUPLE_SIZE / sizeof(uint64_t); ++i) {
-                           old[i] = new_version;
+                           lock.unlockShared(lock_addr);
+                           auto end = utils::getTimePoint();
+                           threads::Worker::my().counters.incr_by(profiling::WorkerCounters::latency, (end - start));
+                           break;
                         }
-                        // write back
-                        if (FLAGS_write_combining) {
-                           if (FLAGS_order_release)
-                              x_order_release(lock_addr, rctx, old);
-                           else
-                              write_combining(lock_addr, rctx, old);
-                        } else {
-                           rdma::postWrite(&old[1], *rctx, rdma::completion::signaled, lock_addr + 8, TUPLE_SIZE - 8);
-                           poll_cq(rctx);
-                           x_unlock(lock_addr, rctx, old);
+                     } else {
+                        auto start = utils::getTimePoint();
+                        // write lock
+                        for (uint64_t repeatCounter = 0;; repeatCounter++) {
+                           if (!lock.tryLockExclusive(lock_addr)) continue;
+                           // increment counter
+                           uint64_t new_version = ++data[0];
+                           for (uint64_t i = 0; i < DATA_WORDS; ++i) {
+                              data[i] = new_version;
+                           }
+                           // write back
+                           lock.unlockExclusive(lock_addr);
+                           auto end = utils::getTimePoint();
+                           updates++;
+                           threads::Worker::my().counters.incr_by(profiling::WorkerCounters::latency, (end - start));
+                           break;
                         }
-                        auto end = utils::getTimePoint();
-                        updates++;
-                        threads::Worker::my().counters.incr_by(profiling::WorkerCounters::latency, (end - start));
-                        break;
                      }
+                     threads::Worker::my().counters.incr(profiling::WorkerCounters::tx_p);
                   }
-                  threads::Worker::my().counters.incr(profiling::WorkerCounters::tx_p);
-               }
+                  for (uint64_t s_i = 0; s_i < FLAGS_storage_nodes; s_i++)
+                     locks[s_i].drain(catalog[s_i].start + 64);
+               });
                g_updates += updates;
                running_threads_counter--;
             });
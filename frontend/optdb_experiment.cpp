@@ -12,6 +12,7 @@
 #include "nam/threads/Concurrency.hpp"
 #include "nam/utils/RandomGenerator.hpp"
 #include "nam/utils/ScrambledZipfGenerator.hpp"
+#include "nam/utils/SimdValidation.hpp"
 #include "nam/utils/Time.hpp"
 // -------------------------------------------------------------------------------------
 #include <gflags/gflags.h>
@@ -30,55 +31,77 @@ DEFINE_bool(versioning, false, "");
 DEFINE_bool(CRC, false, "");
 DEFINE_bool(farm, false, "");
 DEFINE_bool(broken, false, "");
+DEFINE_bool(adaptive, false, "readers fall back to a shared lock on tuples whose optimistic reads keep failing");
+DEFINE_uint64(adaptive_threshold, 4, "consecutive failed optimistic reads of a tuple before the fallback");
+DEFINE_uint64(adaptive_decay_us, 100, "microseconds a tuple is read pessimistically before optimistic reads are tried again");
+DEFINE_bool(select_protocol, false, "choose optimistic or shared reads per region of tuples at epoch boundaries");
+DEFINE_uint64(region_tuples, 4096, "tuple ids per region of the protocol selection");
+DEFINE_uint64(epoch_us, 10000, "microseconds between the protocol decisions");
+DEFINE_uint64(selector_sample, 8, "one in selector_sample reads and writes is counted, power of two");
 
 
 // static constexpr uint64_t TUPLE_SIZE = 256;  // spans multiple cl to get the correctness.
 static constexpr uint64_t TUPLE_SIZE = 512;  // spans multiple cl to get the correctness.
 
-template <typename Consistency, typename LockType>
-void run_check(uint32_t READ_RATIO, nam::rdma::RdmaContext& rctx, uintptr_t lock_addr, uint64_t* lock_buffer, uint64_t* tuple_buffer) {
-   if (READ_RATIO == 100 || utils::RandomGenerator::getRandU64(0, 100) < READ_RATIO) {
-      auto start = utils::getTimePoint();
-      OptimisticLock<Consistency, LockType> tuple(rctx, lock_addr, tuple_buffer, TUPLE_SIZE);
-      for (uint64_t repeatCounter = 0;; repeatCounter++) {
-         try {
-            tuple.lock();
-            // go over the entries
-            [[maybe_unused]] auto versions = tuple.unlock();
-            // after the validation we have a consistent snapshot
-            // -------------------------------------------------------------------------------------
-            uint64_t prev = tuple_buffer[3];
-            bool corrupt = false;
+// optimistic or adaptive reader, restarts until the snapshot validates
+template <typename Tuple>
+void read_check(Tuple& tuple, uint64_t* tuple_buffer) {
+   auto start = utils::getTimePoint();
+   for (uint64_t repeatCounter = 0;; repeatCounter++) {
+      try {
+         tuple.lock();
+         // go over the entries
+         [[maybe_unused]] auto versions = tuple.unlock();
+         // after the validation we have a consistent snapshot
+         // -------------------------------------------------------------------------------------
+         // words 3 to 5 of every cacheline
+         uint64_t prev = tuple_buffer[3];
+         bool corrupt = !utils::simd::cachelineWordsEqual(tuple_buffer, TUPLE_SIZE / CL, 0b00111000, prev);
+         if(corrupt){
             for (uint64_t cl_i = 0; cl_i < (TUPLE_SIZE / CL); cl_i++) {
-               for (uint64_t v_i = 3; v_i < 6; v_i++) {
+               for (uint64_t v_i = 0; v_i < 8; v_i++) {
                   auto idx = (cl_i * 8) + v_i;
-                  if (prev != tuple_buffer[idx]) {
-                     corrupt = true;
-                  }
-               }
-            }
-            if(corrupt){
-               for (uint64_t cl_i = 0; cl_i < (TUPLE_SIZE / CL); cl_i++) {
-                  for (uint64_t v_i = 0; v_i < 8; v_i++) {
-                     auto idx = (cl_i * 8) + v_i;
-                     std::cout <<  tuple_buffer[idx] << "  ";
-                  }
+                  std::cout <<  tuple_buffer[idx] << "  ";
                }
-               std::cout << " "  << std::endl;
-               std::cout << "versions " << versions.first << " " << versions.second << std::endl;
-               throw std::runtime_error("Read consistency check failed ");
             }
-            // -------------------------------------------------------------------------------------
-            break;
-         } catch (const OLRestartException&) {
-            threads::Worker::my().counters.incr(profiling::WorkerCounters::abort);
+            std::cout << " "  << std::endl;
+            std::cout << "versions " << versions.first << " " << versions.second << std::endl;
+            throw std::runtime_error("Read consistency check failed ");
          }
+         // -------------------------------------------------------------------------------------
+         break;
+      } catch (const OLRestartException&) {
+         threads::Worker::my().counters.incr(profiling::WorkerCounters::abort);
+      }
+   }
+   auto end = utils::getTimePoint();
+   threads::Worker::my().counters.incr_by(profiling::WorkerCounters::latency, (end - start));
+}
+
+template <typename Consistency, typename LockType>
+void run_check(uint32_t READ_RATIO,
+               nam::rdma::RdmaContext& rctx,
+               uintptr_t lock_addr,
+               uint64_t* lock_buffer,
+               uint64_t* tuple_buffer,
+               uint64_t lock_id,
+               ReadModeTable* read_modes,
+               RegionProtocolSelector* selector) {
+   if (READ_RATIO == 100 || utils::RandomGenerator::getRandU64(0, 100) < READ_RATIO) {
+      if (selector) {
+         AdaptiveReadLock<Consistency, LockType, RegionProtocolSelector> tuple(*selector, lock_id, rctx, lock_addr, lock_buffer,
+                                                                               tuple_buffer, TUPLE_SIZE);
+         read_check(tuple, tuple_buffer);
+      } else if (read_modes) {
+         AdaptiveReadLock<Consistency, LockType> tuple(*read_modes, rctx, lock_addr, lock_buffer, tuple_buffer, TUPLE_SIZE);
+         read_check(tuple, tuple_buffer);
+      } else {
+         OptimisticLock<Consistency, LockType> tuple(rctx, lock_addr, tuple_buffer, TUPLE_SIZE);
+         read_check(tuple, tuple_buffer);
       }
-      auto end = utils::getTimePoint();
-      threads::Worker::my().counters.incr_by(profiling::WorkerCounters::latency, (end - start));
    } else {
       auto start = utils::getTimePoint();
-      ExclusiveLock<Consistency, LockType> tuple(rctx, lock_addr, lock_buffer, tuple_buffer, TUPLE_SIZE);
+      ExclusiveLock<Consistency, LockType> tuple(rctx, lock_addr, lock_buffer, tuple_buffer, TUPLE_SIZE, read_modes || selector);
       for (uint64_t repeatCounter = 0;; repeatCounter++) {
          try {
             tuple.lock();
@@ -115,6 +138,7 @@ void run_check(uint32_t READ_RATIO, nam::rdma::RdmaContext& rctx, uintptr_t lock
             // }
 
             tuple.unlock();
+            if (selector) selector->wrote(lock_id, repeatCounter);
             break;
          } catch (const OLRestartException&) {
             threads::Worker::my().counters.incr(profiling::WorkerCounters::abort);
@@ -131,6 +155,7 @@ int main(int argc, char* argv[]) {
    gflags::ParseCommandLineFlags(&argc, &argv, true);
    // -------------------------------------------------------------------------------------
    using namespace nam;
+   CRC::select(utils::checksumFunction(utils::parseChecksum(FLAGS_checksum)));
    nam::NAM db;
    db.registerMemoryRegion("block", FLAGS_dramGB * 1024 * 1024 * 1024);
    // -------------------------------------------------------------------------------------
@@ -142,12 +167,16 @@ int main(int argc, char* argv[]) {
       benchmark += "-versioning";
    } else if (FLAGS_CRC) {
       benchmark += "-CRC";
+      if (FLAGS_checksum != "crc64") { benchmark += "=" + FLAGS_checksum; }
    } else if (FLAGS_farm) {
       benchmark += "-FaRM";
    } else if (FLAGS_broken) {
       benchmark += "-broken";
    }
    if (FLAGS_footer) { benchmark += "-footer"; }
+   ensure(!(FLAGS_adaptive && FLAGS_select_protocol));
+   if (FLAGS_adaptive) { benchmark += "+adaptive=" + std::to_string(FLAGS_adaptive_threshold) + "/" + std::to_string(FLAGS_adaptive_decay_us) + "us"; }
+   if (FLAGS_select_protocol) { benchmark += "+select=" + std::to_string(FLAGS_region_tuples) + "/" + std::to_string(FLAGS_epoch_us) + "us"; }
    // -------------------------------------------------------------------------------------
    std::vector<std::string> workload_type;  // warm up or benchmark
    std::vector<uint32_t> workloads;
@@ -159,6 +188,13 @@ int main(int argc, char* argv[]) {
    // zipfs.insert(zipfs.end(), {1.5,2});
    // -------------------------------------------------------------------------------------
    u64 lock_count = FLAGS_lock_count;
+   std::unique_ptr<ReadModeTable> read_modes;
+   if (FLAGS_adaptive)
+      read_modes = std::make_unique<ReadModeTable>(std::min<u64>(Helper::nextPowerTwo(4 * lock_count * FLAGS_storage_nodes), 1ul << 16),
+                                                   FLAGS_adaptive_threshold, FLAGS_adaptive_decay_us);
+   std::unique_ptr<RegionProtocolSelector> selector;
+   if (FLAGS_select_protocol)
+      selector = std::make_unique<RegionProtocolSelector>(lock_count, FLAGS_region_tuples, FLAGS_epoch_us, FLAGS_selector_sample);
    // -------------------------------------------------------------------------------------
    crc64_init();
    // -------------------------------------------------------------------------------------
@@ -205,25 +241,25 @@ int main(int argc, char* argv[]) {
                   // todo copy form opt benchmark just adjust number nodes and then run_check
                   if (FLAGS_footer) {
                      if (FLAGS_versioning) {
-                        run_check<V2, FooterLock>(READ_RATIO, *rctx, lock_addr, lock_buffers[s_id], tuple_buffers[s_id]);
+                        run_check<V2, FooterLock>(READ_RATIO, *rctx, lock_addr, lock_buffers[s_id], tuple_buffers[s_id], lock_id, read_modes.get(), selector.get());
                      } else if (FLAGS_CRC) {
-                        run_check<CRC, FooterLock>(READ_RATIO, *rctx, lock_addr, lock_buffers[s_id], tuple_buffers[s_id]);
+                        run_check<CRC, FooterLock>(READ_RATIO, *rctx, lock_addr, lock_buffers[s_id], tuple_buffers[s_id], lock_id, read_modes.get(), selector.get());
                      } else if (FLAGS_farm) {
-                        run_check<FaRM, FooterLock>(READ_RATIO, *rctx, lock_addr, lock_buffers[s_id], tuple_buffers[s_id]);
+                        run_check<FaRM, FooterLock>(READ_RATIO, *rctx, lock_addr, lock_buffers[s_id], tuple_buffers[s_id], lock_id, read_modes.get(), selector.get());
                      } else if (FLAGS_broken) {
-                        run_check<Broken, FooterLock>(READ_RATIO, *rctx, lock_addr, lock_buffers[s_id], tuple_buffers[s_id]);
+                        run_check<Broken, FooterLock>(READ_RATIO, *rctx, lock_addr, lock_buffers[s_id], tuple_buffers[s_id], lock_id, read_modes.get(), selector.get());
                      } else
                         throw std::runtime_error("wrong option");
                   } else {
                      if (FLAGS_versioning) {
-                        run_check<V2, HeaderLock>(READ_RATIO, *rctx, lock_addr, lock_buffers[s_id], tuple_buffers[s_id]);
+                        run_check<V2, HeaderLock>(READ_RATIO, *rctx, lock_addr, lock_buffers[s_id], tuple_buffers[s_id], lock_id, read_modes.get(), selector.get());
                      } else if (FLAGS_CRC) {
-                        run_check<CRC, HeaderLock>(READ_RATIO, *rctx, lock_addr, lock_buffers[s_id], tuple_buffers[s_id]);
+                        run_check<CRC, HeaderLock>(READ_RATIO, *rctx, lock_addr, lock_buffers[s_id], tuple_buffers[s_id], lock_id, read_modes.get(), selector.get());
 
                      } else if (FLAGS_farm) {
-                        run_check<FaRM, HeaderLock>(READ_RATIO, *rctx, lock_addr, lock_buffers[s_id], tuple_buffers[s_id]);
+                        run_check<FaRM, HeaderLock>(READ_RATIO, *rctx, lock_addr, lock_buffers[s_id], tuple_buffers[s_id], lock_id, read_modes.get(), selector.get());
                      }else if (FLAGS_broken) {
-                        run_check<Broken, FooterLock>(READ_RATIO, *rctx, lock_addr, lock_buffers[s_id], tuple_buffers[s_id]);
+                        run_check<Broken, FooterLock>(READ_RATIO, *rctx, lock_addr, lock_buffers[s_id], tuple_buffers[s_id], lock_id, read_modes.get(), selector.get());
                      }
                   }
                   threads::Worker::my().counters.incr(profiling::WorkerCounters::tx_p);
@@ -247,6 +283,10 @@ int main(int argc, char* argv[]) {
          stage++;
       }
       std::cout << "updates " << g_updates << "\n";
+      if (read_modes) std::cout << "switches to pessimistic reads " << read_modes->getSwitches() << "\n";
+      if (selector)
+         std::cout << "protocol switches " << selector->getSwitches() << " in " << selector->getEpochs() << " epochs, shared regions "
+                   << selector->getSharedRegions() << "/" << selector->getRegions() << "\n";
    }
    return 0;
 }
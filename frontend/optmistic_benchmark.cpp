@@ -34,6 +34,7 @@ DEFINE_bool(farm, false, "");
 DEFINE_bool(broken, false, "");
 DEFINE_bool(pessimistic, false, "");
 DEFINE_uint64(padding, 8, "");
+DEFINE_bool(dirty_writeback, false, "exclusive unlocks write back only the modified cache lines instead of the whole block");
 DEFINE_uint64(sleep, 0, "sleep in microseconds ");
 DEFINE_string(zipfs, "0", "zipfs format must be space delimited and integer scaled 100 -> 1.0");
 DEFINE_string(readratios, "100 50 0", "zipfs format must be space delimited");
@@ -92,7 +93,13 @@ void run_test(uint32_t READ_RATIO,
          try {
             tuple.lock();
             tuple_buffer[index] += 5;
-            tuple.unlock();
+            if (FLAGS_dirty_writeback) {
+               utils::DirtyLines dirty(FLAGS_block_size);
+               dirty.markWord(index);
+               tuple.unlock(dirty);
+            } else {
+               tuple.unlock();
+            }
             break;
          } catch (const OLRestartException&) {
             threads::Worker::my().counters.incr(profiling::WorkerCounters::abort);
@@ -140,7 +147,13 @@ void run_pessimistic(uint32_t READ_RATIO,
          try {
             tuple.lockExclusive();
             tuple_buffer[index] += 5;
-            tuple.unlockExclusive();
+            if (FLAGS_dirty_writeback) {
+               utils::DirtyLines dirty(FLAGS_block_size);
+               dirty.markWord(index);
+               tuple.unlockExclusive(dirty);
+            } else {
+               tuple.unlockExclusive();
+            }
             break;
          } catch (const OLRestartException&) {
             threads::Worker::my().counters.incr(profiling::WorkerCounters::abort);
@@ -228,6 +241,7 @@ int main(int argc, char* argv[]) {
    gflags::ParseCommandLineFlags(&argc, &argv, true);
    // -------------------------------------------------------------------------------------
    using namespace nam;
+   CRC::select(utils::checksumFunction(utils::parseChecksum(FLAGS_checksum)));
 
    if (FLAGS_storage_node) {
       ensure(((FLAGS_lock_count * FLAGS_block_size) + (FLAGS_lock_count * FLAGS_padding)) < (FLAGS_dramGB * 1024 * 1024 * 1024));
@@ -254,6 +268,7 @@ int main(int argc, char* argv[]) {
          benchmark += "-versioning";
       } else if (FLAGS_CRC) {
          benchmark += "-CRC";
+         if (FLAGS_checksum != "crc64") { benchmark += "=" + FLAGS_checksum; }
       } else if (FLAGS_farm) {
          benchmark += "-FaRM";
       } else if (FLAGS_broken) {
@@ -261,6 +276,7 @@ int main(int argc, char* argv[]) {
       }
       if (FLAGS_footer) { benchmark += "-footer"; }
       if (FLAGS_pessimistic) { benchmark = "pessimistic"; }
+      if (FLAGS_dirty_writeback) { benchmark += "+dirty_writeback"; }
       // -------------------------------------------------------------------------------------
       std::vector<std::string> workload_type;  // warm up or benchmark
       std::vector<double> zipfs;
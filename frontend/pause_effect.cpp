@@ -6,9 +6,11 @@
 #include "nam/Storage.hpp"
 #include "nam/profiling/ProfilingThread.hpp"
 #include "nam/profiling/counters/WorkerCounters.hpp"
+#include "nam/syncprimitives/RemoteRWLock.hpp"
 #include "nam/threads/Concurrency.hpp"
 #include "nam/utils/RandomGenerator.hpp"
 #include "nam/utils/ScrambledZipfGenerator.hpp"
+#include "nam/utils/SimdValidation.hpp"
 #include "nam/utils/Time.hpp"
 // -------------------------------------------------------------------------------------
 #include <gflags/gflags.h>
@@ -25,13 +27,7 @@ DEFINE_bool(speculative_read, false, "");
 DEFINE_bool(write_combining, false, "");
 DEFINE_bool(order_release, false, "");
 DEFINE_uint64(padding, 8, "");
-DEFINE_uint64(sleep, 0, "sleep in microseconds ");
-
-static constexpr uint64_t EXCLUSIVE_LOCKED = 0x1000000000000000;
-static constexpr uint64_t EXCLUSIVE_UNLOCK_TO_BE_ADDED = 0xFFFFFFFFFFFFFFFF - EXCLUSIVE_LOCKED + 1;
-static constexpr uint64_t UNLOCKED = 0;
-static constexpr uint64_t MASKED_SHARED_LOCKS = 0x1000000000000000;
-static constexpr uint64_t SHARED_UNLOCK_TO_BE_ADDED = 0xFFFFFFFFFFFFFFFF;
+DEFINE_uint64(sleep, 0, "pauses between posting the fetch and add and the data read of speculative readers");
 
 static constexpr uint64_t TUPLE_SIZE = 256;  // spans multiple cl to get the correctness.
 
@@ -78,6 +74,7 @@ int main(int argc, char* argv[]) {
       if (FLAGS_write_combining) { benchmark += "+write_combining"; }
       if (FLAGS_order_release) { benchmark += "+order_release"; }
       if (FLAGS_sleep > 0) { benchmark += "sleep_inbetween" + std::to_string(FLAGS_sleep); }
+      if (!FLAGS_backoffPolicy.empty()) { benchmark += "+backoff=" + FLAGS_backoffPolicy; }
       // -------------------------------------------------------------------------------------
       std::vector<std::string> workload_type;  // warm up or benchmark
       std::vector<uint32_t> workloads;
@@ -90,6 +87,8 @@ int main(int argc, char* argv[]) {
       zipfs.insert(zipfs.end(), {0});
       // -------------------------------------------------------------------------------------
       u64 lock_count = FLAGS_lock_count;
+      sync::ContentionTable contention(std::min<u64>(Helper::nextPowerTwo(4 * lock_count), 1ul << 16));
+      sync::ContentionTable* counted = sync::Backoff::adaptiveFromFlags() ? &contention : nullptr;
       // -------------------------------------------------------------------------------------
       std::atomic<uint64_t> g_updates =0;
       uint64_t stage =1;
@@ -107,101 +106,57 @@ int main(int argc, char* argv[]) {
                compute.getWorkerPool().scheduleJobAsync(t_i, [&, t_i]() {
                   uint64_t updates = 0;
                   auto& cm = compute.getCM();
-                  auto* buffer = static_cast<uint64_t*>(cm.getGlobalBuffer().allocate(1024, 64));
+                  auto* buffer = static_cast<uint64_t*>(cm.getGlobalBuffer().allocate(TUPLE_SIZE * FLAGS_storage_nodes, 64));
                   uint64_t* barrier_buffer = static_cast<uint64_t*>(cm.getGlobalBuffer().allocate(64, 64));
-                  uint64_t* old = reinterpret_cast<uint64_t*>(buffer);
 
                   auto& cctxs = threads::Worker::my().cctxs;
                   auto& catalog = threads::Worker::my().catalog;
                   auto barrier_addr = catalog[0].start;
                   rdma_barrier_wait(barrier_addr,stage,barrier_buffer, *cctxs[0].rctx );
-                  
-                  auto poll_cq = [&](rdma::RdmaContext*& rctx) {
-                     int comp{0};
-                     ibv_wc wcReturn;
-                     while (comp == 0) {
-                        _mm_pause();
-                        comp = rdma::pollCompletion(rctx->id->qp->send_cq, 1, &wcReturn);
-                     }
-                  };
-                  // -------------------------------------------------------------------------------------
-                  // READ
-                  // -------------------------------------------------------------------------------------
-                  auto s_unlock = [&](rdma::RdmaContext*& rctx ,uint64_t lock_addr) {
-                     rdma::postFetchAdd(int64_t{-1}, old, *(rctx), rdma::completion::signaled, lock_addr);
-                     poll_cq(rctx);
-                  };
-                  // + basic_read
-                  auto basic_s_lock = [&](rdma::RdmaContext*& rctx,uint64_t lock_addr) {
-                     volatile uint64_t& s_locked = old[0];
-                     rdma::postFetchAdd(1, old, *(rctx), rdma::completion::signaled, lock_addr);
-                     poll_cq(rctx);
-
-                     if (s_locked >= EXCLUSIVE_LOCKED) {
-                        s_unlock(rctx, lock_addr);
-                        return false;
-                     }
-                     // -------------------------------------------------------------------------------------
-                     // read
-                     rdma::postRead(old, *rctx, rdma::completion::signaled, lock_addr, TUPLE_SIZE, 0);
-                     poll_cq(rctx);
-                     return true;
-                  };
 
-                  // + speculative read
-                  auto speculative_read_s_lock = [&](rdma::RdmaContext*& rctx ,uint64_t lock_addr) {
-                     volatile uint64_t& s_locked = old[0];
-                     rdma::postFetchAdd(1, old, *(rctx), rdma::completion::unsignaled, lock_addr);
-                     // -------------------------------------------------------------------------------------
-                     if (FLAGS_sleep > 0) {
-                        for (size_t i = 0; i < FLAGS_sleep; ++i) {
-                           _mm_pause();
-                        }
-                     }
-                     // -------------------------------------------------------------------------------------
-                     rdma::postRead(&old[1], *rctx, rdma::completion::signaled, lock_addr + 8, TUPLE_SIZE - 8, 0);
-                     poll_cq(rctx);
-                     if (s_locked >= EXCLUSIVE_LOCKED) {
-                        s_unlock(rctx,lock_addr);
-                        return false;
+                  // the requests of a lock operation are posted separately, -sleep pauses in between
+                  sync::withRemoteRWLock<sync::HeadLock>(FLAGS_speculative_read, FLAGS_order_release, FLAGS_write_combining, false, [&](auto tag) {
+                     using Lock = typename decltype(tag)::type;
+                     // one lock per storage node, each with its tuple in the buffer
+                     std::vector<Lock> locks;
+                     locks.reserve(FLAGS_storage_nodes);
+                     for (uint64_t s_i = 0; s_i < FLAGS_storage_nodes; s_i++) {
+                        locks.emplace_back(cctxs[s_i], buffer + s_i * (TUPLE_SIZE / sizeof(uint64_t)), TUPLE_SIZE,
+                                           sync::Backoff::fromFlags(Lock::defaultBackoff(), counted));
+                        locks.back().setPostGap(FLAGS_sleep);
                      }
-                     return true;
-                  };
+                     constexpr uint64_t DATA_WORDS = (TUPLE_SIZE - 8) / sizeof(uint64_t);
 
-                  uint64_t current_node =0;
-                  
-                  running_threads_counter++;
-                  while (keep_running) {
-                     uint64_t s_id = current_node % FLAGS_storage_nodes;
-                     current_node++;
-                     auto* rctx = cctxs[s_id].rctx;
-                     auto desc = catalog[s_id];
-                     auto addr = desc.start + 64;
-                     uint64_t lock_id = zipf_random->rand(0);
-                     auto lock_addr = addr + (lock_id * TUPLE_SIZE) + (lock_id * FLAGS_padding);
-                     ensure(lock_id < lock_count);
-                     auto start = utils::getTimePoint();
-                     // read lock
-                     bool locked = false;
-                     if (FLAGS_speculative_read) {
-                        locked = speculative_read_s_lock(rctx,lock_addr);
-                     } else
-                        locked = basic_s_lock(rctx,lock_addr);
-                     if (!locked) continue;
-                     // verify cl counter
-                     uint64_t prev_version = old[1];
-                     for (uint64_t i = 1; i < TUPLE_SIZE / sizeof(uint64_t); ++i) {
-                        if (prev_version != old[i]) {
-                           std::cout << "prev " << prev_version << " " << old[i] << std::endl;
+                     uint64_t current_node =0;
+                     
+                     running_threads_counter++;
+                     while (keep_running) {
+                        uint64_t s_id = current_node % FLAGS_storage_nodes;
+                        current_node++;
+                        auto& lock = locks[s_id];
+                        auto desc = catalog[s_id];
+                        auto addr = desc.start + 64;
+                        uint64_t lock_id = zipf_random->rand(0);
+                        auto lock_addr = addr + (lock_id * TUPLE_SIZE) + (lock_id * FLAGS_padding);
+                        ensure(lock_id < lock_count);
+                        auto start = utils::getTimePoint();
+                        // read lock
+                        if (!lock.tryLockShared(lock_addr)) continue;
+                        // verify cl counter
+                        uint64_t* data = lock.data();
+                        if (!utils::simd::uniform(data, DATA_WORDS)) {
+                           auto i = utils::simd::firstMismatch(data, DATA_WORDS);
+                           std::cout << "prev " << data[0] << " " << data[i] << std::endl;
                            throw;
                         }
-                        prev_version = old[i];
+                        lock.unlockShared(lock_addr);
+                        auto end = utils::getTimePoint();
+                        threads::Worker::my().counters.incr_by(profiling::WorkerCounters::latency, (end - start));
+                        threads::Worker::my().counters.incr(profiling::WorkerCounters::tx_p);
                      }
-                     s_unlock(rctx,lock_addr);
-                     auto end = utils::getTimePoint();
-                     threads::Worker::my().counters.incr_by(profiling::WorkerCounters::latency, (end - start));
-                     threads::Worker::my().counters.incr(profiling::WorkerCounters::tx_p);
-                  }
+                     for (uint64_t s_i = 0; s_i < FLAGS_storage_nodes; s_i++)
+                        locks[s_i].drain(catalog[s_i].start + 64);
+                  });
                   g_updates += updates;
                   running_threads_counter--;
                });
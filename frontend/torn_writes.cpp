@@ -57,30 +57,21 @@ int main(int argc, char* argv[]) {
          auto* cl_zero = static_cast<uint64_t*>(cm.getGlobalBuffer().allocate(FLAGS_write_size, 64));
          auto* cl_ones = static_cast<uint64_t*>(cm.getGlobalBuffer().allocate(FLAGS_write_size, 64));
          memset(cl_ones, 1, FLAGS_write_size);
+         auto& cctx = threads::Worker::my().cctxs[0];
          running_threads_counter++;
-         uint64_t SIGNAL_ = 16 - 1;
          uint64_t ops = 0;
-         uint64_t wqe = 0;
          while (keep_running) {
             if (!keep_running) break;
             size_t remote_addr = desc.start;
-            rdma::completion signal = ((wqe & SIGNAL_) == 0) ? rdma::completion::signaled : rdma::completion::unsignaled;
+            auto [signal, wrId] = cctx.nextWQE();
             if (ops % 2 == 0)
-               rdma::postWrite(cl_zero, *rctx, signal, remote_addr, FLAGS_write_size);
+               rdma::postWrite(cl_zero, *rctx, signal, remote_addr, FLAGS_write_size, wrId);
             else
-               rdma::postWrite(cl_ones, *rctx, signal, remote_addr, FLAGS_write_size);
-            wqe++;
+               rdma::postWrite(cl_ones, *rctx, signal, remote_addr, FLAGS_write_size, wrId);
             ops++;
             writes++;
-            // -------------------------------------------------------------------------------------
-            if ((wqe & SIGNAL_) == SIGNAL_) {
-               int comp{0};
-               ibv_wc wcReturn;
-               while (comp == 0) {
-                  comp = rdma::pollCompletion(rctx->id->qp->send_cq, 1, &wcReturn);
-               }
-            }
          }
+         cctx.drain();
          running_threads_counter--;
       });
       // -------------------------------------------------------------------------------------
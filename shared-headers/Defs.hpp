@@ -133,6 +133,8 @@ struct MemoryRegionDesc{
    uintptr_t start ;
    size_t size_bytes;
    int region_id;
+   uint32_t rkey;  // every region has its own registration
+   uint32_t lkey = 0;  // only known on the node that registered it
 };
 
 